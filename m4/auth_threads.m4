@@ -0,0 +1,22 @@
+dnl * Can the auth process verify passwords in threads?
+AC_DEFUN([DOVECOT_AUTH_THREADS], [
+  OLD_LIBS="$LIBS"
+  LIBS="$LIBS $CRYPT_LIBS"
+  AC_CHECK_FUNCS(crypt_r)
+  LIBS="$OLD_LIBS"
+
+  AC_CHECK_HEADERS(sys/eventfd.h)
+  have_auth_threads=no
+  AC_CHECK_HEADERS([pthread.h stdatomic.h], [
+    have_auth_threads=yes
+  ], [
+    have_auth_threads=no
+    break
+  ])
+  AS_IF([test $have_auth_threads = yes], [
+    AC_CHECK_LIB(pthread, pthread_create, [
+      AUTH_LIBS="$AUTH_LIBS -lpthread"
+      AC_DEFINE(HAVE_AUTH_THREADS,, [Define if auth process can verify passwords in threads])
+    ])
+  ])
+])
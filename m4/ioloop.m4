@@ -1,6 +1,31 @@
 dnl * I/O loop function
 AC_DEFUN([DOVECOT_IOLOOP], [
   have_ioloop=no
+
+  AS_IF([test "$ioloop" = "uring"], [
+    AC_CACHE_CHECK([whether we can use io_uring],i_cv_io_uring_works,[
+      AC_COMPILE_IFELSE([AC_LANG_PROGRAM([[
+        #include <linux/io_uring.h>
+        #include <sys/epoll.h>
+        #include <sys/syscall.h>
+      ]], [[
+        struct io_uring_getevents_arg arg;
+        (void)arg;
+        (void)epoll_create(5);
+        return IORING_ENTER_EXT_ARG + __NR_io_uring_enter;
+      ]])],[
+        i_cv_io_uring_works=yes
+      ], [
+        i_cv_io_uring_works=no
+      ])
+    ])
+    AS_IF([test $i_cv_io_uring_works = yes], [
+      AC_DEFINE(IOLOOP_URING,, [Implement I/O loop with Linux io_uring, falling back to epoll])
+      have_ioloop=yes
+    ], [
+      AC_MSG_ERROR([uring ioloop requested but linux/io_uring.h is too old or missing])
+    ])
+  ])
   
   AS_IF([test "$ioloop" = "best" || test "$ioloop" = "epoll"], [
     AC_CACHE_CHECK([whether we can use epoll],i_cv_epoll_works,[
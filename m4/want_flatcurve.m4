@@ -6,6 +6,12 @@ AC_DEFUN([DOVECOT_WANT_FLATCURVE], [
       PKGCONFIG_REQUIRES="$PKGCONFIG_REQUIRES xapian-core"
       have_flatcurve=yes
       fts="$fts flatcurve"
+      AC_CHECK_HEADER(pthread.h, [
+        AC_CHECK_LIB(pthread, pthread_create, [
+          XAPIAN_LIBS="$XAPIAN_LIBS -lpthread"
+          AC_DEFINE(HAVE_FLATCURVE_WRITER_THREAD,, [Define if fts-flatcurve can write to Xapian in a separate thread])
+        ])
+      ])
     ],[
       AS_IF([test $want_flatcurve = yes], [
         AC_MSG_ERROR(cannot build with Flatcurve FTS: $XAPIAN_PKG_ERRORS)
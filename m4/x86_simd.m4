@@ -0,0 +1,32 @@
+dnl * Can x86 SIMD functions be compiled with target attributes and selected
+dnl * at runtime?
+AC_DEFUN([DOVECOT_X86_SIMD], [
+  AC_CACHE_CHECK([for x86 SIMD runtime dispatch],i_cv_have_x86_simd_dispatch,[
+    AC_LINK_IFELSE([AC_LANG_PROGRAM([[
+      #include <immintrin.h>
+      __attribute__((target("avx2"))) static int f_avx2(void)
+      {
+        return _mm256_movemask_epi8(_mm256_set1_epi8(1));
+      }
+      __attribute__((target("pclmul,sse4.1"))) static int f_pclmul(void)
+      {
+        __m128i x = _mm_clmulepi64_si128(_mm_setzero_si128(),
+                                         _mm_setzero_si128(), 0);
+        return _mm_extract_epi32(x, 1);
+      }
+    ]], [[
+      __builtin_cpu_init();
+      if (__builtin_cpu_supports("avx2"))
+        return f_avx2();
+      if (__builtin_cpu_supports("pclmul"))
+        return f_pclmul();
+    ]])],[
+      i_cv_have_x86_simd_dispatch=yes
+    ], [
+      i_cv_have_x86_simd_dispatch=no
+    ])
+  ])
+  AS_IF([test $i_cv_have_x86_simd_dispatch = yes], [
+    AC_DEFINE(HAVE_X86_SIMD_DISPATCH,, [Define if x86 SIMD code can be selected at runtime])
+  ])
+])
@@ -12,15 +12,42 @@
 
 #include <time.h>
 
-struct auth_cache {
-	HASH_TABLE(char *, struct auth_cache_node *) hash;
+/* The cache is split into shards by the key's hash. Each shard has its own
+   hash table and separate lists and size limits for positive and negative
+   entries. The lists are used as CLOCK: lookups only mark the node
+   referenced, and the eviction gives referenced nodes a second chance by
+   moving them back to head instead of evicting them. */
+#define AUTH_CACHE_MAX_SHARDS 16
+#define AUTH_CACHE_MIN_SHARD_SIZE (64*1024)
+
+enum auth_cache_list_type {
+	AUTH_CACHE_LIST_POSITIVE = 0,
+	AUTH_CACHE_LIST_NEGATIVE,
+
+	AUTH_CACHE_LIST_COUNT
+};
+
+struct auth_cache_list {
+	/* New nodes are added to head, eviction scans from tail */
 	struct auth_cache_node *head, *tail;
+	size_t max_size, size_left;
+};
+
+struct auth_cache_shard {
+	HASH_TABLE(struct auth_cache_key *, struct auth_cache_node *) hash;
+	struct auth_cache_list lists[AUTH_CACHE_LIST_COUNT];
+
+	unsigned int hit_count, miss_count, eviction_count;
+};
+
+struct auth_cache {
+	struct auth_cache_shard *shards;
+	unsigned int shard_count;
 	struct event *event;
 
-	size_t max_size, size_left;
+	size_t max_size, neg_max_size;
 	unsigned int ttl_secs, neg_ttl_secs;
 
-	unsigned int hit_count, miss_count;
 	unsigned int pos_entries, neg_entries;
 	unsigned long long pos_size, neg_size;
 };
@@ -145,50 +172,125 @@ char *auth_cache_parse_key_and_fields(pool_t pool, const char *query,
 					    exclude_driver);
 }
 
+static unsigned int auth_cache_key_hash(const struct auth_cache_key *key)
+{
+	return key->hash;
+}
+
+static int auth_cache_key_cmp(const struct auth_cache_key *key1,
+			      const struct auth_cache_key *key2)
+{
+	if (key1->hash != key2->hash)
+		return 1;
+	return strcmp(key1->str, key2->str);
+}
+
+static struct auth_cache_shard *
+auth_cache_get_shard(struct auth_cache *cache, const struct auth_cache_key *key)
+{
+	/* shard_count is a power of 2. All the keys in a shard share these
+	   bits, but that doesn't matter to the shard's hash table, since its
+	   Fibonacci hashing mixes all the bits of the hash together. */
+	return &cache->shards[(key->hash >> 16) & (cache->shard_count - 1)];
+}
+
+static struct auth_cache_list *
+auth_cache_node_get_list(struct auth_cache_shard *shard,
+			 struct auth_cache_node *node)
+{
+	return &shard->lists[node->negative ? AUTH_CACHE_LIST_NEGATIVE :
+			     AUTH_CACHE_LIST_POSITIVE];
+}
+
 static void
-auth_cache_node_unlink(struct auth_cache *cache, struct auth_cache_node *node)
+auth_cache_node_unlink(struct auth_cache_list *list,
+		       struct auth_cache_node *node)
 {
 	if (node->prev != NULL)
 		node->prev->next = node->next;
 	else {
 		/* unlinking tail */
-		cache->tail = node->next;
+		list->tail = node->next;
 	}
 
 	if (node->next != NULL)
 		node->next->prev = node->prev;
 	else {
 		/* unlinking head */
-		cache->head = node->prev;
+		list->head = node->prev;
 	}
 }
 
 static void
-auth_cache_node_link_head(struct auth_cache *cache,
+auth_cache_node_link_head(struct auth_cache_list *list,
 			  struct auth_cache_node *node)
 {
-	node->prev = cache->head;
+	node->prev = list->head;
 	node->next = NULL;
 
-	cache->head = node;
+	list->head = node;
 	if (node->prev != NULL)
 		node->prev->next = node;
 	else
-		cache->tail = node;
+		list->tail = node;
 }
 
 static void
-auth_cache_node_destroy(struct auth_cache *cache, struct auth_cache_node *node)
+auth_cache_node_destroy(struct auth_cache_shard *shard,
+			struct auth_cache_node *node)
 {
-	char *key = node->data;
+	struct auth_cache_list *list = auth_cache_node_get_list(shard, node);
 
-	auth_cache_node_unlink(cache, node);
+	auth_cache_node_unlink(list, node);
 
-	cache->size_left += node->alloc_size;
-	hash_table_remove(cache->hash, key);
+	list->size_left += node->alloc_size;
+	hash_table_remove(shard->hash, &node->key);
 	i_free(node);
 }
 
+static void
+auth_cache_list_make_space(struct auth_cache_shard *shard,
+			   struct auth_cache_list *list, size_t size)
+{
+	struct auth_cache_node *node;
+
+	while (list->size_left < size && list->tail != NULL) {
+		node = list->tail;
+		if (node->referenced) {
+			/* second chance */
+			node->referenced = FALSE;
+			if (node != list->head) {
+				auth_cache_node_unlink(list, node);
+				auth_cache_node_link_head(list, node);
+			}
+		} else {
+			auth_cache_node_destroy(shard, node);
+			shard->eviction_count++;
+		}
+	}
+}
+
+static void auth_cache_send_shard_stats(struct auth_cache *cache)
+{
+	struct auth_cache_shard *shard;
+	unsigned int i;
+
+	for (i = 0; i < cache->shard_count; i++) {
+		shard = &cache->shards[i];
+		e_debug(event_create_passthrough(cache->event)->
+			set_name("auth_cache_shard_stats")->
+			add_int("shard", i)->
+			add_int("hits", shard->hit_count)->
+			add_int("misses", shard->miss_count)->
+			add_int("evictions", shard->eviction_count)->
+			add_int("entries", hash_table_count(shard->hash))->
+			event(),
+			"Cache shard %u: hits=%u misses=%u evictions=%u "
+			"entries=%u", i, shard->hit_count, shard->miss_count,
+			shard->eviction_count, hash_table_count(shard->hash));
+	}
+}
+
 static void sig_auth_cache_clear(const siginfo_t *si ATTR_UNUSED, void *context)
 {
 	struct auth_cache *cache = context;
@@ -200,46 +302,86 @@ static void sig_auth_cache_clear(const siginfo_t *si ATTR_UNUSED, void *context)
 static void sig_auth_cache_stats(const siginfo_t *si ATTR_UNUSED, void *context)
 {
 	struct auth_cache *cache = context;
+	struct auth_cache_shard *shard;
+	unsigned int i, hit_count = 0, miss_count = 0, eviction_count = 0;
 	unsigned int total_count;
-	size_t cache_used;
+	size_t cache_used = 0;
+
+	auth_cache_send_shard_stats(cache);
+	for (i = 0; i < cache->shard_count; i++) {
+		shard = &cache->shards[i];
+		hit_count += shard->hit_count;
+		miss_count += shard->miss_count;
+		eviction_count += shard->eviction_count;
+		for (unsigned int j = 0; j < AUTH_CACHE_LIST_COUNT; j++) {
+			cache_used += shard->lists[j].max_size -
+				shard->lists[j].size_left;
+		}
+	}
 
-	total_count = cache->hit_count + cache->miss_count;
+	total_count = hit_count + miss_count;
 	e_info(cache->event, "Authentication cache hits %u/%u (%u%%)",
-	       cache->hit_count, total_count,
-	       total_count == 0 ? 100 : (cache->hit_count * 100 / total_count));
+	       hit_count, total_count,
+	       total_count == 0 ? 100 : (hit_count * 100 / total_count));
 
 	e_info(cache->event, "Authentication cache inserts: "
 	       "positive: %u entries %llu bytes, "
-	       "negative: %u entries %llu bytes",
+	       "negative: %u entries %llu bytes, evictions: %u",
 	       cache->pos_entries, cache->pos_size,
-	       cache->neg_entries, cache->neg_size);
+	       cache->neg_entries, cache->neg_size, eviction_count);
 
-	cache_used = cache->max_size - cache->size_left;
 	e_info(cache->event, "Authentication cache current size: "
-	       "%zu bytes used of %zu bytes (%u%%)",
+	       "%zu bytes used of %zu bytes (%u%%) in %u shards",
 	       cache_used, cache->max_size,
-	       (unsigned int)(cache_used * 100ULL / cache->max_size));
+	       (unsigned int)(cache_used * 100ULL / cache->max_size),
+	       cache->shard_count);
 
 	/* reset counters */
-	cache->hit_count = cache->miss_count = 0;
+	for (i = 0; i < cache->shard_count; i++) {
+		shard = &cache->shards[i];
+		shard->hit_count = shard->miss_count = 0;
+		shard->eviction_count = 0;
+	}
 	cache->pos_entries = cache->neg_entries = 0;
 	cache->pos_size = cache->neg_size = 0;
 }
 
-struct auth_cache *auth_cache_new(size_t max_size, unsigned int ttl_secs,
-				  unsigned int neg_ttl_secs
-)
+struct auth_cache *auth_cache_new(size_t max_size, size_t neg_max_size,
+				  unsigned int ttl_secs,
+				  unsigned int neg_ttl_secs)
 {
 	struct auth_cache *cache;
+	struct auth_cache_shard *shard;
+	unsigned int i;
+
+	i_assert(neg_max_size < max_size);
 
 	cache = i_new(struct auth_cache, 1);
-	hash_table_create(&cache->hash, default_pool, 0, str_hash, strcmp);
 	cache->max_size = max_size;
-	cache->size_left = max_size;
+	cache->neg_max_size = neg_max_size;
 	cache->ttl_secs = ttl_secs;
 	cache->neg_ttl_secs = neg_ttl_secs;
 	cache->event = event_create(auth_event);
 
+	/* Small caches would be too fragmented with many shards */
+	cache->shard_count = 1;
+	while (cache->shard_count < AUTH_CACHE_MAX_SHARDS &&
+	       (max_size - neg_max_size) / (cache->shard_count * 2) >=
+	       AUTH_CACHE_MIN_SHARD_SIZE)
+		cache->shard_count *= 2;
+	cache->shards = i_new(struct auth_cache_shard, cache->shard_count);
+	for (i = 0; i < cache->shard_count; i++) {
+		shard = &cache->shards[i];
+		hash_table_create(&shard->hash, default_pool, 0,
+				  auth_cache_key_hash, auth_cache_key_cmp);
+		shard->lists[AUTH_CACHE_LIST_POSITIVE].max_size =
+			(max_size - neg_max_size) / cache->shard_count;
+		shard->lists[AUTH_CACHE_LIST_NEGATIVE].max_size =
+			neg_max_size / cache->shard_count;
+		for (unsigned int j = 0; j < AUTH_CACHE_LIST_COUNT; j++)
+			shard->lists[j].size_left = shard->lists[j].max_size;
+	}
+
 	lib_signals_set_handler(SIGHUP, LIBSIG_FLAGS_SAFE,
 				sig_auth_cache_clear, cache);
 	lib_signals_set_handler(SIGUSR2, LIBSIG_FLAGS_SAFE,
@@ -250,24 +392,37 @@ struct auth_cache *auth_cache_new(size_t max_size, unsigned int ttl_secs,
 void auth_cache_free(struct auth_cache **_cache)
 {
 	struct auth_cache *cache = *_cache;
+	unsigned int i;
 
 	*_cache = NULL;
 	lib_signals_unset_handler(SIGHUP, sig_auth_cache_clear, cache);
 	lib_signals_unset_handler(SIGUSR2, sig_auth_cache_stats, cache);
 
+	auth_cache_send_shard_stats(cache);
 	auth_cache_clear(cache);
-	hash_table_destroy(&cache->hash);
+	for (i = 0; i < cache->shard_count; i++)
+		hash_table_destroy(&cache->shards[i].hash);
+	i_free(cache->shards);
 	event_unref(&cache->event);
 	i_free(cache);
 }
 
 unsigned int auth_cache_clear(struct auth_cache *cache)
 {
-	unsigned int ret = hash_table_count(cache->hash);
-
-	while (cache->tail != NULL)
-		auth_cache_node_destroy(cache, cache->tail);
-	hash_table_clear(cache->hash, FALSE);
+	struct auth_cache_shard *shard;
+	unsigned int i, j, ret = 0;
+
+	for (i = 0; i < cache->shard_count; i++) {
+		shard = &cache->shards[i];
+		ret += hash_table_count(shard->hash);
+		for (j = 0; j < AUTH_CACHE_LIST_COUNT; j++) {
+			while (shard->lists[j].tail != NULL) {
+				auth_cache_node_destroy(shard,
+					shard->lists[j].tail);
+			}
+		}
+		hash_table_clear(shard->hash, FALSE);
+	}
 	return ret;
 }
 
@@ -316,14 +471,22 @@ static bool auth_cache_node_is_one_of_users(struct auth_cache_node *node,
 unsigned int auth_cache_clear_users(struct auth_cache *cache,
 				    const char *const *usernames)
 {
+	struct auth_cache_shard *shard;
 	struct auth_cache_node *node, *next;
-	unsigned int ret = 0;
-
-	for (node = cache->tail; node != NULL; node = next) {
-		next = node->next;
-		if (auth_cache_node_is_one_of_users(node, usernames)) {
-			auth_cache_node_destroy(cache, node);
-			ret++;
+	unsigned int i, j, ret = 0;
+
+	for (i = 0; i < cache->shard_count; i++) {
+		shard = &cache->shards[i];
+		for (j = 0; j < AUTH_CACHE_LIST_COUNT; j++) {
+			for (node = shard->lists[j].tail; node != NULL;
+			     node = next) {
+				next = node->next;
+				if (auth_cache_node_is_one_of_users(node,
+								    usernames)) {
+					auth_cache_node_destroy(shard, node);
+					ret++;
+				}
+			}
 		}
 	}
 	return ret;
@@ -338,9 +501,10 @@ auth_cache_escape(const char *string,
 	return str_tabescape(string);
 }
 
-static const char *
+static void
 auth_request_expand_cache_key(const struct auth_request *request,
-			      const char *key, const char *username)
+			      const char *key, const char *username,
+			      struct auth_cache_key *key_r)
 {
 	static bool error_logged = FALSE;
 	const char *error;
@@ -370,7 +534,8 @@ auth_request_expand_cache_key(const struct auth_request *request,
 		e_error(authdb_event(request),
 			"Failed to expand auth cache key %s: %s", key, error);
 	}
-	return str_c(value);
+	key_r->str = str_c(value);
+	key_r->hash = str_hash(key_r->str);
 }
 
 const char *
@@ -378,7 +543,9 @@ auth_cache_lookup(struct auth_cache *cache, const struct auth_request *request,
 		  const char *key, struct auth_cache_node **node_r,
 		  bool *expired_r, bool *neg_expired_r)
 {
+	struct auth_cache_shard *shard;
 	struct auth_cache_node *node;
+	struct auth_cache_key lookup_key;
 	const char *value;
 	unsigned int ttl_secs;
 	time_t now;
@@ -386,28 +553,27 @@ auth_cache_lookup(struct auth_cache *cache, const struct auth_request *request,
 	*expired_r = FALSE;
 	*neg_expired_r = FALSE;
 
-	key = auth_request_expand_cache_key(request, key, request->fields.translated_username);
-	node = hash_table_lookup(cache->hash, key);
+	auth_request_expand_cache_key(request, key,
+				      request->fields.translated_username,
+				      &lookup_key);
+	shard = auth_cache_get_shard(cache, &lookup_key);
+	node = hash_table_lookup(shard->hash, &lookup_key);
 	if (node == NULL) {
-		cache->miss_count++;
+		shard->miss_count++;
 		return NULL;
 	}
 
 	value = node->data + strlen(node->data) + 1;
-	ttl_secs = *value == '\0' ? cache->neg_ttl_secs : cache->ttl_secs;
+	ttl_secs = node->negative ? cache->neg_ttl_secs : cache->ttl_secs;
 
 	now = time(NULL);
 	if (node->created < now - (time_t)ttl_secs) {
 		/* TTL expired */
-		cache->miss_count++;
+		shard->miss_count++;
 		*expired_r = TRUE;
 	} else {
-		/* move to head */
-		if (node != cache->head) {
-			auth_cache_node_unlink(cache, node);
-			auth_cache_node_link_head(cache, node);
-		}
-		cache->hit_count++;
+		node->referenced = TRUE;
+		shard->hit_count++;
 	}
 	if (node->created < now - (time_t)cache->neg_ttl_secs)
 		*neg_expired_r = TRUE;
@@ -421,46 +587,59 @@ auth_cache_lookup(struct auth_cache *cache, const struct auth_request *request,
 void auth_cache_insert(struct auth_cache *cache, struct auth_request *request,
 		       const char *key, const char *value, bool last_success)
 {
-        struct auth_cache_node *node;
+	struct auth_cache_shard *shard;
+	struct auth_cache_list *list;
+	struct auth_cache_node *node;
+	struct auth_cache_key insert_key;
 	size_t data_size, alloc_size, key_len, value_len = strlen(value);
-	char *hash_key;
+	bool negative = *value == '\0';
 
-	if (*value == '\0' && cache->neg_ttl_secs == 0) {
+	if (negative && cache->neg_ttl_secs == 0) {
 		/* we're not caching negative entries */
 		return;
 	}
 
-	key = auth_request_expand_cache_key(request, key, request->fields.translated_username);
-	key_len = strlen(key);
+	auth_request_expand_cache_key(request, key,
+				      request->fields.translated_username,
+				      &insert_key);
+	key_len = strlen(insert_key.str);
 
 	data_size = key_len + 1 + value_len + 1;
 	alloc_size = sizeof(struct auth_cache_node) + data_size;
 
-	/* make sure we have enough space */
-	while (cache->size_left < alloc_size && cache->tail != NULL)
-		auth_cache_node_destroy(cache, cache->tail);
-
-	node = hash_table_lookup(cache->hash, key);
+	shard = auth_cache_get_shard(cache, &insert_key);
+	node = hash_table_lookup(shard->hash, &insert_key);
 	if (node != NULL) {
 		/* key is already in cache (probably expired), remove it */
-		auth_cache_node_destroy(cache, node);
+		auth_cache_node_destroy(shard, node);
 	}
 
+	list = &shard->lists[negative ? AUTH_CACHE_LIST_NEGATIVE :
+			     AUTH_CACHE_LIST_POSITIVE];
+	if (alloc_size > list->max_size) {
+		/* doesn't fit even into an empty shard */
+		return;
+	}
+	/* make sure we have enough space */
+	auth_cache_list_make_space(shard, list, alloc_size);
+
 	/* @UNSAFE */
 	node = i_malloc(alloc_size);
 	node->created = time(NULL);
 	node->alloc_size = alloc_size;
 	node->last_success = last_success;
-	memcpy(node->data, key, key_len);
+	node->negative = negative;
+	memcpy(node->data, insert_key.str, key_len);
 	memcpy(node->data + key_len + 1, value, value_len);
+	node->key.str = node->data;
+	node->key.hash = insert_key.hash;
 
-	auth_cache_node_link_head(cache, node);
+	auth_cache_node_link_head(list, node);
 
-	cache->size_left -= alloc_size;
-	hash_key = node->data;
-	hash_table_insert(cache->hash, hash_key, node);
+	list->size_left -= alloc_size;
+	hash_table_insert(shard->hash, &node->key, node);
 
-	if (*value != '\0') {
+	if (!negative) {
 		cache->pos_entries++;
 		cache->pos_size += alloc_size;
 	} else {
@@ -472,12 +651,16 @@ void auth_cache_insert(struct auth_cache *cache, struct auth_request *request,
 void auth_cache_remove(struct auth_cache *cache,
 		       const struct auth_request *request, const char *key)
 {
+	struct auth_cache_shard *shard;
 	struct auth_cache_node *node;
+	struct auth_cache_key remove_key;
 
-	key = auth_request_expand_cache_key(request, key, request->fields.user);
-	node = hash_table_lookup(cache->hash, key);
+	auth_request_expand_cache_key(request, key, request->fields.user,
+				      &remove_key);
+	shard = auth_cache_get_shard(cache, &remove_key);
+	node = hash_table_lookup(shard->hash, &remove_key);
 	if (node == NULL)
 		return;
 
-	auth_cache_node_destroy(cache, node);
+	auth_cache_node_destroy(shard, node);
 }
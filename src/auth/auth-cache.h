@@ -1,14 +1,26 @@
 #ifndef AUTH_CACHE_H
 #define AUTH_CACHE_H
 
+struct auth_cache_key {
+	const char *str;
+	/* str_hash() of str, calculated only once per lookup */
+	unsigned int hash;
+};
+
 struct auth_cache_node {
 	struct auth_cache_node *prev, *next;
+	struct auth_cache_key key;
 
 	time_t created;
 	/* Total number of bytes used by this node */
 	uint32_t alloc_size:31;
 	/* TRUE if the user gave the correct password the last time. */
 	bool last_success:1;
+	/* TRUE if the node has been used since the eviction scan last
+	   passed it. */
+	bool referenced:1;
+	/* TRUE if this is a negative cache entry */
+	bool negative:1;
 
 	char data[]; /* key \0 value \0 */
 };
@@ -26,10 +38,13 @@ char *auth_cache_parse_key_and_fields(pool_t pool, const char *query,
 				      const char *exclude_driver);
 
 /* Create a new cache. max_size specifies the maximum amount of memory in
-   bytes to use for cache (it's not fully exact). ttl_secs specifies time to
-   live for cache record, requests older than that are not used.
-   neg_ttl_secs specifies the TTL for negative entries. */
-struct auth_cache *auth_cache_new(size_t max_size, unsigned int ttl_secs,
+   bytes to use for cache (it's not fully exact). neg_max_size is the part of
+   it that negative entries can use, so they can't push out the positive
+   entries. ttl_secs specifies time to live for cache record, requests older
+   than that are not used. neg_ttl_secs specifies the TTL for negative
+   entries. */
+struct auth_cache *auth_cache_new(size_t max_size, size_t neg_max_size,
+				  unsigned int ttl_secs,
 				  unsigned int neg_ttl_secs);
 void auth_cache_free(struct auth_cache **cache);
 
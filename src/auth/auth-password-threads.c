@@ -0,0 +1,462 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "auth-common.h"
+#include "ioloop.h"
+#include "fd-util.h"
+#include "safe-memset.h"
+#include "password-scheme.h"
+#include "mycrypt.h"
+#include "crypt-blowfish.h"
+#include "auth-password-threads.h"
+
+#ifdef HAVE_AUTH_THREADS
+
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#ifdef HAVE_SYS_EVENTFD_H
+#  include <sys/eventfd.h>
+#endif
+#ifdef HAVE_LIBSODIUM
+#  include <sodium.h>
+#endif
+
+#define CRYPT_BLF_PREFIX_LEN (7+22+1) /* $2.$nn$ + salt */
+#define CRYPT_BLF_BUFFER_LEN 128
+
+/* The threads must not call (almost) any Dovecot functions, because most of
+   them use the data stack, pools, events or logging, none of which are
+   thread-safe. They only run the hash functions for the copies of the
+   passwords given to them, and everything else is done by the main thread
+   when it gets the finished job back. */
+
+enum auth_password_thread_method {
+	AUTH_PASSWORD_THREAD_METHOD_NONE = 0,
+	AUTH_PASSWORD_THREAD_METHOD_BLOWFISH,
+	AUTH_PASSWORD_THREAD_METHOD_CRYPT_R,
+	AUTH_PASSWORD_THREAD_METHOD_ARGON2,
+};
+
+struct auth_password_job {
+	struct auth_password_job *next;
+
+	enum auth_password_thread_method method;
+	char *plain_password;
+	char *crypted;
+
+	/* Set by the thread */
+	int ret;
+	int error_errno;
+
+	auth_password_threads_callback_t *callback;
+	void *context;
+};
+
+struct auth_password_thread {
+	struct auth_password_threads *pt;
+	pthread_t thread;
+
+#ifdef HAVE_CRYPT_R
+	struct mycrypt_data *crypt_data;
+#endif
+	char blf_output[CRYPT_BLF_BUFFER_LEN];
+};
+
+struct auth_password_threads {
+	struct auth_password_thread *threads;
+	unsigned int thread_count;
+
+	/* Jobs waiting for a free thread. Protected by the mutex, since
+	   the idle threads need to sleep on the condition anyway. */
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	struct auth_password_job *queue_head, *queue_tail;
+	bool stopping;
+
+	/* Finished jobs, pushed by the threads without locking. The main
+	   thread takes the whole list at once, so it's in reverse order. */
+	_Atomic(struct auth_password_job *) done_head;
+	/* Threads write here when they push to an empty done list. With
+	   eventfd both are the same fd. */
+	int fd_notify[2];
+	struct io *io_notify;
+
+	/* Jobs given to the threads, but not yet finished in main thread */
+	unsigned int pending_count;
+	bool deinitializing;
+};
+
+static struct auth_password_threads *password_threads = NULL;
+
+static void
+auth_password_job_run(struct auth_password_thread *thread,
+		      struct auth_password_job *job)
+{
+	const char *crypted = NULL;
+
+	switch (job->method) {
+	case AUTH_PASSWORD_THREAD_METHOD_NONE:
+		break;
+	case AUTH_PASSWORD_THREAD_METHOD_BLOWFISH:
+		crypted = crypt_blowfish_rn(job->plain_password, job->crypted,
+					    thread->blf_output,
+					    sizeof(thread->blf_output));
+		break;
+	case AUTH_PASSWORD_THREAD_METHOD_CRYPT_R:
+#ifdef HAVE_CRYPT_R
+		crypted = mycrypt_r(job->plain_password, job->crypted,
+				    thread->crypt_data);
+#endif
+		break;
+	case AUTH_PASSWORD_THREAD_METHOD_ARGON2:
+#ifdef HAVE_LIBSODIUM
+		job->ret = crypto_pwhash_str_verify(job->crypted,
+				job->plain_password,
+				strlen(job->plain_password)) < 0 ? 0 : 1;
+		return;
+#else
+		break;
+#endif
+	}
+
+	if (crypted == NULL) {
+		job->ret = -1;
+		job->error_errno = errno;
+	} else {
+		job->ret = str_equals_timing_almost_safe(crypted,
+							 job->crypted) ? 1 : 0;
+	}
+}
+
+static void
+auth_password_job_done(struct auth_password_threads *pt,
+		       struct auth_password_job *job)
+{
+	struct auth_password_job *head =
+		atomic_load_explicit(&pt->done_head, memory_order_relaxed);
+	uint64_t one = 1;
+
+	do {
+		job->next = head;
+	} while (!atomic_compare_exchange_weak_explicit(&pt->done_head,
+			&head, job, memory_order_release,
+			memory_order_relaxed));
+	if (head != NULL) {
+		/* the main thread has already been notified */
+		return;
+	}
+#ifdef HAVE_SYS_EVENTFD_H
+	if (write(pt->fd_notify[1], &one, sizeof(one)) < 0) {
+#else
+	if (write(pt->fd_notify[1], &one, 1) < 0) {
+#endif
+		/* The fd is non-blocking, so the pipe is just full and
+		   there's already something to read. Logging isn't possible
+		   here anyway. */
+	}
+}
+
+static void *auth_password_thread_main(void *context)
+{
+	struct auth_password_thread *thread = context;
+	struct auth_password_threads *pt = thread->pt;
+	struct auth_password_job *job;
+
+	for (;;) {
+		pthread_mutex_lock(&pt->mutex);
+		while (pt->queue_head == NULL && !pt->stopping)
+			pthread_cond_wait(&pt->cond, &pt->mutex);
+		if (pt->stopping) {
+			pthread_mutex_unlock(&pt->mutex);
+			break;
+		}
+		job = pt->queue_head;
+		pt->queue_head = job->next;
+		if (pt->queue_head == NULL)
+			pt->queue_tail = NULL;
+		pthread_mutex_unlock(&pt->mutex);
+
+		auth_password_job_run(thread, job);
+		auth_password_job_done(pt, job);
+	}
+	return NULL;
+}
+
+static void
+auth_password_job_finish(struct auth_password_threads *pt,
+			 struct auth_password_job *job, const char *error)
+{
+	i_assert(pt->pending_count > 0);
+	pt->pending_count--;
+
+	if (job->ret < 0 && error == NULL) {
+		const char *func =
+			job->method == AUTH_PASSWORD_THREAD_METHOD_BLOWFISH ?
+			"crypt_blowfish_rn()" : "crypt_r()";
+		error = t_strdup_printf("%s failed: %s", func,
+					strerror(job->error_errno));
+	}
+	T_BEGIN {
+		job->callback(job->ret, error, job->context);
+	} T_END;
+
+	safe_memset(job->plain_password, 0, strlen(job->plain_password));
+	i_free(job->plain_password);
+	i_free(job->crypted);
+	i_free(job);
+}
+
+static void auth_password_threads_finish_done(struct auth_password_threads *pt)
+{
+	struct auth_password_job *job, *next, *list = NULL;
+
+	job = atomic_exchange_explicit(&pt->done_head, NULL,
+				       memory_order_acquire);
+	/* reverse to get the jobs in the order they finished */
+	for (; job != NULL; job = next) {
+		next = job->next;
+		job->next = list;
+		list = job;
+	}
+	for (job = list; job != NULL; job = next) {
+		next = job->next;
+		auth_password_job_finish(pt, job, NULL);
+	}
+}
+
+static void auth_password_threads_notify(struct auth_password_threads *pt)
+{
+	unsigned char buf[128];
+	ssize_t ret;
+
+	ret = read(pt->fd_notify[0], buf, sizeof(buf));
+	if (ret < 0 && errno != EAGAIN)
+		i_fatal("read(password threads notify fd) failed: %m");
+	auth_password_threads_finish_done(pt);
+}
+
+static void auth_password_threads_notify_init(struct auth_password_threads *pt)
+{
+#ifdef HAVE_SYS_EVENTFD_H
+	pt->fd_notify[0] = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (pt->fd_notify[0] == -1)
+		i_fatal("eventfd() failed: %m");
+	pt->fd_notify[1] = pt->fd_notify[0];
+#else
+	if (pipe(pt->fd_notify) < 0)
+		i_fatal("pipe() failed: %m");
+	fd_set_nonblock(pt->fd_notify[0], TRUE);
+	fd_set_nonblock(pt->fd_notify[1], TRUE);
+	fd_close_on_exec(pt->fd_notify[0], TRUE);
+	fd_close_on_exec(pt->fd_notify[1], TRUE);
+#endif
+	pt->io_notify = io_add(pt->fd_notify[0], IO_READ,
+			       auth_password_threads_notify, pt);
+}
+
+void auth_password_threads_init(unsigned int thread_count)
+{
+	struct auth_password_threads *pt;
+	sigset_t sigset, old_sigset;
+	unsigned int i;
+	int ret;
+
+	i_assert(password_threads == NULL);
+
+	if (thread_count == 0)
+		return;
+
+	pt = i_new(struct auth_password_threads, 1);
+	pt->thread_count = thread_count;
+	pt->threads = i_new(struct auth_password_thread, thread_count);
+	pthread_mutex_init(&pt->mutex, NULL);
+	pthread_cond_init(&pt->cond, NULL);
+	atomic_init(&pt->done_head, NULL);
+	auth_password_threads_notify_init(pt);
+
+	/* signals are handled by the main thread */
+	sigfillset(&sigset);
+	pthread_sigmask(SIG_BLOCK, &sigset, &old_sigset);
+	for (i = 0; i < thread_count; i++) {
+		struct auth_password_thread *thread = &pt->threads[i];
+
+		thread->pt = pt;
+#ifdef HAVE_CRYPT_R
+		thread->crypt_data = mycrypt_data_new();
+		if (thread->crypt_data == NULL)
+			i_fatal_status(FATAL_OUTOFMEM, "mycrypt_data_new() failed: %m");
+#endif
+		ret = pthread_create(&thread->thread, NULL,
+				     auth_password_thread_main, thread);
+		if (ret != 0)
+			i_fatal("pthread_create() failed: %s", strerror(ret));
+	}
+	pthread_sigmask(SIG_SETMASK, &old_sigset, NULL);
+	password_threads = pt;
+}
+
+void auth_password_threads_deinit(void)
+{
+	struct auth_password_threads *pt = password_threads;
+	struct auth_password_job *job, *next;
+	unsigned int i;
+
+	if (pt == NULL)
+		return;
+
+	/* Let the threads finish their current jobs. The queued ones are
+	   never started. */
+	pthread_mutex_lock(&pt->mutex);
+	pt->stopping = TRUE;
+	pthread_cond_broadcast(&pt->cond);
+	pthread_mutex_unlock(&pt->mutex);
+	for (i = 0; i < pt->thread_count; i++) {
+		(void)pthread_join(pt->threads[i].thread, NULL);
+#ifdef HAVE_CRYPT_R
+		mycrypt_data_free(&pt->threads[i].crypt_data);
+#endif
+	}
+
+	/* the callbacks may try to verify more passwords, but they must
+	   be done without threads now */
+	pt->deinitializing = TRUE;
+	auth_password_threads_finish_done(pt);
+	for (job = pt->queue_head; job != NULL; job = next) {
+		next = job->next;
+		job->ret = -1;
+		auth_password_job_finish(pt, job,
+			"Auth process is shutting down");
+	}
+	pt->queue_head = pt->queue_tail = NULL;
+	i_assert(pt->pending_count == 0);
+
+	io_remove(&pt->io_notify);
+	if (pt->fd_notify[1] != pt->fd_notify[0])
+		i_close_fd(&pt->fd_notify[1]);
+	i_close_fd(&pt->fd_notify[0]);
+	pthread_cond_destroy(&pt->cond);
+	pthread_mutex_destroy(&pt->mutex);
+	i_free(pt->threads);
+	i_free(pt);
+	password_threads = NULL;
+}
+
+bool auth_password_threads_enabled(void)
+{
+	return password_threads != NULL && !password_threads->deinitializing;
+}
+
+static bool
+auth_password_is_blowfish(const unsigned char *raw_password, size_t size)
+{
+	return size >= CRYPT_BLF_PREFIX_LEN &&
+		raw_password[0] == '$' && raw_password[1] == '2' &&
+		raw_password[2] >= 'a' && raw_password[2] <= 'z' &&
+		raw_password[3] == '$';
+}
+
+static enum auth_password_thread_method
+auth_password_thread_get_method(const char *scheme,
+				const unsigned char *raw_password, size_t size)
+{
+	/* CRYPT is an alias of BLF-CRYPT, so the scheme names are compared
+	   directly. Anything that would fail verification or log something
+	   special (weak schemes) is left for password_verify(). */
+	scheme = t_strcut(scheme, '.');
+	if (strcasecmp(scheme, "BLF-CRYPT") == 0) {
+		return auth_password_is_blowfish(raw_password, size) ?
+			AUTH_PASSWORD_THREAD_METHOD_BLOWFISH :
+			AUTH_PASSWORD_THREAD_METHOD_NONE;
+	}
+	if (strcasecmp(scheme, "CRYPT") == 0 ||
+	    strcasecmp(scheme, "SHA256-CRYPT") == 0 ||
+	    strcasecmp(scheme, "SHA512-CRYPT") == 0) {
+		/* the same as crypt_verify() */
+		if (size > 4 && raw_password[0] == '$' &&
+		    raw_password[1] == '2' && raw_password[3] == '$') {
+			return auth_password_is_blowfish(raw_password, size) ?
+				AUTH_PASSWORD_THREAD_METHOD_BLOWFISH :
+				AUTH_PASSWORD_THREAD_METHOD_NONE;
+		}
+#ifdef HAVE_CRYPT_R
+		if (size > 3 && raw_password[0] == '$' &&
+		    (raw_password[1] == '5' || raw_password[1] == '6') &&
+		    raw_password[2] == '$')
+			return AUTH_PASSWORD_THREAD_METHOD_CRYPT_R;
+#endif
+		return AUTH_PASSWORD_THREAD_METHOD_NONE;
+	}
+#ifdef HAVE_LIBSODIUM
+	if (strcasecmp(scheme, "ARGON2") == 0 ||
+	    strcasecmp(scheme, "ARGON2I") == 0 ||
+	    strcasecmp(scheme, "ARGON2ID") == 0)
+		return AUTH_PASSWORD_THREAD_METHOD_ARGON2;
+#endif
+	return AUTH_PASSWORD_THREAD_METHOD_NONE;
+}
+
+#undef auth_password_threads_verify
+bool auth_password_threads_verify(const char *scheme,
+				  const char *plain_password,
+				  const unsigned char *raw_password,
+				  size_t size,
+				  auth_password_threads_callback_t *callback,
+				  void *context)
+{
+	struct auth_password_threads *pt = password_threads;
+	struct auth_password_job *job;
+	enum auth_password_thread_method method;
+
+	if (!auth_password_threads_enabled())
+		return FALSE;
+	method = auth_password_thread_get_method(scheme, raw_password, size);
+	if (method == AUTH_PASSWORD_THREAD_METHOD_NONE)
+		return FALSE;
+
+	job = i_new(struct auth_password_job, 1);
+	job->method = method;
+	job->plain_password = i_strdup(plain_password);
+	job->crypted = i_strndup(raw_password, size);
+	job->callback = callback;
+	job->context = context;
+	pt->pending_count++;
+
+	pthread_mutex_lock(&pt->mutex);
+	if (pt->queue_tail == NULL)
+		pt->queue_head = job;
+	else
+		pt->queue_tail->next = job;
+	pt->queue_tail = job;
+	pthread_cond_signal(&pt->cond);
+	pthread_mutex_unlock(&pt->mutex);
+	return TRUE;
+}
+
+#else
+
+void auth_password_threads_init(unsigned int thread_count ATTR_UNUSED)
+{
+}
+
+void auth_password_threads_deinit(void)
+{
+}
+
+bool auth_password_threads_enabled(void)
+{
+	return FALSE;
+}
+
+#undef auth_password_threads_verify
+bool auth_password_threads_verify(const char *scheme ATTR_UNUSED,
+				  const char *plain_password ATTR_UNUSED,
+				  const unsigned char *raw_password ATTR_UNUSED,
+				  size_t size ATTR_UNUSED,
+				  auth_password_threads_callback_t *callback ATTR_UNUSED,
+				  void *context ATTR_UNUSED)
+{
+	return FALSE;
+}
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef AUTH_PASSWORD_THREADS_H
+#define AUTH_PASSWORD_THREADS_H
+
+/* Verifying CPU-heavy password schemes (SHA*-CRYPT, BLF-CRYPT, ARGON2) in a
+   pool of threads within the auth process. The threads do only the hashing,
+   everything else stays in the main thread. */
+
+/* ret is the same as with password_verify(): 1 = matched, 0 = didn't match,
+   -1 = error. */
+typedef void
+auth_password_threads_callback_t(int ret, const char *error, void *context);
+
+/* Start the given number of verification threads. */
+void auth_password_threads_init(unsigned int thread_count);
+/* Stop the threads. The callbacks of verifications that haven't finished
+   yet are called with an error. */
+void auth_password_threads_deinit(void);
+
+/* Returns TRUE if the threads are running. */
+bool auth_password_threads_enabled(void);
+
+/* Verify the raw (decoded) password in a thread. Returns FALSE if the
+   threads aren't running or can't handle the scheme or the password, in
+   which case the caller must verify the password itself. Otherwise the
+   callback is called later from the ioloop. */
+bool auth_password_threads_verify(const char *scheme,
+				  const char *plain_password,
+				  const unsigned char *raw_password,
+				  size_t size,
+				  auth_password_threads_callback_t *callback,
+				  void *context);
+#define auth_password_threads_verify(scheme, plain_password, \
+				     raw_password, size, callback, context) \
+	auth_password_threads_verify(scheme, plain_password, \
+		raw_password, size - \
+		CALLBACK_TYPECHECK(callback, void (*)( \
+			int, const char *, typeof(context))), \
+		(auth_password_threads_callback_t *)callback, context)
+
+#endif
@@ -25,6 +25,7 @@
 #include "passdb.h"
 #include "passdb-blocking.h"
 #include "passdb-cache.h"
+#include "auth-password-threads.h"
 #include "userdb-blocking.h"
 #include "password-scheme.h"
 #include "wildcard-match.h"
@@ -2622,58 +2623,70 @@ auth_request_password_verify(struct auth_request *request,
 						crypted_password, scheme, TRUE);
 }
 
-enum passdb_result
-auth_request_password_verify_log(struct auth_request *request,
-				 struct event *event,
-				 const char *plain_password,
-				 const char *crypted_password,
-				 const char *scheme,
-				 bool log_password_mismatch)
+/* Returns FALSE if the result is already known without verifying the
+   password. */
+static bool
+auth_request_password_verify_start(struct auth_request *request,
+				   struct event *event,
+				   const char *crypted_password,
+				   const char *scheme,
+				   const unsigned char **raw_password_r,
+				   size_t *raw_password_size_r,
+				   enum passdb_result *result_r)
 {
-	enum passdb_result result;
-	const unsigned char *raw_password;
-	size_t raw_password_size;
 	const char *error;
 	int ret;
-	struct password_generate_params gen_params = {
-		.user = request->fields.original_username,
-		.rounds = 0
-	};
 
 	if (request->fields.skip_password_check) {
 		/* passdb continue* rule after a successful authentication */
-		return PASSDB_RESULT_OK;
+		*result_r = PASSDB_RESULT_OK;
+		return FALSE;
 	}
 
 	if (request->passdb->set->deny) {
 		/* this is a deny database, we don't care about the password */
-		return PASSDB_RESULT_PASSWORD_MISMATCH;
+		*result_r = PASSDB_RESULT_PASSWORD_MISMATCH;
+		return FALSE;
 	}
 
 	if (auth_fields_exists(request->fields.extra_fields, "nopassword")) {
 		e_debug(event, "Allowing any password");
-		return PASSDB_RESULT_OK;
+		*result_r = PASSDB_RESULT_OK;
+		return FALSE;
 	}
 
 	ret = password_decode(crypted_password, scheme,
-			      &raw_password, &raw_password_size, &error);
+			      raw_password_r, raw_password_size_r, &error);
 	if (ret <= 0) {
 		if (ret < 0) {
 			e_error(event,
 				"Password data is not valid for scheme %s: %s",
 				scheme, error);
+			*result_r = PASSDB_RESULT_INTERNAL_FAILURE;
 		} else {
 			e_error(event, "Unknown scheme %s", scheme);
-			return PASSDB_RESULT_SCHEME_NOT_AVAILABLE;
+			*result_r = PASSDB_RESULT_SCHEME_NOT_AVAILABLE;
 		}
-		return PASSDB_RESULT_INTERNAL_FAILURE;
+		return FALSE;
 	}
+	return TRUE;
+}
+
+static enum passdb_result
+auth_request_password_verify_finish(struct auth_request *request,
+				    struct event *event,
+				    const char *plain_password,
+				    const char *crypted_password,
+				    const char *scheme,
+				    bool log_password_mismatch,
+				    int ret, const char *error)
+{
+	enum passdb_result result;
+	struct password_generate_params gen_params = {
+		.user = request->fields.original_username,
+		.rounds = 0
+	};
 
-	/* Use original_username since it may be important for some
-	   password schemes (eg. digest-md5). Otherwise the username is used
-	   only for logging purposes. */
-	ret = password_verify(plain_password, &gen_params,
-			      scheme, raw_password, raw_password_size, &error);
 	if (ret < 0) {
 		const char *password_str = request->set->debug_passwords ?
 			t_strdup_printf(" '%s'", crypted_password) : "";
@@ -2694,6 +2707,115 @@ auth_request_password_verify_log(struct auth_request *request,
 	return result;
 }
 
+enum passdb_result
+auth_request_password_verify_log(struct auth_request *request,
+				 struct event *event,
+				 const char *plain_password,
+				 const char *crypted_password,
+				 const char *scheme,
+				 bool log_password_mismatch)
+{
+	enum passdb_result result;
+	const unsigned char *raw_password;
+	size_t raw_password_size;
+	const char *error;
+	int ret;
+	struct password_generate_params gen_params = {
+		.user = request->fields.original_username,
+		.rounds = 0
+	};
+
+	if (!auth_request_password_verify_start(request, event,
+						crypted_password, scheme,
+						&raw_password,
+						&raw_password_size, &result))
+		return result;
+
+	/* Use original_username since it may be important for some
+	   password schemes (eg. digest-md5). Otherwise the username is used
+	   only for logging purposes. */
+	ret = password_verify(plain_password, &gen_params,
+			      scheme, raw_password, raw_password_size, &error);
+	return auth_request_password_verify_finish(request, event,
+		plain_password, crypted_password, scheme,
+		log_password_mismatch, ret, error);
+}
+
+struct auth_request_password_verify_context {
+	struct auth_request *request;
+	char *crypted_password;
+	char *scheme;
+	verify_plain_callback_t *callback;
+};
+
+static void
+auth_request_db_password_verify_threaded(
+	int ret, const char *error,
+	struct auth_request_password_verify_context *ctx)
+{
+	struct auth_request *request = ctx->request;
+	enum passdb_result result;
+
+	result = auth_request_password_verify_finish(request,
+		authdb_event(request), request->mech_password,
+		ctx->crypted_password, ctx->scheme, TRUE, ret, error);
+	ctx->callback(result, request);
+
+	safe_memset(ctx->crypted_password, 0, strlen(ctx->crypted_password));
+	i_free(ctx->crypted_password);
+	i_free(ctx->scheme);
+	i_free(ctx);
+	auth_request_unref(&request);
+}
+
+void auth_request_db_password_verify_async(struct auth_request *request,
+					   const char *crypted_password,
+					   const char *scheme,
+					   verify_plain_callback_t *callback)
+{
+	struct event *event = authdb_event(request);
+	struct auth_request_password_verify_context *ctx;
+	const unsigned char *raw_password;
+	size_t raw_password_size;
+	enum passdb_result result;
+	const char *error;
+	int ret;
+	struct password_generate_params gen_params = {
+		.user = request->fields.original_username,
+		.rounds = 0
+	};
+
+	if (!auth_request_password_verify_start(request, event,
+						crypted_password, scheme,
+						&raw_password,
+						&raw_password_size, &result)) {
+		callback(result, request);
+		return;
+	}
+
+	ctx = i_new(struct auth_request_password_verify_context, 1);
+	if (auth_password_threads_verify(scheme, request->mech_password,
+					 raw_password, raw_password_size,
+					 auth_request_db_password_verify_threaded,
+					 ctx)) {
+		e_debug(event, "Verifying %s password in a thread", scheme);
+		ctx->request = request;
+		ctx->crypted_password = i_strdup(crypted_password);
+		ctx->scheme = i_strdup(scheme);
+		ctx->callback = callback;
+		auth_request_ref(request);
+		return;
+	}
+	i_free(ctx);
+
+	ret = password_verify(request->mech_password, &gen_params,
+			      scheme, raw_password, raw_password_size, &error);
+	result = auth_request_password_verify_finish(request, event,
+		request->mech_password, crypted_password, scheme,
+		TRUE, ret, error);
+	callback(result, request);
+}
+
 enum passdb_result
 auth_request_db_password_verify(struct auth_request *request,
 				const char *plain_password,
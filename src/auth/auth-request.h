@@ -387,6 +387,13 @@ auth_request_db_password_verify_log(struct auth_request *request,
 				    const char *scheme,
 				    bool log_password_mismatch)
 				    ATTR_WARN_UNUSED_RESULT;
+/* Like auth_request_db_password_verify() for request->mech_password, but the
+   password may be verified in a thread (auth_password_verify_threads). The
+   callback is called either before returning or later from the ioloop. */
+void auth_request_db_password_verify_async(struct auth_request *request,
+					   const char *crypted_password,
+					   const char *scheme,
+					   verify_plain_callback_t *callback);
 enum passdb_result auth_request_password_missing(struct auth_request *request);
 
 void auth_request_log_password_mismatch(struct auth_request *request,
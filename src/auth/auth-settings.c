@@ -291,9 +291,11 @@ static const struct setting_define auth_setting_defines[] = {
 	DEF(BOOLLIST, realms),
 	DEF(STR, default_domain),
 	DEF(SIZE, cache_size),
+	DEF(SIZE, cache_negative_size),
 	DEF(TIME, cache_ttl),
 	DEF(TIME, cache_negative_ttl),
 	DEF(BOOL, cache_verify_password_with_worker),
+	DEF(UINT, password_verify_threads),
 	DEF(STR, username_chars),
 	DEF(STR_HIDDEN, username_translation),
 	DEF(STR_NOVARS, username_format),
@@ -358,9 +360,11 @@ static const struct auth_settings auth_default_settings = {
 	.realms = ARRAY_INIT,
 	.default_domain = "",
 	.cache_size = 0,
+	.cache_negative_size = 0,
 	.cache_ttl = 60*60,
 	.cache_negative_ttl = 60*60,
 	.cache_verify_password_with_worker = FALSE,
+	.password_verify_threads = 0,
 	.username_chars = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ01234567890.-_@",
 	.username_translation = "",
 	.username_format = "%{user | lower}",
@@ -597,6 +601,19 @@ static bool auth_settings_ext_check(struct event *event, void *_set,
 					   set->cache_size);
 		return FALSE;
 	}
+	if (set->cache_size > 0 &&
+	    set->cache_negative_size >= set->cache_size) {
+		*error_r = "auth_cache_negative_size must be smaller than "
+			"auth_cache_size";
+		return FALSE;
+	}
+#ifndef HAVE_AUTH_THREADS
+	if (set->password_verify_threads > 0) {
+		*error_r = "auth_password_verify_threads: "
+			"Dovecot was built without thread support";
+		return FALSE;
+	}
+#endif
 
 	if (!auth_verify_verbose_password(set, error_r))
 		return FALSE;
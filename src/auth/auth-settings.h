@@ -55,9 +55,11 @@ struct auth_settings {
 	ARRAY_TYPE(const_string) realms;
 	const char *default_domain;
 	uoff_t cache_size;
+	uoff_t cache_negative_size;
 	unsigned int cache_ttl;
 	unsigned int cache_negative_ttl;
 	bool cache_verify_password_with_worker;
+	unsigned int password_verify_threads;
 	const char *username_chars;
 	const char *username_translation;
 	const char *username_format;
@@ -24,6 +24,7 @@
 #include "mech-otp-common.h"
 #include "auth.h"
 #include "auth-penalty.h"
+#include "auth-password-threads.h"
 #include "auth-token.h"
 #include "auth-request-handler.h"
 #include "auth-worker-server.h"
@@ -240,6 +241,8 @@ static void main_init(void)
 	} else {
 		/* caching is handled only by the main auth process */
 		passdb_cache_init(global_auth_settings);
+		auth_password_threads_init(
+			global_auth_settings->password_verify_threads);
 		if (global_auth_settings->allow_weak_schemes)
 			i_warning("Weak password schemes are allowed");
 	}
@@ -256,6 +259,9 @@ static void main_deinit(void)
 	}
 	/* deinit auth workers, which aborts pending requests */
         auth_worker_connection_deinit();
+	/* stop password verification threads, which also aborts pending
+	   requests */
+	auth_password_threads_deinit();
 	/* deinit passdbs and userdbs. it aborts any pending async requests. */
 	auths_deinit();
 	/* flush pending requests */
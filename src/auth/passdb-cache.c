@@ -188,6 +188,7 @@ bool passdb_cache_lookup_credentials(struct auth_request *request,
 
 void passdb_cache_init(const struct auth_settings *set)
 {
+	uoff_t neg_size;
 	rlim_t limit;
 
 	if (set->cache_size == 0 || set->cache_ttl == 0)
@@ -200,8 +201,16 @@ void passdb_cache_init(const struct auth_settings *set)
 			  set->cache_size/1024/1024,
 			  (uoff_t)(limit/1024/1024));
 	}
-	passdb_cache = auth_cache_new(set->cache_size, set->cache_ttl,
-				      set->cache_negative_ttl);
+	/* By default negative entries can use 1/8 of the cache. If they
+	   aren't cached at all, the positive entries can use all of it. */
+	if (set->cache_negative_ttl == 0)
+		neg_size = 0;
+	else if (set->cache_negative_size != 0)
+		neg_size = set->cache_negative_size;
+	else
+		neg_size = set->cache_size / 8;
+	passdb_cache = auth_cache_new(set->cache_size, neg_size,
+				      set->cache_ttl, set->cache_negative_ttl);
 }
 
 void passdb_cache_deinit(void)
@@ -83,7 +83,8 @@ static int passwd_file_save_results(struct auth_request *request,
 }
 
 static void
-passwd_file_verify_plain(struct auth_request *request, const char *password,
+passwd_file_verify_plain(struct auth_request *request,
+			 const char *password ATTR_UNUSED,
 			 verify_plain_callback_t *callback)
 {
 	struct passdb_module *_module = request->passdb->passdb;
@@ -91,7 +92,6 @@ passwd_file_verify_plain(struct auth_request *request, const char *password,
 		(struct passwd_file_passdb_module *)_module;
 	struct passwd_user *pu;
 	const char *scheme, *crypted_pass;
-	enum passdb_result result;
         int ret;
 
 	ret = db_passwd_file_lookup(module->pwf, request,
@@ -107,10 +107,8 @@ passwd_file_verify_plain(struct auth_request *request, const char *password,
 		return;
 	}
 
-	result = auth_request_db_password_verify(request, password,
-						 crypted_pass, scheme);
-
-	callback(result, request);
+	auth_request_db_password_verify_async(request, crypted_pass, scheme,
+					      callback);
 }
 
 static void
@@ -158,10 +158,8 @@ static void sql_query_callback(struct sql_result *result,
 		return;
 	}
 
-	passdb_result = auth_request_db_password_verify(
-		auth_request, auth_request->mech_password, password, scheme);
-
-	sql_request->callback.verify_plain(passdb_result, auth_request);
+	auth_request_db_password_verify_async(auth_request, password, scheme,
+		sql_request->callback.verify_plain);
 	i_assert(dup_password != NULL);
 	safe_memset(dup_password, 0, strlen(dup_password));
 	auth_request_unref(&auth_request);
@@ -1,5 +1,7 @@
 /* Copyright (c) 2013-2018 Dovecot authors, see the included COPYING file */
 
+#define AUTH_REQUEST_FIELDS_CONST
+
 #include "lib.h"
 #include "str.h"
 #include "auth-request.h"
@@ -9,6 +11,7 @@
 const struct var_expand_table
 auth_request_var_expand_static_tab[AUTH_REQUEST_VAR_TAB_COUNT + 1] = {
 	{ .key = "user", .value = NULL },
+	{ .key = "id", .value = "1" },
 
 	{ .key = "a", .value = NULL },
 	{ .key = "b", .value = NULL },
@@ -23,7 +26,7 @@ auth_request_get_var_expand_table_full(const struct auth_request *auth_request A
 				       const char *username ATTR_UNUSED,
 				       unsigned int *count ATTR_UNUSED)
 {
-	i_unreached();
+	return NULL;
 }
 
 static int mock_get_passdb(const char *key, const char **value_r,
@@ -100,12 +103,132 @@ static void test_auth_cache_parse_key(void)
 	test_end();
 }
 
+static const char *
+test_cache_lookup(struct auth_cache *cache, struct auth_request *request,
+		  const char *key)
+{
+	bool expired, neg_expired;
+
+	return auth_cache_lookup(cache, request, key, NULL,
+				 &expired, &neg_expired);
+}
+
+static void test_auth_cache_insert_lookup(void)
+{
+	struct auth_request request;
+	struct auth_cache *cache;
+	const char *value;
+	unsigned int i;
+
+	test_begin("auth cache insert and lookup");
+	i_zero(&request);
+	cache = auth_cache_new(8192, 1024, 60, 60);
+
+	test_assert(test_cache_lookup(cache, &request, "user1") == NULL);
+	auth_cache_insert(cache, &request, "user1", "pass1", TRUE);
+	value = test_cache_lookup(cache, &request, "user1");
+	test_assert_strcmp(value, "pass1");
+
+	auth_cache_insert(cache, &request, "user2", "", FALSE);
+	value = test_cache_lookup(cache, &request, "user2");
+	test_assert_strcmp(value, "");
+
+	/* replacing */
+	auth_cache_insert(cache, &request, "user1", "pass2", TRUE);
+	value = test_cache_lookup(cache, &request, "user1");
+	test_assert_strcmp(value, "pass2");
+
+	/* negative entries can't push out positive ones */
+	for (i = 0; i < 100; i++) {
+		auth_cache_insert(cache, &request,
+				  t_strdup_printf("unknown%u", i), "", FALSE);
+	}
+	test_assert(test_cache_lookup(cache, &request, "user2") == NULL);
+	value = test_cache_lookup(cache, &request, "user1");
+	test_assert_strcmp(value, "pass2");
+
+	/* the key begins with "P1\t" */
+	request.fields.user = "user1";
+	auth_cache_remove(cache, &request, "user1");
+	test_assert(test_cache_lookup(cache, &request, "user1") == NULL);
+	auth_cache_insert(cache, &request, "user1", "pass1", TRUE);
+	test_assert(auth_cache_clear_users(cache,
+		(const char *const[]){ "user1", NULL }) == 1);
+	test_assert(test_cache_lookup(cache, &request, "user1") == NULL);
+
+	auth_cache_free(&cache);
+	test_end();
+}
+
+static void test_auth_cache_eviction(void)
+{
+	struct auth_request request;
+	struct auth_cache *cache;
+	unsigned int i;
+
+	test_begin("auth cache eviction");
+	i_zero(&request);
+	cache = auth_cache_new(2048, 1024, 60, 60);
+
+	/* fill the positive entries' space */
+	for (i = 0; i < 100; i++) {
+		auth_cache_insert(cache, &request,
+				  t_strdup_printf("user%u", i), "pass", TRUE);
+	}
+	for (i = 0; i < 100; i++) {
+		if (test_cache_lookup(cache, &request,
+				      t_strdup_printf("user%u", i)) != NULL)
+			break;
+	}
+	test_assert(i > 0 && i < 99);
+	/* the oldest entry was looked up, so the next ones are
+	   evicted before it */
+	auth_cache_insert(cache, &request, "new", "pass", TRUE);
+	test_assert(test_cache_lookup(cache, &request,
+				      t_strdup_printf("user%u", i)) != NULL);
+	test_assert(test_cache_lookup(cache, &request,
+				      t_strdup_printf("user%u", i + 1)) == NULL);
+	test_assert(test_cache_lookup(cache, &request, "new") != NULL);
+
+	auth_cache_free(&cache);
+	test_end();
+}
+
+static void test_auth_cache_shards(void)
+{
+	struct auth_request request;
+	struct auth_cache *cache;
+	unsigned int i;
+
+	test_begin("auth cache shards");
+	i_zero(&request);
+	cache = auth_cache_new(16*1024*1024, 1024*1024, 60, 60);
+	for (i = 0; i < 1000; i++) {
+		auth_cache_insert(cache, &request,
+				  t_strdup_printf("user%u", i),
+				  t_strdup_printf("pass%u", i), TRUE);
+	}
+	for (i = 0; i < 1000; i++) {
+		test_assert_strcmp_idx(
+			test_cache_lookup(cache, &request,
+					  t_strdup_printf("user%u", i)),
+			t_strdup_printf("pass%u", i), i);
+	}
+	test_assert(auth_cache_clear(cache) == 1000);
+	test_assert(test_cache_lookup(cache, &request, "user1") == NULL);
+	auth_cache_free(&cache);
+	test_end();
+}
+
 int main(void)
 {
 	lib_init();
 	auth_event = event_create(NULL);
 	static void (*const test_functions[])(void) = {
 		test_auth_cache_parse_key,
+		test_auth_cache_insert_lookup,
+		test_auth_cache_eviction,
+		test_auth_cache_shards,
 		NULL
 	};
 	int ret = test_run(test_functions);
@@ -0,0 +1,144 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "ioloop.h"
+#include "test-auth.h"
+#include "auth-password-threads.h"
+
+#ifdef HAVE_AUTH_THREADS
+
+#define TEST_PASSWORD "08/15!test~4711"
+#define TEST_BLF_CRYPTED \
+	"$2b$04$ULMh/JvxfRNTrRDwqBzxceYnQf75HQYOGJfoGjxAHCqWaEQWzQvR6"
+
+static const struct {
+	const char *scheme;
+	const char *crypted;
+} test_passwords[] = {
+#ifdef HAVE_CRYPT_R
+	{ "SHA512-CRYPT", "$6$rounds=1000$0123456789abcdef$ZIAd5WqfyLkpvsVC"
+	  "VUU1GrvqaZTqvhJoouxdSqJO71l9Ld3tVrfOatEjarhghvEYADkq//LpDnTeO90tc"
+	  "btHR1" },
+	{ "CRYPT", "$5$rounds=1000$0123456789abcdef$K/DksR0DT01hGc8g/kt"
+	  "9McEgrbFMKi9qrb1jehe7hn4" },
+#endif
+	{ "BLF-CRYPT", TEST_BLF_CRYPTED },
+	{ "CRYPT", TEST_BLF_CRYPTED },
+};
+
+struct test_verify_result {
+	int ret;
+	bool have_error;
+	bool called;
+};
+
+static unsigned int test_pending;
+
+static void
+test_verify_callback(int ret, const char *error,
+		     struct test_verify_result *result)
+{
+	test_assert(!result->called);
+	result->called = TRUE;
+	result->ret = ret;
+	result->have_error = error != NULL;
+	if (--test_pending == 0)
+		io_loop_stop(current_ioloop);
+}
+
+static bool test_verify(const char *scheme, const char *password,
+			const char *crypted, struct test_verify_result *result)
+{
+	i_zero(result);
+	if (!auth_password_threads_verify(scheme, password,
+			(const unsigned char *)crypted, strlen(crypted),
+			test_verify_callback, result))
+		return FALSE;
+	test_pending++;
+	return TRUE;
+}
+
+static void test_auth_password_threads_verify(void)
+{
+	struct test_verify_result results[N_ELEMENTS(test_passwords)][2];
+	struct test_verify_result result;
+	struct ioloop *ioloop;
+	unsigned int i;
+
+	test_begin("auth password threads verify");
+	ioloop = io_loop_create();
+	auth_password_threads_init(3);
+	test_assert(auth_password_threads_enabled());
+
+	/* schemes that are cheap or need special handling aren't
+	   verified in threads */
+	test_assert(!test_verify("PLAIN", TEST_PASSWORD, TEST_PASSWORD,
+				 &result));
+	test_assert(!test_verify("DES-CRYPT", TEST_PASSWORD, "JBOZ0DgmtucwE",
+				 &result));
+	test_assert(!test_verify("BLF-CRYPT", TEST_PASSWORD, "$2y$04$",
+				 &result));
+
+	for (i = 0; i < N_ELEMENTS(test_passwords); i++) {
+		test_assert_idx(test_verify(test_passwords[i].scheme,
+					    TEST_PASSWORD,
+					    test_passwords[i].crypted,
+					    &results[i][0]), i);
+		test_assert_idx(test_verify(test_passwords[i].scheme,
+					    "wrong password",
+					    test_passwords[i].crypted,
+					    &results[i][1]), i);
+	}
+	if (test_pending > 0)
+		io_loop_run(ioloop);
+	test_assert(test_pending == 0);
+
+	for (i = 0; i < N_ELEMENTS(test_passwords); i++) {
+		test_assert_idx(results[i][0].called &&
+				results[i][0].ret == 1 &&
+				!results[i][0].have_error, i);
+		test_assert_idx(results[i][1].called &&
+				results[i][1].ret == 0 &&
+				!results[i][1].have_error, i);
+	}
+
+	auth_password_threads_deinit();
+	test_assert(!auth_password_threads_enabled());
+	io_loop_destroy(&ioloop);
+	test_end();
+}
+
+static void test_auth_password_threads_deinit(void)
+{
+	struct test_verify_result results[20];
+	struct ioloop *ioloop;
+	unsigned int i;
+
+	test_begin("auth password threads deinit");
+	ioloop = io_loop_create();
+	auth_password_threads_init(1);
+
+	/* the jobs still in the queue fail when deinitializing */
+	for (i = 0; i < N_ELEMENTS(results); i++) {
+		test_assert_idx(test_verify("BLF-CRYPT", TEST_PASSWORD,
+					    TEST_BLF_CRYPTED, &results[i]), i);
+	}
+	auth_password_threads_deinit();
+	test_assert(test_pending == 0);
+	for (i = 0; i < N_ELEMENTS(results); i++) {
+		test_assert_idx(results[i].called, i);
+		test_assert_idx(results[i].ret == 1 ||
+				(results[i].ret == -1 &&
+				 results[i].have_error), i);
+	}
+	io_loop_destroy(&ioloop);
+	test_end();
+}
+
+void test_auth_password_threads(void)
+{
+	test_auth_password_threads_verify();
+	test_auth_password_threads_deinit();
+}
+
+#endif
@@ -22,6 +22,9 @@ int main(int argc, char *argv[])
 		TEST_NAMED(test_auth_request_var_expand)
 		TEST_NAMED(test_auth_request_fields)
 		TEST_NAMED(test_username_filter)
+#ifdef HAVE_AUTH_THREADS
+		TEST_NAMED(test_auth_password_threads)
+#endif
 #if defined(BUILTIN_LUA)
 		TEST_NAMED(test_db_lua)
 #endif
@@ -41,6 +41,7 @@ static void dump_hdr(struct istream *input, uint64_t *modseq_r,
 	printf("create stamp = %u\n", hdr.create_stamp);
 	printf("initial modseq = %"PRIu64"\n", hdr.initial_modseq);
 	printf("compat flags = %x\n", hdr.compat_flags);
+	printf("flags = %x\n", hdr.flags);
 	*modseq_r = hdr.initial_modseq;
 	*version_r = MAIL_TRANSACTION_LOG_HDR_VERSION(&hdr);
 }
@@ -62,6 +63,9 @@ static const char *log_record_type(unsigned int type)
 	case MAIL_TRANSACTION_FLAG_UPDATE:
 		name = "flag-update";
 		break;
+	case MAIL_TRANSACTION_FLAG_UPDATE_PACKED:
+		name = "flag-update-packed";
+		break;
 	case MAIL_TRANSACTION_HEADER_UPDATE:
 		name = "header-update";
 		break;
@@ -286,6 +290,22 @@ static void log_record_print(const struct mail_transaction_header *hdr,
 		}
 		break;
 	}
+	case MAIL_TRANSACTION_FLAG_UPDATE_PACKED: {
+		buffer_t *buf = t_buffer_create(size * 4);
+		const struct mail_transaction_flag_update *u;
+		const char *error;
+
+		if (mail_index_unpack_flag_updates(data, size, buf, &error) < 0) {
+			printf(" - broken: %s\n", error);
+			break;
+		}
+		u = buf->data;
+		for (size = buf->used; size > 0; size -= sizeof(*u), u++) {
+			printf(" - uids=%u-%u (flags +%x-%x, modseq_inc_flag=%d)\n",
+			       u->uid1, u->uid2, u->add_flags, u->remove_flags, u->modseq_inc_flag);
+		}
+		break;
+	}
 	case MAIL_TRANSACTION_HEADER_UPDATE: {
 		const struct mail_transaction_header_update *u = data;
 
@@ -424,6 +444,11 @@ static void log_record_print(const struct mail_transaction_header *hdr,
 		const struct mail_transaction_boundary *rec = data;
 
 		printf(" - size=%u\n", rec->size);
+		if (size >= sizeof(struct mail_transaction_boundary_crc)) {
+			const struct mail_transaction_boundary_crc *crc_rec = data;
+
+			printf(" - crc32=%08x\n", crc_rec->crc32);
+		}
 		break;
 	}
 	case MAIL_TRANSACTION_ATTRIBUTE_UPDATE: {
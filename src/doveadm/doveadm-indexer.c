@@ -119,6 +119,9 @@ static int cmd_indexer_list_print(const char *const *args)
 	case 'o':
 		doveadm_print("optimize");
 		break;
+	case 'c':
+		doveadm_print("index-chunk");
+		break;
 	default:
 		doveadm_print(args[5]);
 		break;
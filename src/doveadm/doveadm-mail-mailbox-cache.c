@@ -1,6 +1,7 @@
 /* Copyright (c) 2018 Dovecot authors, see the included COPYING file */
 
 #include "lib.h"
+#include "array.h"
 #include "str.h"
 #include "time-util.h"
 #include "mail-index-private.h"
@@ -12,6 +13,14 @@
 #include "doveadm-mailbox-list-iter.h"
 #include "doveadm-mail.h"
 
+struct mailbox_cache_field_stats {
+	unsigned int cached_count;
+	uint64_t cached_bytes;
+	/* last seq where the field was seen */
+	uint32_t seen_seq;
+};
+ARRAY_DEFINE_TYPE(mailbox_cache_field_stats, struct mailbox_cache_field_stats);
+
 struct mailbox_cache_cmd_context {
 	struct doveadm_mail_cmd_context ctx;
 
@@ -360,6 +369,201 @@ static void cmd_mailbox_cache_purge_init(struct doveadm_mail_cmd_context *_ctx)
 		i_fatal_status(EX_USAGE, "Missing mailbox");
 }
 
+static void
+cmd_mailbox_cache_stats_scan_mail(struct mail_cache_view *view, uint32_t seq,
+				  ARRAY_TYPE(mailbox_cache_field_stats) *stats)
+{
+	struct mail_cache *cache = view->cache;
+	struct mail_cache_lookup_iterate_ctx iter;
+	struct mail_cache_iterate_field field;
+	struct mailbox_cache_field_stats *field_stats;
+	const void *data;
+	unsigned int i;
+
+	mail_cache_lookup_iter_init(view, seq, &iter);
+	while (mail_cache_lookup_iter_next(&iter, &field) > 0) {
+		field_stats = array_idx_get_space(stats, field.field_idx);
+		if (field_stats->seen_seq != seq) {
+			field_stats->seen_seq = seq;
+			field_stats->cached_count++;
+		}
+		field_stats->cached_bytes += field.size;
+	}
+
+	for (i = 0; i < cache->fields_count; i++) {
+		if (!cache->fields[i].column ||
+		    mail_cache_column_lookup(view, seq, i, &data) <= 0)
+			continue;
+		field_stats = array_idx_get_space(stats, i);
+		if (field_stats->seen_seq != seq) {
+			field_stats->seen_seq = seq;
+			field_stats->cached_count++;
+			field_stats->cached_bytes +=
+				cache->fields[i].field.field_size;
+		}
+	}
+}
+
+static void
+cmd_mailbox_cache_stats_print_field(struct mailbox *box,
+				    struct mail_cache *cache,
+				    unsigned int field_idx,
+				    unsigned int messages_count,
+				    ARRAY_TYPE(mailbox_cache_field_stats) *stats,
+				    ARRAY_TYPE(mail_cache_field_stats) *lookup_stats)
+{
+	const struct mailbox_cache_field_stats *field_stats;
+	const struct mail_cache_field_stats *field_lookup_stats;
+	static const struct mailbox_cache_field_stats empty_stats;
+	static const struct mail_cache_field_stats empty_lookup_stats;
+
+	if (field_idx < array_count(stats))
+		field_stats = array_idx(stats, field_idx);
+	else
+		field_stats = &empty_stats;
+	if (field_idx < array_count(lookup_stats))
+		field_lookup_stats = array_idx(lookup_stats, field_idx);
+	else
+		field_lookup_stats = &empty_lookup_stats;
+
+	doveadm_print(mailbox_get_vname(box));
+	doveadm_print(cache->fields[field_idx].field.name);
+	doveadm_print(cmd_mailbox_cache_decision_to_str(
+		cache->fields[field_idx].field.decision));
+	doveadm_print_num(field_stats->cached_count);
+	doveadm_print_num(messages_count - field_stats->cached_count);
+	doveadm_print_num(field_stats->cached_bytes);
+	doveadm_print_num(field_lookup_stats->hit_count);
+	doveadm_print_num(field_lookup_stats->miss_count);
+	doveadm_print_num(field_lookup_stats->parse_bytes);
+	doveadm_print_num(field_lookup_stats->parse_usecs);
+}
+
+static int cmd_mailbox_cache_stats_run_box(struct mailbox_cache_cmd_context *ctx,
+					   struct mailbox *box)
+{
+	struct mail_cache *cache = box->cache;
+	struct mail_cache_view *view;
+	ARRAY_TYPE(mailbox_cache_field_stats) stats;
+	ARRAY_TYPE(mail_cache_field_stats) lookup_stats;
+	const char *const *field_name;
+	unsigned int idx;
+	uint32_t seq, messages_count;
+
+	if (mail_cache_open_and_verify(cache) < 0 ||
+	    MAIL_CACHE_IS_UNUSABLE(cache)) {
+		e_error(ctx->ctx.cctx->event, "Cache is unusable");
+		ctx->ctx.exit_code = EX_TEMPFAIL;
+		return -1;
+	}
+
+	view = mail_cache_view_open(cache, box->view);
+	/* this is an administrative scan, not a client access */
+	mail_cache_view_update_cache_decisions(view, FALSE);
+
+	t_array_init(&stats, cache->fields_count);
+	messages_count = mail_index_view_get_messages_count(box->view);
+	for (seq = 1; seq <= messages_count; seq++)
+		cmd_mailbox_cache_stats_scan_mail(view, seq, &stats);
+	mail_cache_view_close(&view);
+
+	/* lookup statistics aggregated from the sessions that have accessed
+	   the mailbox */
+	t_array_init(&lookup_stats, cache->fields_count);
+	if (mail_cache_read_field_stats(cache, &lookup_stats) < 0) {
+		e_error(ctx->ctx.cctx->event,
+			"Failed to read cache lookup statistics");
+		ctx->ctx.exit_code = EX_TEMPFAIL;
+		return -1;
+	}
+
+	if (ctx->all_fields) {
+		for (idx = 0; idx < cache->fields_count; idx++) {
+			cmd_mailbox_cache_stats_print_field(box, cache, idx,
+				messages_count, &stats, &lookup_stats);
+		}
+		return 0;
+	}
+	for (field_name = ctx->fields; *field_name != NULL; field_name++) {
+		idx = mail_cache_register_lookup(cache, *field_name);
+		if (idx == UINT_MAX) {
+			doveadm_print(mailbox_get_vname(box));
+			doveadm_print(*field_name);
+			doveadm_print("<not found>");
+			doveadm_print("");
+			doveadm_print("");
+			doveadm_print("");
+			doveadm_print("");
+			doveadm_print("");
+			doveadm_print("");
+			doveadm_print("");
+			continue;
+		}
+		cmd_mailbox_cache_stats_print_field(box, cache, idx,
+						    messages_count, &stats,
+						    &lookup_stats);
+	}
+	return 0;
+}
+
+static int cmd_mailbox_cache_stats_run(struct doveadm_mail_cmd_context *_ctx,
+				       struct mail_user *user)
+{
+	struct mailbox_cache_cmd_context *ctx =
+		container_of(_ctx, struct mailbox_cache_cmd_context, ctx);
+	const char *const *boxname;
+	int ret = 0;
+
+	if (_ctx->exit_code != 0)
+		return -1;
+
+	for(boxname = ctx->boxes; ret == 0 && *boxname != NULL; boxname++) {
+		struct mailbox *box;
+		if ((ret = cmd_mailbox_cache_open_box(_ctx, user, *boxname, &box)) < 0)
+			break;
+		T_BEGIN {
+			ret = cmd_mailbox_cache_stats_run_box(ctx, box);
+		} T_END;
+		mailbox_free(&box);
+	}
+
+	return ret;
+}
+
+static void cmd_mailbox_cache_stats_init(struct doveadm_mail_cmd_context *_ctx)
+{
+	struct doveadm_cmd_context *cctx = _ctx->cctx;
+	struct mailbox_cache_cmd_context *ctx =
+		container_of(_ctx, struct mailbox_cache_cmd_context, ctx);
+	const char *value_str;
+
+	if (doveadm_cmd_param_str(cctx, "fieldstr", &value_str))
+		ctx->fields = (const char *const *)p_strsplit_spaces(_ctx->pool, value_str, ", ");
+	else
+		ctx->all_fields = TRUE;
+
+	if (!doveadm_cmd_param_array(cctx, "mailbox", &ctx->boxes))
+		i_fatal_status(EX_USAGE, "Missing mailbox");
+
+	doveadm_print_header_simple("mailbox");
+	doveadm_print_header_simple("field");
+	doveadm_print_header_simple("decision");
+	doveadm_print_header("cached", "cached",
+			     DOVEADM_PRINT_HEADER_FLAG_RIGHT_JUSTIFY);
+	doveadm_print_header("missing", "missing",
+			     DOVEADM_PRINT_HEADER_FLAG_RIGHT_JUSTIFY);
+	doveadm_print_header("bytes", "bytes",
+			     DOVEADM_PRINT_HEADER_FLAG_RIGHT_JUSTIFY);
+	doveadm_print_header("hits", "hits",
+			     DOVEADM_PRINT_HEADER_FLAG_RIGHT_JUSTIFY);
+	doveadm_print_header("misses", "misses",
+			     DOVEADM_PRINT_HEADER_FLAG_RIGHT_JUSTIFY);
+	doveadm_print_header("parse_bytes", "parse bytes",
+			     DOVEADM_PRINT_HEADER_FLAG_RIGHT_JUSTIFY);
+	doveadm_print_header("parse_usecs", "parse usecs",
+			     DOVEADM_PRINT_HEADER_FLAG_RIGHT_JUSTIFY);
+}
+
 static struct doveadm_mail_cmd_context *cmd_mailbox_cache_decision_alloc(void)
 {
 	struct mailbox_cache_cmd_context *ctx =
@@ -390,6 +594,16 @@ static struct doveadm_mail_cmd_context *cmd_mailbox_cache_purge_alloc(void)
 	return &ctx->ctx;
 }
 
+static struct doveadm_mail_cmd_context *cmd_mailbox_cache_stats_alloc(void)
+{
+	struct mailbox_cache_cmd_context *ctx =
+		doveadm_mail_cmd_alloc(struct mailbox_cache_cmd_context);
+	ctx->ctx.v.init = cmd_mailbox_cache_stats_init;
+	ctx->ctx.v.run = cmd_mailbox_cache_stats_run;
+	doveadm_print_init(DOVEADM_PRINT_TYPE_TABLE);
+	return &ctx->ctx;
+}
+
 struct doveadm_cmd_ver2 doveadm_cmd_mailbox_cache_decision = {
 	.name = "mailbox cache decision",
 	.mail_cmd = cmd_mailbox_cache_decision_alloc,
@@ -425,3 +639,15 @@ DOVEADM_CMD_MAIL_COMMON
 DOVEADM_CMD_PARAM('\0', "mailbox", CMD_PARAM_ARRAY, CMD_PARAM_FLAG_POSITIONAL)
 DOVEADM_CMD_PARAMS_END
 };
+
+struct doveadm_cmd_ver2 doveadm_cmd_mailbox_cache_stats = {
+	.name = "mailbox cache stats",
+	.mail_cmd = cmd_mailbox_cache_stats_alloc,
+	.usage = DOVEADM_CMD_MAIL_USAGE_PREFIX
+		"[--fields <fields>] <mailbox> [<mailbox> ... ]",
+DOVEADM_CMD_PARAMS_START
+DOVEADM_CMD_MAIL_COMMON
+DOVEADM_CMD_PARAM('f', "fieldstr", CMD_PARAM_STR, 0)
+DOVEADM_CMD_PARAM('\0', "mailbox", CMD_PARAM_ARRAY, CMD_PARAM_FLAG_POSITIONAL)
+DOVEADM_CMD_PARAMS_END
+};
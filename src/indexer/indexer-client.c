@@ -156,6 +156,9 @@ indexer_client_request_list_write(string_t *str,
 	case INDEXER_REQUEST_TYPE_OPTIMIZE:
 		str_append_c(str, 'o');
 		break;
+	case INDEXER_REQUEST_TYPE_INDEX_CHUNK:
+		str_append_c(str, 'c');
+		break;
 	}
 	str_append_c(str, '\t');
 	if (request->working)
@@ -2,29 +2,89 @@
 
 #include "lib.h"
 #include "array.h"
+#include "ioloop.h"
 #include "llist.h"
 #include "hash.h"
+#include "time-util.h"
 #include "wildcard-match.h"
 #include "indexer-queue.h"
 
+/* A lower class gets to start a request if it hasn't started any for this
+   many seconds, even if higher classes have queued requests. */
+static const unsigned int indexer_request_class_aging_secs[] = {
+	[INDEXER_REQUEST_CLASS_INTERACTIVE] = 0,
+	[INDEXER_REQUEST_CLASS_PRECACHE] = 10,
+	[INDEXER_REQUEST_CLASS_BACKGROUND] = 60,
+};
+static_assert_array_size(indexer_request_class_aging_secs,
+			 INDEXER_REQUEST_CLASS_COUNT);
+
+static const char *const indexer_request_class_names[] = {
+	[INDEXER_REQUEST_CLASS_INTERACTIVE] = "interactive",
+	[INDEXER_REQUEST_CLASS_PRECACHE] = "precache",
+	[INDEXER_REQUEST_CLASS_BACKGROUND] = "background",
+};
+static_assert_array_size(indexer_request_class_names,
+			 INDEXER_REQUEST_CLASS_COUNT);
+
+/* The user's queued requests in one class */
+struct indexer_queue_user_class {
+	/* Round-robin list of the users that have queued requests in the
+	   class */
+	struct indexer_queue_user_class *prev, *next;
+	struct indexer_queue_user *user;
+
+	struct indexer_request *head, *tail;
+	/* Chunks can be started while the user is busy with their parent
+	   request, so they are kept separately. */
+	struct indexer_request *chunk_head, *chunk_tail;
+};
+
+struct indexer_queue_user {
+	char *username;
+	/* Linked list of the user's requests, not including chunks */
+	struct indexer_request *requests;
+	/* Number of requests being worked on, not including chunks */
+	unsigned int working_count;
+
+	struct indexer_queue_user_class classes[INDEXER_REQUEST_CLASS_COUNT];
+};
+
+struct indexer_queue_class {
+	struct indexer_queue_user_class *head, *tail;
+	unsigned int count;
+	/* The last time a request of this class was started, or when the
+	   class became non-empty. */
+	time_t last_served;
+};
+
 struct indexer_queue {
 	indexer_queue_callback_t *callback;
 	void (*listen_callback)(struct indexer_queue *);
+	struct event *event;
 
 	/* username+mailbox -> indexer_request */
 	HASH_TABLE(struct indexer_request *, struct indexer_request *) requests;
-	/* username -> indexer_request */
-	HASH_TABLE(char *, struct indexer_request *) users;
-	struct indexer_request *head, *tail;
+	/* username -> indexer_queue_user */
+	HASH_TABLE(char *, struct indexer_queue_user *) users;
+
+	struct indexer_queue_class classes[INDEXER_REQUEST_CLASS_COUNT];
+	unsigned int queued_count;
 };
 
 struct indexer_queue_iter {
 	struct indexer_queue *queue;
 	struct hash_iterate_context *hash_iter;
+	enum indexer_request_class class;
+	struct indexer_queue_user_class *uclass;
 	struct indexer_request *next;
 	bool only_working;
 };
 
+static struct event_category event_category_indexer = {
+	.name = "indexer",
+};
+
 static unsigned int
 indexer_request_hash(const struct indexer_request *request)
 {
@@ -48,6 +108,8 @@ indexer_queue_init(indexer_queue_callback_t *callback)
 	hash_table_create(&queue->requests, default_pool, 0,
 			  indexer_request_hash, indexer_request_cmp);
 	hash_table_create(&queue->users, default_pool, 0, str_hash, strcmp);
+	queue->event = event_create(NULL);
+	event_add_category(queue->event, &event_category_indexer);
 	return queue;
 }
 
@@ -63,6 +125,7 @@ void indexer_queue_deinit(struct indexer_queue **_queue)
 
 	hash_table_destroy(&queue->users);
 	hash_table_destroy(&queue->requests);
+	event_unref(&queue->event);
 	i_free(queue);
 }
 
@@ -93,14 +156,81 @@ static void request_add_context(struct indexer_request *request, void *context)
 	array_push_back(&request->contexts, &context);
 }
 
+static void
+indexer_queue_request_link(struct indexer_queue *queue,
+			   struct indexer_request *request, bool append)
+{
+	struct indexer_queue_class *qclass = &queue->classes[request->class];
+	struct indexer_queue_user_class *uclass =
+		&request->user->classes[request->class];
+	bool uclass_linked = uclass->head != NULL || uclass->chunk_head != NULL;
+
+	if (request->parent != NULL)
+		DLLIST2_APPEND(&uclass->chunk_head, &uclass->chunk_tail, request);
+	else if (append)
+		DLLIST2_APPEND(&uclass->head, &uclass->tail, request);
+	else
+		DLLIST2_PREPEND(&uclass->head, &uclass->tail, request);
+
+	if (!append) {
+		/* the user is served next in the class */
+		if (uclass_linked)
+			DLLIST2_REMOVE(&qclass->head, &qclass->tail, uclass);
+		DLLIST2_PREPEND(&qclass->head, &qclass->tail, uclass);
+	} else if (!uclass_linked) {
+		DLLIST2_APPEND(&qclass->head, &qclass->tail, uclass);
+	}
+	if (qclass->count++ == 0)
+		qclass->last_served = ioloop_time;
+	queue->queued_count++;
+}
+
+static void
+indexer_queue_request_unlink(struct indexer_queue *queue,
+			     struct indexer_request *request)
+{
+	struct indexer_queue_class *qclass = &queue->classes[request->class];
+	struct indexer_queue_user_class *uclass =
+		&request->user->classes[request->class];
+
+	if (request->parent != NULL)
+		DLLIST2_REMOVE(&uclass->chunk_head, &uclass->chunk_tail, request);
+	else
+		DLLIST2_REMOVE(&uclass->head, &uclass->tail, request);
+	if (uclass->head == NULL && uclass->chunk_head == NULL)
+		DLLIST2_REMOVE(&qclass->head, &qclass->tail, uclass);
+
+	i_assert(qclass->count > 0);
+	qclass->count--;
+	queue->queued_count--;
+}
+
+static struct indexer_queue_user *
+indexer_queue_user_get(struct indexer_queue *queue, const char *username)
+{
+	struct indexer_queue_user *user;
+	unsigned int i;
+
+	user = hash_table_lookup(queue->users, username);
+	if (user == NULL) {
+		user = i_new(struct indexer_queue_user, 1);
+		user->username = i_strdup(username);
+		for (i = 0; i < INDEXER_REQUEST_CLASS_COUNT; i++)
+			user->classes[i].user = user;
+		hash_table_insert(queue->users, user->username, user);
+	}
+	return user;
+}
+
 static struct indexer_request *
-indexer_queue_append_request(struct indexer_queue *queue, bool append,
+indexer_queue_append_request(struct indexer_queue *queue,
+			     enum indexer_request_class class, bool append,
 			     const char *username, const char *mailbox,
 			     const char *session_id,
 			     unsigned int max_recent_msgs, void *context)
 {
-	struct indexer_request *request, *first_request;
-	char *first_username;
+	struct indexer_request *request;
+	struct indexer_queue_user *user;
 
 	request = indexer_queue_lookup(queue, username, mailbox);
 	if (request != NULL) {
@@ -109,18 +239,23 @@ indexer_queue_append_request(struct indexer_queue *queue, bool append,
 		request_add_context(request, context);
 		if (request->working) {
 			/* we're already indexing this mailbox. */
+			if (!request->reindex_head && !request->reindex_tail)
+				request->reindex_class = class;
+			else if (class < request->reindex_class)
+				request->reindex_class = class;
 			if (append)
 				request->reindex_tail = TRUE;
 			else
 				request->reindex_head = TRUE;
+		} else if (append && class >= request->class) {
+			/* keep the request in its old position */
 		} else {
-			if (append) {
-				/* keep the request in its old position */
-			} else {
-				/* move request to beginning of the queue */
-				DLLIST2_REMOVE(&queue->head, &queue->tail, request);
-				DLLIST2_PREPEND(&queue->head, &queue->tail, request);
-			}
+			/* move request to the higher class, or to the
+			   beginning of its class */
+			indexer_queue_request_unlink(queue, request);
+			if (class < request->class)
+				request->class = class;
+			indexer_queue_request_link(queue, request, append);
 		}
 		return request;
 	}
@@ -130,23 +265,16 @@ indexer_queue_append_request(struct indexer_queue *queue, bool append,
 	request->mailbox = i_strdup(mailbox);
 	request->session_id = i_strdup(session_id);
 	request->max_recent_msgs = max_recent_msgs;
+	request->class = class;
+	request->queued_time = ioloop_timeval;
 	request_add_context(request, context);
 	hash_table_insert(queue->requests, request, request);
 
-	if (!hash_table_lookup_full(queue->users, username,
-				    &first_username, &first_request)) {
-		first_username = i_strdup(username);
-		hash_table_insert(queue->users, first_username, request);
-	} else {
-		DLLIST_PREPEND_FULL(&first_request, request,
-				    user_prev, user_next);
-		hash_table_update(queue->users, first_username, request);
-	}
+	user = indexer_queue_user_get(queue, username);
+	DLLIST_PREPEND_FULL(&user->requests, request, user_prev, user_next);
+	request->user = user;
 
-	if (append)
-		DLLIST2_APPEND(&queue->head, &queue->tail, request);
-	else
-		DLLIST2_PREPEND(&queue->head, &queue->tail, request);
+	indexer_queue_request_link(queue, request, append);
 	return request;
 }
 
@@ -164,7 +292,10 @@ void indexer_queue_append(struct indexer_queue *queue, bool append,
 {
 	struct indexer_request *request;
 
-	request = indexer_queue_append_request(queue, append, username, mailbox,
+	request = indexer_queue_append_request(queue, append ?
+					       INDEXER_REQUEST_CLASS_PRECACHE :
+					       INDEXER_REQUEST_CLASS_INTERACTIVE,
+					       append, username, mailbox,
 					       session_id, max_recent_msgs,
 					       context);
 	request->type = INDEXER_REQUEST_TYPE_INDEX;
@@ -177,24 +308,86 @@ void indexer_queue_append_optimize(struct indexer_queue *queue,
 {
 	struct indexer_request *request;
 
-	request = indexer_queue_append_request(queue, TRUE, username, mailbox,
+	request = indexer_queue_append_request(queue,
+					       INDEXER_REQUEST_CLASS_BACKGROUND,
+					       TRUE, username, mailbox,
 					       NULL, 0, context);
 	request->type = INDEXER_REQUEST_TYPE_OPTIMIZE;
 	indexer_queue_append_finish(queue);
 }
 
+static struct indexer_request *
+indexer_queue_class_peek(struct indexer_queue_class *qclass)
+{
+	struct indexer_queue_user_class *uclass;
+
+	/* Only the users that are busy are skipped, so this doesn't scan
+	   more than the number of requests being worked on. */
+	for (uclass = qclass->head; uclass != NULL; uclass = uclass->next) {
+		if (uclass->chunk_head != NULL)
+			return uclass->chunk_head;
+		if (uclass->user->working_count == 0)
+			return uclass->head;
+	}
+	return NULL;
+}
+
 struct indexer_request *indexer_queue_request_peek(struct indexer_queue *queue)
 {
-	return queue->head;
+	struct indexer_queue_class *qclass;
+	struct indexer_request *request;
+	unsigned int i;
+
+	/* first the classes that have waited for too long */
+	for (i = INDEXER_REQUEST_CLASS_INTERACTIVE + 1;
+	     i < INDEXER_REQUEST_CLASS_COUNT; i++) {
+		qclass = &queue->classes[i];
+		if (qclass->count > 0 &&
+		    qclass->last_served +
+		    (time_t)indexer_request_class_aging_secs[i] <= ioloop_time &&
+		    (request = indexer_queue_class_peek(qclass)) != NULL)
+			return request;
+	}
+	for (i = 0; i < INDEXER_REQUEST_CLASS_COUNT; i++) {
+		request = indexer_queue_class_peek(&queue->classes[i]);
+		if (request != NULL)
+			return request;
+	}
+	return NULL;
 }
 
 void indexer_queue_request_remove(struct indexer_queue *queue)
 {
-	struct indexer_request *request = queue->head;
+	struct indexer_request *request = indexer_queue_request_peek(queue);
 
 	i_assert(request != NULL);
 
-	DLLIST2_REMOVE(&queue->head, &queue->tail, request);
+	struct indexer_queue_class *qclass = &queue->classes[request->class];
+	struct indexer_queue_user_class *uclass =
+		&request->user->classes[request->class];
+
+	indexer_queue_request_unlink(queue, request);
+	if (uclass->head != NULL || uclass->chunk_head != NULL) {
+		/* round-robin: the user's next request in the class waits
+		   until the other users have been served */
+		DLLIST2_REMOVE(&qclass->head, &qclass->tail, uclass);
+		DLLIST2_APPEND(&qclass->head, &qclass->tail, uclass);
+	}
+	qclass->last_served = ioloop_time;
+
+	long long wait_usecs =
+		timeval_diff_usecs(&ioloop_timeval, &request->queued_time);
+	e_debug(event_create_passthrough(queue->event)->
+		set_name("indexer_request_started")->
+		add_str("user", request->username)->
+		add_str("mailbox", request->mailbox)->
+		add_str("class", indexer_request_class_names[request->class])->
+		add_int("queue_wait_usecs", wait_usecs)->
+		add_int("queue_depth", queue->queued_count)->
+		add_int("class_queue_depth", qclass->count)->event(),
+		"Starting %s request for %s (waited %lld us, %u requests queued)",
+		indexer_request_class_names[request->class], request->mailbox,
+		wait_usecs, queue->queued_count);
 }
 
 static void indexer_queue_request_status_int(struct indexer_queue *queue,
@@ -215,38 +408,158 @@ void indexer_queue_request_status(struct indexer_queue *queue,
 				  const struct indexer_status *status)
 {
 	i_assert(status->state == INDEXER_STATE_PROCESSING);
-	indexer_queue_request_status_int(queue, request, status);
+	if (request->parent == NULL) {
+		indexer_queue_request_status_int(queue, request, status);
+		return;
+	}
+
+	/* report the progress of all the chunks together */
+	struct indexer_request *parent = request->parent;
+
+	parent->chunks_progress += status->progress;
+	parent->chunks_progress -= request->chunk_progress;
+	parent->chunks_total += status->total;
+	parent->chunks_total -= request->chunk_total;
+	request->chunk_progress = status->progress;
+	request->chunk_total = status->total;
+
+	struct indexer_status parent_status = {
+		.state = INDEXER_STATE_PROCESSING,
+		.progress = parent->chunks_progress,
+		.total = parent->chunks_total,
+	};
+	indexer_queue_request_status_int(queue, parent, &parent_status);
 }
 
-void indexer_queue_move_head_to_tail(struct indexer_queue *queue)
+void indexer_queue_request_add_chunk(struct indexer_queue *queue,
+				     struct indexer_request *request,
+				     const char *chunk_id,
+				     uint32_t first_uid, uint32_t last_uid)
 {
-	struct indexer_request *request = queue->head;
+	struct indexer_request *chunk;
 
-	indexer_queue_request_remove(queue);
-	DLLIST2_APPEND(&queue->head, &queue->tail, request);
+	i_assert(request->working);
+	i_assert(request->parent == NULL);
+	i_assert(request->type == INDEXER_REQUEST_TYPE_INDEX);
+	i_assert(first_uid <= last_uid);
+
+	if (request->chunks_pending == 0) {
+		/* the worker that split the request */
+		request->chunks_pending = 1;
+	}
+	request->chunks_pending++;
+
+	chunk = i_new(struct indexer_request, 1);
+	chunk->parent = request;
+	chunk->user = request->user;
+	chunk->class = request->class;
+	chunk->queued_time = ioloop_timeval;
+	chunk->username = request->username;
+	chunk->mailbox = request->mailbox;
+	chunk->session_id = request->session_id;
+	chunk->type = INDEXER_REQUEST_TYPE_INDEX_CHUNK;
+	chunk->chunk_id = i_strdup(chunk_id);
+	chunk->chunk_first_uid = first_uid;
+	chunk->chunk_last_uid = last_uid;
+	indexer_queue_request_link(queue, chunk, FALSE);
 }
 
 void indexer_queue_request_work(struct indexer_request *request)
 {
+	i_assert(!request->working);
+
 	request->working = TRUE;
+	request->work_time = ioloop_timeval;
+	if (request->parent == NULL)
+		request->user->working_count++;
 	request->working_context_idx =
 		!array_is_created(&request->contexts) ? 0 :
 		array_count(&request->contexts);
 }
 
+static void
+indexer_queue_request_finished_event(struct indexer_queue *queue,
+				     struct indexer_request *request,
+				     enum indexer_state state)
+{
+	if (!request->working)
+		return;
+
+	long long work_usecs =
+		timeval_diff_usecs(&ioloop_timeval, &request->work_time);
+	e_debug(event_create_passthrough(queue->event)->
+		set_name("indexer_request_finished")->
+		add_str("user", request->username)->
+		add_str("mailbox", request->mailbox)->
+		add_str("class", indexer_request_class_names[request->class])->
+		add_str("chunk", request->parent != NULL ? "yes" : "no")->
+		add_str("success", state == INDEXER_STATE_COMPLETED ?
+			"yes" : "no")->
+		add_int("duration_usecs", work_usecs)->event(),
+		"Finished %s request for %s in %lld us",
+		indexer_request_class_names[request->class], request->mailbox,
+		work_usecs);
+}
+
 void indexer_queue_request_finish(struct indexer_queue *queue,
 				  struct indexer_request **_request,
 				  enum indexer_state state)
 {
-	struct indexer_request *first_request, *request = *_request;
-	char *first_username;
+	struct indexer_request *request = *_request;
+	struct indexer_queue_user *user = request->user;
 
 	*_request = NULL;
 
 	i_assert(state != INDEXER_STATE_PROCESSING);
+	if (request->parent != NULL) {
+		/* finished a chunk - finish also its part of the parent */
+		struct indexer_request *parent = request->parent;
+
+		i_assert(parent->chunks_pending > 0);
+		indexer_queue_request_finished_event(queue, request, state);
+		i_free(request->chunk_id);
+		i_free(request);
+		indexer_queue_request_finish(queue, &parent, state);
+		return;
+	}
+	if (request->chunks_pending > 0) {
+		if (state != INDEXER_STATE_COMPLETED)
+			request->chunks_failed = TRUE;
+		if (--request->chunks_pending > 0) {
+			/* wait for the rest of the chunks */
+			return;
+		}
+		indexer_queue_request_finished_event(queue, request,
+			request->chunks_failed ? INDEXER_STATE_FAILED :
+			INDEXER_STATE_COMPLETED);
+		request->chunks_progress = request->chunks_total = 0;
+		if (!request->chunks_failed)
+			state = INDEXER_STATE_COMPLETED;
+		else if (request->cancelled)
+			state = INDEXER_STATE_FAILED;
+		else {
+			/* Retry indexing the mailbox without splitting it.
+			   The waiting contexts get notified only after that. */
+			if ((!request->reindex_head && !request->reindex_tail) ||
+			    request->class < request->reindex_class)
+				request->reindex_class = request->class;
+			request->no_split = TRUE;
+			request->reindex_head = TRUE;
+			request->working_context_idx = 0;
+		}
+		request->chunks_failed = FALSE;
+		request->cancelled = FALSE;
+	} else {
+		indexer_queue_request_finished_event(queue, request, state);
+	}
 	struct indexer_status status = { .state = state };
 	indexer_queue_request_status_int(queue, request, &status);
 
+	if (request->working) {
+		i_assert(user->working_count > 0);
+		user->working_count--;
+	}
+
 	if (request->reindex_head || request->reindex_tail) {
 		i_assert(request->working);
 		request->working = FALSE;
@@ -254,24 +567,21 @@ void indexer_queue_request_finish(struct indexer_queue *queue,
 			array_delete(&request->contexts, 0,
 				     request->working_context_idx);
 		}
-		if (request->reindex_head)
-			DLLIST2_PREPEND(&queue->head, &queue->tail, request);
-		else
-			DLLIST2_APPEND(&queue->head, &queue->tail, request);
+		request->class = request->reindex_class;
+		request->queued_time = ioloop_timeval;
+		indexer_queue_request_link(queue, request,
+					   !request->reindex_head);
 		request->reindex_head = FALSE;
 		request->reindex_tail = FALSE;
 		return;
 	}
 
-	if (!hash_table_lookup_full(queue->users, request->username,
-				    &first_username, &first_request))
-		i_unreached();
-	DLLIST_REMOVE_FULL(&first_request, request, user_prev, user_next);
-	if (first_request != NULL)
-		hash_table_update(queue->users, first_username, first_request);
-	else {
-		hash_table_remove(queue->users, first_username);
-		i_free(first_username);
+	DLLIST_REMOVE_FULL(&user->requests, request, user_prev, user_next);
+	if (user->requests == NULL) {
+		i_assert(user->working_count == 0);
+		hash_table_remove(queue->users, user->username);
+		i_free(user->username);
+		i_free(user);
 	}
 	hash_table_remove(queue->requests, request);
 	if (array_is_created(&request->contexts))
@@ -292,21 +602,55 @@ indexer_queue_request_cancel(struct indexer_queue *queue,
 
 	*_request = NULL;
 	request->reindex_head = request->reindex_tail = FALSE;
-	DLLIST2_REMOVE(&queue->head, &queue->tail, request);
+	indexer_queue_request_unlink(queue, request);
 	indexer_queue_request_finish(queue, &request, INDEXER_STATE_FAILED);
 }
 
+static void
+indexer_queue_request_cancel_chunks(struct indexer_queue *queue,
+				    struct indexer_request *parent)
+{
+	struct indexer_queue_user *user = parent->user;
+	struct indexer_request *request, *next;
+	unsigned int i, queued_count = 0;
+
+	parent->cancelled = TRUE;
+	for (i = 0; i < INDEXER_REQUEST_CLASS_COUNT; i++) {
+		request = user->classes[i].chunk_head;
+		for (; request != NULL; request = request->next) {
+			if (request->parent == parent)
+				queued_count++;
+		}
+	}
+	/* The parent may be freed when its last chunk is finished, so stop
+	   as soon as all of its queued chunks are cancelled. */
+	for (i = 0; queued_count > 0; i++) {
+		i_assert(i < INDEXER_REQUEST_CLASS_COUNT);
+		request = user->classes[i].chunk_head;
+		for (; request != NULL && queued_count > 0; request = next) {
+			next = request->next;
+			if (request->parent == parent) {
+				queued_count--;
+				indexer_queue_request_cancel(queue, &request);
+			}
+		}
+	}
+}
+
 void indexer_queue_cancel(struct indexer_queue *queue, const char *username,
 			  const char *mailbox_mask)
 {
+	struct indexer_queue_user *user;
 	struct indexer_request *request, *next;
 	bool single_mailbox =
 		mailbox_mask != NULL && wildcard_is_literal(mailbox_mask);
 
 	if (single_mailbox)
 		request = indexer_queue_lookup(queue, username, mailbox_mask);
-	else
-		request = hash_table_lookup(queue->users, username);
+	else {
+		user = hash_table_lookup(queue->users, username);
+		request = user == NULL ? NULL : user->requests;
+	}
 
 	while (request != NULL) {
 		next = request->user_next;
@@ -316,8 +660,11 @@ void indexer_queue_cancel(struct indexer_queue *queue, const char *username,
 		} else if (request->working) {
 			/* Can't remove a request that is being worked on,
 			   but we can make sure it won't be added back to the
-			   queue. */
+			   queue. Its chunks that haven't been started yet
+			   can be removed. */
 			request->reindex_head = request->reindex_tail = FALSE;
+			if (request->chunks_pending > 0)
+				indexer_queue_request_cancel_chunks(queue, request);
 		} else {
 			indexer_queue_request_cancel(queue, &request);
 		}
@@ -327,6 +674,22 @@ void indexer_queue_cancel(struct indexer_queue *queue, const char *username,
 	}
 }
 
+static struct indexer_request *
+indexer_queue_first(struct indexer_queue *queue)
+{
+	struct indexer_queue_user_class *uclass;
+	unsigned int i;
+
+	for (i = 0; i < INDEXER_REQUEST_CLASS_COUNT; i++) {
+		uclass = queue->classes[i].head;
+		if (uclass != NULL) {
+			return uclass->chunk_head != NULL ?
+				uclass->chunk_head : uclass->head;
+		}
+	}
+	return NULL;
+}
+
 void indexer_queue_cancel_all(struct indexer_queue *queue)
 {
 	struct indexer_request *request;
@@ -336,17 +699,19 @@ void indexer_queue_cancel_all(struct indexer_queue *queue)
 	   (or are cancelled) we don't try to retry them (especially during
 	   deinit where it crashes) */
 	iter = hash_table_iterate_init(queue->requests);
-	while (hash_table_iterate(iter, queue->requests, &request, &request))
+	while (hash_table_iterate(iter, queue->requests, &request, &request)) {
 		request->reindex_head = request->reindex_tail = FALSE;
+		request->cancelled = TRUE;
+	}
 	hash_table_iterate_deinit(&iter);
 
-	while ((request = indexer_queue_request_peek(queue)) != NULL)
+	while ((request = indexer_queue_first(queue)) != NULL)
 		indexer_queue_request_cancel(queue, &request);
 }
 
 bool indexer_queue_is_empty(struct indexer_queue *queue)
 {
-	return queue->head == NULL;
+	return queue->queued_count == 0;
 }
 
 unsigned int indexer_queue_count(struct indexer_queue *queue)
@@ -369,6 +734,23 @@ indexer_queue_iter_init(struct indexer_queue *queue, bool only_working)
 	return iter;
 }
 
+static void indexer_queue_iter_next_uclass(struct indexer_queue_iter *iter)
+{
+	/* go to the next user with queued requests in the class, or to the
+	   next class */
+	iter->uclass = iter->uclass == NULL ? NULL : iter->uclass->next;
+	while (iter->uclass == NULL &&
+	       iter->class < INDEXER_REQUEST_CLASS_COUNT)
+		iter->uclass = iter->queue->classes[iter->class++].head;
+
+	if (iter->uclass == NULL)
+		iter->next = NULL;
+	else if (iter->uclass->chunk_head != NULL)
+		iter->next = iter->uclass->chunk_head;
+	else
+		iter->next = iter->uclass->head;
+}
+
 struct indexer_request *indexer_queue_iter_next(struct indexer_queue_iter *iter)
 {
 	struct indexer_request *request;
@@ -383,11 +765,18 @@ struct indexer_request *indexer_queue_iter_next(struct indexer_queue_iter *iter)
 		hash_table_iterate_deinit(&iter->hash_iter);
 		if (iter->only_working)
 			return NULL;
-		iter->next = indexer_queue_request_peek(iter->queue);
+		indexer_queue_iter_next_uclass(iter);
 	}
 	request = iter->next;
-	if (request != NULL)
+	if (request == NULL)
+		return NULL;
+
+	if (request->next != NULL)
 		iter->next = request->next;
+	else if (request->parent != NULL && iter->uclass->head != NULL)
+		iter->next = iter->uclass->head;
+	else
+		indexer_queue_iter_next_uclass(iter);
 	return request;
 }
 
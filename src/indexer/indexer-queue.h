@@ -11,13 +11,29 @@ enum indexer_request_type {
 	INDEXER_REQUEST_TYPE_INDEX,
 	/* optimize the mailbox */
 	INDEXER_REQUEST_TYPE_OPTIMIZE,
+	/* index a UID range of the mailbox as a part of a split request */
+	INDEXER_REQUEST_TYPE_INDEX_CHUNK,
+};
+
+/* Scheduling classes in priority order. Requests of a higher class are
+   started first, unless a lower class has waited for too long. */
+enum indexer_request_class {
+	/* a client is waiting for the indexing to finish (PREPEND) */
+	INDEXER_REQUEST_CLASS_INTERACTIVE,
+	/* precaching new mails (APPEND) */
+	INDEXER_REQUEST_CLASS_PRECACHE,
+	/* optimizing */
+	INDEXER_REQUEST_CLASS_BACKGROUND,
+
+	INDEXER_REQUEST_CLASS_COUNT
 };
 
 struct indexer_request {
-	/* Linked list of all requests - highest priority first */
+	/* Linked list of the user's queued requests in the same class */
 	struct indexer_request *prev, *next;
 	/* Linked list of the same username's requests */
 	struct indexer_request *user_prev, *user_next;
+	struct indexer_queue_user *user;
 
 	char *username;
 	char *mailbox;
@@ -25,6 +41,25 @@ struct indexer_request {
 	unsigned int max_recent_msgs;
 
 	enum indexer_request_type type;
+	enum indexer_request_class class;
+	/* class of the reindexing */
+	enum indexer_request_class reindex_class;
+	/* when the request was queued / started */
+	struct timeval queued_time, work_time;
+
+	/* INDEXER_REQUEST_TYPE_INDEX_CHUNK: The request that was split into
+	   chunks. The username, mailbox and session_id are shared with it.
+	   Chunks exist only in the queue, not in the requests hash. */
+	struct indexer_request *parent;
+	/* <set>:<index>:<count> */
+	char *chunk_id;
+	uint32_t chunk_first_uid, chunk_last_uid;
+	unsigned int chunk_progress, chunk_total;
+
+	/* Split request: Number of chunks not finished yet, including the
+	   worker that split the request. */
+	unsigned int chunks_pending;
+	unsigned int chunks_progress, chunks_total;
 
 	/* currently indexing this mailbox */
 	bool working:1;
@@ -33,6 +68,13 @@ struct indexer_request {
 	   working.) */
 	bool reindex_head:1;
 	bool reindex_tail:1;
+	/* the request must not be split into chunks (splitting failed
+	   earlier) */
+	bool no_split:1;
+	/* some of the chunks failed */
+	bool chunks_failed:1;
+	/* the request was cancelled while its chunks were being indexed */
+	bool cancelled:1;
 
 	/* when working finished, call this number of contexts and leave the
 	   rest to the reindexing. */
@@ -65,7 +107,11 @@ void indexer_queue_cancel_all(struct indexer_queue *queue);
 bool indexer_queue_is_empty(struct indexer_queue *queue);
 unsigned int indexer_queue_count(struct indexer_queue *queue);
 
-/* Return the next request from the queue, without removing it. */
+/* Return the next request that can be started, without removing it from the
+   queue. The highest class is preferred, and the users within the class are
+   served round-robin. A user's requests are indexed one at a time, except
+   for the chunks of a split request. Returns NULL if all the queued requests
+   are waiting for their users' previous requests to finish. */
 struct indexer_request *indexer_queue_request_peek(struct indexer_queue *queue);
 /* Remove the next request from the queue. You must call
    indexer_queue_request_finish() to free its memory. */
@@ -74,8 +120,14 @@ void indexer_queue_request_remove(struct indexer_queue *queue);
 void indexer_queue_request_status(struct indexer_queue *queue,
 				  struct indexer_request *request,
 				  const struct indexer_status *status);
-/* Move the next request to the end of the queue. */
-void indexer_queue_move_head_to_tail(struct indexer_queue *queue);
+/* Split a request that is being worked on into chunks. The chunk is added
+   to the beginning of the queue, and the request is finished only after all
+   of its chunks are finished. If any of the chunks fail, the request is
+   retried without splitting. */
+void indexer_queue_request_add_chunk(struct indexer_queue *queue,
+				     struct indexer_request *request,
+				     const char *chunk_id,
+				     uint32_t first_uid, uint32_t last_uid);
 /* Start working on a request */
 void indexer_queue_request_work(struct indexer_request *request);
 /* Finish the request and free its memory. */
@@ -84,7 +136,7 @@ void indexer_queue_request_finish(struct indexer_queue *queue,
 				  enum indexer_state state);
 
 /* Iterate through all requests. First it returns the requests currently being
-   worked on, followed by the queued requests in the priority order. If
+   worked on, followed by the queued requests in the class order. If
    only_working=TRUE, return only the requests currently being worked on. */
 struct indexer_queue_iter *
 indexer_queue_iter_init(struct indexer_queue *queue, bool only_working);
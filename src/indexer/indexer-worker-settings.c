@@ -4,6 +4,7 @@
 #include "buffer.h"
 #include "settings-parser.h"
 #include "service-settings.h"
+#include "indexer-worker-settings.h"
 
 struct service_settings indexer_worker_service_settings = {
 	.name = "indexer-worker",
@@ -40,3 +41,27 @@ const struct setting_keyvalue indexer_worker_service_settings_defaults[] = {
 
 	{ NULL, NULL }
 };
+
+#undef DEF
+#define DEF(type, name) \
+	SETTING_DEFINE_STRUCT_##type(#name, name, struct indexer_worker_settings)
+
+static const struct setting_define indexer_worker_setting_defines[] = {
+	DEF(UINT, indexer_worker_parallel_min_messages),
+
+	SETTING_DEFINE_LIST_END
+};
+
+static const struct indexer_worker_settings indexer_worker_default_settings = {
+	.indexer_worker_parallel_min_messages = 0,
+};
+
+const struct setting_parser_info indexer_worker_setting_parser_info = {
+	.name = "indexer_worker",
+
+	.defines = indexer_worker_setting_defines,
+	.defaults = &indexer_worker_default_settings,
+
+	.struct_size = sizeof(struct indexer_worker_settings),
+	.pool_offset1 = 1 + offsetof(struct indexer_worker_settings, pool),
+};
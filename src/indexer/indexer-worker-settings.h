@@ -0,0 +1,13 @@
+#ifndef INDEXER_WORKER_SETTINGS_H
+#define INDEXER_WORKER_SETTINGS_H
+
+struct indexer_worker_settings {
+	pool_t pool;
+	/* Split indexing a mailbox into parallel chunks of at least this
+	   many messages. 0 = disabled. */
+	unsigned int indexer_worker_parallel_min_messages;
+};
+
+extern const struct setting_parser_info indexer_worker_setting_parser_info;
+
+#endif
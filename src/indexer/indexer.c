@@ -52,27 +52,12 @@ static bool worker_send_request(struct indexer_request *request)
 
 static void queue_try_send_more(struct indexer_queue *queue)
 {
-	struct worker_connection *worker;
-	struct indexer_request *request, *first_moved_request = NULL;
+	struct indexer_request *request;
 
+	/* The queue doesn't return requests for users that already have a
+	   request being worked on, except for the chunks of a split
+	   request. */
 	while ((request = indexer_queue_request_peek(queue)) != NULL) {
-		worker = worker_connections_find_user(request->username);
-		if (worker != NULL) {
-			/* There is already a connection handling a request
-			 * for this user. Move the request to the back of the
-			 * queue and handle requests from other users.
-			 * Terminate if we went through all requests. */
-			if (request == first_moved_request) {
-				/* all requests are waiting for existing users
-				   to finish. */
-				break;
-			}
-			if (first_moved_request == NULL)
-				first_moved_request = request;
-			indexer_queue_move_head_to_tail(queue);
-			continue;
-		}
-
 		/* create a new connection to a worker */
 		if (!worker_send_request(request))
 			break;
@@ -120,7 +105,7 @@ int main(int argc, char *argv[])
 
 	queue = indexer_queue_init(indexer_client_status_callback);
 	indexer_queue_set_listen_callback(queue, queue_listen_callback);
-	worker_connections_init();
+	worker_connections_init(queue);
 	master_service_init_finish(master_service);
 
 	master_service_run(master_service, client_connected);
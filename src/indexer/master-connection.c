@@ -2,9 +2,11 @@
 
 #include "lib.h"
 #include "connection.h"
+#include "guid.h"
 #include "ioloop.h"
 #include "istream.h"
 #include "ostream.h"
+#include "str.h"
 #include "strescape.h"
 #include "hostpid.h"
 #include "process-title.h"
@@ -14,13 +16,15 @@
 #include "mail-storage-private.h"
 #include "mail-storage-service.h"
 #include "mail-search-build.h"
+#include "settings.h"
 #include "master-connection.h"
 #include "indexer.h"
+#include "indexer-worker-settings.h"
 
 #include <unistd.h>
 
 #define INDEXER_PROTOCOL_MAJOR_VERSION 1
-#define INDEXER_PROTOCOL_MINOR_VERSION 0
+#define INDEXER_PROTOCOL_MINOR_VERSION 1
 
 #define INDEXER_MASTER_NAME "indexer-master-worker"
 #define INDEXER_WORKER_NAME "indexer-worker-master"
@@ -33,6 +37,12 @@ struct master_connection {
 	struct connection conn;
 	struct mail_storage_service_ctx *storage_service;
 
+	/* Current request: The mailbox can be split into this many chunks */
+	unsigned int max_chunks;
+	/* Current request: Index only this chunk's UID range */
+	const char *chunk_id;
+	uint32_t chunk_first_uid, chunk_last_uid;
+
 	bool version_received:1;
 };
 
@@ -77,6 +87,7 @@ index_mailbox_precache_real(struct master_connection *conn, struct mailbox *box)
 	struct mail_search_context *ctx;
 	struct mail *mail;
 	struct mailbox_metadata metadata;
+	uint32_t seq1 = 0, seq2 = 0;
 	int ret = 0;
 	struct event *index_event = event_create(box->event);
 	event_add_category(index_event, &event_category_indexer_worker);
@@ -89,7 +100,30 @@ index_mailbox_precache_real(struct master_connection *conn, struct mailbox *box)
 		return -1;
 	}
 
-	if (status.fts_last_indexed_uid >= status.uidnext - 1) {
+	if (conn->chunk_id != NULL) {
+		/* parallel indexing: the chunk's UID range */
+		mailbox_get_seq_range(box, conn->chunk_first_uid,
+				      conn->chunk_last_uid, &seq1, &seq2);
+		if (seq1 == 0) {
+			/* All of the chunk's mails were expunged. Committing
+			   the indexing transaction without any mails finishes
+			   it as an empty chunk. */
+			e_debug(index_event, "Chunk %s UIDs %u..%u are expunged",
+				conn->chunk_id, conn->chunk_first_uid,
+				conn->chunk_last_uid);
+			trans = mailbox_transaction_begin(box,
+					MAILBOX_TRANSACTION_FLAG_NO_CACHE_DEC,
+					"indexing");
+			if (mailbox_transaction_commit(&trans) < 0) {
+				e_error(index_event,
+					"Transaction commit failed: %s",
+					mailbox_get_last_internal_error(box, NULL));
+				ret = -1;
+			}
+			event_unref(&index_event);
+			return ret;
+		}
+	} else if (status.fts_last_indexed_uid >= status.uidnext - 1) {
 		e_debug(index_event,
 			"Index is already up to date "
 			"(last_indexed_uid=%u, uidnext=%u)",
@@ -105,16 +139,21 @@ index_mailbox_precache_real(struct master_connection *conn, struct mailbox *box)
 		event_unref(&index_event);
 		return -1;
 	}
-	uint32_t seq = 0, unused ATTR_UNUSED;
-	if (status.fts_last_indexed_uid > 0)
-		mailbox_get_seq_range(box, 1, status.fts_last_indexed_uid,
-				      &unused, &seq);
-	seq++;
+	if (conn->chunk_id == NULL) {
+		uint32_t unused ATTR_UNUSED;
+
+		seq2 = 0;
+		if (status.fts_last_indexed_uid > 0)
+			mailbox_get_seq_range(box, 1, status.fts_last_indexed_uid,
+					      &unused, &seq2);
+		seq1 = seq2 + 1;
+		seq2 = status.messages;
+	}
 
 	trans = mailbox_transaction_begin(box, MAILBOX_TRANSACTION_FLAG_NO_CACHE_DEC,
 					  "indexing");
 	search_args = mail_search_build_init();
-	mail_search_build_add_seqset(search_args, seq, status.messages);
+	mail_search_build_add_seqset(search_args, seq1, seq2);
 
 	event_enable_user_cpu_usecs(index_event);
 
@@ -128,7 +167,7 @@ index_mailbox_precache_real(struct master_connection *conn, struct mailbox *box)
 	uint32_t first_uid = 0, last_uid = 0;
 	unsigned int counter = 0;
 	unsigned int percentage_sent = 0;
-	unsigned int goal = status.messages + 1 - seq;
+	unsigned int goal = seq2 + 1 - seq1;
 	while (mailbox_search_next(ctx, &mail)) {
 		if (first_uid == 0)
 			first_uid = mail->uid;
@@ -176,7 +215,10 @@ index_mailbox_precache_real(struct master_connection *conn, struct mailbox *box)
 	event_add_int(index_event, "last_uid", last_uid);
 
 #define FINISHED_EVENT_NAME "indexer_worker_indexing_finished"
-	if (mailbox_transaction_commit(&trans) < 0) {
+	if (ret < 0 && conn->chunk_id != NULL) {
+		/* a partially indexed chunk must not be published */
+		mailbox_transaction_rollback(&trans);
+	} else if (mailbox_transaction_commit(&trans) < 0) {
 		struct event_passthrough *e = event_create_passthrough(index_event)->
 			set_name(FINISHED_EVENT_NAME);
 		errstr = t_strdup_printf("Transaction commit failed: %s",
@@ -198,6 +240,70 @@ index_mailbox_precache_real(struct master_connection *conn, struct mailbox *box)
 	return ret;
 }
 
+static int
+index_mailbox_split(struct master_connection *conn, struct mailbox *box)
+{
+	const struct indexer_worker_settings *set;
+	struct mailbox_status status;
+	const char *error;
+	uint32_t seq, unused ATTR_UNUSED, uid1, uid2;
+	unsigned int i, missing, count;
+	guid_128_t set_guid;
+
+	if (settings_get(box->event, &indexer_worker_setting_parser_info, 0,
+			 &set, &error) < 0) {
+		e_error(box->event, "%s", error);
+		return -1;
+	}
+	unsigned int min_messages = set->indexer_worker_parallel_min_messages;
+	settings_free(set);
+	if (min_messages == 0)
+		return 0;
+
+	if (mailbox_get_status(box, STATUS_MESSAGES | STATUS_FTS_LAST_INDEXED_UID,
+			       &status) < 0) {
+		e_error(box->event, "Status lookup failed: %s",
+			mailbox_get_last_internal_error(box, NULL));
+		return -1;
+	}
+	if (!status.fts_index_chunks) {
+		/* FTS isn't enabled or its backend can't index in chunks */
+		return 0;
+	}
+	seq = 0;
+	if (status.fts_last_indexed_uid > 0) {
+		mailbox_get_seq_range(box, 1, status.fts_last_indexed_uid,
+				      &unused, &seq);
+	}
+	missing = status.messages - seq;
+	count = I_MIN(conn->max_chunks, missing / min_messages);
+	if (count < 2)
+		return 0;
+
+	/* Let the indexer send the chunks to different workers */
+	guid_128_generate(set_guid);
+	string_t *str = t_str_new(128);
+	str_printfa(str, "split\t%s", guid_128_to_string(set_guid));
+	for (i = 0; i < count; i++) {
+		mail_index_lookup_uid(box->view,
+				      seq + 1 + (uint64_t)missing * i / count,
+				      &uid1);
+		mail_index_lookup_uid(box->view,
+				      seq + (uint64_t)missing * (i + 1) / count,
+				      &uid2);
+		str_printfa(str, "\t%u:%u", uid1, uid2);
+	}
+	str_append_c(str, '\n');
+	o_stream_nsend(conn->conn.output, str_data(str), str_len(str));
+
+	e_debug(event_create_passthrough(box->event)->
+		set_name("indexer_worker_indexing_split")->
+		add_int("message_count", missing)->
+		add_int("chunk_count", count)->event(),
+		"Split indexing %u messages into %u chunks", missing, count);
+	return 1;
+}
+
 static int
 index_mailbox_precache(struct master_connection *conn, struct mailbox *box);
 
@@ -285,7 +391,14 @@ index_mailbox(struct master_connection *conn, struct mail_user *user,
 		}
 		ret = -1;
 	} else if (strchr(what, 'i') != NULL) {
-		if (index_mailbox_precache(conn, box) < 0)
+		if (conn->max_chunks > 1 && box->virtual_vfuncs == NULL)
+			ret = index_mailbox_split(conn, box);
+		if (ret == 0 && index_mailbox_precache(conn, box) < 0)
+			ret = -1;
+		else if (ret > 0)
+			ret = 0;
+	} else if (strchr(what, 'c') != NULL) {
+		if (index_mailbox_precache_real(conn, box) < 0)
 			ret = -1;
 	}
 	mailbox_free(&box);
@@ -300,6 +413,7 @@ master_connection_cmd_index(struct master_connection *conn,
 {
 	struct mail_storage_service_input input;
 	struct mail_user *user;
+	const char *code_override_fields[2] = { NULL, NULL };
 	const char *error;
 	int ret;
 
@@ -312,6 +426,12 @@ master_connection_cmd_index(struct master_connection *conn,
 	   multiple users' indexing at the same time.) */
 	if (session_id[0] != '\0')
 		input.session_id_prefix = session_id;
+	if (conn->chunk_id != NULL) {
+		/* index the mails into the chunk's own FTS shard */
+		code_override_fields[0] =
+			t_strconcat("fts_index_chunk=", conn->chunk_id, NULL);
+		input.code_override_fields = code_override_fields;
+	}
 
 	if (mail_storage_service_lookup_next(conn->storage_service, &input,
 					     &user, &error) <= 0) {
@@ -352,16 +472,46 @@ master_connection_input_args(struct connection *_conn, const char *const *args)
 {
 	struct master_connection *conn =
 		container_of(_conn, struct master_connection, conn);
-	unsigned int max_recent_msgs;
+	unsigned int max_recent_msgs, args_count = str_array_length(args);
+	const char *p;
 	int ret;
 
-	/* <username> <mailbox> <session ID> <max_recent_msgs> [i][o] */
-	if (str_array_length(args) != 5 ||
+	/* <username> <mailbox> <session ID> <max_recent_msgs> [i][o]
+	   [<max chunks>], or
+	   <username> <mailbox> <session ID> <max_recent_msgs> c
+	   <first uid>:<last uid> <chunk ID> */
+	conn->max_chunks = 0;
+	conn->chunk_id = NULL;
+	if (args_count < 5 || args_count > 7 ||
 	    str_to_uint(args[3], &max_recent_msgs) < 0 || args[4][0] == '\0') {
 		e_error(conn->conn.event, "Invalid input from master: %s",
 			t_strarray_join(args, "\t"));
 		return -1;
 	}
+	if (strcmp(args[4], "c") == 0) {
+		if (args_count != 7 || args[6][0] == '\0' ||
+		    (p = strchr(args[5], ':')) == NULL ||
+		    str_to_uint32(t_strdup_until(args[5], p),
+				  &conn->chunk_first_uid) < 0 ||
+		    str_to_uint32(p + 1, &conn->chunk_last_uid) < 0 ||
+		    conn->chunk_first_uid == 0 ||
+		    conn->chunk_first_uid > conn->chunk_last_uid) {
+			e_error(conn->conn.event, "Invalid chunk input from master: %s",
+				t_strarray_join(args, "\t"));
+			return -1;
+		}
+		conn->chunk_id = args[6];
+	} else if (args_count == 6) {
+		if (str_to_uint(args[5], &conn->max_chunks) < 0) {
+			e_error(conn->conn.event, "Invalid input from master: %s",
+				t_strarray_join(args, "\t"));
+			return -1;
+		}
+	} else if (args_count != 5) {
+		e_error(conn->conn.event, "Invalid input from master: %s",
+			t_strarray_join(args, "\t"));
+		return -1;
+	}
 	const char *username = args[0];
 	const char *mailbox = args[1];
 	const char *session_id = args[2];
@@ -369,6 +519,7 @@ master_connection_input_args(struct connection *_conn, const char *const *args)
 
 	ret = master_connection_cmd_index(conn, username, mailbox, session_id,
 					  max_recent_msgs, what);
+	conn->chunk_id = NULL;
 
 	const char *str = t_strdup_printf("%d\n",
 		ret < 0 ? INDEXER_STATE_FAILED: INDEXER_STATE_COMPLETED);
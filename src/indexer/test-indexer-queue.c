@@ -1,15 +1,100 @@
 /* Copyright (c) 2022 Dovecot authors, see the included COPYING file */
 
 #include "lib.h"
+#include "ioloop.h"
+#include "str.h"
+#include "lib-event-private.h"
+#include "event-filter.h"
 #include "test-common.h"
 #include "indexer-queue.h"
 
 void indexer_refresh_proctitle(void) { }
 
+struct test_indexer_status {
+	enum indexer_state last_state;
+	unsigned int progress, total;
+	unsigned int finish_count;
+};
+
 static void
-indexer_queue_status_callback(const struct indexer_status *status ATTR_UNUSED,
-			      void *context ATTR_UNUSED)
+indexer_queue_status_callback(const struct indexer_status *status,
+			      void *context)
+{
+	struct test_indexer_status *test_status = context;
+
+	if (test_status == NULL)
+		return;
+	test_status->last_state = status->state;
+	test_status->progress = status->progress;
+	test_status->total = status->total;
+	if (status->state != INDEXER_STATE_PROCESSING)
+		test_status->finish_count++;
+}
+
+static unsigned int test_finished_events[2];
+static unsigned int test_finished_failures;
+
+static bool
+test_indexer_queue_finished_callback(struct event *event,
+				     enum event_callback_type type,
+				     struct failure_context *ctx ATTR_UNUSED,
+				     const char *fmt ATTR_UNUSED,
+				     va_list args ATTR_UNUSED)
 {
+	const char *chunk, *success;
+
+	if (type != EVENT_CALLBACK_TYPE_SEND ||
+	    strcmp(event->sending_name, "indexer_request_finished") != 0)
+		return TRUE;
+
+	chunk = event_find_field_recursive_str(event, "chunk");
+	success = event_find_field_recursive_str(event, "success");
+	test_assert(chunk != NULL && success != NULL);
+	if (chunk == NULL || success == NULL)
+		return TRUE;
+	test_finished_events[strcmp(chunk, "yes") == 0 ? 1 : 0]++;
+	if (strcmp(success, "yes") != 0)
+		test_finished_failures++;
+	return TRUE;
+}
+
+static void test_indexer_queue_finished_events_init(void)
+{
+	struct event_filter *filter;
+	const char *error;
+
+	i_zero(&test_finished_events);
+	test_finished_failures = 0;
+	event_register_callback(test_indexer_queue_finished_callback);
+	filter = event_filter_create();
+	test_assert(event_filter_parse("event=indexer_request_finished",
+				       filter, &error) == 0);
+	event_set_global_debug_log_filter(filter);
+	event_filter_unref(&filter);
+}
+
+static void test_indexer_queue_finished_events_deinit(void)
+{
+	event_unset_global_debug_log_filter();
+	event_unregister_callback(test_indexer_queue_finished_callback);
+}
+
+static const char *test_indexer_queue_get_queued(struct indexer_queue *queue)
+{
+	struct indexer_queue_iter *iter;
+	struct indexer_request *request;
+	string_t *str = t_str_new(64);
+
+	iter = indexer_queue_iter_init(queue, FALSE);
+	while ((request = indexer_queue_iter_next(iter)) != NULL) {
+		if (request->working)
+			continue;
+		if (str_len(str) > 0)
+			str_append_c(str, ',');
+		str_append(str, request->mailbox);
+	}
+	indexer_queue_iter_deinit(&iter);
+	return str_c(str);
 }
 
 static void test_indexer_queue(void)
@@ -25,20 +110,15 @@ static void test_indexer_queue(void)
 	indexer_queue_append(queue, FALSE, "user2", "mailbox2", "session2", 0, NULL);
 	indexer_queue_append(queue, FALSE, "user1", "mailbox1", "session1", 0, NULL);
 
-	request = indexer_queue_request_peek(queue);
-	test_assert_strcmp(request->username, "user1");
-	test_assert_strcmp(request->mailbox, "mailbox1");
-
-	indexer_queue_move_head_to_tail(queue);
-
+	/* prepended requests go first, the latest one first */
 	struct {
 		const char *username;
 		const char *mailbox;
 	} expected[] = {
+		{ "user1", "mailbox1" },
 		{ "user2", "mailbox2" },
 		{ "user2", "mailbox3" },
 		{ "user1", "mailbox4" },
-		{ "user1", "mailbox1" },
 	};
 	for (unsigned int i = 0; i < N_ELEMENTS(expected); i++) {
 		request = indexer_queue_request_peek(queue);
@@ -157,16 +237,12 @@ static void test_indexer_queue_cancel(void)
 
 	/* cancel user1's all requests */
 	indexer_queue_cancel(queue, "user1", NULL);
-	request = indexer_queue_request_peek(queue);
-	test_assert_strcmp(request->mailbox, "mailbox2");
-	test_assert_strcmp(request->next->mailbox, "mailbox3");
-	test_assert(request->next->next == NULL);
+	test_assert_strcmp(test_indexer_queue_get_queued(queue),
+			   "mailbox2,mailbox3");
 
 	/* cancel user2's requests one by one */
 	indexer_queue_cancel(queue, "user2", "mailbox2");
-	request = indexer_queue_request_peek(queue);
-	test_assert_strcmp(request->mailbox, "mailbox3");
-	test_assert(request->next == NULL);
+	test_assert_strcmp(test_indexer_queue_get_queued(queue), "mailbox3");
 
 	indexer_queue_cancel(queue, "user2", "mailbox3");
 	test_assert(indexer_queue_request_peek(queue) == NULL);
@@ -232,9 +308,12 @@ static void test_indexer_queue_iter(void)
 	test_assert((iter_request1 == request1 && iter_request2 == request2) ||
 		    (iter_request1 == request2 && iter_request2 == request1));
 
-	request = indexer_queue_request_peek(queue);
-	test_assert(indexer_queue_iter_next(iter) == request);
-	test_assert(indexer_queue_iter_next(iter) == request->next);
+	/* the queued requests wait for their users' requests to finish */
+	test_assert(indexer_queue_request_peek(queue) == NULL);
+	request = indexer_queue_iter_next(iter);
+	test_assert(request != NULL && strcmp(request->mailbox, "mailbox3") == 0);
+	request = indexer_queue_iter_next(iter);
+	test_assert(request != NULL && strcmp(request->mailbox, "mailbox4") == 0);
 	test_assert(indexer_queue_iter_next(iter) == NULL);
 	indexer_queue_iter_deinit(&iter);
 
@@ -258,6 +337,268 @@ static void test_indexer_queue_iter(void)
 	test_end();
 }
 
+static const char *
+test_indexer_queue_run(struct indexer_queue *queue, unsigned int count)
+{
+	struct indexer_request *request;
+	string_t *str = t_str_new(64);
+
+	/* start and finish requests one at a time */
+	while (count-- > 0 &&
+	       (request = indexer_queue_request_peek(queue)) != NULL) {
+		if (str_len(str) > 0)
+			str_append_c(str, ',');
+		str_append(str, request->mailbox);
+		indexer_queue_request_remove(queue);
+		indexer_queue_request_work(request);
+		indexer_queue_request_finish(queue, &request,
+					     INDEXER_STATE_COMPLETED);
+	}
+	return str_c(str);
+}
+
+static void test_indexer_queue_fairness(void)
+{
+	struct indexer_queue *queue;
+
+	test_begin("indexer queue fairness");
+	queue = indexer_queue_init(indexer_queue_status_callback);
+
+	/* users are served round-robin within the class */
+	indexer_queue_append(queue, TRUE, "user1", "box1a", "session1", 0, NULL);
+	indexer_queue_append(queue, TRUE, "user1", "box1b", "session1", 0, NULL);
+	indexer_queue_append(queue, TRUE, "user1", "box1c", "session1", 0, NULL);
+	indexer_queue_append(queue, TRUE, "user2", "box2a", "session2", 0, NULL);
+	indexer_queue_append(queue, TRUE, "user2", "box2b", "session2", 0, NULL);
+	indexer_queue_append(queue, TRUE, "user3", "box3a", "session3", 0, NULL);
+	test_assert_strcmp(test_indexer_queue_run(queue, 3),
+			   "box1a,box2a,box3a");
+	indexer_queue_append(queue, TRUE, "user4", "box4a", "session4", 0, NULL);
+	test_assert_strcmp(test_indexer_queue_run(queue, UINT_MAX),
+			   "box1b,box2b,box4a,box1c");
+
+	/* a user's requests are started one at a time */
+	struct indexer_request *request;
+	indexer_queue_append(queue, TRUE, "user1", "box1a", "session1", 0, NULL);
+	indexer_queue_append(queue, TRUE, "user1", "box1b", "session1", 0, NULL);
+	request = indexer_queue_request_peek(queue);
+	indexer_queue_request_remove(queue);
+	indexer_queue_request_work(request);
+	test_assert(indexer_queue_request_peek(queue) == NULL);
+	test_assert(!indexer_queue_is_empty(queue));
+	indexer_queue_request_finish(queue, &request, INDEXER_STATE_COMPLETED);
+	test_assert_strcmp(test_indexer_queue_run(queue, UINT_MAX), "box1b");
+	test_assert(indexer_queue_is_empty(queue));
+
+	indexer_queue_deinit(&queue);
+	test_end();
+}
+
+static void test_indexer_queue_classes(void)
+{
+	struct indexer_queue *queue;
+	time_t orig_ioloop_time = ioloop_time;
+
+	test_begin("indexer queue classes");
+	queue = indexer_queue_init(indexer_queue_status_callback);
+	ioloop_time = 1000;
+
+	indexer_queue_append_optimize(queue, "user1", "optimize", NULL);
+	indexer_queue_append(queue, TRUE, "user2", "precache", "session2", 0, NULL);
+	indexer_queue_append(queue, FALSE, "user3", "search", "session3", 0, NULL);
+	test_assert_strcmp(test_indexer_queue_run(queue, UINT_MAX),
+			   "search,precache,optimize");
+
+	/* an appended request moves to a higher class when prepended */
+	indexer_queue_append(queue, TRUE, "user1", "box1", "session1", 0, NULL);
+	indexer_queue_append(queue, TRUE, "user2", "box2", "session2", 0, NULL);
+	indexer_queue_append(queue, FALSE, "user2", "box2", "session2", 0, NULL);
+	test_assert_strcmp(test_indexer_queue_run(queue, UINT_MAX), "box2,box1");
+
+	/* a lower class isn't starved by a higher class */
+	indexer_queue_append(queue, TRUE, "user1", "precache1", "session1", 0, NULL);
+	indexer_queue_append(queue, TRUE, "user1", "precache2", "session1", 0, NULL);
+	for (unsigned int i = 0; i < 4; i++) {
+		indexer_queue_append(queue, FALSE, t_strdup_printf("user%u", i + 2),
+				     "search", "session", 0, NULL);
+	}
+	test_assert_strcmp(test_indexer_queue_run(queue, 1), "search");
+	ioloop_time += 10;
+	test_assert_strcmp(test_indexer_queue_run(queue, 3),
+			   "precache1,search,search");
+	ioloop_time += 10;
+	test_assert_strcmp(test_indexer_queue_run(queue, UINT_MAX),
+			   "precache2,search");
+
+	ioloop_time = orig_ioloop_time;
+	indexer_queue_deinit(&queue);
+	test_end();
+}
+
+static void
+test_indexer_queue_split_init(struct indexer_queue *queue,
+			      struct test_indexer_status *status,
+			      struct indexer_request **request_r)
+{
+	struct indexer_request *request;
+
+	i_zero(status);
+	indexer_queue_append(queue, TRUE, "user1", "mailbox1", "session1", 0,
+			     status);
+	request = indexer_queue_request_peek(queue);
+	indexer_queue_request_remove(queue);
+	indexer_queue_request_work(request);
+
+	indexer_queue_request_add_chunk(queue, request, "set:0:3", 1, 100);
+	indexer_queue_request_add_chunk(queue, request, "set:1:3", 101, 200);
+	indexer_queue_request_add_chunk(queue, request, "set:2:3", 201, 300);
+	*request_r = request;
+}
+
+static void test_indexer_queue_split(void)
+{
+	struct indexer_queue *queue;
+	struct indexer_request *request, *parent, *chunks[3];
+	struct test_indexer_status status;
+	unsigned int i;
+
+	test_begin("indexer queue split");
+	queue = indexer_queue_init(indexer_queue_status_callback);
+	test_indexer_queue_split_init(queue, &status, &parent);
+	indexer_queue_append(queue, TRUE, "user1", "mailbox2", "session2", 0, NULL);
+
+	/* the chunks are queued before other requests, but they don't show
+	   up as separate requests */
+	test_assert(indexer_queue_count(queue) == 2);
+	for (i = 0; i < N_ELEMENTS(chunks); i++) {
+		chunks[i] = indexer_queue_request_peek(queue);
+		test_assert_idx(chunks[i]->type == INDEXER_REQUEST_TYPE_INDEX_CHUNK, i);
+		test_assert_idx(chunks[i]->parent == parent, i);
+		test_assert_strcmp_idx(chunks[i]->mailbox, "mailbox1", i);
+		indexer_queue_request_remove(queue);
+		indexer_queue_request_work(chunks[i]);
+	}
+	test_assert(chunks[2]->chunk_first_uid == 201 &&
+		    chunks[2]->chunk_last_uid == 300);
+	test_assert_strcmp(chunks[2]->chunk_id, "set:2:3");
+	/* user1 is still busy with the parent request */
+	test_assert(indexer_queue_request_peek(queue) == NULL);
+
+	/* the parent isn't finished by the worker that split it */
+	indexer_queue_request_finish(queue, &parent, INDEXER_STATE_COMPLETED);
+	test_assert(status.finish_count == 0);
+	parent = chunks[0]->parent;
+	test_assert(parent->working);
+
+	/* the chunks' progress is reported together */
+	struct indexer_status chunk_status = {
+		.state = INDEXER_STATE_PROCESSING,
+		.progress = 10,
+		.total = 100,
+	};
+	indexer_queue_request_status(queue, chunks[0], &chunk_status);
+	chunk_status.progress = 20;
+	indexer_queue_request_status(queue, chunks[1], &chunk_status);
+	chunk_status.progress = 30;
+	indexer_queue_request_status(queue, chunks[0], &chunk_status);
+	test_assert(status.last_state == INDEXER_STATE_PROCESSING);
+	test_assert(status.progress == 50 && status.total == 200);
+
+	for (i = 0; i < N_ELEMENTS(chunks); i++) {
+		test_assert_idx(status.finish_count == 0, i);
+		indexer_queue_request_finish(queue, &chunks[i],
+					     INDEXER_STATE_COMPLETED);
+	}
+	test_assert(status.finish_count == 1);
+	test_assert(status.last_state == INDEXER_STATE_COMPLETED);
+	test_assert(indexer_queue_count(queue) == 1);
+	request = indexer_queue_request_peek(queue);
+	test_assert(request != NULL && strcmp(request->mailbox, "mailbox2") == 0);
+
+	indexer_queue_cancel_all(queue);
+	indexer_queue_deinit(&queue);
+	test_end();
+}
+
+static void test_indexer_queue_split_failure(void)
+{
+	struct indexer_queue *queue;
+	struct indexer_request *request, *parent;
+	struct test_indexer_status status;
+	unsigned int i;
+
+	test_begin("indexer queue split failure");
+	test_indexer_queue_finished_events_init();
+	queue = indexer_queue_init(indexer_queue_status_callback);
+	test_indexer_queue_split_init(queue, &status, &parent);
+	indexer_queue_request_finish(queue, &parent, INDEXER_STATE_COMPLETED);
+
+	for (i = 0; i < 3; i++) {
+		request = indexer_queue_request_peek(queue);
+		indexer_queue_request_remove(queue);
+		indexer_queue_request_work(request);
+		indexer_queue_request_finish(queue, &request, i == 1 ?
+			INDEXER_STATE_FAILED : INDEXER_STATE_COMPLETED);
+	}
+
+	/* a failed chunk retries the whole request without splitting */
+	test_assert(status.finish_count == 0);
+	/* the parent's event is sent only once after all of its chunks */
+	test_assert(test_finished_events[0] == 1);
+	test_assert(test_finished_events[1] == 3);
+	test_assert(test_finished_failures == 2);
+	request = indexer_queue_request_peek(queue);
+	test_assert(request->type == INDEXER_REQUEST_TYPE_INDEX);
+	test_assert(request->no_split);
+	test_assert(!request->working);
+	test_assert(request->next == NULL);
+
+	indexer_queue_request_remove(queue);
+	indexer_queue_request_work(request);
+	indexer_queue_request_finish(queue, &request, INDEXER_STATE_COMPLETED);
+	test_assert(status.finish_count == 1);
+	test_assert(status.last_state == INDEXER_STATE_COMPLETED);
+	test_assert(indexer_queue_count(queue) == 0);
+	test_assert(test_finished_events[0] == 2);
+	test_assert(test_finished_failures == 2);
+
+	indexer_queue_deinit(&queue);
+	test_indexer_queue_finished_events_deinit();
+	test_end();
+}
+
+static void test_indexer_queue_split_cancel(void)
+{
+	struct indexer_queue *queue;
+	struct indexer_request *request, *parent;
+	struct test_indexer_status status;
+
+	test_begin("indexer queue split cancel");
+	queue = indexer_queue_init(indexer_queue_status_callback);
+	test_indexer_queue_split_init(queue, &status, &parent);
+
+	/* one chunk is being worked on */
+	request = indexer_queue_request_peek(queue);
+	indexer_queue_request_remove(queue);
+	indexer_queue_request_work(request);
+
+	/* the queued chunks are removed */
+	indexer_queue_cancel(queue, "user1", NULL);
+	test_assert(indexer_queue_request_peek(queue) == NULL);
+	test_assert(status.finish_count == 0);
+
+	indexer_queue_request_finish(queue, &parent, INDEXER_STATE_COMPLETED);
+	test_assert(status.finish_count == 0);
+	indexer_queue_request_finish(queue, &request, INDEXER_STATE_COMPLETED);
+	test_assert(status.finish_count == 1);
+	test_assert(status.last_state == INDEXER_STATE_FAILED);
+	test_assert(indexer_queue_request_peek(queue) == NULL);
+	test_assert(indexer_queue_count(queue) == 0);
+
+	indexer_queue_deinit(&queue);
+	test_end();
+}
+
 int main(void)
 {
 	static void (*const test_functions[])(void) = {
@@ -266,6 +607,11 @@ int main(void)
 		test_indexer_queue_reindex,
 		test_indexer_queue_cancel,
 		test_indexer_queue_iter,
+		test_indexer_queue_fairness,
+		test_indexer_queue_classes,
+		test_indexer_queue_split,
+		test_indexer_queue_split_failure,
+		test_indexer_queue_split_cancel,
 		NULL
 	};
 	return test_run(test_functions);
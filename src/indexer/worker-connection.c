@@ -17,7 +17,7 @@
 #include <unistd.h>
 
 #define INDEXER_PROTOCOL_MAJOR_VERSION 1
-#define INDEXER_PROTOCOL_MINOR_VERSION 0
+#define INDEXER_PROTOCOL_MINOR_VERSION 1
 
 #define INDEXER_MASTER_NAME "indexer-master-worker"
 #define INDEXER_WORKER_NAME "indexer-worker-master"
@@ -29,12 +29,12 @@ struct worker_connection {
 	worker_available_callback_t *avail_callback;
 
 	pid_t pid;
-	char *request_username;
 	struct indexer_request *request;
 };
 
 static unsigned int worker_last_process_limit = 0;
 static struct connection_list *worker_connections;
+static struct indexer_queue *indexer_queue;
 
 static void worker_connection_call_callback(struct worker_connection *worker,
 					    const struct indexer_status *status)
@@ -52,7 +52,6 @@ static void worker_connection_destroy(struct connection *conn)
 
 	struct indexer_status status = { .state = INDEXER_STATE_FAILED };
 	worker_connection_call_callback(worker, &status);
-	i_free_and_null(worker->request_username);
 	connection_deinit(conn);
 
 	worker->avail_callback();
@@ -92,6 +91,41 @@ worker_connection_handshake_args(struct connection *conn, const char *const *arg
 	return 1;
 }
 
+static int
+worker_connection_input_split(struct worker_connection *worker,
+			      const char *const *args)
+{
+	const char *set = args[0];
+	unsigned int i, count = str_array_length(args + 1);
+	uint32_t first_uid, last_uid;
+	const char *p;
+
+	/* split <set> <first uid>:<last uid> [...] */
+	if (worker->request == NULL ||
+	    worker->request->type != INDEXER_REQUEST_TYPE_INDEX ||
+	    set == NULL || set[0] == '\0' || count == 0) {
+		e_error(worker->conn.event, "Worker sent unexpected split");
+		return -1;
+	}
+	for (i = 0; i < count; i++) {
+		p = strchr(args[1 + i], ':');
+		if (p == NULL ||
+		    str_to_uint32(t_strdup_until(args[1 + i], p),
+				  &first_uid) < 0 ||
+		    str_to_uint32(p + 1, &last_uid) < 0 ||
+		    first_uid == 0 || first_uid > last_uid) {
+			e_error(worker->conn.event,
+				"Worker sent invalid split UID range '%s'",
+				args[1 + i]);
+			return -1;
+		}
+		indexer_queue_request_add_chunk(indexer_queue, worker->request,
+			t_strdup_printf("%s:%u:%u", set, i, count),
+			first_uid, last_uid);
+	}
+	return 1;
+}
+
 static int
 worker_connection_input_args(struct connection *conn, const char *const *args)
 {
@@ -101,6 +135,9 @@ worker_connection_input_args(struct connection *conn, const char *const *args)
 	int state;
 	int ret = 1;
 
+	if (strcmp(args[0], "split") == 0)
+		return worker_connection_input_split(worker, args + 1);
+
 	if (str_to_int(args[0], &state) < 0 ||
 	    state < INDEXER_STATE_FAILED || state > INDEXER_STATE_COMPLETED) {
 		e_error(conn->event, "Worker sent invalid state '%s'", args[0]);
@@ -139,7 +176,6 @@ static void
 worker_connection_send_request(struct worker_connection *worker,
 			       struct indexer_request *request)
 {
-	worker->request_username = i_strdup(request->username);
 	worker->request = request;
 
 	T_BEGIN {
@@ -155,10 +191,19 @@ worker_connection_send_request(struct worker_connection *worker,
 		switch (request->type) {
 		case INDEXER_REQUEST_TYPE_INDEX:
 			str_append_c(str, 'i');
+			/* allow the worker to split the request into this
+			   many chunks */
+			if (!request->no_split && worker_last_process_limit > 1)
+				str_printfa(str, "\t%u", worker_last_process_limit);
 			break;
 		case INDEXER_REQUEST_TYPE_OPTIMIZE:
 			str_append_c(str, 'o');
 			break;
+		case INDEXER_REQUEST_TYPE_INDEX_CHUNK:
+			str_printfa(str, "c\t%u:%u\t", request->chunk_first_uid,
+				    request->chunk_last_uid);
+			str_append_tabescaped(str, request->chunk_id);
+			break;
 		}
 		str_append_c(str, '\n');
 		o_stream_nsend(worker->conn.output, str_data(str), str_len(str));
@@ -181,8 +226,9 @@ static const struct connection_settings worker_connection_set = {
 	.client = TRUE,
 };
 
-void worker_connections_init(void)
+void worker_connections_init(struct indexer_queue *queue)
 {
+	indexer_queue = queue;
 	worker_connections =
 		connection_list_init(&worker_connection_set,
 				     &worker_connection_vfuncs);
@@ -222,17 +268,3 @@ unsigned int worker_connections_get_count(void)
 {
 	return worker_connections->connections_count;
 }
-
-struct worker_connection *worker_connections_find_user(const char *username)
-{
-	struct connection *conn;
-
-	for (conn = worker_connections->connections; conn != NULL; conn = conn->next) {
-		struct worker_connection *worker =
-			container_of(conn, struct worker_connection, conn);
-
-		if (strcmp(worker->request_username, username) == 0)
-			return worker;
-	}
-	return NULL;
-}
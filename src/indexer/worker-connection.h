@@ -3,8 +3,8 @@
 
 #include "indexer.h"
 
+struct indexer_queue;
 struct indexer_request;
-struct worker_connection;
 
 typedef void worker_available_callback_t(void);
 
@@ -18,9 +18,9 @@ int worker_connection_try_create(const char *socket_path,
 				 worker_available_callback_t *avail_callback);
 
 unsigned int worker_connections_get_count(void);
-struct worker_connection *worker_connections_find_user(const char *username);
 
-void worker_connections_init(void);
+/* Chunks of split requests are added to the given queue. */
+void worker_connections_init(struct indexer_queue *queue);
 void worker_connections_deinit(void);
 
 #endif
@@ -4,6 +4,9 @@
 #  include "config.h"
 #endif
 
+#ifdef HAVE_CRYPT_R
+#  define _GNU_SOURCE /* crypt_r() with older glibc */
+#endif
 #define _XOPEN_SOURCE 4
 #define _XOPEN_SOURCE_EXTENDED 1 /* 1 needed for AIX */
 #ifndef _AIX
@@ -13,6 +16,7 @@
 #ifdef CRYPT_USE_XPG6
 #  define _XPG6 /* Some Solaris versions require this, some break with this */
 #endif
+#include <stdlib.h>
 #include <unistd.h>
 #ifdef HAVE_CRYPT_H
 # include <crypt.h>
@@ -24,3 +28,28 @@ char *mycrypt(const char *key, const char *salt)
 {
 	return crypt(key, salt);
 }
+
+#ifdef HAVE_CRYPT_R
+struct mycrypt_data {
+	struct crypt_data data;
+};
+
+struct mycrypt_data *mycrypt_data_new(void)
+{
+	/* crypt_data must be zeroed before its first use */
+	return calloc(1, sizeof(struct mycrypt_data));
+}
+
+void mycrypt_data_free(struct mycrypt_data **_data)
+{
+	struct mycrypt_data *data = *_data;
+
+	*_data = NULL;
+	free(data);
+}
+
+char *mycrypt_r(const char *key, const char *salt, struct mycrypt_data *data)
+{
+	return crypt_r(key, salt, &data->data);
+}
+#endif
@@ -5,4 +5,14 @@
    _XOPEN_SOURCE define which breaks other things. */
 char *mycrypt(const char *key, const char *salt);
 
+#ifdef HAVE_CRYPT_R
+/* Reentrant version of mycrypt(). The returned string points to the data,
+   which must not be used by multiple threads at the same time. These don't
+   use any Dovecot lib functions, so they can be called from other threads.
+   mycrypt_data_new() returns NULL if out of memory. */
+struct mycrypt_data *mycrypt_data_new(void);
+void mycrypt_data_free(struct mycrypt_data **data);
+char *mycrypt_r(const char *key, const char *salt, struct mycrypt_data *data);
+#endif
+
 #endif
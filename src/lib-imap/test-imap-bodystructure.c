@@ -592,6 +592,50 @@ static void test_imap_bodystructure_parse_full(void)
 	} T_END;
 }
 
+static void test_imap_bodystructure_serialize(void)
+{
+	struct message_part *parts, *parts2;
+	const char *error;
+	unsigned int i;
+
+	for (i = 0; i < parse_tests_count; i++) T_BEGIN {
+		struct parse_test *test = &parse_tests[i];
+		string_t *str = t_str_new(128);
+		buffer_t *parts_buf = t_buffer_create(128);
+		buffer_t *data_buf = t_buffer_create(128);
+		pool_t pool = pool_alloconly_create("imap bodystructure serialize", 1024);
+
+		test_begin(t_strdup_printf("imap bodystructure serialize [%u]", i));
+		parts = msg_parse(pool, test->message, 0, 0, TRUE);
+		message_part_serialize(parts, parts_buf);
+		message_part_data_serialize(parts, data_buf);
+
+		parts2 = message_part_deserialize(pool, parts_buf->data,
+						  parts_buf->used, &error);
+		test_assert(parts2 != NULL);
+		test_assert(message_part_data_deserialize(pool, parts2,
+				data_buf->data, data_buf->used, &error) == 0);
+
+		test_assert(imap_bodystructure_write(parts2, str, TRUE, &error) == 0);
+		test_assert_strcmp(str_c(str), test->bodystructure);
+		str_truncate(str, 0);
+		test_assert(imap_bodystructure_write(parts2, str, FALSE, &error) == 0);
+		test_assert_strcmp(str_c(str), test->body);
+
+		/* truncated data is detected */
+		test_assert(message_part_data_deserialize(pool, parts2,
+				data_buf->data, data_buf->used - 1, &error) < 0);
+		/* so is trailing garbage */
+		buffer_append_c(data_buf, 0);
+		test_assert(message_part_data_deserialize(pool, parts2,
+				data_buf->data, data_buf->used, &error) < 0);
+		test_assert_strcmp(error, "Too much data");
+
+		pool_unref(&pool);
+		test_end();
+	} T_END;
+}
+
 static void test_imap_bodystructure_normalize(void)
 {
 	struct message_part *parts;
@@ -752,6 +796,7 @@ int main(void)
 		test_imap_bodystructure_parse_invalid,
 		test_imap_bodystructure_normalize,
 		test_imap_bodystructure_parse_full,
+		test_imap_bodystructure_serialize,
 		test_imap_bodystructure_truncation,
 		test_imap_bodystructure_nesting,
 		NULL
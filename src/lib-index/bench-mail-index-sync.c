@@ -0,0 +1,158 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "ioloop.h"
+#include "strnum.h"
+#include "time-util.h"
+#include "unlink-directory.h"
+#include "mail-index-private.h"
+#include "mail-transaction-log.h"
+
+#include <stdio.h>
+#include <sys/stat.h>
+
+/**
+ * Measures how long it takes to open an index whose dovecot.index is
+ * behind the transaction log, i.e. how long replaying the log with
+ * mail_index_sync_map() takes.
+ *
+ * If an index directory is given, its dovecot.index and dovecot.index.log
+ * are opened read-only, so e.g. a copy of a real user's index can be used.
+ * Otherwise a synthetic index is generated: the messages are written to
+ * dovecot.index, followed by the given number of single message
+ * transactions that either change flags or expunge a message.
+ */
+
+#define BENCH_DIR ".dovecot.bench"
+#define BENCH_INDEX_PREFIX "dovecot.index"
+#define BENCH_REPEAT_COUNT 5
+
+static void bench_generate_index(unsigned int messages_count,
+				 unsigned int changes_count)
+{
+	struct mail_index *index;
+	struct mail_index_view *view;
+	struct mail_index_transaction *trans;
+	uint32_t seq, uid, file_seq, uid_validity = 123456;
+	uoff_t file_offset;
+	const char *error;
+	unsigned int i, count;
+
+	(void)unlink_directory(BENCH_DIR, UNLINK_DIRECTORY_FLAG_RMDIR, &error);
+	if (mkdir(BENCH_DIR, 0700) < 0)
+		i_fatal("mkdir(%s) failed: %m", BENCH_DIR);
+
+	index = mail_index_alloc(NULL, BENCH_DIR, BENCH_INDEX_PREFIX);
+	if (mail_index_open_or_create(index, MAIL_INDEX_OPEN_FLAG_CREATE) < 0)
+		i_fatal("mail_index_open_or_create() failed");
+	view = mail_index_view_open(index);
+	trans = mail_index_transaction_begin(view,
+			MAIL_INDEX_TRANSACTION_FLAG_EXTERNAL);
+	mail_index_update_header(trans,
+		offsetof(struct mail_index_header, uid_validity),
+		&uid_validity, sizeof(uid_validity), TRUE);
+	for (uid = 1; uid <= messages_count; uid++)
+		mail_index_append(trans, uid, &seq);
+	if (mail_index_transaction_commit(&trans) < 0)
+		i_fatal("mail_index_transaction_commit() failed");
+	mail_index_view_close(&view);
+
+	if (mail_transaction_log_sync_lock(index->log, "bench",
+					   &file_seq, &file_offset) < 0)
+		i_fatal("mail_transaction_log_sync_lock() failed");
+	mail_index_write(index, TRUE, "bench");
+	mail_transaction_log_sync_unlock(index->log, "bench");
+
+	for (i = 0; i < changes_count; i++) {
+		view = mail_index_view_open(index);
+		count = mail_index_view_get_messages_count(view);
+		if (count == 0) {
+			mail_index_view_close(&view);
+			break;
+		}
+		seq = 1 + i_rand_limit(count);
+		trans = mail_index_transaction_begin(view,
+				MAIL_INDEX_TRANSACTION_FLAG_EXTERNAL);
+		if (i % 4 == 3)
+			mail_index_expunge(trans, seq);
+		else {
+			mail_index_update_flags(trans, seq,
+				i % 2 == 0 ? MODIFY_ADD : MODIFY_REMOVE,
+				MAIL_SEEN);
+		}
+		if (mail_index_transaction_commit(&trans) < 0)
+			i_fatal("mail_index_transaction_commit() failed");
+		mail_index_view_close(&view);
+	}
+	mail_index_close(index);
+	mail_index_free(&index);
+}
+
+static uint64_t bench_open_index(const char *dir, unsigned int *messages_r)
+{
+	struct mail_index *index;
+	uint64_t ts;
+
+	index = mail_index_alloc(NULL, dir, BENCH_INDEX_PREFIX);
+	ts = i_nanoseconds();
+	if (mail_index_open(index, MAIL_INDEX_OPEN_FLAG_READONLY) <= 0)
+		i_fatal("mail_index_open(%s) failed", dir);
+	ts = i_nanoseconds() - ts;
+	*messages_r = index->map->hdr.messages_count;
+	mail_index_close(index);
+	mail_index_free(&index);
+	return ts;
+}
+
+static void print_usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [<index dir> | <messages> [<changes>]]\n",
+		prog);
+	fprintf(stderr, "Generates 100000 messages with 20000 changes "
+		"if nothing given\n");
+	lib_exit(1);
+}
+
+int main(int argc, const char *argv[])
+{
+	unsigned int i, messages_count = 100000, changes_count = 20000;
+	const char *dir = BENCH_DIR, *error;
+	uint64_t nsecs = 0;
+	bool generated = FALSE;
+
+	lib_init();
+	/* the index needs a non-zero indexid, which is taken from ioloop_time */
+	ioloop_time = time(NULL);
+
+	if (argc > 3)
+		print_usage(argv[0]);
+	if (argc > 1 && str_to_uint(argv[1], &messages_count) < 0) {
+		if (argc > 2)
+			print_usage(argv[0]);
+		dir = argv[1];
+	} else {
+		if (argc > 2 && str_to_uint(argv[2], &changes_count) < 0)
+			print_usage(argv[0]);
+		if (messages_count == 0)
+			print_usage(argv[0]);
+		bench_generate_index(messages_count, changes_count);
+		generated = TRUE;
+	}
+
+	for (i = 0; i < BENCH_REPEAT_COUNT; i++)
+		nsecs += bench_open_index(dir, &messages_count);
+
+	if (generated) {
+		printf("%u changes replayed, %u messages left\n",
+		       changes_count, messages_count);
+		(void)unlink_directory(BENCH_DIR,
+				       UNLINK_DIRECTORY_FLAG_RMDIR, &error);
+	} else {
+		printf("%s: %u messages\n", dir, messages_count);
+	}
+	printf("\tOpen and sync: %0.02lf ms\n",
+	       (double)nsecs / BENCH_REPEAT_COUNT / 1000000.0);
+
+	lib_deinit();
+	return 0;
+}
@@ -0,0 +1,93 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "str.h"
+#include "mail-cache-private.h"
+
+#include <ctype.h>
+
+/* Column records are the field's data followed by a byte telling whether
+   the field has been set for the message. The index zero-fills the records
+   of new messages, so an unset column can't be confused with a set one. */
+#define MAIL_CACHE_COLUMN_SET 0x01
+
+static const char *mail_cache_column_ext_name(const char *field_name)
+{
+	string_t *str = t_str_new(64);
+	const char *p;
+
+	str_append(str, MAIL_CACHE_COLUMN_EXT_PREFIX);
+	for (p = field_name; *p != '\0'; p++) {
+		if (i_isalnum(*p) || *p == '-' || *p == '_')
+			str_append_c(str, *p);
+		else
+			str_append_c(str, '-');
+	}
+	return str_c(str);
+}
+
+bool mail_cache_register_column(struct mail_cache *cache,
+				unsigned int field_idx)
+{
+	struct mail_cache_field_private *priv;
+	const char *ext_name;
+
+	i_assert(field_idx < cache->fields_count);
+
+	priv = &cache->fields[field_idx];
+	if (priv->column)
+		return TRUE;
+	if (priv->field.type != MAIL_CACHE_FIELD_FIXED_SIZE ||
+	    priv->field.field_size > MAIL_CACHE_COLUMN_MAX_FIELD_SIZE)
+		return FALSE;
+
+	ext_name = mail_cache_column_ext_name(priv->field.name);
+	if (strlen(ext_name) >= MAIL_INDEX_EXT_NAME_MAX_LENGTH)
+		return FALSE;
+
+	priv->column_ext_id =
+		mail_index_ext_register(cache->index, ext_name, 0,
+					priv->field.field_size + 1, 1);
+	priv->column = TRUE;
+	return TRUE;
+}
+
+int mail_cache_column_lookup(struct mail_cache_view *view, uint32_t seq,
+			     unsigned int field_idx, const void **data_r)
+{
+	const struct mail_cache_field_private *priv;
+	const unsigned char *rec;
+	const void *data;
+	bool expunged;
+
+	i_assert(field_idx < view->cache->fields_count);
+
+	priv = &view->cache->fields[field_idx];
+	if (!priv->column)
+		return 0;
+
+	mail_index_lookup_ext(view->view, seq, priv->column_ext_id,
+			      &data, &expunged);
+	if (data == NULL)
+		return 0;
+	rec = data;
+	if ((rec[priv->field.field_size] & MAIL_CACHE_COLUMN_SET) == 0)
+		return 0;
+	*data_r = rec;
+	return 1;
+}
+
+void mail_cache_column_update(struct mail_cache *cache,
+			      struct mail_index_transaction *t, uint32_t seq,
+			      unsigned int field_idx, const void *data)
+{
+	const struct mail_cache_field_private *priv = &cache->fields[field_idx];
+	unsigned char rec[MAIL_CACHE_COLUMN_MAX_FIELD_SIZE + 1];
+
+	i_assert(priv->column);
+	i_assert(priv->field.field_size <= MAIL_CACHE_COLUMN_MAX_FIELD_SIZE);
+
+	memcpy(rec, data, priv->field.field_size);
+	rec[priv->field.field_size] = MAIL_CACHE_COLUMN_SET;
+	mail_index_update_ext(t, seq, priv->column_ext_id, rec, NULL);
+}
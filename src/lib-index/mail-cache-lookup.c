@@ -350,6 +350,7 @@ int mail_cache_field_exists(struct mail_cache_view *view, uint32_t seq,
 			    unsigned int field)
 {
 	const uint8_t *data;
+	const void *column_data;
 
 	i_assert(seq > 0);
 
@@ -357,6 +358,9 @@ int mail_cache_field_exists(struct mail_cache_view *view, uint32_t seq,
 	   fields that don't yet exist in the cache file. So don't add any
 	   fast-paths checking whether the field exists in the file. */
 
+	if (mail_cache_column_lookup(view, seq, field, &column_data) > 0)
+		return 1;
+
 	/* FIXME: we should discard the cache if view has been synced */
 	if (view->cached_exists_seq != seq) {
 		if (mail_cache_seq(view, seq) < 0)
@@ -412,15 +416,63 @@ mail_cache_lookup_bitmask(struct mail_cache_lookup_iterate_ctx *iter,
 	return ret < 0 ? -1 : (found ? 1 : 0);
 }
 
+static void
+mail_cache_field_stats_update(struct mail_cache *cache, unsigned int field_idx,
+			      bool hit)
+{
+	struct mail_cache_field_stats *stats = &cache->fields[field_idx].stats;
+
+	if (hit)
+		stats->hit_count++;
+	else
+		stats->miss_count++;
+}
+
+const struct mail_cache_field_stats *
+mail_cache_field_get_stats(struct mail_cache *cache, unsigned int field_idx)
+{
+	i_assert(field_idx < cache->fields_count);
+
+	return &cache->fields[field_idx].stats;
+}
+
+void mail_cache_fields_add_parse_stats(struct mail_cache *cache,
+				       const unsigned int field_idxs[],
+				       unsigned int count, uoff_t bytes,
+				       uint64_t usecs)
+{
+	struct mail_cache_field_stats *stats;
+	unsigned int i;
+
+	for (i = 0; i < count; i++) {
+		i_assert(field_idxs[i] < cache->fields_count);
+		stats = &cache->fields[field_idxs[i]].stats;
+		stats->parse_bytes += bytes;
+		stats->parse_usecs += usecs;
+	}
+}
+
 int mail_cache_lookup_field(struct mail_cache_view *view, buffer_t *dest_buf,
 			    uint32_t seq, unsigned int field_idx)
 {
 	struct mail_cache_lookup_iterate_ctx iter;
 	struct mail_cache_iterate_field field;
+	const void *column_data;
 	int ret;
 
+	if (mail_cache_column_lookup(view, seq, field_idx, &column_data) > 0) {
+		/* the column has it - no need to look into the cache file */
+		mail_cache_decision_state_update(view, seq, field_idx);
+		buffer_append(dest_buf, column_data,
+			      view->cache->fields[field_idx].field.field_size);
+		mail_cache_field_stats_update(view->cache, field_idx, TRUE);
+		return 1;
+	}
+
 	ret = mail_cache_field_exists(view, seq, field_idx);
 	mail_cache_decision_state_update(view, seq, field_idx);
+	if (ret >= 0)
+		mail_cache_field_stats_update(view->cache, field_idx, ret > 0);
 	if (ret <= 0)
 		return ret;
 
@@ -564,6 +616,11 @@ mail_cache_lookup_headers_real(struct mail_cache_view *view, string_t *dest,
 	if (ret < 0)
 		return -1;
 
+	for (i = 0; i < fields_count; i++) {
+		mail_cache_field_stats_update(view->cache, field_idxs[i],
+			field_state[field_idxs[i]] == HDR_FIELD_STATE_SEEN);
+	}
+
 	/* check that all fields were found */
 	for (i = 0; i <= max_field; i++) {
 		if (field_state[i] == HDR_FIELD_STATE_WANT)
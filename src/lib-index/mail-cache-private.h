@@ -13,6 +13,11 @@
 
 #define MAIL_CACHE_MAX_WRITE_BUFFER (1024*256)
 
+/* Index extension name prefix for cache columns */
+#define MAIL_CACHE_COLUMN_EXT_PREFIX "cache-"
+/* Maximum size of a fixed size field that can have a column */
+#define MAIL_CACHE_COLUMN_MAX_FIELD_SIZE 32
+
 #define MAIL_CACHE_IS_UNUSABLE(cache) \
 	((cache)->hdr == NULL)
 
@@ -113,7 +118,15 @@ struct mail_cache_field_private {
 	   that doesn't have a local cache. That will result in the caching
 	   decision to change from TEMP to YES. */
 	uint32_t uid_highwater;
-
+	/* Index extension used for the field's column, if column=TRUE */
+	uint32_t column_ext_id;
+	/* Lookup statistics collected since they were last flushed */
+	struct mail_cache_field_stats stats;
+	/* Flushed statistics that haven't been written to the stats file */
+	struct mail_cache_field_stats unsaved_stats;
+
+	/* Field is mirrored to a column, see mail_cache_register_column() */
+	bool column:1;
 	/* Unused fields aren't written to cache file */
 	bool used:1;
 	/* field.decision is pending a write to cache file header. If the
@@ -383,6 +396,10 @@ int mail_cache_map(struct mail_cache *cache, size_t offset, size_t size,
    (and deleted), -1 if I/O error. */
 int mail_cache_map_all(struct mail_cache *cache);
 void mail_cache_file_close(struct mail_cache *cache);
+/* Flush the field statistics when the cache is being freed. The unsaved
+   statistics are written if the stats file wasn't updated too recently,
+   otherwise they are dropped. */
+void mail_cache_free_field_stats(struct mail_cache *cache);
 int mail_cache_reopen(struct mail_cache *cache);
 int mail_cache_sync_reset_id(struct mail_cache *cache);
 
@@ -399,6 +416,11 @@ mail_cache_decision_changed_event(struct mail_cache *cache, struct event *event,
 
 bool mail_cache_headers_check_capped(struct mail_cache *cache);
 
+/* Write the field's data also to its column. */
+void mail_cache_column_update(struct mail_cache *cache,
+			      struct mail_index_transaction *t, uint32_t seq,
+			      unsigned int field_idx, const void *data);
+
 struct mail_cache_purge_drop_ctx {
 	struct mail_cache *cache;
 	time_t max_yes_downgrade_time;
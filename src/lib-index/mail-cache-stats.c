@@ -0,0 +1,340 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "ioloop.h"
+#include "array.h"
+#include "str.h"
+#include "strescape.h"
+#include "strnum.h"
+#include "istream.h"
+#include "ostream.h"
+#include "file-dotlock.h"
+#include "nfs-workarounds.h"
+#include "mail-cache-private.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+
+/* The stats file contains a version line followed by one line for each
+   field: <name> TAB <hits> TAB <misses> TAB <parse bytes> TAB <parse usecs> */
+#define MAIL_CACHE_STATS_FILE_SUFFIX ".stats"
+#define MAIL_CACHE_STATS_FILE_VERSION "1"
+/* Don't wait long for the lock. The statistics are only lost from the file
+   if it can't be updated, the events have already been sent. */
+#define MAIL_CACHE_STATS_LOCK_TIMEOUT 2
+/* Rewrite the stats file at most this often, unless there are at least
+   MAIL_CACHE_STATS_WRITE_MIN_LOOKUPS unsaved lookups. Smaller unsaved
+   statistics are kept in memory until the cache is freed, and dropped if
+   the file was updated too recently even then. */
+#define MAIL_CACHE_STATS_WRITE_INTERVAL_SECS (5*60)
+#define MAIL_CACHE_STATS_WRITE_MIN_LOOKUPS 10000
+
+static bool
+mail_cache_field_stats_are_empty(const struct mail_cache_field_stats *stats)
+{
+	return stats->hit_count == 0 && stats->miss_count == 0 &&
+		stats->parse_bytes == 0 && stats->parse_usecs == 0;
+}
+
+static void
+mail_cache_field_stats_add(struct mail_cache_field_stats *dest,
+			   const struct mail_cache_field_stats *src)
+{
+	dest->hit_count += src->hit_count;
+	dest->miss_count += src->miss_count;
+	dest->parse_bytes += src->parse_bytes;
+	dest->parse_usecs += src->parse_usecs;
+}
+
+static const char *mail_cache_stats_get_path(struct mail_cache *cache)
+{
+	return t_strconcat(cache->filepath, MAIL_CACHE_STATS_FILE_SUFFIX, NULL);
+}
+
+static int
+mail_cache_stats_parse_line(const char *line, const char **name_r,
+			    struct mail_cache_field_stats *stats_r)
+{
+	const char *const *args = t_strsplit_tabescaped(line);
+
+	if (str_array_length(args) != 5 ||
+	    str_to_uint64(args[1], &stats_r->hit_count) < 0 ||
+	    str_to_uint64(args[2], &stats_r->miss_count) < 0 ||
+	    str_to_uint64(args[3], &stats_r->parse_bytes) < 0 ||
+	    str_to_uint64(args[4], &stats_r->parse_usecs) < 0)
+		return -1;
+	*name_r = args[0];
+	return 0;
+}
+
+/* Add the stats file's contents to stats. Lines for fields that aren't
+   registered to the cache are added to unknown_lines, if it's non-NULL.
+   Returns 1 if ok, 0 if the file doesn't exist, -1 on error. */
+static int
+mail_cache_stats_read(struct mail_cache *cache, const char *path,
+		      ARRAY_TYPE(mail_cache_field_stats) *stats,
+		      ARRAY_TYPE(const_string) *unknown_lines)
+{
+	struct mail_cache_field_stats line_stats, *field_stats;
+	struct istream *input;
+	const char *line, *name;
+	unsigned int field_idx;
+	int fd, ret = 1;
+
+	fd = nfs_safe_open(path, O_RDONLY);
+	if (fd == -1) {
+		if (errno == ENOENT)
+			return 0;
+		mail_index_file_set_syscall_error(cache->index, path, "open()");
+		return -1;
+	}
+
+	input = i_stream_create_fd_autoclose(&fd, SIZE_MAX);
+	line = i_stream_read_next_line(input);
+	if (line != NULL && strcmp(line, MAIL_CACHE_STATS_FILE_VERSION) != 0) {
+		e_warning(cache->event,
+			  "Stats file %s has unsupported version %s - ignoring",
+			  path, line);
+		line = NULL;
+	}
+	while (line != NULL &&
+	       (line = i_stream_read_next_line(input)) != NULL) {
+		if (mail_cache_stats_parse_line(line, &name, &line_stats) < 0) {
+			e_warning(cache->event,
+				  "Stats file %s has invalid line: %s",
+				  path, line);
+			continue;
+		}
+		field_idx = mail_cache_register_lookup(cache, name);
+		if (field_idx == UINT_MAX) {
+			if (unknown_lines != NULL) {
+				line = t_strdup(line);
+				array_push_back(unknown_lines, &line);
+			}
+			continue;
+		}
+		field_stats = array_idx_get_space(stats, field_idx);
+		mail_cache_field_stats_add(field_stats, &line_stats);
+	}
+	if (input->stream_errno != 0) {
+		e_error(cache->event, "read(%s) failed: %s",
+			path, i_stream_get_error(input));
+		ret = -1;
+	}
+	i_stream_destroy(&input);
+	return ret;
+}
+
+static void
+mail_cache_stats_write_field(struct ostream *output, const char *name,
+			     const struct mail_cache_field_stats *stats)
+{
+	string_t *str = t_str_new(128);
+
+	str_append_tabescaped(str, name);
+	str_printfa(str, "\t%"PRIu64"\t%"PRIu64"\t%"PRIu64"\t%"PRIu64"\n",
+		    stats->hit_count, stats->miss_count,
+		    stats->parse_bytes, stats->parse_usecs);
+	o_stream_nsend(output, str_data(str), str_len(str));
+}
+
+static int mail_cache_stats_update_file(struct mail_cache *cache)
+{
+	struct mail_index *index = cache->index;
+	struct dotlock_settings dotlock_set;
+	struct dotlock *dotlock;
+	ARRAY_TYPE(mail_cache_field_stats) stats;
+	ARRAY_TYPE(const_string) unknown_lines;
+	struct mail_cache_field_stats *field_stats;
+	struct ostream *output;
+	const char *path, *line;
+	unsigned int i;
+	int fd;
+
+	path = mail_cache_stats_get_path(cache);
+	dotlock_set = cache->dotlock_settings;
+	dotlock_set.timeout = MAIL_CACHE_STATS_LOCK_TIMEOUT;
+	fd = file_dotlock_open_group(&dotlock_set, path, 0, index->set.mode,
+				     index->set.gid, index->set.gid_origin,
+				     &dotlock);
+	if (fd == -1) {
+		if (errno == ENOENT) {
+			/* index directory was already deleted */
+			return 0;
+		}
+		if (errno == EAGAIN) {
+			e_debug(cache->event,
+				"Timeout waiting for stats file %s lock", path);
+		} else {
+			mail_index_file_set_syscall_error(index, path,
+				"file_dotlock_open()");
+		}
+		return -1;
+	}
+
+	t_array_init(&stats, cache->fields_count);
+	t_array_init(&unknown_lines, 8);
+	if (mail_cache_stats_read(cache, path, &stats, &unknown_lines) < 0) {
+		/* start over with only the new statistics */
+		array_clear(&stats);
+		array_clear(&unknown_lines);
+	}
+
+	output = o_stream_create_fd_file(fd, 0, FALSE);
+	o_stream_cork(output);
+	o_stream_nsend_str(output, MAIL_CACHE_STATS_FILE_VERSION"\n");
+	for (i = 0; i < cache->fields_count; i++) {
+		field_stats = array_idx_get_space(&stats, i);
+		mail_cache_field_stats_add(field_stats,
+					   &cache->fields[i].unsaved_stats);
+		if (!mail_cache_field_stats_are_empty(field_stats)) {
+			mail_cache_stats_write_field(output,
+				cache->fields[i].field.name, field_stats);
+		}
+	}
+	array_foreach_elem(&unknown_lines, line) {
+		o_stream_nsend_str(output, line);
+		o_stream_nsend(output, "\n", 1);
+	}
+	if (o_stream_finish(output) < 0) {
+		e_error(cache->event, "write(%s) failed: %s",
+			file_dotlock_get_lock_path(dotlock),
+			o_stream_get_error(output));
+		o_stream_destroy(&output);
+		file_dotlock_delete(&dotlock);
+		return -1;
+	}
+	o_stream_destroy(&output);
+
+	if (file_dotlock_replace(&dotlock, 0) < 0) {
+		mail_index_file_set_syscall_error(index, path,
+			"file_dotlock_replace()");
+		return -1;
+	}
+	return 0;
+}
+
+static bool
+mail_cache_stats_want_write(struct mail_cache *cache, bool freeing)
+{
+	struct stat st;
+	const char *path;
+	uint64_t lookups = 0;
+	unsigned int i;
+	bool unsaved = FALSE;
+
+	for (i = 0; i < cache->fields_count; i++) {
+		const struct mail_cache_field_stats *stats =
+			&cache->fields[i].unsaved_stats;
+
+		if (!mail_cache_field_stats_are_empty(stats))
+			unsaved = TRUE;
+		lookups += stats->hit_count + stats->miss_count;
+	}
+	if (!unsaved)
+		return FALSE;
+	if (lookups >= MAIL_CACHE_STATS_WRITE_MIN_LOOKUPS)
+		return TRUE;
+
+	path = mail_cache_stats_get_path(cache);
+	if (nfs_safe_stat(path, &st) < 0) {
+		if (errno == ENOENT)
+			return TRUE;
+		mail_index_file_set_syscall_error(cache->index, path,
+						  "stat()");
+		return freeing;
+	}
+	if (st.st_mtime + MAIL_CACHE_STATS_WRITE_INTERVAL_SECS <= ioloop_time)
+		return TRUE;
+	if (freeing) {
+		e_debug(cache->event, "Stats file %s was updated recently - "
+			"dropping the unsaved statistics", path);
+	}
+	return FALSE;
+}
+
+static void mail_cache_stats_write(struct mail_cache *cache, bool freeing)
+{
+	unsigned int i;
+	bool write = FALSE;
+
+	/* Mail deliveries don't write the stats file. Their lookups are
+	   still visible in the events. */
+	if (!MAIL_INDEX_IS_IN_MEMORY(cache->index) &&
+	    (cache->index->flags & MAIL_INDEX_OPEN_FLAG_SAVEONLY) == 0) T_BEGIN {
+		write = mail_cache_stats_want_write(cache, freeing);
+		if (write)
+			(void)mail_cache_stats_update_file(cache);
+	} T_END;
+	if (!write && !freeing)
+		return;
+
+	/* Written, failed or dropped. Failures aren't retried, since the
+	   next attempt would most likely fail the same way. */
+	for (i = 0; i < cache->fields_count; i++)
+		i_zero(&cache->fields[i].unsaved_stats);
+}
+
+static void
+mail_cache_flush_field_stats_full(struct mail_cache *cache, bool freeing)
+{
+	struct mail_cache_field_private *priv;
+	bool changed = FALSE;
+	unsigned int i;
+
+	for (i = 0; i < cache->fields_count; i++) {
+		priv = &cache->fields[i];
+		if (mail_cache_field_stats_are_empty(&priv->stats))
+			continue;
+		changed = TRUE;
+
+		e_debug(event_create_passthrough(cache->event)->
+			set_name("mail_cache_field_stats")->
+			add_str("field", priv->field.name)->
+			add_int("hits", priv->stats.hit_count)->
+			add_int("misses", priv->stats.miss_count)->
+			add_int("parse_bytes", priv->stats.parse_bytes)->
+			add_int("parse_usecs", priv->stats.parse_usecs)->
+			event(),
+			"Cache field %s: hits=%"PRIu64" misses=%"PRIu64
+			" parse_bytes=%"PRIu64" parse_usecs=%"PRIu64,
+			priv->field.name, priv->stats.hit_count,
+			priv->stats.miss_count, priv->stats.parse_bytes,
+			priv->stats.parse_usecs);
+	}
+	if (changed) {
+		for (i = 0; i < cache->fields_count; i++) {
+			priv = &cache->fields[i];
+			mail_cache_field_stats_add(&priv->unsaved_stats,
+						   &priv->stats);
+			i_zero(&priv->stats);
+		}
+	}
+	if (changed || freeing)
+		mail_cache_stats_write(cache, freeing);
+}
+
+void mail_cache_flush_field_stats(struct mail_cache *cache)
+{
+	mail_cache_flush_field_stats_full(cache, FALSE);
+}
+
+void mail_cache_free_field_stats(struct mail_cache *cache)
+{
+	mail_cache_flush_field_stats_full(cache, TRUE);
+}
+
+int mail_cache_read_field_stats(struct mail_cache *cache,
+				ARRAY_TYPE(mail_cache_field_stats) *stats_r)
+{
+	int ret;
+
+	if (MAIL_INDEX_IS_IN_MEMORY(cache->index))
+		return 0;
+	T_BEGIN {
+		ret = mail_cache_stats_read(cache,
+					    mail_cache_stats_get_path(cache),
+					    stats_r, NULL);
+	} T_END;
+	return ret < 0 ? -1 : 0;
+}
@@ -615,6 +615,8 @@ void mail_cache_free(struct mail_cache **_cache)
 
 	i_assert(cache->views == NULL);
 
+	mail_cache_free_field_stats(cache);
+
 	if (cache->file_cache != NULL)
 		file_cache_free(&cache->file_cache);
 
@@ -64,6 +64,16 @@ struct mail_cache_field {
 	time_t last_used;
 };
 
+struct mail_cache_field_stats {
+	/* Number of lookups that found / didn't find the field */
+	uint64_t hit_count, miss_count;
+	/* Bytes parsed and time spent parsing mails, because the field
+	   wasn't found from cache. If multiple fields were missing, the same
+	   parse is counted for each of them. */
+	uint64_t parse_bytes, parse_usecs;
+};
+ARRAY_DEFINE_TYPE(mail_cache_field_stats, struct mail_cache_field_stats);
+
 struct mail_cache *mail_cache_open_or_create(struct mail_index *index);
 struct mail_cache *
 mail_cache_open_or_create_path(struct mail_index *index, const char *path);
@@ -86,6 +96,15 @@ mail_cache_register_lookup(struct mail_cache *cache, const char *name);
 /* Returns specified field */
 const struct mail_cache_field *
 mail_cache_register_get_field(struct mail_cache *cache, unsigned int field_idx);
+/* Mirror a fixed size field into a column: an index extension that has the
+   field's value for each message, stored densely by sequence. Lookups are
+   then answered from the index map without walking the message's cache
+   records, which makes e.g. sorting by the field cheap. The column is kept
+   over cache purges and its records are removed along with expunged
+   messages. Returns FALSE if the field can't have a column, i.e. it's not
+   a (small) fixed size field. */
+bool mail_cache_register_column(struct mail_cache *cache,
+				unsigned int field_idx);
 /* Returns a list of all registered fields. The returned pool must be freed. */
 struct mail_cache_field *
 mail_cache_register_get_list(struct mail_cache *cache, pool_t *pool_r,
@@ -178,6 +197,35 @@ void mail_cache_decision_add(struct mail_cache_view *view, uint32_t seq,
 int mail_cache_lookup_field(struct mail_cache_view *view, buffer_t *dest_buf,
 			    uint32_t seq, unsigned int field_idx);
 
+/* Returns the field's lookup statistics collected since the previous
+   mail_cache_flush_field_stats() call. */
+const struct mail_cache_field_stats *
+mail_cache_field_get_stats(struct mail_cache *cache, unsigned int field_idx);
+/* Add parsing cost to the statistics of the fields whose lookups missed and
+   caused the mail to be parsed. */
+void mail_cache_fields_add_parse_stats(struct mail_cache *cache,
+				       const unsigned int field_idxs[],
+				       unsigned int count, uoff_t bytes,
+				       uint64_t usecs);
+/* Send the collected field statistics as "mail_cache_field_stats" events and
+   reset them. The statistics are also added to the totals in the cache's
+   stats file, but the file is rewritten at most once per few minutes unless
+   a lot of lookups have been done. Until then they are kept in memory.
+   This is called when the cache is freed, but it can also be called
+   earlier, e.g. when a mailbox is closed. */
+void mail_cache_flush_field_stats(struct mail_cache *cache);
+/* Read the statistics totals from the cache's stats file into stats_r,
+   indexed by field_idx. Fields without statistics are left zero. Returns 0 if
+   ok, -1 on error. */
+int mail_cache_read_field_stats(struct mail_cache *cache,
+				ARRAY_TYPE(mail_cache_field_stats) *stats_r);
+
+/* Look up the field from its column. Only committed changes are visible.
+   Returns 1 if found, 0 if the field has no column or it isn't set for the
+   message. The returned data isn't necessarily aligned. */
+int mail_cache_column_lookup(struct mail_cache_view *view, uint32_t seq,
+			     unsigned int field_idx, const void **data_r);
+
 /* Return specified cached headers. Returns 1 if all fields were found,
    0 if not, -1 if error. dest is updated only if all fields were found. */
 int mail_cache_lookup_headers(struct mail_cache_view *view, string_t *dest,
@@ -11,6 +11,10 @@
 #include "mail-index-modseq.h"
 #include "ioloop.h"
 
+#if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+#  define MAP_ANONYMOUS MAP_ANON
+#endif
+
 static void mail_index_map_copy_hdr(struct mail_index_map *map,
 				    const struct mail_index_header *hdr)
 {
@@ -28,6 +32,41 @@ static void mail_index_map_copy_hdr(struct mail_index_map *map,
 	map->hdr.unused_old_recent_messages_count = 0;
 }
 
+static void *
+mail_index_mmap_file(struct mail_index *index, uoff_t file_size,
+		     size_t *mmap_size_r)
+{
+#ifdef MAP_ANONYMOUS
+	uoff_t space = I_MAX(file_size / 100, MAIL_INDEX_MMAP_MIN_APPEND_SPACE);
+	void *base;
+	int old_errno;
+
+	if ((index->flags & MAIL_INDEX_OPEN_FLAG_MMAP_SHARED) != 0 &&
+	    file_size + space <= SSIZE_T_MAX) {
+		/* Reserve anonymous space after the file, so records can be
+		   appended without copying the whole map to memory. The file
+		   is mapped over the beginning of it. */
+		base = mmap(NULL, file_size + space, PROT_READ | PROT_WRITE,
+			    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (base == MAP_FAILED)
+			return MAP_FAILED;
+		if (mmap(base, file_size, PROT_READ | PROT_WRITE,
+			 MAP_PRIVATE | MAP_FIXED, index->fd, 0) == MAP_FAILED) {
+			old_errno = errno;
+			if (munmap(base, file_size + space) < 0)
+				mail_index_set_syscall_error(index, "munmap()");
+			errno = old_errno;
+			return MAP_FAILED;
+		}
+		*mmap_size_r = file_size + space;
+		return base;
+	}
+#endif
+	*mmap_size_r = file_size;
+	return mmap(NULL, file_size, PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE, index->fd, 0);
+}
+
 static int mail_index_mmap(struct mail_index_map *map, uoff_t file_size)
 {
 	struct mail_index *index = map->index;
@@ -45,10 +84,11 @@ static int mail_index_mmap(struct mail_index_map *map, uoff_t file_size)
 		return -1;
 	}
 
-	rec_map->mmap_base = mmap(NULL, file_size, PROT_READ | PROT_WRITE,
-				  MAP_PRIVATE, index->fd, 0);
+	rec_map->mmap_base = mail_index_mmap_file(index, file_size,
+						  &rec_map->mmap_size);
 	if (rec_map->mmap_base == MAP_FAILED) {
 		rec_map->mmap_base = NULL;
+		rec_map->mmap_size = 0;
 		if (ioloop_time != index->last_mmap_error_time) {
 			index->last_mmap_error_time = ioloop_time;
 			mail_index_set_syscall_error(index, t_strdup_printf(
@@ -56,24 +96,22 @@ static int mail_index_mmap(struct mail_index_map *map, uoff_t file_size)
 		}
 		return -1;
 	}
-	rec_map->mmap_size = file_size;
 
 	hdr = rec_map->mmap_base;
-	if (rec_map->mmap_size >
-	    offsetof(struct mail_index_header, major_version) &&
+	if (file_size > offsetof(struct mail_index_header, major_version) &&
 	    hdr->major_version != MAIL_INDEX_MAJOR_VERSION) {
 		/* major version change - handle silently */
 		return 0;
 	}
 
-	if (rec_map->mmap_size < MAIL_INDEX_HEADER_MIN_SIZE) {
+	if (file_size < MAIL_INDEX_HEADER_MIN_SIZE) {
 		mail_index_set_error(index, "Corrupted index file %s: "
-				     "File too small (%zu)",
-				     index->filepath, rec_map->mmap_size);
+				     "File too small (%"PRIuUOFF_T")",
+				     index->filepath, file_size);
 		return 0;
 	}
 
-	if (!mail_index_check_header_compat(hdr, rec_map->mmap_size, &error)) {
+	if (!mail_index_check_header_compat(hdr, file_size, &error)) {
 		/* Can't use this file */
 		mail_index_set_error(index, "Corrupted index file %s: %s",
 				     index->filepath, error);
@@ -85,11 +123,11 @@ static int mail_index_mmap(struct mail_index_map *map, uoff_t file_size)
 	rec_map->mmap_used_size = hdr->header_size +
 		hdr->messages_count * hdr->record_size;
 
-	if (rec_map->mmap_used_size <= rec_map->mmap_size)
+	if (rec_map->mmap_used_size <= file_size)
 		rec_map->records_count = hdr->messages_count;
 	else {
 		rec_map->records_count =
-			(rec_map->mmap_size - hdr->header_size) /
+			(file_size - hdr->header_size) /
 			hdr->record_size;
 		rec_map->mmap_used_size = hdr->header_size +
 			rec_map->records_count * hdr->record_size;
@@ -445,11 +445,30 @@ void mail_index_record_map_move_to_private(struct mail_index_map *map)
 			rec = MAIL_INDEX_REC_AT_SEQ(map, new_map->records_count);
 			new_map->last_appended_uid = rec->uid;
 		}
-		buffer_set_used_size(new_map->buffer, new_map->records_count *
-				     map->hdr.record_size);
+		if (new_map->buffer != NULL) {
+			buffer_set_used_size(new_map->buffer,
+				new_map->records_count * map->hdr.record_size);
+		} else {
+			new_map->mmap_used_size =
+				((char *)new_map->records -
+				 (char *)new_map->mmap_base) +
+				new_map->records_count * map->hdr.record_size;
+		}
 	}
 }
 
+bool mail_index_map_mmap_has_append_space(const struct mail_index_map *map)
+{
+	const struct mail_index_record_map *rec_map = map->rec_map;
+	size_t used_size;
+
+	i_assert(rec_map->mmap_base != NULL);
+
+	used_size = ((char *)rec_map->records - (char *)rec_map->mmap_base) +
+		rec_map->records_count * map->hdr.record_size;
+	return rec_map->mmap_size - used_size >= map->hdr.record_size;
+}
+
 void mail_index_map_move_to_memory(struct mail_index_map *map)
 {
 	struct mail_index_record_map *new_map;
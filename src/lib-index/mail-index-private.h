@@ -15,6 +15,10 @@ struct mail_index_sync_map_ctx;
 
 /* How large index files to mmap() instead of reading to memory. */
 #define MAIL_INDEX_MMAP_MIN_SIZE (1024*64)
+/* With MAIL_INDEX_OPEN_FLAG_MMAP_SHARED reserve this much (or 1% of the
+   file size, if larger) address space after the mmap()ed index for
+   appending records. */
+#define MAIL_INDEX_MMAP_MIN_APPEND_SPACE (1024*64)
 /* How many times to retry opening index files if read/fstat returns ESTALE.
    This happens with NFS when the file has been deleted (ie. index file was
    rewritten by another computer than us). */
@@ -369,6 +373,9 @@ struct mail_index_map *mail_index_map_clone(const struct mail_index_map *map);
 void mail_index_record_map_move_to_private(struct mail_index_map *map);
 /* If map points to mmap()ed index, copy it to the memory. */
 void mail_index_map_move_to_memory(struct mail_index_map *map);
+/* Returns TRUE if a record can be appended to the mmap()ed rec_map without
+   moving it to memory. */
+bool mail_index_map_mmap_has_append_space(const struct mail_index_map *map);
 
 void mail_index_fchown(struct mail_index *index, int fd, const char *path);
 
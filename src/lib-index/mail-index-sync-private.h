@@ -33,6 +33,9 @@ struct mail_index_sync_map_ctx {
 	uoff_t ext_intro_offset, ext_intro_end_offset;
 
 	ARRAY(struct mail_index_expunge_handler) expunge_handlers;
+	/* If created, expunges are collected here and applied in one pass
+	   when a non-expunge record is synced or the sync finishes. */
+	ARRAY_TYPE(seq_range) pending_expunges;
 	ARRAY(void *) extra_contexts;
 	buffer_t *unknown_extensions;
 
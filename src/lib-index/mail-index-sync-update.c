@@ -69,7 +69,7 @@ static void mail_index_sync_replace_map(struct mail_index_sync_map_ctx *ctx,
 }
 
 static struct mail_index_map *
-mail_index_sync_move_to_private_memory(struct mail_index_sync_map_ctx *ctx)
+mail_index_sync_move_to_private(struct mail_index_sync_map_ctx *ctx)
 {
 	struct mail_index_map *map = ctx->view->map;
 
@@ -80,14 +80,52 @@ mail_index_sync_move_to_private_memory(struct mail_index_sync_map_ctx *ctx)
 		mail_index_sync_replace_map(ctx, map);
 		i_assert(ctx->view->map == map);
 	}
+	return map;
+}
 
-	if (!MAIL_INDEX_MAP_IS_IN_MEMORY(ctx->view->map)) {
+static struct mail_index_map *
+mail_index_sync_move_to_private_memory(struct mail_index_sync_map_ctx *ctx)
+{
+	struct mail_index_map *map;
+
+	map = mail_index_sync_move_to_private(ctx);
+	if (!MAIL_INDEX_MAP_IS_IN_MEMORY(map)) {
 		/* map points to mmap()ed area, copy it into memory. */
-		mail_index_map_move_to_memory(ctx->view->map);
+		mail_index_map_move_to_memory(map);
 	}
 	return map;
 }
 
+static struct mail_index_map *
+mail_index_sync_get_append_map(struct mail_index_sync_map_ctx *ctx)
+{
+	struct mail_index_map *map;
+
+	map = mail_index_sync_move_to_private(ctx);
+	if (!MAIL_INDEX_MAP_IS_IN_MEMORY(map) &&
+	    !mail_index_map_mmap_has_append_space(map)) {
+		/* we can't write past the mmap()ed memory area */
+		mail_index_map_move_to_memory(map);
+	}
+	return map;
+}
+
+static struct mail_index_map *
+mail_index_sync_get_expunge_map(struct mail_index_sync_map_ctx *ctx)
+{
+	struct mail_index_map *map;
+
+	if ((ctx->view->index->flags & MAIL_INDEX_OPEN_FLAG_MMAP_SHARED) == 0 ||
+	    MAIL_INDEX_MAP_IS_IN_MEMORY(ctx->view->map))
+		return mail_index_sync_get_atomic_map(ctx);
+
+	/* Expunge directly in the mmap()ed area. Only the pages after the
+	   first expunged record become private to us. */
+	map = mail_index_sync_move_to_private(ctx);
+	mail_index_record_map_move_to_private(map);
+	return map;
+}
+
 struct mail_index_map *
 mail_index_sync_get_atomic_map(struct mail_index_sync_map_ctx *ctx)
 {
@@ -246,8 +284,8 @@ sync_expunge_range(struct mail_index_sync_map_ctx *ctx, const ARRAY_TYPE(seq_ran
 	if (count == 0)
 		return;
 
-	/* Get a private in-memory rec_map, which we can modify. */
-	map = mail_index_sync_get_atomic_map(ctx);
+	/* Get a private rec_map, which we can modify. */
+	map = mail_index_sync_get_expunge_map(ctx);
 
 	/* call the expunge handlers first */
 	if (sync_expunge_handlers_init(ctx)) {
@@ -297,11 +335,44 @@ sync_expunge_range(struct mail_index_sync_map_ctx *ctx, const ARRAY_TYPE(seq_ran
 	}
 }
 
+static void
+mail_index_sync_flush_expunges(struct mail_index_sync_map_ctx *ctx)
+{
+	if (!array_is_created(&ctx->pending_expunges) ||
+	    array_is_empty(&ctx->pending_expunges))
+		return;
+
+	sync_expunge_range(ctx, &ctx->pending_expunges);
+	array_clear(&ctx->pending_expunges);
+}
+
+static ARRAY_TYPE(seq_range) *
+sync_expunge_get_seqs(struct mail_index_sync_map_ctx *ctx)
+{
+	ARRAY_TYPE(seq_range) *seqs;
+
+	if (array_is_created(&ctx->pending_expunges))
+		return &ctx->pending_expunges;
+
+	seqs = t_new(ARRAY_TYPE(seq_range), 1);
+	t_array_init(seqs, 64);
+	return seqs;
+}
+
 static void *sync_append_record(struct mail_index_map *map)
 {
 	size_t append_pos;
 	void *ret;
 
+	if (map->rec_map->buffer == NULL) {
+		/* append to the space reserved after the mmap()ed index */
+		ret = MAIL_INDEX_MAP_IDX(map, map->rec_map->records_count);
+		map->rec_map->mmap_used_size =
+			((char *)ret - (char *)map->rec_map->mmap_base) +
+			map->hdr.record_size;
+		return ret;
+	}
+
 	append_pos = map->rec_map->records_count * map->hdr.record_size;
 	ret = buffer_get_space_unsafe(map->rec_map->buffer, append_pos,
 				      map->hdr.record_size);
@@ -387,9 +458,9 @@ static int sync_append(const struct mail_index_record *rec,
 	}
 
 	/* We'll need to append a new record. If map currently points to
-	   mmap()ed index, it first needs to be moved to memory since we can't
-	   write past the mmap()ed memory area. */
-	map = mail_index_sync_move_to_private_memory(ctx);
+	   mmap()ed index, it first needs to be moved to memory unless there's
+	   space reserved after the mmap()ed memory area. */
+	map = mail_index_sync_get_append_map(ctx);
 
 	if (rec->uid <= map->rec_map->last_appended_uid) {
 		i_assert(map->hdr.messages_count < map->rec_map->records_count);
@@ -519,6 +590,12 @@ mail_index_sync_record_real(struct mail_index_sync_map_ctx *ctx,
 {
 	int ret = 0;
 
+	if ((hdr->type & (MAIL_TRANSACTION_EXPUNGE |
+			  MAIL_TRANSACTION_EXPUNGE_GUID)) == 0) {
+		/* the following records may depend on the expunges */
+		mail_index_sync_flush_expunges(ctx);
+	}
+
 	switch (hdr->type & MAIL_TRANSACTION_TYPE_MASK) {
 	case MAIL_TRANSACTION_APPEND: {
 		const struct mail_index_record *rec, *end;
@@ -534,43 +611,45 @@ mail_index_sync_record_real(struct mail_index_sync_map_ctx *ctx,
 	case MAIL_TRANSACTION_EXPUNGE:
 	case MAIL_TRANSACTION_EXPUNGE|MAIL_TRANSACTION_EXPUNGE_PROT: {
 		const struct mail_transaction_expunge *rec = data, *end;
-		ARRAY_TYPE(seq_range) seqs;
+		ARRAY_TYPE(seq_range) *seqs;
 		uint32_t seq1, seq2;
 
 		if ((hdr->type & MAIL_TRANSACTION_EXTERNAL) == 0) {
 			/* this is simply a request for expunge */
 			break;
 		}
-		t_array_init(&seqs, 64);
+		seqs = sync_expunge_get_seqs(ctx);
 		end = CONST_PTR_OFFSET(data, hdr->size);
 		for (; rec != end; rec++) {
 			if (mail_index_lookup_seq_range(ctx->view,
 					rec->uid1, rec->uid2, &seq1, &seq2))
-				seq_range_array_add_range(&seqs, seq1, seq2);
+				seq_range_array_add_range(seqs, seq1, seq2);
 		}
-		sync_expunge_range(ctx, &seqs);
+		if (seqs != &ctx->pending_expunges)
+			sync_expunge_range(ctx, seqs);
 		break;
 	}
 	case MAIL_TRANSACTION_EXPUNGE_GUID:
 	case MAIL_TRANSACTION_EXPUNGE_GUID|MAIL_TRANSACTION_EXPUNGE_PROT: {
 		const struct mail_transaction_expunge_guid *rec = data, *end;
-		ARRAY_TYPE(seq_range) seqs;
+		ARRAY_TYPE(seq_range) *seqs;
 		uint32_t seq;
 
 		if ((hdr->type & MAIL_TRANSACTION_EXTERNAL) == 0) {
 			/* this is simply a request for expunge */
 			break;
 		}
-		t_array_init(&seqs, 64);
+		seqs = sync_expunge_get_seqs(ctx);
 		end = CONST_PTR_OFFSET(data, hdr->size);
 		for (; rec != end; rec++) {
 			i_assert(rec->uid != 0);
 
 			if (mail_index_lookup_seq(ctx->view, rec->uid, &seq))
-				seq_range_array_add(&seqs, seq);
+				seq_range_array_add(seqs, seq);
 		}
 
-		sync_expunge_range(ctx, &seqs);
+		if (seqs != &ctx->pending_expunges)
+			sync_expunge_range(ctx, seqs);
 		break;
 	}
 	case MAIL_TRANSACTION_FLAG_UPDATE: {
@@ -832,7 +911,11 @@ void mail_index_sync_map_deinit(struct mail_index_sync_map_ctx *sync_map_ctx)
 {
 	i_assert(sync_map_ctx->modseq_ctx == NULL);
 
+	i_assert(!array_is_created(&sync_map_ctx->pending_expunges) ||
+		 array_is_empty(&sync_map_ctx->pending_expunges));
+
 	buffer_free(&sync_map_ctx->unknown_extensions);
+	array_free(&sync_map_ctx->pending_expunges);
 	if (sync_map_ctx->expunge_handlers_used)
 		mail_index_sync_deinit_expunge_handlers(sync_map_ctx);
 	mail_index_sync_deinit_handlers(sync_map_ctx);
@@ -988,6 +1071,9 @@ int mail_index_sync_map(struct mail_index_map **_map,
 					       &prev_seq, &prev_offset);
 
 	mail_index_sync_map_init(&sync_map_ctx, view, type);
+	/* Nothing looks at the map until the whole log is synced, so
+	   consecutive expunge transactions can be applied in one pass. */
+	i_array_init(&sync_map_ctx.pending_expunges, 64);
 	if (reset) {
 		/* Reset the entire index. Leave only indexid and
 		   log_file_seq. */
@@ -1023,6 +1109,7 @@ int mail_index_sync_map(struct mail_index_map **_map,
 		/* we'll just skip over broken entries */
 		(void)mail_index_sync_record(&sync_map_ctx, thdr, tdata);
 	}
+	mail_index_sync_flush_expunges(&sync_map_ctx);
 	map = view->map;
 
 	if (had_dirty)
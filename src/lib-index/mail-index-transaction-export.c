@@ -20,6 +20,33 @@ log_append_buffer(struct mail_index_export_context *ctx,
 					buf->data, buf->used);
 }
 
+static bool
+log_append_packed_flag_updates(struct mail_index_export_context *ctx,
+			       const struct mail_transaction_flag_update *updates,
+			       unsigned int count)
+{
+	struct mail_transaction_log *log = ctx->append_ctx->log;
+	const struct mail_transaction_log_header *hdr = &log->head->hdr;
+	bool ret;
+
+	if ((log->index->flags & MAIL_INDEX_OPEN_FLAG_LOG_PACKED_FLAG_UPDATES) == 0)
+		return FALSE;
+	if (!MAIL_TRANSACTION_LOG_VERSION_HAVE(
+		MAIL_TRANSACTION_LOG_HDR_VERSION(hdr), PACKED_FLAG_UPDATES))
+		return FALSE;
+
+	T_BEGIN {
+		buffer_t *buf = t_buffer_create(count * 8);
+
+		ret = mail_index_pack_flag_updates(buf, updates, count);
+		if (ret) {
+			log_append_buffer(ctx, buf,
+					  MAIL_TRANSACTION_FLAG_UPDATE_PACKED);
+		}
+	} T_END;
+	return ret;
+}
+
 static void log_append_flag_updates(struct mail_index_export_context *ctx,
 				    struct mail_index_transaction *t)
 {
@@ -43,8 +70,13 @@ static void log_append_flag_updates(struct mail_index_export_context *ctx,
 		if ((updates[i].add_flags & MAIL_INDEX_MAIL_FLAG_UPDATE_MODSEQ) != 0)
 			log_update->modseq_inc_flag = 1;
 	}
-	log_append_buffer(ctx, log_updates.arr.buffer,
-			  MAIL_TRANSACTION_FLAG_UPDATE);
+	if (!log_append_packed_flag_updates(ctx, array_front(&log_updates),
+					    count)) {
+		/* packing is disabled, the log format is too old or the
+		   updates can't be packed */
+		log_append_buffer(ctx, log_updates.arr.buffer,
+				  MAIL_TRANSACTION_FLAG_UPDATE);
+	}
 	array_free(&log_updates);
 }
 
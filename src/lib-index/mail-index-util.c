@@ -3,7 +3,9 @@
 #include "lib.h"
 #include "array.h"
 #include "bsearch-insert-pos.h"
+#include "numpack.h"
 #include "mail-index-private.h"
+#include "mail-transaction-log.h"
 
 uint32_t mail_index_uint32_to_offset(uint32_t offset)
 {
@@ -145,3 +147,93 @@ bool mail_index_seq_array_add(ARRAY_TYPE(seq_array) *array, uint32_t seq,
 		return FALSE;
 	}
 }
+
+bool mail_index_pack_flag_updates(buffer_t *dest,
+				  const struct mail_transaction_flag_update *updates,
+				  unsigned int count)
+{
+	size_t start_pos = dest->used;
+	uint32_t prev_uid2 = 0;
+	uint64_t range;
+	unsigned int i;
+
+	for (i = 0; i < count; i++) {
+		if (updates[i].uid1 <= prev_uid2 ||
+		    updates[i].uid1 > updates[i].uid2)
+			return FALSE;
+
+		/* the lowest bit of the range is modseq_inc_flag */
+		range = (uint64_t)(updates[i].uid2 - updates[i].uid1) << 1;
+		if (updates[i].modseq_inc_flag != 0)
+			range |= 1;
+		numpack_encode(dest, updates[i].uid1 - prev_uid2);
+		numpack_encode(dest, range);
+		buffer_append_c(dest, updates[i].add_flags);
+		buffer_append_c(dest, updates[i].remove_flags);
+		prev_uid2 = updates[i].uid2;
+	}
+	/* records need to be 32bit aligned */
+	if (((dest->used - start_pos) % 4) != 0)
+		buffer_append_zero(dest, 4 - (dest->used - start_pos) % 4);
+	return TRUE;
+}
+
+int mail_index_unpack_flag_update_next(const uint8_t **_p, const uint8_t *end,
+				       uint32_t *prev_uid2,
+				       struct mail_transaction_flag_update *u_r,
+				       const char **error_r)
+{
+	const uint8_t *p = *_p;
+	uint64_t uid_diff, range;
+
+	/* each update takes at least 4 bytes. anything smaller is the
+	   padding at the end. */
+	if (end - p < 4) {
+		for (; p < end; p++) {
+			if (*p != 0) {
+				*error_r = "Packed flag update has garbage at the end";
+				return -1;
+			}
+		}
+		*_p = p;
+		return 0;
+	}
+
+	if (numpack_decode(&p, end, &uid_diff) < 0 ||
+	    numpack_decode(&p, end, &range) < 0 || end - p < 2) {
+		*error_r = "Truncated packed flag update";
+		return -1;
+	}
+	if (uid_diff == 0) {
+		*error_r = "Non-sorted UID ranges in packed flag update";
+		return -1;
+	}
+	if (uid_diff > (uint32_t)-1 - *prev_uid2 ||
+	    (range >> 1) > (uint32_t)-1 - (*prev_uid2 + uid_diff)) {
+		*error_r = "UID overflow in packed flag update";
+		return -1;
+	}
+	i_zero(u_r);
+	u_r->uid1 = *prev_uid2 + uid_diff;
+	u_r->uid2 = u_r->uid1 + (range >> 1);
+	u_r->modseq_inc_flag = range & 1;
+	u_r->add_flags = p[0];
+	u_r->remove_flags = p[1];
+	*_p = p + 2;
+	*prev_uid2 = u_r->uid2;
+	return 1;
+}
+
+int mail_index_unpack_flag_updates(const void *data, size_t size,
+				   buffer_t *dest, const char **error_r)
+{
+	const uint8_t *p = data, *end = p + size;
+	struct mail_transaction_flag_update u;
+	uint32_t prev_uid2 = 0;
+	int ret;
+
+	while ((ret = mail_index_unpack_flag_update_next(&p, end, &prev_uid2,
+							 &u, error_r)) > 0)
+		buffer_append(dest, &u, sizeof(u));
+	return ret;
+}
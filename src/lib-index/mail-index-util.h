@@ -1,6 +1,8 @@
 #ifndef MAIL_INDEX_UTIL_H
 #define MAIL_INDEX_UTIL_H
 
+struct mail_transaction_flag_update;
+
 ARRAY_DEFINE_TYPE(seq_array, uint32_t);
 
 uint32_t mail_index_uint32_to_offset(uint32_t offset);
@@ -19,4 +21,24 @@ bool mail_index_seq_array_add(ARRAY_TYPE(seq_array) *array, uint32_t seq,
 			      const void *record, size_t record_size,
 			      void *old_record) ATTR_NULL(5);
 
+/* Append the flag updates to dest in MAIL_TRANSACTION_FLAG_UPDATE_PACKED
+   format. Returns FALSE if the updates can't be packed, because they
+   aren't sorted by UID or they overlap. */
+bool mail_index_pack_flag_updates(buffer_t *dest,
+				  const struct mail_transaction_flag_update *updates,
+				  unsigned int count);
+/* Read the next update from MAIL_TRANSACTION_FLAG_UPDATE_PACKED record
+   contents at *p and move *p past it. *prev_uid2 must be 0 for the first
+   update. Returns 1 if an update was read, 0 at the end of the record, -1 if
+   the data is corrupted. */
+int mail_index_unpack_flag_update_next(const uint8_t **p, const uint8_t *end,
+				       uint32_t *prev_uid2,
+				       struct mail_transaction_flag_update *u_r,
+				       const char **error_r);
+/* Unpack MAIL_TRANSACTION_FLAG_UPDATE_PACKED record contents and append them
+   to dest as struct mail_transaction_flag_update[]. Returns 0 on success,
+   -1 if the data is corrupted. */
+int mail_index_unpack_flag_updates(const void *data, size_t size,
+				   buffer_t *dest, const char **error_r);
+
 #endif
@@ -40,6 +40,21 @@ enum mail_index_open_flags {
 	/* MAIL_INDEX_MAIL_FLAG_DIRTY can be used as a backend-specific flag.
 	   All special handling of the flag is disabled by this. */
 	MAIL_INDEX_OPEN_FLAG_NO_DIRTY		= 0x1000,
+	/* Keep the mmap()ed index file mapped while syncing appends and
+	   expunges, instead of copying all the records to memory. Only the
+	   modified pages become private to the process, the rest stay shared
+	   with the other processes that have the same index mapped. */
+	MAIL_INDEX_OPEN_FLAG_MMAP_SHARED	= 0x2000,
+	/* Write a checksum for each transaction to newly created transaction
+	   log files. This allows readers to verify appended transactions
+	   without having to check afterwards that the mmap()ed file didn't
+	   change while it was being read. Useful only for local
+	   filesystems. */
+	MAIL_INDEX_OPEN_FLAG_LOG_CHECKSUMS	= 0x4000,
+	/* Write flag updates as MAIL_TRANSACTION_FLAG_UPDATE_PACKED records.
+	   Newly created transaction log files get the minor version that
+	   supports them, so older Dovecot versions can't read the logs. */
+	MAIL_INDEX_OPEN_FLAG_LOG_PACKED_FLAG_UPDATES = 0x8000,
 };
 
 enum mail_index_header_compat_flags {
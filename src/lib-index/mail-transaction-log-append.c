@@ -3,6 +3,7 @@
 #include "lib.h"
 #include "array.h"
 #include "write-full.h"
+#include "crc32.h"
 #include "mail-index-private.h"
 #include "mail-transaction-log-private.h"
 
@@ -137,7 +138,7 @@ log_append_sync_offset_if_needed(struct mail_transaction_log_append_ctx *ctx)
 	} else if (file->max_tail_offset == file->sync_offset) {
 		/* we're synced all the way to tail offset, so this sync
 		   transaction can also be included in the same tail offset. */
-		if (ctx->output->used == 0 && !ctx->tail_offset_changed) {
+		if (ctx->transaction_count <= 1 && !ctx->tail_offset_changed) {
 			/* nothing to write here after all (e.g. all unchanged
 			   flag updates were dropped by export) */
 			return;
@@ -170,26 +171,11 @@ log_append_sync_offset_if_needed(struct mail_transaction_log_append_ctx *ctx)
 					buf.data, buf.used);
 }
 
-static int
-mail_transaction_log_append_locked(struct mail_transaction_log_append_ctx *ctx)
+static void
+log_append_boundary(struct mail_transaction_log_append_ctx *ctx)
 {
-	struct mail_transaction_log_file *file = ctx->log->head;
 	struct mail_transaction_boundary *boundary;
 
-	if (file->sync_offset < file->last_size) {
-		/* there is some garbage at the end of the transaction log
-		   (eg. previous write failed). remove it so reader doesn't
-		   break because of it. */
-		buffer_set_used_size(file->buffer,
-				     file->sync_offset - file->buffer_offset);
-		if (!MAIL_TRANSACTION_LOG_FILE_IN_MEMORY(file)) {
-			if (ftruncate(file->fd, file->sync_offset) < 0) {
-				mail_index_file_set_syscall_error(ctx->log->index,
-					file->filepath, "ftruncate()");
-			}
-		}
-	}
-
 	/* don't include log_file_tail_offset update in the transaction */
 	boundary = buffer_get_space_unsafe(ctx->output,
 				sizeof(struct mail_transaction_header),
@@ -206,6 +192,60 @@ mail_transaction_log_append_locked(struct mail_transaction_log_append_ctx *ctx)
 	}
 
 	log_append_sync_offset_if_needed(ctx);
+}
+
+static void
+log_append_boundary_crc(struct mail_transaction_log_append_ctx *ctx)
+{
+	struct mail_transaction_boundary_crc *boundary;
+	const size_t boundary_size = sizeof(struct mail_transaction_header) +
+		sizeof(*boundary);
+
+	if (ctx->transaction_count <= 2) {
+		/* 0-1 changes. The boundary would be as large as the change
+		   itself, so don't bother with it. Readers verify records
+		   without a boundary by checking the file size instead. */
+		buffer_delete(ctx->output, 0, boundary_size);
+		log_append_sync_offset_if_needed(ctx);
+		return;
+	}
+
+	/* The boundary covers the whole write, including the
+	   log_file_tail_offset update, so readers can verify all of it. */
+	log_append_sync_offset_if_needed(ctx);
+
+	boundary = buffer_get_space_unsafe(ctx->output,
+				sizeof(struct mail_transaction_header),
+				sizeof(*boundary));
+	boundary->size = ctx->output->used;
+	boundary->crc32 = crc32_data(CONST_PTR_OFFSET(ctx->output->data,
+						      boundary_size),
+				     ctx->output->used - boundary_size);
+}
+
+static int
+mail_transaction_log_append_locked(struct mail_transaction_log_append_ctx *ctx)
+{
+	struct mail_transaction_log_file *file = ctx->log->head;
+
+	if (file->sync_offset < file->last_size) {
+		/* there is some garbage at the end of the transaction log
+		   (eg. previous write failed). remove it so reader doesn't
+		   break because of it. */
+		buffer_set_used_size(file->buffer,
+				     file->sync_offset - file->buffer_offset);
+		if (!MAIL_TRANSACTION_LOG_FILE_IN_MEMORY(file)) {
+			if (ftruncate(file->fd, file->sync_offset) < 0) {
+				mail_index_file_set_syscall_error(ctx->log->index,
+					file->filepath, "ftruncate()");
+			}
+		}
+	}
+
+	if (MAIL_TRANSACTION_LOG_FILE_HAS_CHECKSUMS(file))
+		log_append_boundary_crc(ctx);
+	else
+		log_append_boundary(ctx);
 	if (log_buffer_write(ctx) < 0)
 		return -1;
 	file->sync_highest_modseq = ctx->new_highest_modseq;
@@ -217,7 +257,8 @@ int mail_transaction_log_append_begin(struct mail_index *index,
 				      struct mail_transaction_log_append_ctx **ctx_r)
 {
 	struct mail_transaction_log_append_ctx *ctx;
-	struct mail_transaction_boundary boundary;
+	struct mail_transaction_boundary_crc boundary;
+	size_t boundary_size;
 
 	if (!index->log_sync_locked) {
 		if (mail_transaction_log_lock_head(index->log, "appending") < 0)
@@ -228,9 +269,13 @@ int mail_transaction_log_append_begin(struct mail_index *index,
 	ctx->output = buffer_create_dynamic(default_pool, 1024);
 	ctx->trans_flags = flags;
 
+	/* the boundary is filled when committing */
 	i_zero(&boundary);
+	boundary_size = MAIL_TRANSACTION_LOG_FILE_HAS_CHECKSUMS(index->log->head) ?
+		sizeof(struct mail_transaction_boundary_crc) :
+		sizeof(struct mail_transaction_boundary);
 	mail_transaction_log_append_add(ctx, MAIL_TRANSACTION_BOUNDARY,
-					&boundary, sizeof(boundary));
+					&boundary, boundary_size);
 
 	*ctx_r = ctx;
 	return 0;
@@ -8,6 +8,7 @@
 #include "read-full.h"
 #include "write-full.h"
 #include "mmap-util.h"
+#include "crc32.h"
 #include "mail-index-private.h"
 #include "mail-index-modseq.h"
 #include "mail-transaction-log-private.h"
@@ -227,13 +228,15 @@ mail_transaction_log_init_hdr(struct mail_transaction_log *log,
 
 	i_zero(hdr);
 	hdr->major_version = MAIL_TRANSACTION_LOG_MAJOR_VERSION;
-	hdr->minor_version = MAIL_TRANSACTION_LOG_MINOR_VERSION;
+	hdr->minor_version = MAIL_TRANSACTION_LOG_INDEX_MINOR_VERSION(index);
 	hdr->hdr_size = sizeof(struct mail_transaction_log_header);
 	hdr->indexid = log->index->indexid;
 	hdr->create_stamp = ioloop_time32;
 #ifndef WORDS_BIGENDIAN
 	hdr->compat_flags |= MAIL_INDEX_COMPAT_LITTLE_ENDIAN;
 #endif
+	if ((index->flags & MAIL_INDEX_OPEN_FLAG_LOG_CHECKSUMS) != 0)
+		hdr->flags |= MAIL_TRANSACTION_LOG_HDR_FLAG_CHECKSUMS;
 
 	if (index->fd != -1) {
 		/* not creating index - make sure we have latest header */
@@ -1045,6 +1048,29 @@ flag_updates_have_non_internal(const struct mail_transaction_flag_update *u,
 	return FALSE;
 }
 
+static bool
+packed_flag_updates_have_non_internal(const void *data, size_t size,
+				      unsigned int version)
+{
+	const uint8_t *p = data, *end = p + size;
+	struct mail_transaction_flag_update u;
+	uint32_t prev_uid2 = 0;
+	const char *error;
+	int ret;
+
+	if (!MAIL_TRANSACTION_LOG_VERSION_HAVE(version, HIDE_INTERNAL_MODSEQS))
+		return TRUE;
+
+	while ((ret = mail_index_unpack_flag_update_next(&p, end, &prev_uid2,
+							 &u, &error)) > 0) {
+		if (!MAIL_TRANSACTION_FLAG_UPDATE_IS_INTERNAL(&u))
+			return TRUE;
+	}
+	/* if the record is corrupted, the log view will notice it later on.
+	   until then just assume that modseq increases. */
+	return ret < 0;
+}
+
 void mail_transaction_update_modseq(const struct mail_transaction_header *hdr,
 				    const void *data, uint64_t *cur_modseq,
 				    unsigned int version)
@@ -1100,6 +1126,11 @@ void mail_transaction_update_modseq(const struct mail_transaction_header *hdr,
 			*cur_modseq += 1;
 		break;
 	}
+	case MAIL_TRANSACTION_FLAG_UPDATE_PACKED:
+		if (packed_flag_updates_have_non_internal(data,
+				trans_size - sizeof(*hdr), version))
+			*cur_modseq += 1;
+		break;
 	case MAIL_TRANSACTION_MODSEQ_UPDATE: {
 		const struct mail_transaction_modseq_update *rec, *end;
 
@@ -1114,6 +1145,35 @@ void mail_transaction_update_modseq(const struct mail_transaction_header *hdr,
 	}
 }
 
+static int
+log_file_track_boundary_crc(struct mail_transaction_log_file *file,
+			    const struct mail_transaction_header *hdr,
+			    unsigned int trans_size, const char **error_r)
+{
+	const struct mail_transaction_boundary_crc *boundary =
+		(const void *)(hdr + 1);
+
+	if (trans_size < sizeof(*hdr) + sizeof(*boundary) ||
+	    boundary->size < trans_size) {
+		/* written without a checksum */
+		return 1;
+	}
+	if (crc32_data(CONST_PTR_OFFSET(hdr, trans_size),
+		       boundary->size - trans_size) != boundary->crc32) {
+		if (!file->locked) {
+			/* the transaction is most likely still being
+			   written. if it's corrupted, the next sync with
+			   the log locked will notice it. */
+			return 0;
+		}
+		*error_r = "Transaction checksum mismatch";
+		mail_transaction_log_file_set_corrupted(file, "%s", *error_r);
+		return -1;
+	}
+	file->checksum_verified_offset = file->sync_offset + boundary->size;
+	return 1;
+}
+
 static int
 log_file_track_sync(struct mail_transaction_log_file *file,
 		    const struct mail_transaction_header *hdr,
@@ -1165,6 +1225,12 @@ log_file_track_sync(struct mail_transaction_log_file *file,
 			/* the full transaction hasn't been written yet */
 			return 0;
 		}
+		if (MAIL_TRANSACTION_LOG_FILE_HAS_CHECKSUMS(file)) {
+			ret = log_file_track_boundary_crc(file, hdr, trans_size,
+							  error_r);
+			if (ret <= 0)
+				return ret;
+		}
 		break;
 	}
 	}
@@ -1187,10 +1253,16 @@ mail_transaction_log_file_sync(struct mail_transaction_log_file *file,
 	struct stat st;
 	size_t size, avail;
 	uint32_t trans_size = 0;
+	bool need_size_check;
 	int ret;
 
 	i_assert(file->sync_offset >= file->buffer_offset);
 
+	/* If all the transactions read here have a valid checksum, they
+	   were fully written and there's no need to check for changes in
+	   the file size. */
+	need_size_check = !MAIL_TRANSACTION_LOG_FILE_HAS_CHECKSUMS(file);
+
 	*retry_r = FALSE;
 
 	data = buffer_get_data(file->buffer, &size);
@@ -1228,10 +1300,12 @@ mail_transaction_log_file_sync(struct mail_transaction_log_file *file,
 			break;
 		}
 
+		if (file->sync_offset >= file->checksum_verified_offset)
+			need_size_check = TRUE;
 		file->sync_offset += trans_size;
 	}
 
-	if (file->mmap_base != NULL && !file->locked) {
+	if (file->mmap_base != NULL && !file->locked && need_size_check) {
 		/* Now that all the mmaped pages have page faulted, check if
 		   the file had changed while doing that. Only after the last
 		   page has faulted, the size returned by fstat() can be
@@ -1530,6 +1604,25 @@ mail_transaction_log_file_munmap(struct mail_transaction_log_file *file)
 	buffer_free(&file->buffer);
 }
 
+static void
+mail_transaction_log_file_willneed(struct mail_transaction_log_file *file,
+				   uoff_t start_offset)
+{
+	size_t page_size = mmap_get_page_size();
+	uoff_t offset = start_offset - start_offset % page_size;
+
+	if (offset >= file->mmap_size ||
+	    file->mmap_size - offset <= page_size)
+		return;
+
+	/* we're going to read everything after start_offset. start reading
+	   it all in already instead of faulting in the pages one by one. */
+	errno = posix_madvise(PTR_OFFSET(file->mmap_base, offset),
+			      file->mmap_size - offset, POSIX_MADV_WILLNEED);
+	if (errno != 0)
+		log_file_set_syscall_error(file, "posix_madvise()");
+}
+
 static int
 mail_transaction_log_file_map_mmap(struct mail_transaction_log_file *file,
 				   uoff_t start_offset, const char **reason_r)
@@ -1579,6 +1672,7 @@ mail_transaction_log_file_map_mmap(struct mail_transaction_log_file *file,
 
 		if (mail_transaction_log_file_mmap(file, reason_r) < 0)
 			return -1;
+		mail_transaction_log_file_willneed(file, start_offset);
 		ret = mail_transaction_log_file_sync(file, &retry, reason_r);
 	} while (retry);
 
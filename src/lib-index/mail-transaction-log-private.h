@@ -12,6 +12,13 @@ struct dotlock_settings;
 #define MAIL_TRANSACTION_LOG_DOTLOCK_CHANGE_TIMEOUT (3*60)
 
 #define MAIL_TRANSACTION_LOG_FILE_IN_MEMORY(file) ((file)->fd == -1)
+#define MAIL_TRANSACTION_LOG_FILE_HAS_CHECKSUMS(file) \
+	(((file)->hdr.flags & MAIL_TRANSACTION_LOG_HDR_FLAG_CHECKSUMS) != 0)
+/* Minor version for the index's newly created log files */
+#define MAIL_TRANSACTION_LOG_INDEX_MINOR_VERSION(index) \
+	(((index)->flags & MAIL_INDEX_OPEN_FLAG_LOG_PACKED_FLAG_UPDATES) != 0 ? \
+	 MAIL_TRANSACTION_LOG_PACKED_MINOR_VERSION : \
+	 MAIL_TRANSACTION_LOG_MINOR_VERSION)
 
 #define LOG_FILE_MODSEQ_CACHE_SIZE 10
 
@@ -80,6 +87,9 @@ struct mail_transaction_log_file {
 	   MAIL_TRANSACTION_INDEX_UNDELETED records. These are used to update
 	   mail_index.index_delete* fields. */
 	uoff_t index_deleted_offset, index_undeleted_offset;
+	/* With MAIL_TRANSACTION_LOG_HDR_FLAG_CHECKSUMS: The end offset of the
+	   last transaction whose checksum was successfully verified. */
+	uoff_t checksum_verified_offset;
 
 	/* Cache to optimize mail_transaction_log_file_get_modseq_next_offset()
 	   so it doesn't always have to start from the beginning of the log
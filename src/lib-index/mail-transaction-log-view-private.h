@@ -11,6 +11,9 @@ struct mail_transaction_log_view {
 	uoff_t min_file_offset, max_file_offset;
 
 	struct mail_transaction_header tmp_hdr;
+	/* Packed records converted to their unpacked format. The record
+	   header is followed by its data. */
+	buffer_t *unpacked_buf;
 
 	/* a list of log files we've referenced. we have to keep this list
 	   explicitly because more files may be added into the linked list
@@ -58,6 +58,7 @@ void mail_transaction_log_view_close(struct mail_transaction_log_view **_view)
 	mail_transaction_logs_clean(view->log);
 
 	array_free(&view->file_refs);
+	buffer_free(&view->unpacked_buf);
 	i_free(view);
 }
 
@@ -770,6 +771,46 @@ log_view_is_record_valid(struct mail_transaction_log_file *file,
 	return TRUE;
 }
 
+static int
+log_view_unpack_record(struct mail_transaction_log_view *view,
+		       struct mail_transaction_log_file *file,
+		       const struct mail_transaction_header **hdr,
+		       const void **data)
+{
+	struct mail_transaction_header new_hdr;
+	uint32_t rec_size;
+	const char *error;
+
+	i_assert(((*hdr)->type & MAIL_TRANSACTION_TYPE_MASK) ==
+		 MAIL_TRANSACTION_FLAG_UPDATE_PACKED);
+
+	if (view->unpacked_buf == NULL)
+		view->unpacked_buf = buffer_create_dynamic(default_pool, 1024);
+	buffer_set_used_size(view->unpacked_buf, 0);
+	buffer_append_zero(view->unpacked_buf, sizeof(new_hdr));
+
+	rec_size = mail_index_offset_to_uint32((*hdr)->size) - sizeof(**hdr);
+	if (mail_index_unpack_flag_updates(*data, rec_size,
+					   view->unpacked_buf, &error) < 0) {
+		mail_transaction_log_file_set_corrupted(file, "%s", error);
+		return -1;
+	}
+	if (view->unpacked_buf->used >= 0x40000000) {
+		mail_transaction_log_file_set_corrupted(file,
+			"Packed flag update record is too large");
+		return -1;
+	}
+
+	new_hdr.type = ((*hdr)->type & ENUM_NEGATE(MAIL_TRANSACTION_TYPE_MASK)) |
+		MAIL_TRANSACTION_FLAG_UPDATE;
+	new_hdr.size = mail_index_uint32_to_offset(view->unpacked_buf->used);
+	buffer_write(view->unpacked_buf, 0, &new_hdr, sizeof(new_hdr));
+
+	*hdr = view->unpacked_buf->data;
+	*data = CONST_PTR_OFFSET(*hdr, sizeof(**hdr));
+	return 0;
+}
+
 static int
 log_view_get_next(struct mail_transaction_log_view *view,
 		  const struct mail_transaction_header **hdr_r,
@@ -837,6 +878,10 @@ log_view_get_next(struct mail_transaction_log_view *view,
 		return -1;
 	}
 
+	if (rec_type == MAIL_TRANSACTION_FLAG_UPDATE_PACKED &&
+	    log_view_unpack_record(view, file, &hdr, &data) < 0)
+		return -1;
+
 	T_BEGIN {
 		ret = log_view_is_record_valid(file, hdr, data) ? 1 : -1;
 	} T_END;
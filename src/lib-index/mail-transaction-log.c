@@ -220,7 +220,8 @@ bool mail_transaction_log_want_rotate(struct mail_transaction_log *log,
 
 	if (file->hdr.major_version < MAIL_TRANSACTION_LOG_MAJOR_VERSION ||
 	    (file->hdr.major_version == MAIL_TRANSACTION_LOG_MAJOR_VERSION &&
-	     file->hdr.minor_version < MAIL_TRANSACTION_LOG_MINOR_VERSION)) {
+	     file->hdr.minor_version <
+	     MAIL_TRANSACTION_LOG_INDEX_MINOR_VERSION(log->index))) {
 		/* upgrade immediately to a new log file format */
 		*reason_r = t_strdup_printf(
 			".log file format version %u.%u is too old",
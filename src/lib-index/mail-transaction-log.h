@@ -7,6 +7,9 @@
 
 #define MAIL_TRANSACTION_LOG_MAJOR_VERSION 1
 #define MAIL_TRANSACTION_LOG_MINOR_VERSION 3
+/* Minor version of the log files created with
+   MAIL_INDEX_OPEN_FLAG_LOG_PACKED_FLAG_UPDATES */
+#define MAIL_TRANSACTION_LOG_PACKED_MINOR_VERSION 4
 /* Minimum allowed mail_transaction_log_header.hdr_size. If it's smaller,
    assume the file is corrupted. */
 #define MAIL_TRANSACTION_LOG_HEADER_MIN_SIZE 24
@@ -32,6 +35,10 @@
    See MAIL_TRANSACTION_FLAG_UPDATE_IS_INTERNAL(). */
 #define MAIL_TRANSACTION_LOG_VERSION_FEATURE_HIDE_INTERNAL_MODSEQS \
 	MAIL_TRANSACTION_LOG_VERSION_FULL(1, 3)
+/* Log feature: Flag updates can be written as
+   MAIL_TRANSACTION_FLAG_UPDATE_PACKED records. */
+#define MAIL_TRANSACTION_LOG_VERSION_FEATURE_PACKED_FLAG_UPDATES \
+	MAIL_TRANSACTION_LOG_VERSION_FULL(1, 4)
 
 struct mail_transaction_log_header {
 	/* Major version is increased only when you can't have backwards
@@ -77,12 +84,23 @@ struct mail_transaction_log_header {
 	/* Same as enum mail_index_header_compat_flags. Needs
 	   MAIL_TRANSACTION_LOG_VERSION_FEATURE_COMPAT_FLAGS. */
 	uint8_t compat_flags;
+	/* enum mail_transaction_log_header_flags */
+	uint8_t flags;
 	/* Unused fields to make the struct 64bit aligned. These can be used
 	   to add more fields to the header. */
-	uint8_t unused[3];
+	uint8_t unused[2];
 	uint32_t unused2;
 };
 
+enum mail_transaction_log_header_flags {
+	/* Each write of multiple records to the log begins with a
+	   MAIL_TRANSACTION_BOUNDARY record containing
+	   struct mail_transaction_boundary_crc. Single records are written
+	   without it. Older versions ignore the flag and may still append
+	   records without checksums to the file. */
+	MAIL_TRANSACTION_LOG_HDR_FLAG_CHECKSUMS = 0x01,
+};
+
 enum mail_transaction_type {
 	/* struct mail_transaction_expunge[] - Expunge the UIDs.
 	   Must have MAIL_TRANSACTION_EXPUNGE_PROT ORed to this. Avoid using
@@ -159,6 +177,21 @@ enum mail_transaction_type {
 		- For each "+" only: Length of the attribute value.
 	   */
 	MAIL_TRANSACTION_ATTRIBUTE_UPDATE       = 0x00100000,
+	/* Same as MAIL_TRANSACTION_FLAG_UPDATE, but the
+	   struct mail_transaction_flag_update[] is packed to save space.
+	   Each update is written as:
+	    - numpack: uid1 - previous update's uid2 (or 0 for the first)
+	    - numpack: (uid2 - uid1) << 1 | (modseq_inc_flag != 0)
+	    - uint8_t add_flags
+	    - uint8_t remove_flags
+	    - This repeats for each update. The UID ranges must be sorted
+	      and they can't overlap.
+	   - 0..3 bytes of zero padding for 32bit alignment
+
+	   Log readers convert these back to MAIL_TRANSACTION_FLAG_UPDATE
+	   records, see mail_index_unpack_flag_updates(). Needs
+	   MAIL_TRANSACTION_LOG_VERSION_FEATURE_PACKED_FLAG_UPDATES. */
+	MAIL_TRANSACTION_FLAG_UPDATE_PACKED	= 0x00200000,
 
 	/* Mask to get the attribute type only (excluding flags). */
 	MAIL_TRANSACTION_TYPE_MASK		= 0x0fffffff,
@@ -343,6 +376,15 @@ struct mail_transaction_boundary {
 	/* Size of the whole transaction, including this record and header. */
 	uint32_t size;
 };
+/* See MAIL_TRANSACTION_BOUNDARY. Used instead of
+   struct mail_transaction_boundary in log files that have
+   MAIL_TRANSACTION_LOG_HDR_FLAG_CHECKSUMS. */
+struct mail_transaction_boundary_crc {
+	/* Size of the whole transaction, including this record and header. */
+	uint32_t size;
+	/* CRC32 of the rest of the transaction following this record. */
+	uint32_t crc32;
+};
 
 struct mail_transaction_log_append_ctx {
 	struct mail_transaction_log *log;
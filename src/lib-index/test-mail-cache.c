@@ -1,6 +1,8 @@
 /* Copyright (c) 2020 Dovecot authors, see the included COPYING file */
 
 #include "lib.h"
+#include "ioloop.h"
+#include "array.h"
 #include "str.h"
 #include "write-full.h"
 #include "test-common.h"
@@ -806,6 +808,180 @@ static void test_mail_cache_duplicate_fields(void)
 	test_end();
 }
 
+static void test_mail_cache_columns(void)
+{
+	struct mail_cache_field cache_fields[] = {
+		{
+			.name = "fixed.col",
+			.type = MAIL_CACHE_FIELD_FIXED_SIZE,
+			.field_size = 4,
+			.decision = MAIL_CACHE_DECISION_YES,
+		},
+		{
+			.name = "string",
+			.type = MAIL_CACHE_FIELD_STRING,
+			.decision = MAIL_CACHE_DECISION_YES,
+		},
+	};
+	const uint8_t fixed_data[][4] = {
+		{ 0x12, 0x34, 0x56, 0x78 },
+		{ 0x9a, 0xbc, 0xde, 0xf0 },
+	};
+	struct test_mail_cache_ctx ctx;
+	struct mail_index_transaction *trans;
+	struct mail_cache_view *cache_view;
+	struct mail_cache_transaction_ctx *cache_trans;
+	const void *data;
+	string_t *str = t_str_new(16);
+
+	test_begin("mail cache columns");
+	test_mail_cache_init(test_mail_index_init(TRUE), &ctx);
+	mail_cache_register_fields(ctx.cache, cache_fields,
+				   N_ELEMENTS(cache_fields),
+				   unsafe_data_stack_pool);
+	test_assert(mail_cache_register_column(ctx.cache, cache_fields[0].idx));
+	test_assert(!mail_cache_register_column(ctx.cache, cache_fields[1].idx));
+
+	test_mail_cache_add_mail(&ctx, UINT_MAX, NULL);
+	test_mail_cache_add_mail(&ctx, UINT_MAX, NULL);
+
+	cache_view = mail_cache_view_open(ctx.cache, ctx.view);
+	test_assert(mail_cache_column_lookup(cache_view, 1,
+		cache_fields[0].idx, &data) == 0);
+
+	trans = mail_index_transaction_begin(ctx.view, 0);
+	cache_trans = mail_cache_get_transaction(cache_view, trans);
+	for (uint32_t seq = 1; seq <= 2; seq++) {
+		mail_cache_add(cache_trans, seq, cache_fields[0].idx,
+			       fixed_data[seq-1], sizeof(fixed_data[seq-1]));
+	}
+	test_assert(mail_index_transaction_commit(&trans) == 0);
+	test_mail_cache_view_sync(&ctx);
+
+	for (uint32_t seq = 1; seq <= 2; seq++) {
+		test_assert_idx(mail_cache_column_lookup(cache_view, seq,
+			cache_fields[0].idx, &data) == 1, seq);
+		test_assert_idx(memcmp(data, fixed_data[seq-1], 4) == 0, seq);
+		test_assert_idx(mail_cache_field_exists(cache_view, seq,
+			cache_fields[0].idx) == 1, seq);
+	}
+
+	/* the column is used even if the cache file is lost */
+	i_unlink(ctx.cache->filepath);
+	test_assert(mail_cache_reopen(ctx.cache) == 0);
+	test_assert(mail_cache_lookup_field(cache_view, str, 2,
+					    cache_fields[0].idx) == 1);
+	test_assert(str_len(str) == 4 &&
+		    memcmp(str_data(str), fixed_data[1], 4) == 0);
+
+	/* expunging the first mail moves the second one's value to seq 1 */
+	trans = mail_index_transaction_begin(ctx.view, 0);
+	mail_index_expunge(trans, 1);
+	test_assert(mail_index_transaction_commit(&trans) == 0);
+	test_mail_cache_index_sync(&ctx);
+	test_mail_cache_view_sync(&ctx);
+
+	test_assert(mail_index_view_get_messages_count(ctx.view) == 1);
+	test_assert(mail_cache_column_lookup(cache_view, 1,
+		cache_fields[0].idx, &data) == 1);
+	test_assert(memcmp(data, fixed_data[1], 4) == 0);
+
+	mail_cache_view_close(&cache_view);
+	test_mail_cache_deinit(&ctx);
+	test_mail_index_delete();
+	test_end();
+}
+
+static void test_mail_cache_field_stats(void)
+{
+	struct mail_cache_field cache_fields[] = {
+		{
+			.name = "string",
+			.type = MAIL_CACHE_FIELD_STRING,
+			.decision = MAIL_CACHE_DECISION_YES,
+		},
+	};
+	struct test_mail_cache_ctx ctx;
+	struct mail_index_transaction *trans;
+	struct mail_cache_view *cache_view;
+	struct mail_cache_transaction_ctx *cache_trans;
+	const struct mail_cache_field_stats *stats;
+	ARRAY_TYPE(mail_cache_field_stats) saved_stats;
+	string_t *str = t_str_new(16);
+	unsigned int idx;
+
+	test_begin("mail cache field stats");
+	test_mail_cache_init(test_mail_index_init(TRUE), &ctx);
+	mail_cache_register_fields(ctx.cache, cache_fields,
+				   N_ELEMENTS(cache_fields),
+				   unsafe_data_stack_pool);
+	idx = cache_fields[0].idx;
+
+	test_mail_cache_add_mail(&ctx, UINT_MAX, NULL);
+	test_mail_cache_add_mail(&ctx, UINT_MAX, NULL);
+
+	cache_view = mail_cache_view_open(ctx.cache, ctx.view);
+	trans = mail_index_transaction_begin(ctx.view, 0);
+	cache_trans = mail_cache_get_transaction(cache_view, trans);
+	mail_cache_add(cache_trans, 1, idx, "foo", 3);
+	test_assert(mail_index_transaction_commit(&trans) == 0);
+	test_mail_cache_view_sync(&ctx);
+
+	test_assert(mail_cache_lookup_field(cache_view, str, 1, idx) == 1);
+	test_assert(mail_cache_lookup_field(cache_view, str, 2, idx) == 0);
+	test_assert(mail_cache_lookup_field(cache_view, str, 1, idx) == 1);
+	stats = mail_cache_field_get_stats(ctx.cache, idx);
+	test_assert(stats->hit_count == 2);
+	test_assert(stats->miss_count == 1);
+	test_assert(stats->parse_bytes == 0 && stats->parse_usecs == 0);
+
+	mail_cache_fields_add_parse_stats(ctx.cache, &idx, 1, 100, 5);
+	mail_cache_fields_add_parse_stats(ctx.cache, &idx, 1, 20, 1);
+	test_assert(stats->parse_bytes == 120);
+	test_assert(stats->parse_usecs == 6);
+
+	/* flushing resets the statistics. The stats file doesn't exist yet,
+	   so it's written immediately. */
+	ioloop_time = time(NULL);
+	mail_cache_flush_field_stats(ctx.cache);
+	test_assert(stats->hit_count == 0 && stats->miss_count == 0);
+	test_assert(stats->parse_bytes == 0 && stats->parse_usecs == 0);
+
+	/* the stats file was just written, so these stay in memory */
+	test_assert(mail_cache_lookup_field(cache_view, str, 2, idx) == 0);
+	mail_cache_fields_add_parse_stats(ctx.cache, &idx, 1, 30, 2);
+	mail_cache_flush_field_stats(ctx.cache);
+	/* nothing new to flush */
+	mail_cache_flush_field_stats(ctx.cache);
+
+	t_array_init(&saved_stats, 4);
+	test_assert(mail_cache_read_field_stats(ctx.cache, &saved_stats) == 0);
+	test_assert(array_count(&saved_stats) == idx + 1);
+	stats = array_idx(&saved_stats, idx);
+	test_assert(stats->hit_count == 2);
+	test_assert(stats->miss_count == 1);
+	test_assert(stats->parse_bytes == 120);
+	test_assert(stats->parse_usecs == 6);
+
+	/* the next flush after the write interval writes all of them */
+	ioloop_time += 60*60;
+	test_assert(mail_cache_lookup_field(cache_view, str, 2, idx) == 0);
+	mail_cache_flush_field_stats(ctx.cache);
+
+	array_clear(&saved_stats);
+	test_assert(mail_cache_read_field_stats(ctx.cache, &saved_stats) == 0);
+	stats = array_idx(&saved_stats, idx);
+	test_assert(stats->hit_count == 2);
+	test_assert(stats->miss_count == 3);
+	test_assert(stats->parse_bytes == 150);
+	test_assert(stats->parse_usecs == 8);
+
+	mail_cache_view_close(&cache_view);
+	test_mail_cache_deinit(&ctx);
+	test_mail_index_delete();
+	test_end();
+}
+
 int main(void)
 {
 	static void (*const test_functions[])(void) = {
@@ -820,6 +996,8 @@ int main(void)
 		test_mail_cache_in_memory,
 		test_mail_cache_size_corruption,
 		test_mail_cache_duplicate_fields,
+		test_mail_cache_columns,
+		test_mail_cache_field_stats,
 		NULL
 	};
 	return test_run(test_functions);
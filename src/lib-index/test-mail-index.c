@@ -158,11 +158,309 @@ static void test_mail_index_new_extension(void)
 	test_end();
 }
 
+static void test_mail_index_mmap_shared(void)
+{
+	struct mail_index *index, *index2;
+	struct mail_index_view *view;
+	struct mail_index_transaction *trans;
+	uint32_t seq, uid, file_seq, uid_validity = 123456;
+	uoff_t file_offset;
+
+	test_begin("mail index mmap shared");
+	index = test_mail_index_init(TRUE);
+	view = mail_index_view_open(index);
+
+	/* Write an index file that is large enough to be mmap()ed */
+	trans = mail_index_transaction_begin(view,
+			MAIL_INDEX_TRANSACTION_FLAG_EXTERNAL);
+	mail_index_update_header(trans,
+		offsetof(struct mail_index_header, uid_validity),
+		&uid_validity, sizeof(uid_validity), TRUE);
+	for (uid = 1; uid <= 10000; uid++)
+		mail_index_append(trans, uid, &seq);
+	test_assert(mail_index_transaction_commit(&trans) == 0);
+
+	test_assert(mail_transaction_log_sync_lock(index->log, "test",
+						   &file_seq, &file_offset) == 0);
+	mail_index_write(index, TRUE, "test");
+	mail_transaction_log_sync_unlock(index->log, "test");
+
+	index2 = mail_index_alloc(NULL, TESTDIR_NAME, "test.dovecot.index");
+	test_assert(mail_index_open(index2, MAIL_INDEX_OPEN_FLAG_MMAP_SHARED) == 1);
+	test_assert(!MAIL_INDEX_MAP_IS_IN_MEMORY(index2->map));
+
+	/* Append and expunge a mail. The 2nd index syncs them without
+	   moving the records to memory. */
+	mail_index_view_close(&view);
+	view = mail_index_view_open(index);
+	trans = mail_index_transaction_begin(view,
+			MAIL_INDEX_TRANSACTION_FLAG_EXTERNAL);
+	mail_index_append(trans, 10001, &seq);
+	test_assert(mail_index_transaction_commit(&trans) == 0);
+	trans = mail_index_transaction_begin(view,
+			MAIL_INDEX_TRANSACTION_FLAG_EXTERNAL);
+	mail_index_expunge(trans, 1);
+	test_assert(mail_index_transaction_commit(&trans) == 0);
+
+	test_assert(mail_index_refresh(index2) == 0);
+	test_assert(!MAIL_INDEX_MAP_IS_IN_MEMORY(index2->map));
+	test_assert(index2->map->hdr.messages_count == 10000);
+	test_assert(index2->map->rec_map->records_count == 10000);
+	test_assert(MAIL_INDEX_REC_AT_SEQ(index2->map, 1)->uid == 2);
+	test_assert(MAIL_INDEX_REC_AT_SEQ(index2->map, 10000)->uid == 10001);
+
+	mail_index_view_close(&view);
+	test_mail_index_deinit(&index);
+	test_mail_index_deinit(&index2);
+	test_end();
+}
+
+static void test_mail_index_sync_expunges(void)
+{
+	static const uint32_t expunge_uids[] = { 2, 5, 9 };
+	static const uint32_t result_uids[] = { 1, 3, 4, 6, 7, 8, 10 };
+	struct mail_index *index, *index2;
+	struct mail_index_view *view, *view2;
+	struct mail_index_transaction *trans;
+	const struct mail_index_record *rec;
+	uint32_t seq, uid, uid_validity = 123456;
+	unsigned int i;
+
+	test_begin("mail index sync expunges");
+	index = test_mail_index_init(TRUE);
+	index2 = test_mail_index_open(FALSE);
+	view = mail_index_view_open(index);
+
+	trans = mail_index_transaction_begin(view,
+			MAIL_INDEX_TRANSACTION_FLAG_EXTERNAL);
+	mail_index_update_header(trans,
+		offsetof(struct mail_index_header, uid_validity),
+		&uid_validity, sizeof(uid_validity), TRUE);
+	for (uid = 1; uid <= 10; uid++)
+		mail_index_append(trans, uid, &seq);
+	test_assert(mail_index_transaction_commit(&trans) == 0);
+	test_assert(mail_index_refresh(index2) == 0);
+	mail_index_view_close(&view);
+
+	/* Two expunge transactions, a flag update and another expunge.
+	   The 2nd index syncs all of them at once. */
+	for (i = 0; i < N_ELEMENTS(expunge_uids); i++) {
+		if (i == 2) {
+			view = mail_index_view_open(index);
+			trans = mail_index_transaction_begin(view,
+				MAIL_INDEX_TRANSACTION_FLAG_EXTERNAL);
+			test_assert(mail_index_lookup_seq(view, 6, &seq));
+			mail_index_update_flags(trans, seq, MODIFY_ADD,
+						MAIL_SEEN);
+			test_assert(mail_index_transaction_commit(&trans) == 0);
+			mail_index_view_close(&view);
+		}
+		view = mail_index_view_open(index);
+		trans = mail_index_transaction_begin(view,
+				MAIL_INDEX_TRANSACTION_FLAG_EXTERNAL);
+		test_assert(mail_index_lookup_seq(view, expunge_uids[i], &seq));
+		mail_index_expunge(trans, seq);
+		test_assert(mail_index_transaction_commit(&trans) == 0);
+		mail_index_view_close(&view);
+	}
+
+	test_assert(mail_index_refresh(index2) == 0);
+	view2 = mail_index_view_open(index2);
+	test_assert(mail_index_view_get_messages_count(view2) ==
+		    N_ELEMENTS(result_uids));
+	for (seq = 1; seq <= N_ELEMENTS(result_uids); seq++) {
+		rec = mail_index_lookup(view2, seq);
+		test_assert_idx(rec->uid == result_uids[seq-1], seq);
+		test_assert_idx((rec->flags & MAIL_SEEN) ==
+				(rec->uid == 6 ? MAIL_SEEN : 0), seq);
+	}
+	test_assert(mail_index_get_header(view2)->seen_messages_count == 1);
+	mail_index_view_close(&view2);
+
+	test_mail_index_deinit(&index);
+	test_mail_index_deinit(&index2);
+	test_end();
+}
+
+static void test_mail_index_packed_flag_updates(void)
+{
+	struct mail_index *index, *index2;
+	struct mail_index_view *view, *view2;
+	struct mail_index_transaction *trans;
+	const struct mail_index_record *rec;
+	uint32_t seq, uid, uid_validity = 123456;
+	uoff_t old_offset;
+
+	test_begin("mail index packed flag updates");
+	/* packed flag updates are disabled by default */
+	index = test_mail_index_init(TRUE);
+	test_assert(!MAIL_TRANSACTION_LOG_VERSION_HAVE(
+		MAIL_TRANSACTION_LOG_HDR_VERSION(&index->log->head->hdr),
+		PACKED_FLAG_UPDATES));
+	test_mail_index_deinit(&index);
+
+	test_mail_index_delete();
+	if (mkdir(TESTDIR_NAME, 0700) < 0)
+		i_error("mkdir(%s) failed: %m", TESTDIR_NAME);
+	index = mail_index_alloc(NULL, TESTDIR_NAME, "test.dovecot.index");
+	test_assert(mail_index_open_or_create(index,
+		MAIL_INDEX_OPEN_FLAG_CREATE |
+		MAIL_INDEX_OPEN_FLAG_LOG_PACKED_FLAG_UPDATES) == 1);
+	/* readers don't need the flag */
+	index2 = test_mail_index_open(FALSE);
+	test_assert(MAIL_TRANSACTION_LOG_VERSION_HAVE(
+		MAIL_TRANSACTION_LOG_HDR_VERSION(&index->log->head->hdr),
+		PACKED_FLAG_UPDATES));
+	view = mail_index_view_open(index);
+
+	trans = mail_index_transaction_begin(view,
+			MAIL_INDEX_TRANSACTION_FLAG_EXTERNAL);
+	mail_index_update_header(trans,
+		offsetof(struct mail_index_header, uid_validity),
+		&uid_validity, sizeof(uid_validity), TRUE);
+	for (uid = 1; uid <= 10; uid++)
+		mail_index_append(trans, uid, &seq);
+	test_assert(mail_index_transaction_commit(&trans) == 0);
+	test_assert(mail_index_refresh(index2) == 0);
+	mail_index_view_close(&view);
+
+	/* three flag updates fit into a single 12 byte packed record */
+	view = mail_index_view_open(index);
+	old_offset = index->log->head->sync_offset;
+	trans = mail_index_transaction_begin(view,
+			MAIL_INDEX_TRANSACTION_FLAG_EXTERNAL);
+	for (seq = 1; seq <= 3; seq++)
+		mail_index_update_flags(trans, seq, MODIFY_ADD, MAIL_SEEN);
+	mail_index_update_flags(trans, 5, MODIFY_ADD, MAIL_FLAGGED);
+	mail_index_update_flags(trans, 10, MODIFY_ADD, MAIL_DELETED);
+	test_assert(mail_index_transaction_commit(&trans) == 0);
+	test_assert(index->log->head->sync_offset - old_offset ==
+		    sizeof(struct mail_transaction_header) + 12);
+	mail_index_view_close(&view);
+
+	test_assert(mail_index_refresh(index2) == 0);
+	view2 = mail_index_view_open(index2);
+	for (seq = 1; seq <= 10; seq++) {
+		rec = mail_index_lookup(view2, seq);
+		test_assert_idx(rec->flags ==
+				(seq <= 3 ? MAIL_SEEN :
+				 seq == 5 ? MAIL_FLAGGED :
+				 seq == 10 ? MAIL_DELETED : 0), seq);
+	}
+	test_assert(mail_index_get_header(view2)->seen_messages_count == 3);
+	test_assert(mail_index_get_header(view2)->deleted_messages_count == 1);
+	mail_index_view_close(&view2);
+
+	test_mail_index_deinit(&index);
+	test_mail_index_deinit(&index2);
+	test_end();
+}
+
+static void test_mail_index_log_checksums(void)
+{
+	struct mail_index *index, *index2;
+	struct mail_index_view *view, *view2;
+	struct mail_index_transaction *trans;
+	struct mail_transaction_log_file *file;
+	uint32_t seq, uid, uid_validity = 123456;
+	struct mail_transaction_header hdr;
+	struct mail_transaction_boundary_crc boundary;
+	unsigned char buf[sizeof(hdr) + sizeof(boundary)], byte;
+	uoff_t old_offset, new_offset;
+	int fd;
+
+	test_begin("mail index log checksums");
+	test_mail_index_delete();
+	if (mkdir(TESTDIR_NAME, 0700) < 0)
+		i_error("mkdir(%s) failed: %m", TESTDIR_NAME);
+	index = mail_index_alloc(NULL, TESTDIR_NAME, "test.dovecot.index");
+	test_assert(mail_index_open_or_create(index,
+		MAIL_INDEX_OPEN_FLAG_CREATE |
+		MAIL_INDEX_OPEN_FLAG_LOG_CHECKSUMS) == 1);
+	test_assert(MAIL_TRANSACTION_LOG_FILE_HAS_CHECKSUMS(index->log->head));
+	/* readers don't need the flag */
+	index2 = test_mail_index_open(FALSE);
+
+	view = mail_index_view_open(index);
+	trans = mail_index_transaction_begin(view,
+			MAIL_INDEX_TRANSACTION_FLAG_EXTERNAL);
+	mail_index_update_header(trans,
+		offsetof(struct mail_index_header, uid_validity),
+		&uid_validity, sizeof(uid_validity), TRUE);
+	for (uid = 1; uid <= 10; uid++)
+		mail_index_append(trans, uid, &seq);
+	test_assert(mail_index_transaction_commit(&trans) == 0);
+	mail_index_view_close(&view);
+
+	test_assert(mail_index_refresh(index2) == 0);
+	file = index2->log->head;
+	test_assert(file->checksum_verified_offset == file->sync_offset);
+	test_assert(index2->map->hdr.messages_count == 10);
+
+	/* a single record is written without a boundary */
+	view = mail_index_view_open(index);
+	old_offset = index->log->head->sync_offset;
+	trans = mail_index_transaction_begin(view,
+			MAIL_INDEX_TRANSACTION_FLAG_EXTERNAL);
+	mail_index_update_flags(trans, 1, MODIFY_ADD, MAIL_SEEN);
+	test_assert(mail_index_transaction_commit(&trans) == 0);
+	mail_index_view_close(&view);
+	test_assert(index->log->head->sync_offset - old_offset ==
+		    sizeof(struct mail_transaction_header) +
+		    sizeof(struct mail_transaction_flag_update));
+	test_assert(mail_index_refresh(index2) == 0);
+	test_assert(index2->log->head->sync_offset ==
+		    index->log->head->sync_offset);
+
+	/* multiple records get a checksummed boundary */
+	view = mail_index_view_open(index);
+	old_offset = index->log->head->sync_offset;
+	trans = mail_index_transaction_begin(view,
+			MAIL_INDEX_TRANSACTION_FLAG_EXTERNAL);
+	mail_index_update_flags(trans, 2, MODIFY_ADD, MAIL_SEEN);
+	mail_index_append(trans, 11, &seq);
+	test_assert(mail_index_transaction_commit(&trans) == 0);
+	mail_index_view_close(&view);
+	new_offset = index->log->head->sync_offset;
+
+	fd = open(file->filepath, O_RDWR);
+	test_assert(fd != -1);
+	test_assert(pread(fd, buf, sizeof(buf), old_offset) == sizeof(buf));
+	memcpy(&hdr, buf, sizeof(hdr));
+	memcpy(&boundary, buf + sizeof(hdr), sizeof(boundary));
+	test_assert((hdr.type & MAIL_TRANSACTION_TYPE_MASK) ==
+		    MAIL_TRANSACTION_BOUNDARY);
+	test_assert(boundary.size == new_offset - old_offset);
+
+	/* corrupt the last byte of the write. the unlocked reader stops
+	   before the transaction, since it can't know if it's still being
+	   written. */
+	test_assert(pread(fd, &byte, 1, new_offset - 1) == 1);
+	byte ^= 0xff;
+	test_assert(pwrite(fd, &byte, 1, new_offset - 1) == 1);
+	i_close_fd(&fd);
+	test_assert(mail_index_refresh(index2) == 0);
+	test_assert(index2->log->head->sync_offset == old_offset);
+	view2 = mail_index_view_open(index2);
+	test_assert(mail_index_lookup(view2, 1)->flags == MAIL_SEEN);
+	test_assert(mail_index_lookup(view2, 2)->flags == 0);
+	test_assert(mail_index_view_get_messages_count(view2) == 10);
+	mail_index_view_close(&view2);
+
+	test_mail_index_deinit(&index);
+	test_mail_index_deinit(&index2);
+	test_end();
+}
+
 int main(void)
 {
 	static void (*const test_functions[])(void) = {
 		test_mail_index_rotate,
 		test_mail_index_new_extension,
+		test_mail_index_mmap_shared,
+		test_mail_index_sync_expunges,
+		test_mail_index_packed_flag_updates,
+		test_mail_index_log_checksums,
 		NULL
 	};
 	return test_run(test_functions);
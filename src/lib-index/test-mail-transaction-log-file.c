@@ -208,6 +208,7 @@ static size_t update_modseq_test_get_size(const struct update_modseq_test *test)
 	case MAIL_TRANSACTION_INDEX_UNDELETED:
 		return 4;
 	case MAIL_TRANSACTION_TYPE_MASK:
+	case MAIL_TRANSACTION_FLAG_UPDATE_PACKED:
 	case MAIL_TRANSACTION_BOUNDARY:
 	case MAIL_TRANSACTION_EXPUNGE_PROT:
 	case MAIL_TRANSACTION_EXTERNAL:
@@ -241,6 +242,93 @@ static void test_mail_transaction_update_modseq(void)
 	test_end();
 }
 
+static void test_mail_index_pack_flag_updates(void)
+{
+	static const struct mail_transaction_flag_update updates[] = {
+		{ .uid1 = 1, .uid2 = 1, .add_flags = MAIL_SEEN },
+		{ .uid1 = 2, .uid2 = 200, .remove_flags = 0xff,
+		  .add_flags = MAIL_ANSWERED | MAIL_FLAGGED },
+		{ .uid1 = 100000, .uid2 = 100000, .modseq_inc_flag = 1 },
+		{ .uid1 = 4000000000U, .uid2 = (uint32_t)-1,
+		  .add_flags = MAIL_DELETED },
+	};
+	static const struct mail_transaction_flag_update unsorted[] = {
+		{ .uid1 = 5, .uid2 = 10, .add_flags = MAIL_SEEN },
+		{ .uid1 = 10, .uid2 = 20, .add_flags = MAIL_SEEN },
+	};
+	static const struct {
+		const char *data;
+		size_t size;
+	} broken[] = {
+		/* truncated */
+		{ "\x05\x82\x00\x00", 4 },
+		{ "\x01\x80\x80\x80", 4 },
+		/* uid1 isn't larger than the previous uid2 */
+		{ "\x00\x00\x02\x00", 4 },
+		{ "\x01\x00\x02\x00\x00\x00\x02\x00", 8 },
+		/* UID overflows */
+		{ "\xff\xff\xff\xff\x0f\x02\x00\x00", 8 },
+		/* garbage in padding */
+		{ "\x01\x00\x02\x00\x00\x01", 6 },
+	};
+	buffer_t *packed = t_buffer_create(64);
+	buffer_t *unpacked = t_buffer_create(64);
+	const char *error;
+	unsigned int i;
+
+	test_begin("mail_index_pack_flag_updates()");
+	test_assert(mail_index_pack_flag_updates(packed, updates,
+						 N_ELEMENTS(updates)));
+	test_assert(packed->used % 4 == 0);
+	test_assert(packed->used < sizeof(updates));
+	test_assert(mail_index_unpack_flag_updates(packed->data, packed->used,
+						   unpacked, &error) == 0);
+	test_assert(unpacked->used == sizeof(updates));
+	test_assert(memcmp(unpacked->data, updates, sizeof(updates)) == 0);
+
+	buffer_set_used_size(packed, 0);
+	test_assert(!mail_index_pack_flag_updates(packed, unsorted,
+						  N_ELEMENTS(unsorted)));
+
+	for (i = 0; i < N_ELEMENTS(broken); i++) {
+		buffer_set_used_size(unpacked, 0);
+		test_assert_idx(mail_index_unpack_flag_updates(broken[i].data,
+			broken[i].size, unpacked, &error) < 0, i);
+	}
+	test_end();
+}
+
+static void test_mail_transaction_update_modseq_packed(void)
+{
+	static const struct mail_transaction_flag_update internal_update = {
+		.uid1 = 1, .uid2 = 5, .add_flags = MAIL_INDEX_MAIL_FLAG_DIRTY
+	};
+	static const struct mail_transaction_flag_update visible_update = {
+		.uid1 = 6, .uid2 = 6, .add_flags = MAIL_SEEN
+	};
+	struct mail_transaction_header hdr;
+	buffer_t *buf = t_buffer_create(64);
+	uint64_t cur_modseq = INITIAL_MODSEQ;
+
+	test_begin("mail_transaction_update_modseq() with packed flag updates");
+	i_zero(&hdr);
+	hdr.type = MAIL_TRANSACTION_FLAG_UPDATE_PACKED;
+
+	test_assert(mail_index_pack_flag_updates(buf, &internal_update, 1));
+	hdr.size = mail_index_uint32_to_offset(sizeof(hdr) + buf->used);
+	mail_transaction_update_modseq(&hdr, buf->data, &cur_modseq,
+				       TEST_LOG_VERSION);
+	test_assert(cur_modseq == NOUPDATE);
+
+	buffer_set_used_size(buf, 0);
+	test_assert(mail_index_pack_flag_updates(buf, &visible_update, 1));
+	hdr.size = mail_index_uint32_to_offset(sizeof(hdr) + buf->used);
+	mail_transaction_update_modseq(&hdr, buf->data, &cur_modseq,
+				       TEST_LOG_VERSION);
+	test_assert(cur_modseq == UPDATE);
+	test_end();
+}
+
 static struct mail_index *test_mail_index_open(void)
 {
 	struct mail_index *index = mail_index_alloc(NULL, NULL, "test.dovecot.index");
@@ -409,6 +497,8 @@ int main(void)
 {
 	static void (*const test_functions[])(void) = {
 		test_mail_transaction_update_modseq,
+		test_mail_index_pack_flag_updates,
+		test_mail_transaction_update_modseq_packed,
 		test_mail_transaction_log_file_modseq_offsets,
 		test_mail_transaction_log_file_get_modseq_next_offset_inconsistency,
 		NULL
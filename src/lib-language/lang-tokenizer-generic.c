@@ -5,14 +5,17 @@
 #include "buffer.h"
 #include "str.h"
 #include "unichar.h"
-#include "bsearch-insert-pos.h"
+#include "cpu-features.h"
 #include "lang-common.h"
 #include "lang-tokenizer-private.h"
 #include "lang-tokenizer-generic-private.h"
 #include "lang-tokenizer-common.h"
 #include "lang-settings.h"
-#include "word-boundary-data.c"
-#include "word-break-data.c"
+#include "word-class-data.c"
+
+#ifdef __SSE2__
+#  include <emmintrin.h>
+#endif
 
 /* see comments below between is_base64() and skip_base64() */
 #define LANG_SKIP_BASE64_MIN_SEQUENCES 1
@@ -155,33 +158,86 @@ lang_tokenizer_generic_simple_current_token(struct generic_lang_tokenizer *tok,
 	return len > 0;
 }
 
-static bool uint32_find(const uint32_t *data, unsigned int count,
-			uint32_t value, unsigned int *idx_r)
+/* Returns the word class of the character from word-class-data.c, which is
+   generated from WordBreakProperty.txt and PropList.txt. */
+static inline uint8_t word_class(unichar_t c)
 {
-	BINARY_NUMBER_SEARCH(data, count, value, idx_r);
+	if (c > WORD_CLASS_MAX_CODEPOINT)
+		return 0;
+	return word_class_blocks[(word_class_index[c >> WORD_CLASS_BLOCK_SHIFT]
+				  << WORD_CLASS_BLOCK_SHIFT) |
+				 (c & ((1 << WORD_CLASS_BLOCK_SHIFT) - 1))];
 }
 
 static bool lang_uni_word_break(unichar_t c)
 {
-	unsigned int idx;
+	/* Includes Unicode General Punctuation, White_Space, Dash,
+	   Quotation_Mark, Terminal_Punctuation, STerm and
+	   Pattern_White_Space. */
+	return (word_class(c) & WORD_CLASS_BREAK) != 0;
+}
 
-	/* Unicode General Punctuation, including deprecated characters. */
-	if (c >= 0x2000 && c <= 0x206f)
-		return TRUE;
-	/* From word-break-data.c, which is generated from PropList.txt. */
-	if (uint32_find(White_Space, N_ELEMENTS(White_Space), c, &idx))
-		return TRUE;
-	if (uint32_find(Dash, N_ELEMENTS(Dash), c, &idx))
-		return TRUE;
-	if (uint32_find(Quotation_Mark, N_ELEMENTS(Quotation_Mark), c, &idx))
-		return TRUE;
-	if (uint32_find(Terminal_Punctuation, N_ELEMENTS(Terminal_Punctuation), c, &idx))
-		return TRUE;
-	if (uint32_find(STerm, N_ELEMENTS(STerm), c, &idx))
-		return TRUE;
-	if (uint32_find(Pattern_White_Space, N_ELEMENTS(Pattern_White_Space), c, &idx))
+/* Plain ASCII characters that continue a word without any special handling:
+   letters and with the simple algorithm also digits and '_'. */
+static inline bool ascii_is_word_char(unsigned char c, bool letters_only)
+{
+	if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'))
 		return TRUE;
-	return FALSE;
+	return !letters_only && ((c >= '0' && c <= '9') || c == '_');
+}
+
+#ifdef __SSE2__
+/* Returns the position of the first character at or after pos that isn't
+   an ASCII word character, checking 16 bytes at a time. The last <16 bytes
+   aren't checked, so the returned position may point to any character in
+   them. */
+static size_t
+ascii_word_end_sse2(const unsigned char *data, size_t pos, size_t size,
+		    bool letters_only)
+{
+	/* bytes >= 0x80 are negative, so they're never inside the ranges */
+	const __m128i lower_min = _mm_set1_epi8('a' - 1);
+	const __m128i lower_max = _mm_set1_epi8('z' + 1);
+	const __m128i digit_min = _mm_set1_epi8('0' - 1);
+	const __m128i digit_max = _mm_set1_epi8('9' + 1);
+	const __m128i underscore = _mm_set1_epi8('_');
+	const __m128i case_bit = _mm_set1_epi8(0x20);
+	__m128i in, lower, word;
+	unsigned int mask;
+
+	for (; size - pos >= 16; pos += 16) {
+		in = _mm_loadu_si128((const __m128i *)(data + pos));
+		lower = _mm_or_si128(in, case_bit);
+		word = _mm_and_si128(_mm_cmpgt_epi8(lower, lower_min),
+				     _mm_cmpgt_epi8(lower_max, lower));
+		if (!letters_only) {
+			word = _mm_or_si128(word, _mm_and_si128(
+				_mm_cmpgt_epi8(in, digit_min),
+				_mm_cmpgt_epi8(digit_max, in)));
+			word = _mm_or_si128(word,
+					    _mm_cmpeq_epi8(in, underscore));
+		}
+		mask = ~_mm_movemask_epi8(word) & 0xffff;
+		if (mask != 0)
+			return pos + __builtin_ctz(mask);
+	}
+	return pos;
+}
+#endif
+
+/* Returns the position of the first character at or after pos that isn't
+   an ASCII word character. */
+static size_t
+ascii_word_end(const unsigned char *data, size_t pos, size_t size,
+	       bool letters_only)
+{
+#ifdef __SSE2__
+	if (size - pos >= 16 && cpu_has_feature(CPU_FEATURE_SSE2))
+		pos = ascii_word_end_sse2(data, pos, size, letters_only);
+#endif
+	while (pos < size && ascii_is_word_char(data[pos], letters_only))
+		pos++;
+	return pos;
 }
 
 enum lang_break_type {
@@ -337,6 +393,18 @@ lang_tokenizer_generic_simple_next(struct lang_tokenizer *_tok,
 
 	start = tok->token->used > 0 ? 0 : skip_base64(data, size);
 	for (i = start; i < size; i += char_size) {
+		if (tok->prev_type == LETTER_TYPE_ALETTER) {
+			/* Fast path: skip over the rest of a plain ASCII
+			   word. These characters would only be shifted in as
+			   letters one at a time. */
+			size_t end = ascii_word_end(data, i, size, FALSE);
+			if (end > i) {
+				shift_prev_type(tok, LETTER_TYPE_ALETTER);
+				i = end;
+				char_size = 0;
+				continue;
+			}
+		}
 		char_size = uni_utf8_get_char_n(data + i, size - i, &c);
 		i_assert(char_size > 0);
 
@@ -389,9 +457,7 @@ lang_tokenizer_generic_simple_next(struct lang_tokenizer *_tok,
 	return 0;
 }
 
-/* TODO: Arrange array searches roughly in order of likelihood of a match.
-   TODO: Make some array of the arrays, so this can be a foreach loop.
-   TODO: Check for Hangul.
+/* TODO: Check for Hangul.
    TODO: Add Hyphens U+002D HYPHEN-MINUS, U+2010 HYPHEN, possibly also
    U+058A ( ֊ ) ARMENIAN HYPHEN, and U+30A0 KATAKANA-HIRAGANA DOUBLE
    HYPHEN.
@@ -399,42 +465,15 @@ lang_tokenizer_generic_simple_next(struct lang_tokenizer *_tok,
 */
 static enum letter_type letter_type(unichar_t c)
 {
-	unsigned int idx;
+	uint8_t lt;
 
 	if (IS_APOSTROPHE(c))
 		return LETTER_TYPE_APOSTROPHE;
-	if (uint32_find(CR, N_ELEMENTS(CR), c, &idx))
-		return LETTER_TYPE_CR;
-	if (uint32_find(LF, N_ELEMENTS(LF), c, &idx))
-		return LETTER_TYPE_LF;
-	if (uint32_find(Newline, N_ELEMENTS(Newline), c, &idx))
-		return LETTER_TYPE_NEWLINE;
-	if (uint32_find(Extend, N_ELEMENTS(Extend), c, &idx))
-		return LETTER_TYPE_EXTEND;
-	if (uint32_find(Regional_Indicator, N_ELEMENTS(Regional_Indicator), c, &idx))
-		return LETTER_TYPE_REGIONAL_INDICATOR;
-	if (uint32_find(Format, N_ELEMENTS(Format), c, &idx))
-		return LETTER_TYPE_FORMAT;
-	if (uint32_find(Katakana, N_ELEMENTS(Katakana), c, &idx))
-		return LETTER_TYPE_KATAKANA;
-	if (uint32_find(Hebrew_Letter, N_ELEMENTS(Hebrew_Letter), c, &idx))
-		return LETTER_TYPE_HEBREW_LETTER;
-	if (uint32_find(ALetter, N_ELEMENTS(ALetter), c, &idx))
-		return LETTER_TYPE_ALETTER;
-	if (uint32_find(Single_Quote, N_ELEMENTS(Single_Quote), c, &idx))
-		return LETTER_TYPE_SINGLE_QUOTE;
-	if (uint32_find(Double_Quote, N_ELEMENTS(Double_Quote), c, &idx))
-		return LETTER_TYPE_DOUBLE_QUOTE;
-	if (uint32_find(MidNumLet, N_ELEMENTS(MidNumLet), c, &idx))
-		return LETTER_TYPE_MIDNUMLET;
-	if (uint32_find(MidLetter, N_ELEMENTS(MidLetter), c, &idx))
-		return LETTER_TYPE_MIDLETTER;
-	if (uint32_find(MidNum, N_ELEMENTS(MidNum), c, &idx))
-		return LETTER_TYPE_MIDNUM;
-	if (uint32_find(Numeric, N_ELEMENTS(Numeric), c, &idx))
-		return LETTER_TYPE_NUMERIC;
-	if (uint32_find(ExtendNumLet, N_ELEMENTS(ExtendNumLet), c, &idx))
-		return LETTER_TYPE_EXTENDNUMLET;
+	/* The letter types in word-class-data.c are in the same order as in
+	   enum letter_type. */
+	lt = word_class(c) & WORD_CLASS_LETTER_TYPE_MASK;
+	if (lt != 0)
+		return (enum letter_type)lt;
 	if (IS_PREFIX_SPLAT(c)) /* prioritise appropriately */
 		return LETTER_TYPE_PREFIXSPLAT;
 	return LETTER_TYPE_OTHER;
@@ -793,6 +832,16 @@ lang_tokenizer_generic_tr29_next(struct lang_tokenizer *_tok,
 
 	start_pos = tok->token->used > 0 ? 0 : skip_base64(data, size);
 	for (i = start_pos; i < size; ) {
+		if (tok->prev_type == LETTER_TYPE_ALETTER && !tok->wb5a) {
+			/* Fast path: ASCII letters following ALetter never
+			   break a word (WB5). */
+			size_t end = ascii_word_end(data, i, size, TRUE);
+			if (end > i) {
+				add_prev_type(tok, LETTER_TYPE_ALETTER);
+				i = end;
+				continue;
+			}
+		}
 		char_start_i = i;
 		char_size = uni_utf8_get_char_n(data + i, size - i, &c);
 		i_assert(char_size > 0);
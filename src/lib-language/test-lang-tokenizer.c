@@ -3,6 +3,7 @@
 #include "lib.h"
 #include "unichar.h"
 #include "str.h"
+#include "cpu-features.h"
 #include "test-common.h"
 #include "lang-tokenizer.h"
 #include "lang-tokenizer-common.h"
@@ -683,6 +684,78 @@ static void test_lang_tokenizer_skip_base64(void)
 	test_end();
 }
 
+static void
+test_ascii_words_tokenize(const struct lang_settings *set,
+			  const unsigned char *input, size_t size,
+			  bool one_byte, string_t *output)
+{
+	struct lang_tokenizer *tok;
+	const char *token, *error;
+	size_t i, chunk;
+
+	test_assert(lang_tokenizer_create(lang_tokenizer_generic, NULL, set,
+					  event, 0, &tok, &error) == 0);
+	str_truncate(output, 0);
+	for (i = 0; i < size; i += chunk) {
+		chunk = one_byte ? uni_utf8_char_bytes(input[i]) : size - i;
+		while (lang_tokenizer_next(tok, input + i, chunk,
+					   &token, &error) > 0) {
+			str_append(output, token);
+			str_append_c(output, '\n');
+		}
+	}
+	while (lang_tokenizer_final(tok, &token, &error) > 0) {
+		str_append(output, token);
+		str_append_c(output, '\n');
+	}
+	lang_tokenizer_unref(&tok);
+}
+
+static void test_lang_tokenizer_ascii_words(void)
+{
+	static const char *const word_chars[] = {
+		"a", "b", "Z", "0", "9", "_",
+	};
+	static const char *const other_chars[] = {
+		" ", ".", "-", "'", "*", "@", "\xC3\xA4", "\xE2\x80\x99",
+	};
+	const struct lang_settings *const settings[] = {
+		&simple_settings, &tr29_settings, &tr29_wb5a_settings
+	};
+	string_t *input = t_str_new(512);
+	string_t *expected = t_str_new(512), *output = t_str_new(512);
+	unsigned int i, j;
+
+	test_begin("lang tokenizer generic ascii words");
+	for (i = 0; i < 1000; i++) T_BEGIN {
+		/* long runs of ASCII word characters, so the SIMD code
+		   sees whole 16 byte blocks */
+		str_truncate(input, 0);
+		while (str_len(input) < 200) {
+			if (i_rand_limit(8) != 0) {
+				str_append(input, word_chars[
+					i_rand_limit(N_ELEMENTS(word_chars))]);
+			} else {
+				str_append(input, other_chars[
+					i_rand_limit(N_ELEMENTS(other_chars))]);
+			}
+		}
+		for (j = 0; j < N_ELEMENTS(settings); j++) {
+			cpu_features_set_disabled(TRUE);
+			test_ascii_words_tokenize(settings[j], str_data(input),
+						  str_len(input), TRUE,
+						  expected);
+			cpu_features_set_disabled(FALSE);
+			test_ascii_words_tokenize(settings[j], str_data(input),
+						  str_len(input), FALSE,
+						  output);
+			test_assert_idx(strcmp(str_c(output),
+					       str_c(expected)) == 0, i);
+		}
+	} T_END;
+	test_end();
+}
+
 int main(void)
 {
 	init_lang_settings();
@@ -699,6 +772,7 @@ int main(void)
 		test_lang_tokenizer_address_search,
 		test_lang_tokenizer_delete_trailing_partial_char,
 		test_lang_tokenizer_random,
+		test_lang_tokenizer_ascii_words,
 		test_lang_tokenizer_explicit_prefix,
 		NULL
 	};
@@ -2,33 +2,86 @@
 use strict;
 use warnings;
 
-my @categories;
-my $which = shift(@ARGV);
-if ($which eq 'boundaries') {
-    @categories = qw(CR LF Newline Extend Regional_Indicator Format Katakana Hebrew_Letter ALetter
-		    Single_Quote Double_Quote MidNumLet MidLetter MidNum Numeric ExtendNumLet);
-} elsif ($which eq 'breaks') {
-    @categories = qw(White_Space Dash Quotation_Mark Terminal_Punctuation STerm Pattern_White_Space);
-} else {
-    die "specify 'boundaries' or 'breaks'";
-}
+# Generates a two-level lookup table, which gives the word boundary letter
+# type and whether the character is a word break with a single table lookup:
+#
+#   word_class_blocks[(word_class_index[c >> 8] << 8) | (c & 0xff)]
+#
+# The bits 0..4 of the value are the letter type, i.e. the index of the
+# category in @boundaries starting from 1 (the same as enum letter_type).
+# WORD_CLASS_BREAK bit is set if the character is a simple word break.
+# Identical 256 character blocks are shared.
+
+# If a character belongs to multiple categories, the first one wins.
+my @boundaries = qw(CR LF Newline Extend Regional_Indicator Format Katakana
+		    Hebrew_Letter ALetter Single_Quote Double_Quote MidNumLet
+		    MidLetter MidNum Numeric ExtendNumLet);
+my @breaks = qw(White_Space Dash Quotation_Mark Terminal_Punctuation STerm
+		Pattern_White_Space);
+
+my $block_shift = 8;
+my $block_size = 1 << $block_shift;
+my $max_codepoint = 0x10FFFF;
+my $break_bit = 0x80;
 
-my $catregexp=join('|', @categories);
-my %catlists = map { $_ => []; } (@categories);
+my %letter_types = map { $boundaries[$_] => $_ + 1; } (0..$#boundaries);
+my %is_break = map { $_ => 1; } (@breaks);
+my $catregexp = join('|', @boundaries, @breaks);
+my @files = @ARGV;
+
+my $classes = "\0" x ($max_codepoint + 1);
+sub set_class {
+    my ($cat, $cp) = @_;
+    my $value = vec($classes, $cp, 8);
+    if ($is_break{$cat}) {
+	$value |= $break_bit;
+    } elsif (($value & ~$break_bit) == 0 ||
+	     ($value & ~$break_bit) > $letter_types{$cat}) {
+	$value = ($value & $break_bit) | $letter_types{$cat};
+    }
+    vec($classes, $cp, 8) = $value;
+}
 
 while(<>) {
     next if (m/^#/ or m/^\s*$/);
-    push(@{$catlists{$3}}, defined($2) ? (hex($1)..hex($2)) : hex($1))
-	if (m/([[:xdigit:]]+)(?:\.\.([[:xdigit:]]+))?\s+; ($catregexp) #/)
+    next if (!m/([[:xdigit:]]+)(?:\.\.([[:xdigit:]]+))?\s+; ($catregexp) #/);
+    foreach my $cp (defined($2) ? (hex($1)..hex($2)) : hex($1)) {
+	set_class($3, $cp);
+    }
+}
+# Unicode General Punctuation, including deprecated characters.
+foreach my $cp (0x2000..0x206F) {
+    vec($classes, $cp, 8) |= $break_bit;
+}
+
+my (@index, @blocks, %block_numbers);
+for (my $cp = 0; $cp <= $max_codepoint; $cp += $block_size) {
+    my $block = substr($classes, $cp, $block_size);
+    if (!defined($block_numbers{$block})) {
+	$block_numbers{$block} = scalar(@blocks);
+	push(@blocks, $block);
+    }
+    push(@index, $block_numbers{$block});
 }
+my $index_type = scalar(@blocks) <= 256 ? "uint8_t" : "uint16_t";
+die "Too many blocks" if scalar(@blocks) > 65536;
 
-print "/* This file is automatically generated by word-properties.pl from $ARGV */\n";
-foreach(@categories) {
-    my $arref=$catlists{$_};
-    print "static const uint32_t ${_}[]= {\n";
-    while(scalar(@$arref)) {
-	print("\t", join(", ", map { sprintf("0x%05X", $_); } splice(@$arref, 0, 8)));
-	print(scalar(@$arref) ? ", \n" : "\n");
+sub print_values {
+    my ($format, $per_line, @values) = @_;
+    while(scalar(@values)) {
+	print("\t", join(", ", map { sprintf($format, $_); } splice(@values, 0, $per_line)));
+	print(scalar(@values) ? ",\n" : "\n");
     }
-    print("};\n");
 }
+
+print "/* This file is automatically generated by word-properties.pl from @files */\n";
+print "#define WORD_CLASS_BLOCK_SHIFT $block_shift\n";
+print "#define WORD_CLASS_MAX_CODEPOINT ".sprintf("0x%X", $max_codepoint)."\n";
+print "#define WORD_CLASS_BREAK ".sprintf("0x%02X", $break_bit)."\n";
+print "#define WORD_CLASS_LETTER_TYPE_MASK 0x1F\n";
+print "static const $index_type word_class_index[] = {\n";
+print_values("%3d", 16, @index);
+print("};\n");
+print "static const uint8_t word_class_blocks[] = {\n";
+print_values("0x%02X", 16, map { unpack("C*", $_); } @blocks);
+print("};\n");
@@ -0,0 +1,156 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "buffer.h"
+#include "str.h"
+#include "strnum.h"
+#include "time-util.h"
+#include "cpu-features.h"
+#include "crc32.h"
+#include "base64.h"
+#include "qp-decoder.h"
+
+#include <stdio.h>
+
+/**
+ * Measures the throughput of CRC32 (mdbox/index checksums), base64 encoding
+ * and decoding (MIME parts, attachments) and quoted-printable decoding
+ * (text parts). Each codec is run first with the CPU specific kernels
+ * enabled and then with them disabled, so the output shows both the
+ * accelerated and the scalar code's speed on this CPU.
+ */
+
+#define BENCH_REPEAT_COUNT 5
+
+static void bench_print(const char *name, size_t size, uint64_t accel_nsecs,
+			uint64_t scalar_nsecs)
+{
+	double mbytes = (double)size * BENCH_REPEAT_COUNT / (1024 * 1024);
+
+	printf("%-16s %8.1lf MB/s accelerated, %8.1lf MB/s scalar\n", name,
+	       mbytes / (accel_nsecs / 1e9), mbytes / (scalar_nsecs / 1e9));
+}
+
+static uint64_t bench_crc32(const buffer_t *data)
+{
+	volatile uint32_t crc = 0;
+	uint64_t ts = i_nanoseconds();
+
+	for (unsigned int i = 0; i < BENCH_REPEAT_COUNT; i++)
+		crc += crc32_data(data->data, data->used);
+	return i_nanoseconds() - ts;
+}
+
+static uint64_t bench_base64_encode(const buffer_t *data, buffer_t *dest)
+{
+	uint64_t ts = i_nanoseconds();
+
+	for (unsigned int i = 0; i < BENCH_REPEAT_COUNT; i++) {
+		buffer_set_used_size(dest, 0);
+		base64_scheme_encode(&base64_scheme, BASE64_ENCODE_FLAG_CRLF,
+				     76, data->data, data->used, dest);
+	}
+	return i_nanoseconds() - ts;
+}
+
+static uint64_t bench_base64_decode(const buffer_t *data, buffer_t *dest)
+{
+	uint64_t ts = i_nanoseconds();
+
+	for (unsigned int i = 0; i < BENCH_REPEAT_COUNT; i++) {
+		buffer_set_used_size(dest, 0);
+		if (base64_decode(data->data, data->used, dest) < 0)
+			i_fatal("base64_decode() failed");
+	}
+	return i_nanoseconds() - ts;
+}
+
+static uint64_t bench_qp_decode(const buffer_t *data, buffer_t *dest)
+{
+	struct qp_decoder *qp;
+	const char *error;
+	size_t error_pos;
+	uint64_t ts = i_nanoseconds();
+
+	for (unsigned int i = 0; i < BENCH_REPEAT_COUNT; i++) {
+		buffer_set_used_size(dest, 0);
+		qp = qp_decoder_init(dest);
+		if (qp_decoder_more(qp, data->data, data->used,
+				    &error_pos, &error) < 0 ||
+		    qp_decoder_finish(qp, &error) < 0)
+			i_fatal("qp_decoder_more() failed: %s", error);
+		qp_decoder_deinit(&qp);
+	}
+	return i_nanoseconds() - ts;
+}
+
+/* Generates mostly plain text quoted-printable with soft line breaks and
+   some encoded characters, which is what text/plain parts typically look
+   like. */
+static void bench_generate_qp(string_t *dest, size_t size)
+{
+	static const char *const words[] = {
+		"the", "quick", "brown", "fox", "jumps", "over", "lazy",
+		"dog", "mailbox", "quoted-printable", "=C3=A4", "=3D"
+	};
+	size_t line_start = 0;
+
+	while (str_len(dest) < size) {
+		if (str_len(dest) - line_start > 60) {
+			str_append(dest, "=\r\n");
+			line_start = str_len(dest);
+		} else if (str_len(dest) != line_start) {
+			str_append_c(dest, ' ');
+		}
+		str_append(dest, words[i_rand_limit(N_ELEMENTS(words))]);
+	}
+}
+
+int main(int argc, const char *argv[])
+{
+	buffer_t *data, *encoded, *qp, *dest;
+	unsigned int size = 16 * 1024 * 1024;
+	uint64_t accel[4], scalar[4];
+	unsigned int i;
+
+	lib_init();
+	if (argc > 2 || (argc == 2 && (str_to_uint(argv[1], &size) < 0 ||
+				       size == 0))) {
+		fprintf(stderr, "Usage: %s [<size>]\n", argv[0]);
+		lib_exit(1);
+	}
+
+	data = buffer_create_dynamic(default_pool, size);
+	for (i = 0; i < size; i++)
+		buffer_append_c(data, i_rand_uchar());
+	encoded = buffer_create_dynamic(default_pool,
+					MAX_BASE64_ENCODED_SIZE(size) * 2);
+	base64_scheme_encode(&base64_scheme, BASE64_ENCODE_FLAG_CRLF, 76,
+			     data->data, data->used, encoded);
+	qp = buffer_create_dynamic(default_pool, size + 128);
+	bench_generate_qp(qp, size);
+	dest = buffer_create_dynamic(default_pool, encoded->used);
+
+	for (i = 0; i < 2; i++) {
+		uint64_t *res = i == 0 ? accel : scalar;
+
+		cpu_features_set_disabled(i != 0);
+		res[0] = bench_crc32(data);
+		res[1] = bench_base64_encode(data, dest);
+		res[2] = bench_base64_decode(encoded, dest);
+		res[3] = bench_qp_decode(qp, dest);
+	}
+	cpu_features_set_disabled(FALSE);
+
+	bench_print("crc32", data->used, accel[0], scalar[0]);
+	bench_print("base64 encode", data->used, accel[1], scalar[1]);
+	bench_print("base64 decode", encoded->used, accel[2], scalar[2]);
+	bench_print("qp decode", qp->used, accel[3], scalar[3]);
+
+	buffer_free(&data);
+	buffer_free(&encoded);
+	buffer_free(&qp);
+	buffer_free(&dest);
+	lib_deinit();
+	return 0;
+}
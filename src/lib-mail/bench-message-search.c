@@ -0,0 +1,104 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "str.h"
+#include "istream.h"
+#include "strnum.h"
+#include "unichar.h"
+#include "time-util.h"
+#include "message-search.h"
+
+#include <stdio.h>
+
+/**
+ * Generates synthetic text/plain mails and searches them for a few keys
+ * that don't exist in the mails, i.e. the worst case where every mail must
+ * be fully read. Each key is first searched separately, which is how the
+ * keys were searched before message_search_msg_multi() existed, and then
+ * all keys are searched at once.
+ */
+
+static const char *const bench_keys[] = {
+	"nonexistent", "unfindable", "xyzzy", "lorem ipsum dolor"
+};
+
+static const char *
+bench_generate_mail(unsigned int idx, unsigned int body_size)
+{
+	static const char *const words[] = {
+		"the", "quick", "brown", "fox", "jumps", "over", "lazy",
+		"dog", "mail", "server", "search", "message", "body",
+	};
+	string_t *str = t_str_new(body_size + 256);
+
+	str_printfa(str, "From: sender%u@example.com\n"
+		    "To: rcpt@example.com\n"
+		    "Subject: test mail %u\n"
+		    "Content-Type: text/plain; charset=us-ascii\n"
+		    "\n", idx, idx);
+	while (str_len(str) < body_size) {
+		str_append(str, words[i_rand_limit(N_ELEMENTS(words))]);
+		str_append_c(str, i_rand_limit(10) == 0 ? '\n' : ' ');
+	}
+	return str_c(str);
+}
+
+static void print_usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [<mail count> [<body size>]]\n", prog);
+	fprintf(stderr, "Runs with 1000 32k mails if nothing given\n");
+	lib_exit(1);
+}
+
+int main(int argc, const char *argv[])
+{
+	struct message_search_context *ctxs[N_ELEMENTS(bench_keys)];
+	bool matches[N_ELEMENTS(bench_keys)];
+	unsigned int i, j, mail_count = 1000, body_size = 32768;
+	uint64_t separate_nsecs = 0, multi_nsecs = 0, ts;
+	const char *error;
+
+	lib_init();
+
+	if (argc > 3 ||
+	    (argc > 1 && str_to_uint(argv[1], &mail_count) < 0) ||
+	    (argc > 2 && str_to_uint(argv[2], &body_size) < 0))
+		print_usage(argv[0]);
+
+	for (i = 0; i < N_ELEMENTS(bench_keys); i++)
+		ctxs[i] = message_search_init(bench_keys[i], NULL, 0);
+
+	for (i = 0; i < mail_count; i++) T_BEGIN {
+		const char *mail = bench_generate_mail(i, body_size);
+		struct istream *input =
+			i_stream_create_from_data(mail, strlen(mail));
+
+		ts = i_nanoseconds();
+		for (j = 0; j < N_ELEMENTS(bench_keys); j++) {
+			i_stream_seek(input, 0);
+			if (message_search_msg(ctxs[j], input, NULL, &error) < 0)
+				i_fatal("message_search_msg() failed: %s", error);
+		}
+		separate_nsecs += i_nanoseconds() - ts;
+
+		ts = i_nanoseconds();
+		i_stream_seek(input, 0);
+		if (message_search_msg_multi(ctxs, N_ELEMENTS(bench_keys),
+					     input, NULL, matches, &error) < 0)
+			i_fatal("message_search_msg_multi() failed: %s", error);
+		multi_nsecs += i_nanoseconds() - ts;
+		i_stream_unref(&input);
+	} T_END;
+
+	for (i = 0; i < N_ELEMENTS(bench_keys); i++)
+		message_search_deinit(&ctxs[i]);
+
+	printf("%u mails of %u bytes, %u keys\n", mail_count, body_size,
+	       (unsigned int)N_ELEMENTS(bench_keys));
+	printf("\tSeparately: %0.02lf us/mail\n",
+	       (double)separate_nsecs / mail_count / 1000.0);
+	printf("\tAt once: %0.02lf us/mail\n",
+	       (double)multi_nsecs / mail_count / 1000.0);
+	lib_deinit();
+	return 0;
+}
@@ -2,7 +2,10 @@
 
 #include "lib.h"
 #include "buffer.h"
+#include "llist.h"
+#include "numpack.h"
 #include "message-parser.h"
+#include "message-part-data.h"
 #include "message-part-serialize.h"
 
 /*
@@ -26,6 +29,32 @@
      (flags & (MESSAGE_PART_FLAG_MULTIPART | MESSAGE_PART_FLAG_MESSAGE_RFC822))
        unsigned int children_count
 
+   message_part_data_serialize() writes the parts in the same order:
+
+   part data
+     string content_type, content_subtype
+     params content_type_params
+     string content_transfer_encoding, content_id, content_description
+     string content_disposition
+     params content_disposition_params
+     string content_md5
+     numpack language_count+1 (0 = NULL), followed by the strings
+     string content_location
+     numpack has_envelope
+     (has_envelope)
+       string date, subject
+       addresses from, sender, reply_to, to, cc, bcc
+       string in_reply_to, message_id
+
+   string: numpack length+1 (0 = NULL), followed by the string without NUL
+   params: numpack count, followed by name and value strings
+   addresses: numpack count, followed by for each address
+     numpack invalid_syntax, string name, route, mailbox, domain
+
+   The message parser sets envelopes only for the children of
+   message/rfc822 parts. The caller may use the root part's envelope for
+   the message's own envelope.
+
 */
 
 struct deserialize_context {
@@ -264,3 +293,297 @@ message_part_deserialize(pool_t pool, const void *data, size_t size,
 
 	return part;
 }
+
+static void data_serialize_string(buffer_t *dest, const char *str)
+{
+	size_t len;
+
+	if (str == NULL) {
+		numpack_encode(dest, 0);
+		return;
+	}
+	len = strlen(str);
+	numpack_encode(dest, len + 1);
+	buffer_append(dest, str, len);
+}
+
+static void
+data_serialize_params(buffer_t *dest, const struct message_part_param *params,
+		      unsigned int count)
+{
+	unsigned int i;
+
+	numpack_encode(dest, count);
+	for (i = 0; i < count; i++) {
+		data_serialize_string(dest, params[i].name);
+		data_serialize_string(dest, params[i].value);
+	}
+}
+
+static void
+data_serialize_addresses(buffer_t *dest,
+			 const struct message_address_list *list)
+{
+	const struct message_address *addr;
+	unsigned int count = 0;
+
+	for (addr = list->head; addr != NULL; addr = addr->next)
+		count++;
+	numpack_encode(dest, count);
+	for (addr = list->head; addr != NULL; addr = addr->next) {
+		numpack_encode(dest, addr->invalid_syntax ? 1 : 0);
+		data_serialize_string(dest, addr->name);
+		data_serialize_string(dest, addr->route);
+		data_serialize_string(dest, addr->mailbox);
+		data_serialize_string(dest, addr->domain);
+	}
+}
+
+static void
+data_serialize_envelope(buffer_t *dest,
+			const struct message_part_envelope *envelope)
+{
+	if (envelope == NULL) {
+		numpack_encode(dest, 0);
+		return;
+	}
+	numpack_encode(dest, 1);
+	data_serialize_string(dest, envelope->date);
+	data_serialize_string(dest, envelope->subject);
+	data_serialize_addresses(dest, &envelope->from);
+	data_serialize_addresses(dest, &envelope->sender);
+	data_serialize_addresses(dest, &envelope->reply_to);
+	data_serialize_addresses(dest, &envelope->to);
+	data_serialize_addresses(dest, &envelope->cc);
+	data_serialize_addresses(dest, &envelope->bcc);
+	data_serialize_string(dest, envelope->in_reply_to);
+	data_serialize_string(dest, envelope->message_id);
+}
+
+void message_part_data_serialize(const struct message_part *part,
+				 buffer_t *dest)
+{
+	const struct message_part_data *data;
+	unsigned int count;
+
+	for (; part != NULL; part = part->next) {
+		data = part->data;
+		i_assert(data != NULL);
+
+		data_serialize_string(dest, data->content_type);
+		data_serialize_string(dest, data->content_subtype);
+		data_serialize_params(dest, data->content_type_params,
+				      data->content_type_params_count);
+		data_serialize_string(dest, data->content_transfer_encoding);
+		data_serialize_string(dest, data->content_id);
+		data_serialize_string(dest, data->content_description);
+		data_serialize_string(dest, data->content_disposition);
+		data_serialize_params(dest, data->content_disposition_params,
+				      data->content_disposition_params_count);
+		data_serialize_string(dest, data->content_md5);
+		if (data->content_language == NULL)
+			numpack_encode(dest, 0);
+		else {
+			count = str_array_length(data->content_language);
+			numpack_encode(dest, count + 1);
+			for (unsigned int i = 0; i < count; i++) {
+				data_serialize_string(dest,
+					data->content_language[i]);
+			}
+		}
+		data_serialize_string(dest, data->content_location);
+		data_serialize_envelope(dest, data->envelope);
+
+		message_part_data_serialize(part->children, dest);
+	}
+}
+
+static bool read_number(struct deserialize_context *ctx, uint64_t *num_r)
+{
+	if (numpack_decode(&ctx->data, ctx->end, num_r) < 0) {
+		ctx->error = "Invalid number";
+		return FALSE;
+	}
+	return TRUE;
+}
+
+static bool read_count(struct deserialize_context *ctx, unsigned int *count_r)
+{
+	uint64_t num;
+
+	if (!read_number(ctx, &num))
+		return FALSE;
+	/* each item takes at least one byte */
+	if (num > (size_t)(ctx->end - ctx->data)) {
+		ctx->error = "Count points outside data";
+		return FALSE;
+	}
+	*count_r = num;
+	return TRUE;
+}
+
+static bool read_string(struct deserialize_context *ctx, const char **str_r)
+{
+	uint64_t len;
+
+	if (!read_number(ctx, &len))
+		return FALSE;
+	if (len == 0) {
+		*str_r = NULL;
+		return TRUE;
+	}
+	len--;
+	if (len > (size_t)(ctx->end - ctx->data)) {
+		ctx->error = "String points outside data";
+		return FALSE;
+	}
+	*str_r = p_strndup(ctx->pool, ctx->data, len);
+	ctx->data += len;
+	return TRUE;
+}
+
+static bool
+read_params(struct deserialize_context *ctx,
+	    const struct message_part_param **params_r, unsigned int *count_r)
+{
+	struct message_part_param *params;
+	unsigned int i, count;
+
+	if (!read_count(ctx, &count))
+		return FALSE;
+	if (count == 0) {
+		*params_r = NULL;
+		*count_r = 0;
+		return TRUE;
+	}
+	params = p_new(ctx->pool, struct message_part_param, count);
+	for (i = 0; i < count; i++) {
+		if (!read_string(ctx, &params[i].name) ||
+		    !read_string(ctx, &params[i].value))
+			return FALSE;
+	}
+	*params_r = params;
+	*count_r = count;
+	return TRUE;
+}
+
+static bool
+read_addresses(struct deserialize_context *ctx,
+	       struct message_address_list *list)
+{
+	struct message_address *addr;
+	unsigned int i, count;
+	uint64_t invalid_syntax;
+
+	if (!read_count(ctx, &count))
+		return FALSE;
+	for (i = 0; i < count; i++) {
+		addr = p_new(ctx->pool, struct message_address, 1);
+		if (!read_number(ctx, &invalid_syntax) ||
+		    !read_string(ctx, &addr->name) ||
+		    !read_string(ctx, &addr->route) ||
+		    !read_string(ctx, &addr->mailbox) ||
+		    !read_string(ctx, &addr->domain))
+			return FALSE;
+		addr->invalid_syntax = invalid_syntax != 0;
+		DLLIST2_APPEND(&list->head, &list->tail, addr);
+	}
+	return TRUE;
+}
+
+static bool
+read_envelope(struct deserialize_context *ctx,
+	      struct message_part_envelope **envelope_r)
+{
+	struct message_part_envelope *envelope;
+	uint64_t have_envelope;
+
+	if (!read_number(ctx, &have_envelope))
+		return FALSE;
+	if (have_envelope == 0) {
+		*envelope_r = NULL;
+		return TRUE;
+	}
+	envelope = p_new(ctx->pool, struct message_part_envelope, 1);
+	if (!read_string(ctx, &envelope->date) ||
+	    !read_string(ctx, &envelope->subject) ||
+	    !read_addresses(ctx, &envelope->from) ||
+	    !read_addresses(ctx, &envelope->sender) ||
+	    !read_addresses(ctx, &envelope->reply_to) ||
+	    !read_addresses(ctx, &envelope->to) ||
+	    !read_addresses(ctx, &envelope->cc) ||
+	    !read_addresses(ctx, &envelope->bcc) ||
+	    !read_string(ctx, &envelope->in_reply_to) ||
+	    !read_string(ctx, &envelope->message_id))
+		return FALSE;
+	*envelope_r = envelope;
+	return TRUE;
+}
+
+static bool
+message_part_data_deserialize_part(struct deserialize_context *ctx,
+				   struct message_part *part)
+{
+	struct message_part_data *data;
+	const char **languages;
+	unsigned int i, count;
+
+	for (; part != NULL; part = part->next) {
+		data = p_new(ctx->pool, struct message_part_data, 1);
+		if (!read_string(ctx, &data->content_type) ||
+		    !read_string(ctx, &data->content_subtype) ||
+		    !read_params(ctx, &data->content_type_params,
+				 &data->content_type_params_count) ||
+		    !read_string(ctx, &data->content_transfer_encoding) ||
+		    !read_string(ctx, &data->content_id) ||
+		    !read_string(ctx, &data->content_description) ||
+		    !read_string(ctx, &data->content_disposition) ||
+		    !read_params(ctx, &data->content_disposition_params,
+				 &data->content_disposition_params_count) ||
+		    !read_string(ctx, &data->content_md5) ||
+		    !read_count(ctx, &count))
+			return FALSE;
+		if (count > 0) {
+			languages = p_new(ctx->pool, const char *, count);
+			for (i = 0; i < count - 1; i++) {
+				if (!read_string(ctx, &languages[i]))
+					return FALSE;
+				if (languages[i] == NULL) {
+					ctx->error = "NULL content-language";
+					return FALSE;
+				}
+			}
+			data->content_language = languages;
+		}
+		if (!read_string(ctx, &data->content_location) ||
+		    !read_envelope(ctx, &data->envelope))
+			return FALSE;
+		part->data = data;
+
+		if (!message_part_data_deserialize_part(ctx, part->children))
+			return FALSE;
+	}
+	return TRUE;
+}
+
+int message_part_data_deserialize(pool_t pool, struct message_part *part,
+				  const void *data, size_t size,
+				  const char **error_r)
+{
+	struct deserialize_context ctx;
+
+	i_zero(&ctx);
+	ctx.pool = pool;
+	ctx.data = data;
+	ctx.end = ctx.data + size;
+
+	if (!message_part_data_deserialize_part(&ctx, part)) {
+		*error_r = ctx.error;
+		return -1;
+	}
+	if (ctx.data != ctx.end) {
+		*error_r = "Too much data";
+		return -1;
+	}
+	return 0;
+}
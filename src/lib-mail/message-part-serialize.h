@@ -13,4 +13,17 @@ struct message_part *
 message_part_deserialize(pool_t pool, const void *data, size_t size,
 			 const char **error_r);
 
+/* Serialize the message_part_data of all the parts in the same order as
+   message_part_serialize() walks them, including the envelopes of
+   message/rfc822 parts. All the parts must have data set. */
+void message_part_data_serialize(const struct message_part *part,
+				 buffer_t *dest);
+/* Set part->data for all the parts using data serialized by
+   message_part_data_serialize(). The parts tree must be the same as when
+   serializing. Returns 0 on success, -1 and error_r if the data is invalid,
+   in which case some of the parts may have been left with data set. */
+int message_part_data_deserialize(pool_t pool, struct message_part *part,
+				  const void *data, size_t size,
+				  const char **error_r);
+
 #endif
@@ -191,9 +191,37 @@ void message_search_reset(struct message_search_context *ctx)
 	message_decoder_decode_reset(ctx->decoder);
 }
 
-int message_search_msg(struct message_search_context *ctx,
-		       struct istream *input, struct message_part *parts,
-		       const char **error_r)
+static bool
+message_search_multi_more(struct message_search_context *const *ctxs,
+			  unsigned int count, unsigned int lead_idx,
+			  struct message_block *raw_block, bool *matches)
+{
+	struct message_block decoded_block;
+	unsigned int i, found_count = 0;
+
+	/* Only the lead context decodes the input. It's one without
+	   MESSAGE_SEARCH_FLAG_SKIP_HEADERS if any exist, so the other
+	   contexts can just skip the decoded headers they don't want. */
+	if (message_search_more_get_decoded(ctxs[lead_idx], raw_block,
+					    &decoded_block))
+		matches[lead_idx] = TRUE;
+	for (i = 0; i < count; i++) {
+		if (!matches[i] && i != lead_idx &&
+		    (decoded_block.hdr == NULL ||
+		     (ctxs[i]->flags & MESSAGE_SEARCH_FLAG_SKIP_HEADERS) == 0)) {
+			matches[i] = message_search_more_decoded(ctxs[i],
+								 &decoded_block);
+		}
+		if (matches[i])
+			found_count++;
+	}
+	return found_count == count;
+}
+
+int message_search_msg_multi(struct message_search_context *const *ctxs,
+			     unsigned int count, struct istream *input,
+			     struct message_part *parts, bool *matches_r,
+			     const char **error_r)
 {
 	const struct message_parser_settings parser_set = {
 		.hdr_flags = MESSAGE_HEADER_PARSER_FLAG_CLEAN_ONELINE,
@@ -202,9 +230,21 @@ int message_search_msg(struct message_search_context *ctx,
 	struct message_block raw_block;
 	struct message_part *new_parts;
 	pool_t pool = NULL;
+	unsigned int i, lead_idx = 0;
 	int ret;
 
-	message_search_reset(ctx);
+	i_assert(count > 0);
+
+	for (i = 0; i < count; i++) {
+		message_search_reset(ctxs[i]);
+		matches_r[i] = FALSE;
+	}
+	for (i = 0; i < count; i++) {
+		if ((ctxs[i]->flags & MESSAGE_SEARCH_FLAG_SKIP_HEADERS) == 0) {
+			lead_idx = i;
+			break;
+		}
+	}
 
 	if (parts != NULL) {
 		parser_ctx = message_parser_init_from_parts(parts,
@@ -216,7 +256,10 @@ int message_search_msg(struct message_search_context *ctx,
 
 	while ((ret = message_parser_parse_next_block(parser_ctx,
 						      &raw_block)) > 0) {
-		if (message_search_more(ctx, &raw_block)) {
+		if (count == 1 ?
+		    message_search_more(ctxs[0], &raw_block) :
+		    message_search_multi_more(ctxs, count, lead_idx,
+					      &raw_block, matches_r)) {
 			ret = 1;
 			break;
 		}
@@ -226,10 +269,24 @@ int message_search_msg(struct message_search_context *ctx,
 		/* normal exit */
 		ret = 0;
 	}
+	if (count == 1 && ret > 0)
+		matches_r[0] = TRUE;
 	if (message_parser_deinit_from_parts(&parser_ctx, &new_parts, error_r) < 0) {
 		/* broken parts */
 		ret = -1;
 	}
 	pool_unref(&pool);
-	return ret;
+	return ret < 0 ? -1 : 0;
+}
+
+int message_search_msg(struct message_search_context *ctx,
+		       struct istream *input, struct message_part *parts,
+		       const char **error_r)
+{
+	bool match;
+
+	if (message_search_msg_multi(&ctx, 1, input, parts, &match,
+				     error_r) < 0)
+		return -1;
+	return match ? 1 : 0;
 }
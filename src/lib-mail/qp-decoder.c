@@ -3,8 +3,13 @@
 #include "lib.h"
 #include "buffer.h"
 #include "hex-binary.h"
+#include "cpu-features.h"
 #include "qp-decoder.h"
 
+#ifdef __SSE2__
+#  include <emmintrin.h>
+#endif
+
 /* quoted-printable lines can be max 76 characters. if we've seen more than
    that much whitespace, it means there really shouldn't be anything else left
    in the line except trailing whitespace. */
@@ -48,13 +53,53 @@ void qp_decoder_deinit(struct qp_decoder **_qp)
 	i_free(qp);
 }
 
+#ifdef __SSE2__
+/* Returns the position of the first '=', CR, LF, SPACE or TAB at or after
+   pos, checking 16 bytes at a time. The last <16 bytes aren't checked, so
+   the returned position may point to any character in them. */
+static size_t
+qp_text_find_special_sse2(const unsigned char *src, size_t pos,
+			  size_t src_size)
+{
+	const __m128i eq = _mm_set1_epi8('='), cr = _mm_set1_epi8('\r');
+	const __m128i lf = _mm_set1_epi8('\n'), sp = _mm_set1_epi8(' ');
+	const __m128i tab = _mm_set1_epi8('\t');
+	__m128i in, special;
+	unsigned int mask;
+
+	for (; src_size - pos >= 16; pos += 16) {
+		in = _mm_loadu_si128((const __m128i *)(src + pos));
+		special = _mm_or_si128(
+			_mm_or_si128(_mm_cmpeq_epi8(in, eq),
+				     _mm_cmpeq_epi8(in, cr)),
+			_mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(in, lf),
+						  _mm_cmpeq_epi8(in, sp)),
+				     _mm_cmpeq_epi8(in, tab)));
+		mask = _mm_movemask_epi8(special);
+		if (mask != 0)
+			return pos + __builtin_ctz(mask);
+	}
+	return pos;
+}
+#endif
+
 static size_t
 qp_decoder_more_text(struct qp_decoder *qp, const unsigned char *src,
 		     size_t src_size)
 {
 	size_t i, start = 0, ret = src_size;
+#ifdef __SSE2__
+	bool use_sse2 = src_size >= 16 && cpu_has_feature(CPU_FEATURE_SSE2);
+#endif
 
 	for (i = 0; i < src_size; i++) {
+#ifdef __SSE2__
+		if (use_sse2) {
+			i = qp_text_find_special_sse2(src, i, src_size);
+			if (i == src_size)
+				break;
+		}
+#endif
 		if (src[i] > '=') {
 			/* fast path */
 			continue;
@@ -510,11 +510,71 @@ static void test_message_search_more_get_decoded(void)
 	test_end();
 }
 
+static void test_message_search_msg_multi(void)
+{
+	static const char input[] =
+		"Subject: hello world\n"
+		"Content-Type: text/plain\n"
+		"Content-Transfer-Encoding: quoted-printable\n"
+		"\n"
+		"body f=C3=B6=C3=B6 text\n";
+	static const struct {
+		const char *key;
+		enum message_search_flags flags;
+		bool match;
+	} keys[] = {
+		{ "hello", MESSAGE_SEARCH_FLAG_SKIP_HEADERS, FALSE },
+		{ "f\xC3\xB6\xC3\xB6", MESSAGE_SEARCH_FLAG_SKIP_HEADERS, TRUE },
+		{ "hello", 0, TRUE },
+		{ "text", 0, TRUE },
+		{ "missing", 0, FALSE },
+	};
+	struct message_search_context *ctxs[N_ELEMENTS(keys)];
+	bool matches[N_ELEMENTS(keys)];
+	struct istream *input_stream;
+	const char *error;
+	unsigned int i;
+
+	test_begin("message_search_msg_multi()");
+	for (i = 0; i < N_ELEMENTS(keys); i++)
+		ctxs[i] = message_search_init(keys[i].key, NULL, keys[i].flags);
+
+	/* each key alone */
+	for (i = 0; i < N_ELEMENTS(keys); i++) {
+		input_stream = test_istream_create(input);
+		test_assert_idx(message_search_msg(ctxs[i], input_stream, NULL,
+						   &error) == (keys[i].match ? 1 : 0), i);
+		i_stream_unref(&input_stream);
+	}
+
+	/* all keys at once, with and without a header search leading */
+	for (unsigned int first = 0; first < 3; first++) {
+		input_stream = test_istream_create(input);
+		test_assert(message_search_msg_multi(ctxs + first,
+			N_ELEMENTS(keys) - first, input_stream, NULL,
+			matches, &error) == 0);
+		for (i = first; i < N_ELEMENTS(keys); i++)
+			test_assert_idx(matches[i - first] == keys[i].match, i);
+		i_stream_unref(&input_stream);
+	}
+	/* only body searches */
+	input_stream = test_istream_create(input);
+	test_assert(message_search_msg_multi(ctxs, 2, input_stream, NULL,
+					     matches, &error) == 0);
+	test_assert(!matches[0] && matches[1]);
+	i_stream_unref(&input_stream);
+
+	for (i = 0; i < N_ELEMENTS(keys); i++)
+		message_search_deinit(&ctxs[i]);
+	test_end();
+}
+
 int main(void)
 {
 	static void (*const test_functions[])(void) = {
 		test_message_search,
 		test_message_search_more_get_decoded,
+		test_message_search_msg_multi,
 		NULL
 	};
 	return test_run(test_functions);
@@ -178,10 +178,63 @@ static void test_qp_decoder(void)
 	test_end();
 }
 
+static void test_qp_decoder_random(void)
+{
+	static const char *const tokens[] = {
+		"=3D", "=\r\n", "=\n", "\r\n", "\n", " ", "\t", "  \r\n",
+		"=", "=x", "abc", "0123456789abcdefghijklmnopq", "\xff"
+	};
+	string_t *input, *str, *str2;
+	struct qp_decoder *qp;
+	size_t error_pos;
+	const char *error;
+	unsigned int i, j, count;
+	int ret, ret2;
+
+	test_begin("qp-decoder random");
+	input = t_str_new(1024);
+	str = t_str_new(1024);
+	str2 = t_str_new(1024);
+	for (i = 0; i < 1000; i++) {
+		str_truncate(input, 0);
+		count = i_rand_limit(100);
+		for (j = 0; j < count; j++)
+			str_append(input,
+				   tokens[i_rand_limit(N_ELEMENTS(tokens))]);
+
+		/* all at once may use the accelerated text scanning */
+		qp = qp_decoder_init(str);
+		ret = qp_decoder_more(qp, str_data(input), str_len(input),
+				      &error_pos, &error);
+		if (qp_decoder_finish(qp, &error) < 0)
+			ret = -1;
+		qp_decoder_deinit(&qp);
+
+		/* one byte at a time is always scanned by the scalar code */
+		qp = qp_decoder_init(str2);
+		ret2 = 0;
+		for (j = 0; j < str_len(input); j++) {
+			if (qp_decoder_more(qp, str_data(input) + j, 1,
+					    &error_pos, &error) < 0)
+				ret2 = -1;
+		}
+		if (qp_decoder_finish(qp, &error) < 0)
+			ret2 = -1;
+		qp_decoder_deinit(&qp);
+
+		test_assert_idx(ret == ret2, i);
+		test_assert_idx(str_equals(str, str2), i);
+		str_truncate(str, 0);
+		str_truncate(str2, 0);
+	}
+	test_end();
+}
+
 int main(void)
 {
 	static void (*const test_functions[])(void) = {
 		test_qp_decoder,
+		test_qp_decoder_random,
 		NULL
 	};
 	return test_run(test_functions);
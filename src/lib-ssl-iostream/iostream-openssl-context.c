@@ -833,6 +833,12 @@ ssl_iostream_context_init_common(struct ssl_iostream_context *ctx,
 #ifdef SSL_OP_NO_TICKET
 	if (!set->tickets)
 		ssl_ops |= SSL_OP_NO_TICKET;
+#endif
+#ifdef HAVE_OPENSSL_KTLS
+	if (set->ktls) {
+		ssl_ops |= SSL_OP_ENABLE_KTLS;
+		ctx->ktls = TRUE;
+	}
 #endif
 	SSL_CTX_set_options(ctx->ssl_ctx, ssl_ops);
 #ifdef SSL_MODE_RELEASE_BUFFERS
@@ -921,6 +927,9 @@ void openssl_iostream_global_deinit(void)
 {
 	if (!ssl_global_initialized)
 		return;
+#ifdef HAVE_OPENSSL_KTLS
+	openssl_iostream_ktls_deinit();
+#endif
 	dovecot_openssl_common_global_unref();
 }
 
@@ -0,0 +1,303 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "ostream.h"
+#include "iostream-openssl.h"
+
+#ifdef HAVE_OPENSSL_KTLS
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <linux/tls.h>
+
+/* OpenSSL talks to kTLS capable BIOs using these BIO_ctrl()s. They are
+   reserved in the public <openssl/bio.h>, but not exported. The numbers are
+   checked against the OpenSSL version in iostream-openssl.h and at runtime
+   in openssl_iostream_ktls_bio_create(). */
+#define DOVECOT_BIO_CTRL_SET_KTLS 72
+#define DOVECOT_BIO_CTRL_SET_KTLS_TX_SEND_CTRL_MSG 74
+#define DOVECOT_BIO_CTRL_CLEAR_KTLS_TX_CTRL_MSG 75
+
+#ifndef SOL_TLS
+#  define SOL_TLS 282
+#endif
+
+/* The filter BIO sits between OpenSSL and bio_int. All the data still goes
+   through the BIO pair and plain_output, but once OpenSSL hands the TX keys
+   to the BIO they're installed to the socket, and from then on OpenSSL
+   writes plaintext records which the kernel encrypts. Only TX is offloaded:
+   with RX offload the kernel would return non-application data records to
+   plain_input as errors. */
+static BIO_METHOD *ktls_bio_method = NULL;
+
+static size_t ktls_crypto_info_size(const struct tls_crypto_info *info)
+{
+	switch (info->cipher_type) {
+#ifdef TLS_CIPHER_AES_GCM_128
+	case TLS_CIPHER_AES_GCM_128:
+		return sizeof(struct tls12_crypto_info_aes_gcm_128);
+#endif
+#ifdef TLS_CIPHER_AES_GCM_256
+	case TLS_CIPHER_AES_GCM_256:
+		return sizeof(struct tls12_crypto_info_aes_gcm_256);
+#endif
+#ifdef TLS_CIPHER_AES_CCM_128
+	case TLS_CIPHER_AES_CCM_128:
+		return sizeof(struct tls12_crypto_info_aes_ccm_128);
+#endif
+#ifdef TLS_CIPHER_CHACHA20_POLY1305
+	case TLS_CIPHER_CHACHA20_POLY1305:
+		return sizeof(struct tls12_crypto_info_chacha20_poly1305);
+#endif
+	}
+	return 0;
+}
+
+/* Try to get everything OpenSSL has written so far out to the socket.
+   Returns TRUE if nothing is left buffered in userspace. */
+static bool ktls_bio_flush_to_socket(struct ssl_iostream *ssl_io)
+{
+	if (openssl_iostream_bio_output(ssl_io) < 0)
+		return FALSE;
+	if (BIO_ctrl_pending(ssl_io->bio_ext) > 0)
+		return FALSE;
+	if (o_stream_flush(ssl_io->plain_output) < 0)
+		return FALSE;
+	return o_stream_get_buffer_used_size(ssl_io->plain_output) == 0;
+}
+
+/* Fail the connection. Nothing can be written to the socket anymore,
+   because OpenSSL won't encrypt the data itself again. */
+static void ktls_bio_fail(struct ssl_iostream *ssl_io, const char *error)
+{
+	if (ssl_io->plain_stream_errno == 0) {
+		i_free(ssl_io->plain_stream_errstr);
+		ssl_io->plain_stream_errstr = i_strdup(error);
+		ssl_io->plain_stream_errno = EIO;
+	}
+	ssl_io->closed = TRUE;
+}
+
+/* TLS 1.3 KeyUpdate after kTLS is already used. OpenSSL expects the kernel
+   to encrypt with the new keys from now on, so they are either installed or
+   the connection fails. */
+static void
+ktls_bio_update_tx_keys(struct ssl_iostream *ssl_io,
+			const struct tls_crypto_info *info)
+{
+	int fd = o_stream_get_fd(ssl_io->plain_output);
+	size_t size = ktls_crypto_info_size(info);
+
+	/* the kernel encrypts the data only when it's written to the socket,
+	   so everything that used the old keys must have been sent */
+	if (!ktls_bio_flush_to_socket(ssl_io)) {
+		ktls_bio_fail(ssl_io, "kTLS key update failed: "
+			      "Couldn't flush data to socket");
+		return;
+	}
+	i_assert(size > 0);
+	if (setsockopt(fd, SOL_TLS, TLS_TX, info, size) < 0) {
+		ktls_bio_fail(ssl_io, t_strdup_printf(
+			"kTLS key update failed: "
+			"setsockopt(TLS_TX) failed: %m"));
+		return;
+	}
+	e_debug(ssl_io->event, "kTLS send keys updated");
+}
+
+static bool
+ktls_bio_set_tx_keys(struct ssl_iostream *ssl_io,
+		     const struct tls_crypto_info *info)
+{
+	int fd = o_stream_get_fd(ssl_io->plain_output);
+	size_t size = ktls_crypto_info_size(info);
+
+	if (size == 0) {
+		e_debug(ssl_io->event, "kTLS not used: "
+			"Cipher not supported by the kernel");
+		return FALSE;
+	}
+	/* the records written with the old keys must already be in the
+	   socket, since everything written after this gets encrypted with
+	   the new keys. */
+	if (!ktls_bio_flush_to_socket(ssl_io)) {
+		e_debug(ssl_io->event, "kTLS not used: "
+			"Couldn't flush handshake to socket");
+		return FALSE;
+	}
+	if (setsockopt(fd, SOL_TCP, TCP_ULP, "tls", sizeof("tls")) < 0 &&
+	    errno != EEXIST) {
+		e_debug(ssl_io->event, "kTLS not used: "
+			"setsockopt(TCP_ULP, tls) failed: %m");
+		return FALSE;
+	}
+	if (setsockopt(fd, SOL_TLS, TLS_TX, info, size) < 0) {
+		e_debug(ssl_io->event, "kTLS not used: "
+			"setsockopt(TLS_TX) failed: %m");
+		return FALSE;
+	}
+	e_debug(ssl_io->event, "kTLS enabled for sending");
+	ssl_io->ktls_send = TRUE;
+	return TRUE;
+}
+
+static int
+ktls_bio_write_ctrl_msg(BIO *bio, struct ssl_iostream *ssl_io,
+			const char *data, int size)
+{
+	unsigned char cmsg_buf[CMSG_SPACE(sizeof(unsigned char))];
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+	struct iovec iov;
+	ssize_t ret;
+
+	/* keep the records in order: the preceding application data must
+	   have been written before this record bypasses plain_output */
+	if (!ktls_bio_flush_to_socket(ssl_io)) {
+		if (ssl_io->closed)
+			return -1;
+		BIO_set_retry_write(bio);
+		return -1;
+	}
+
+	i_zero(&msg);
+	memset(cmsg_buf, 0, sizeof(cmsg_buf));
+	msg.msg_control = cmsg_buf;
+	msg.msg_controllen = sizeof(cmsg_buf);
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_TLS;
+	cmsg->cmsg_type = TLS_SET_RECORD_TYPE;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(unsigned char));
+	*CMSG_DATA(cmsg) = (unsigned char)ssl_io->ktls_ctrl_msg_type;
+	iov.iov_base = (void *)data;
+	iov.iov_len = size;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+
+	ret = sendmsg(o_stream_get_fd(ssl_io->plain_output), &msg, 0);
+	if (ret < 0) {
+		if (errno == EAGAIN || errno == EINTR) {
+			BIO_set_retry_write(bio);
+			o_stream_set_flush_pending(ssl_io->plain_output, TRUE);
+		}
+		return -1;
+	}
+	/* a partial write leaves the record type set for the rest of it */
+	if (ret == size)
+		ssl_io->ktls_ctrl_msg_type = 0;
+	return (int)ret;
+}
+
+static int ktls_bio_write(BIO *bio, const char *data, int size)
+{
+	struct ssl_iostream *ssl_io = BIO_get_data(bio);
+	int ret;
+
+	BIO_clear_retry_flags(bio);
+	if (ssl_io->closed) {
+		/* the socket's keys may be stale after a failed key update */
+		return -1;
+	}
+	if (ssl_io->ktls_ctrl_msg_type != 0)
+		return ktls_bio_write_ctrl_msg(bio, ssl_io, data, size);
+
+	ret = BIO_write(BIO_next(bio), data, size);
+	BIO_copy_next_retry(bio);
+	return ret;
+}
+
+static int ktls_bio_read(BIO *bio, char *data, int size)
+{
+	int ret;
+
+	BIO_clear_retry_flags(bio);
+	ret = BIO_read(BIO_next(bio), data, size);
+	BIO_copy_next_retry(bio);
+	return ret;
+}
+
+static long ktls_bio_ctrl(BIO *bio, int cmd, long num, void *ptr)
+{
+	struct ssl_iostream *ssl_io = BIO_get_data(bio);
+	BIO *next = BIO_next(bio);
+
+	switch (cmd) {
+	case DOVECOT_BIO_CTRL_SET_KTLS:
+		/* num is non-zero for TX keys */
+		if (num == 0)
+			return 0;
+		if (ssl_io->ktls_send) {
+			/* Returning 0 would make OpenSSL encrypt in userspace
+			   on top of the kernel. */
+			ktls_bio_update_tx_keys(ssl_io, ptr);
+			return 1;
+		}
+		return ktls_bio_set_tx_keys(ssl_io, ptr) ? 1 : 0;
+	case BIO_CTRL_GET_KTLS_SEND:
+		return ssl_io->ktls_send ? 1 : 0;
+	case BIO_CTRL_GET_KTLS_RECV:
+		return 0;
+	case DOVECOT_BIO_CTRL_SET_KTLS_TX_SEND_CTRL_MSG:
+		ssl_io->ktls_ctrl_msg_type = num;
+		return 1;
+	case DOVECOT_BIO_CTRL_CLEAR_KTLS_TX_CTRL_MSG:
+		ssl_io->ktls_ctrl_msg_type = 0;
+		return 1;
+	case BIO_CTRL_FLUSH:
+		/* OpenSSL flushes before switching to the new keys. Moving
+		   the data out already here makes it more likely that the
+		   socket is empty by then. */
+		if (!ssl_io->closed)
+			(void)ktls_bio_flush_to_socket(ssl_io);
+		break;
+	}
+	if (next == NULL)
+		return 0;
+	return BIO_ctrl(next, cmd, num, ptr);
+}
+
+static int ktls_bio_create(BIO *bio)
+{
+	BIO_set_init(bio, 1);
+	return 1;
+}
+
+BIO *openssl_iostream_ktls_bio_create(struct ssl_iostream *ssl_io, BIO *bio_int)
+{
+	BIO *bio;
+
+	/* the library may be a different version than the headers */
+	if (OpenSSL_version_num() < OPENSSL_KTLS_MIN_VERSION ||
+	    OpenSSL_version_num() > OPENSSL_KTLS_MAX_VERSION) {
+		e_debug(ssl_io->event, "kTLS not used: "
+			"Unsupported OpenSSL version %s",
+			OpenSSL_version(OPENSSL_VERSION));
+		return bio_int;
+	}
+	if (ktls_bio_method == NULL) {
+		ktls_bio_method = BIO_meth_new(BIO_get_new_index() |
+					       BIO_TYPE_FILTER, "dovecot ktls");
+		if (ktls_bio_method == NULL)
+			return bio_int;
+		BIO_meth_set_write(ktls_bio_method, ktls_bio_write);
+		BIO_meth_set_read(ktls_bio_method, ktls_bio_read);
+		BIO_meth_set_ctrl(ktls_bio_method, ktls_bio_ctrl);
+		BIO_meth_set_create(ktls_bio_method, ktls_bio_create);
+	}
+	bio = BIO_new(ktls_bio_method);
+	if (bio == NULL)
+		return bio_int;
+	BIO_set_data(bio, ssl_io);
+	return BIO_push(bio, bio_int);
+}
+
+void openssl_iostream_ktls_deinit(void)
+{
+	if (ktls_bio_method != NULL) {
+		BIO_meth_free(ktls_bio_method);
+		ktls_bio_method = NULL;
+	}
+}
+
+#endif
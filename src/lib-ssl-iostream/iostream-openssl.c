@@ -190,6 +190,13 @@ openssl_iostream_create(struct ssl_iostream_context *ctx,
 		event_set_append_log_prefix(ssl_io->event,
 					    t_strdup_printf("%s: ", host));
 	}
+#ifdef HAVE_OPENSSL_KTLS
+	/* kTLS writes the plaintext directly to the socket, so it can't be
+	   used if plain_output is some other stream on top of it. */
+	if (ctx->ktls && ssl_io->plain_output->real_stream->parent == NULL &&
+	    o_stream_get_fd(ssl_io->plain_output) != -1)
+		bio_int = openssl_iostream_ktls_bio_create(ssl_io, bio_int);
+#endif
 	/* bio_int will be freed by SSL_free() */
 	SSL_set_bio(ssl_io->ssl, bio_int, bio_int);
         SSL_set_ex_data(ssl_io->ssl, dovecot_ssl_extdata_index, ssl_io);
@@ -350,7 +357,7 @@ static int openssl_iostream_bio_output_real(struct ssl_iostream *ssl_io)
 	return result;
 }
 
-static int openssl_iostream_bio_output(struct ssl_iostream *ssl_io)
+int openssl_iostream_bio_output(struct ssl_iostream *ssl_io)
 {
 	int ret;
 
@@ -490,7 +497,11 @@ int openssl_iostream_handle_error(struct ssl_iostream *ssl_io, int ret,
 	case SSL_ERROR_WANT_WRITE:
 		if (type != OPENSSL_IOSTREAM_SYNC_TYPE_NONE &&
 		    openssl_iostream_bio_sync(ssl_io, type) == 0) {
-			if (type != OPENSSL_IOSTREAM_SYNC_TYPE_WRITE)
+			/* With kTLS the non-application data records are
+			   written directly to the socket, which may be full.
+			   OpenSSL retries sending them on the next call. */
+			if (type != OPENSSL_IOSTREAM_SYNC_TYPE_WRITE &&
+			    !ssl_io->ktls_send)
 				i_panic("SSL ostream buffer size not unlimited");
 			return 0;
 		}
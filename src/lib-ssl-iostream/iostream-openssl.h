@@ -8,6 +8,18 @@
 #ifndef HAVE_ASN1_STRING_GET0_DATA
 #  define ASN1_STRING_get0_data(str) ASN1_STRING_data(str)
 #endif
+/* kTLS needs OpenSSL's internal kTLS BIO_ctrl()s. Their numbers are known
+   only for OpenSSL v3.0 - v3.5, which reserve them in <openssl/bio.h>. */
+#define OPENSSL_KTLS_MIN_VERSION 0x30000000L
+#define OPENSSL_KTLS_MAX_VERSION 0x305fffffL
+#if defined(SSL_OP_ENABLE_KTLS) && defined(HAVE_LINUX_TLS_H) && \
+	OPENSSL_VERSION_NUMBER >= OPENSSL_KTLS_MIN_VERSION && \
+	OPENSSL_VERSION_NUMBER <= OPENSSL_KTLS_MAX_VERSION && \
+	defined(BIO_CTRL_GET_KTLS_SEND) && BIO_CTRL_GET_KTLS_SEND == 73 && \
+	defined(BIO_CTRL_GET_KTLS_RECV) && BIO_CTRL_GET_KTLS_RECV == 76
+#  define HAVE_OPENSSL_KTLS
+#endif
+
 enum openssl_iostream_sync_type {
 	OPENSSL_IOSTREAM_SYNC_TYPE_NONE,
 	OPENSSL_IOSTREAM_SYNC_TYPE_FIRST_READ,
@@ -32,6 +44,7 @@ struct ssl_iostream_context {
 	bool client_ctx:1;
 	bool verify_remote_cert:1;
 	bool allow_invalid_cert:1;
+	bool ktls:1;
 };
 
 struct ssl_iostream {
@@ -55,6 +68,9 @@ struct ssl_iostream {
 	char *plain_stream_errstr;
 	char *ja3_str;
 	int plain_stream_errno;
+	/* kTLS: record type of the next control message written to the
+	   socket, or 0 for application data */
+	int ktls_ctrl_msg_type;
 
 	ssl_iostream_handshake_callback_t *handshake_callback;
 	void *handshake_context;
@@ -75,6 +91,8 @@ struct ssl_iostream {
 	bool ostream_flush_waiting_input:1;
 	bool closed:1;
 	bool destroyed:1;
+	/* kTLS: the kernel is encrypting the data written to plain_output */
+	bool ktls_send:1;
 };
 
 extern int dovecot_ssl_extdata_index;
@@ -122,6 +140,19 @@ int openssl_iostream_handle_error(struct ssl_iostream *ssl_io, int ret,
 				  enum openssl_iostream_sync_type type,
 				  const char *func_name);
 
+/* Move the SSL encrypted data from bio_ext to plain_output and try to
+   flush it. Returns 1 if something was moved, 0 if not and -1 if
+   plain_output failed. */
+int openssl_iostream_bio_output(struct ssl_iostream *ssl_io);
+
+#ifdef HAVE_OPENSSL_KTLS
+/* Put a filter BIO in front of bio_int, which lets OpenSSL install the TX
+   session keys into the socket's kTLS once the handshake is done. Returns the
+   new BIO, which now owns bio_int. */
+BIO *openssl_iostream_ktls_bio_create(struct ssl_iostream *ssl_io, BIO *bio_int);
+void openssl_iostream_ktls_deinit(void);
+#endif
+
 /* Perform clean shutdown for the connection. */
 void openssl_iostream_shutdown(struct ssl_iostream *ssl_io);
 
@@ -82,6 +82,10 @@ struct ssl_iostream_settings {
 	bool compression;
 	/* If FALSE, set SSL_OP_NO_TICKET. See OpenSSL documentation. */
 	bool tickets;
+	/* Let the kernel encrypt the sent TLS records (Linux kTLS) once the
+	   handshake is done, if the kernel and OpenSSL support it. This also
+	   allows sending files with sendfile(). */
+	bool ktls;
 };
 
 /* Load SSL module */
@@ -228,6 +228,53 @@ o_stream_ssl_sendv(struct ostream_private *stream,
 	return bytes_sent;
 }
 
+static enum ostream_send_istream_result
+o_stream_ssl_send_istream(struct ostream_private *outstream,
+			  struct istream *instream)
+{
+	struct ssl_ostream *sstream = (struct ssl_ostream *)outstream;
+	struct ssl_iostream *ssl_io = sstream->ssl_io;
+	struct ostream *plain_output = ssl_io->plain_output;
+	enum ostream_send_istream_result res;
+	uoff_t old_offset;
+	int ret;
+
+	if (!ssl_io->ktls_send)
+		return io_stream_copy(&outstream->ostream, instream);
+
+	/* The kernel encrypts everything written to the socket, so the
+	   input can be sent directly to plain_output, which uses sendfile()
+	   for files. The data already given to OpenSSL must be sent first. */
+	if (sstream->buffer != NULL && sstream->buffer->used > 0) {
+		if ((ret = o_stream_ssl_flush_buffer(sstream)) < 0)
+			return OSTREAM_SEND_ISTREAM_RESULT_ERROR_OUTPUT;
+		if (ret == 0 || sstream->buffer->used > 0)
+			return OSTREAM_SEND_ISTREAM_RESULT_WAIT_OUTPUT;
+	}
+	if (BIO_ctrl_pending(ssl_io->bio_ext) > 0) {
+		if (openssl_iostream_bio_sync(
+			ssl_io, OPENSSL_IOSTREAM_SYNC_TYPE_WRITE) < 0) {
+			io_stream_set_error(&outstream->iostream,
+					    "%s", ssl_io->plain_stream_errstr);
+			outstream->ostream.stream_errno =
+				ssl_io->plain_stream_errno;
+			return OSTREAM_SEND_ISTREAM_RESULT_ERROR_OUTPUT;
+		}
+		if (BIO_ctrl_pending(ssl_io->bio_ext) > 0)
+			return OSTREAM_SEND_ISTREAM_RESULT_WAIT_OUTPUT;
+	}
+
+	old_offset = instream->v_offset;
+	res = o_stream_send_istream(plain_output, instream);
+	outstream->ostream.offset += instream->v_offset - old_offset;
+	if (res == OSTREAM_SEND_ISTREAM_RESULT_ERROR_OUTPUT) {
+		io_stream_set_error(&outstream->iostream, "%s",
+				    o_stream_get_error(plain_output));
+		outstream->ostream.stream_errno = plain_output->stream_errno;
+	}
+	return res;
+}
+
 static void o_stream_ssl_switch_ioloop_to(struct ostream_private *stream,
 					  struct ioloop *ioloop)
 {
@@ -319,6 +366,7 @@ struct ostream *openssl_o_stream_create_ssl(struct ssl_iostream *ssl_io)
 	sstream->ostream.iostream.destroy = o_stream_ssl_destroy;
 	sstream->ostream.sendv = o_stream_ssl_sendv;
 	sstream->ostream.flush = o_stream_ssl_flush;
+	sstream->ostream.send_istream = o_stream_ssl_send_istream;
 	sstream->ostream.switch_ioloop_to = o_stream_ssl_switch_ioloop_to;
 
 	sstream->ostream.get_buffer_used_size =
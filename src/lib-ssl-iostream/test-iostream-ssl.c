@@ -3,6 +3,8 @@
 #include "test-lib.h"
 #include "buffer.h"
 #include "randgen.h"
+#include "net.h"
+#include "write-full.h"
 #include "istream.h"
 #include "ostream.h"
 #include "iostream-openssl.h"
@@ -10,6 +12,8 @@
 #include "iostream-ssl-test.h"
 
 #include <sys/socket.h>
+#include <unistd.h>
+#include <fcntl.h>
 
 #define MAX_SENT_BYTES 10000
 
@@ -23,10 +27,12 @@ struct test_endpoint {
 	struct istream *input;
 	struct ostream *output;
 	struct io *io;
+	struct istream *file_input;
 	buffer_t *last_write;
 	ssize_t sent;
 	bool client;
 	bool failed;
+	bool key_updated;
 
 	struct test_endpoint *other;
 
@@ -548,12 +554,198 @@ static void test_iostream_ssl_small_packets(void)
 	test_end();
 }
 
+static void ktls_send_failed(struct test_endpoint *ep)
+{
+	/* A kernel without TLS 1.3 rekey support can't continue after
+	   KeyUpdate. Anything else is a bug. */
+	test_assert(ep->iostream->ktls_send &&
+		    strstr(o_stream_get_error(ep->output),
+			   "kTLS key update failed") != NULL);
+	ep->failed = TRUE;
+	io_loop_stop(current_ioloop);
+}
+
+static void ktls_send_key_update(struct test_endpoint *ep)
+{
+	const unsigned char *data;
+	size_t size;
+
+	/* Send some data with SSL_write() before and after a TLS 1.3
+	   KeyUpdate. With kTLS this installs new keys to the socket. */
+	test_assert(i_stream_read_more(ep->file_input, &data, &size) > 0);
+	o_stream_nsend(ep->output, data, size);
+	i_stream_skip(ep->file_input, size);
+	(void)o_stream_flush(ep->output);
+
+	test_assert(SSL_key_update(ep->iostream->ssl,
+				   SSL_KEY_UPDATE_NOT_REQUESTED) == 1);
+	test_assert(i_stream_read_more(ep->file_input, &data, &size) > 0);
+	o_stream_nsend(ep->output, data, size);
+	i_stream_skip(ep->file_input, size);
+	ep->key_updated = TRUE;
+}
+
+static int ktls_send_flush_callback(struct test_endpoint *ep)
+{
+	if (ep->failed)
+		return -1;
+	if (ep->file_input->eof) {
+		/* already finishing */
+		if (o_stream_finish(ep->output) < 0) {
+			ktls_send_failed(ep);
+			return -1;
+		}
+		return flush_output(ep, TRUE);
+	}
+	if (!ep->key_updated && ssl_iostream_is_handshaked(ep->iostream))
+		ktls_send_key_update(ep);
+	switch (o_stream_send_istream(ep->output, ep->file_input)) {
+	case OSTREAM_SEND_ISTREAM_RESULT_FINISHED:
+		break;
+	case OSTREAM_SEND_ISTREAM_RESULT_WAIT_INPUT:
+		i_unreached();
+	case OSTREAM_SEND_ISTREAM_RESULT_WAIT_OUTPUT:
+		return 1;
+	case OSTREAM_SEND_ISTREAM_RESULT_ERROR_INPUT:
+		test_assert(FALSE);
+		io_loop_stop(current_ioloop);
+		return -1;
+	case OSTREAM_SEND_ISTREAM_RESULT_ERROR_OUTPUT:
+		ktls_send_failed(ep);
+		return -1;
+	}
+	if (o_stream_finish(ep->output) < 0) {
+		ktls_send_failed(ep);
+		return -1;
+	}
+	return flush_output(ep, TRUE);
+}
+
+static void ktls_receive_input_callback(struct test_endpoint *ep)
+{
+	const unsigned char *data;
+	size_t size;
+
+	while (i_stream_read_more(ep->input, &data, &size) > 0) {
+		buffer_append(ep->last_write, data, size);
+		i_stream_skip(ep->input, size);
+	}
+	if (ep->input->eof) {
+		test_assert(ep->input->stream_errno == 0);
+		ep->finished = TRUE;
+		if (ep->other->finished)
+			io_loop_stop(current_ioloop);
+	}
+}
+
+static void test_iostream_ssl_ktls_send_istream(void)
+{
+	struct ssl_iostream_settings set;
+	struct test_endpoint *server, *client;
+	struct ioloop *ioloop;
+	struct ip_addr ip;
+	in_port_t port = 0;
+	buffer_t *file_data;
+	int fd, listen_fd, server_fd, client_fd;
+	const char *error;
+
+	test_begin("ssl: ktls send istream");
+
+	/* kTLS needs a TCP socket. If the kernel or OpenSSL doesn't support
+	   it, this tests the fallback. */
+	test_assert(net_addr2ip("127.0.0.1", &ip) == 0);
+	if ((listen_fd = net_listen(&ip, &port, 1)) < 0)
+		i_fatal("net_listen() failed: %m");
+	if ((client_fd = net_connect_ip_blocking(&ip, port, NULL)) < 0)
+		i_fatal("net_connect_ip() failed: %m");
+	if ((server_fd = net_accept(listen_fd, NULL, NULL)) < 0)
+		i_fatal("net_accept() failed: %m");
+	i_close_fd(&listen_fd);
+	fd_set_nonblock(server_fd, TRUE);
+	fd_set_nonblock(client_fd, TRUE);
+
+	fd = open(".temp.ssl-ktls", O_RDWR | O_CREAT | O_TRUNC, 0600);
+	if (fd == -1)
+		i_fatal("creat(.temp.ssl-ktls) failed: %m");
+	i_unlink(".temp.ssl-ktls");
+	file_data = buffer_create_dynamic(default_pool, 1024*1024);
+	random_fill(buffer_append_space_unsafe(file_data, 1024*1024),
+		    1024*1024);
+	if (write_full(fd, file_data->data, file_data->used) < 0)
+		i_fatal("write(.temp.ssl-ktls) failed: %m");
+	if (lseek(fd, 0, SEEK_SET) < 0)
+		i_fatal("lseek(.temp.ssl-ktls) failed: %m");
+
+	ioloop = io_loop_create();
+
+	ssl_iostream_test_settings_server(&set);
+	set.ktls = TRUE;
+	server = create_test_endpoint(server_fd, &set);
+	ssl_iostream_test_settings_client(&set);
+	set.allow_invalid_cert = TRUE;
+	set.ktls = TRUE;
+	client = create_test_endpoint(client_fd, &set);
+	client->client = TRUE;
+
+	client->other = server;
+	server->other = client;
+	server->file_input = i_stream_create_fd_autoclose(&fd, 1024);
+
+	test_assert(ssl_iostream_context_init_server(server->set, &server->ctx,
+		    &error) == 0);
+	test_assert(ssl_iostream_context_init_client(client->set, &client->ctx,
+		    &error) == 0);
+
+	test_assert(io_stream_create_ssl_server(server->ctx, NULL,
+						&server->input, &server->output,
+						&server->iostream, &error) == 0);
+	test_assert(io_stream_create_ssl_client(client->ctx, "localhost", NULL, 0,
+						&client->input, &client->output,
+						&client->iostream, &error) == 0);
+
+	o_stream_set_flush_callback(server->output, ktls_send_flush_callback,
+				    server);
+	client->io = io_add_istream(client->input, ktls_receive_input_callback,
+				    client);
+	server->io = io_add_istream(server->input, bufsize_discard_callback,
+				    server);
+
+	test_assert(ssl_iostream_handshake(client->iostream) == 0);
+	test_assert(ssl_iostream_handshake(server->iostream) == 0);
+	o_stream_set_flush_pending(server->output, TRUE);
+
+	struct timeout *to = timeout_add(5000, io_loop_stop, ioloop);
+	io_loop_run(ioloop);
+	timeout_remove(&to);
+
+	if (!server->failed) {
+		test_assert(server->finished && client->finished);
+		test_assert(buffer_cmp(client->last_write, file_data));
+	}
+
+	i_stream_unref(&server->file_input);
+	i_stream_unref(&server->input);
+	o_stream_unref(&server->output);
+	i_stream_unref(&client->input);
+	o_stream_unref(&client->output);
+
+	destroy_test_endpoint(&server);
+	destroy_test_endpoint(&client);
+	buffer_free(&file_data);
+
+	io_loop_destroy(&ioloop);
+	ssl_iostream_context_cache_free();
+
+	test_end();
+}
+
 int main(void)
 {
 	static void (*const test_functions[])(void) = {
 		test_iostream_ssl_handshake,
 		test_iostream_ssl_get_buffer_avail_size,
 		test_iostream_ssl_small_packets,
+		test_iostream_ssl_ktls_send_istream,
 		NULL
 	};
 	ssl_iostream_openssl_init();
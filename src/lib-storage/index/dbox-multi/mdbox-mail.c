@@ -12,6 +12,7 @@
 #include "mdbox-file.h"
 
 #include <sys/stat.h>
+#include <fcntl.h>
 
 int mdbox_mail_lookup(struct mdbox_mailbox *mbox, struct mail_index_view *view,
 		      uint32_t seq, uint32_t *map_uid_r)
@@ -156,6 +157,59 @@ int mdbox_mail_open(struct dbox_mail *mail, uoff_t *offset_r,
 	return 0;
 }
 
+static bool mdbox_mail_prefetch(struct mail *_mail)
+{
+	struct dbox_mail *mail = DBOX_MAIL(_mail);
+/* HAVE_POSIX_FADVISE alone isn't enough for CentOS 4.9 */
+#if defined(HAVE_POSIX_FADVISE) && defined(POSIX_FADV_WILLNEED)
+	struct mdbox_mailbox *mbox = MDBOX_MAILBOX(_mail->box);
+	struct index_mail_data *data = &mail->imail.data;
+	struct mdbox_map_mail_index_record rec;
+	uint32_t map_uid;
+	uint16_t refcount;
+	off_t len;
+	bool deleted;
+
+	if (data->access_part == 0 || data->stream != NULL ||
+	    _mail->saving || mail->open_file != NULL) {
+		/* everything we need is cached or the mail is already
+		   being read */
+		return TRUE;
+	}
+
+	/* The messages are in the m.* files next to each other, so tell OS
+	   to start reading only this message's range of the file. */
+	if (mdbox_mail_lookup(mbox, _mail->transaction->view, _mail->seq,
+			      &map_uid) < 0 ||
+	    mdbox_map_lookup_full(mbox->storage->map, map_uid,
+				  &rec, &refcount) <= 0)
+		return TRUE;
+
+	mail->open_file = mdbox_file_init(mbox->storage, rec.file_id);
+	mail->offset = rec.offset;
+	if (!dbox_file_is_open(mail->open_file))
+		_mail->transaction->stats.open_lookup_count++;
+	if (dbox_file_open(mail->open_file, &deleted) <= 0 || deleted) {
+		/* let the actual read handle the errors */
+		dbox_file_unref(&mail->open_file);
+		return TRUE;
+	}
+
+	if ((data->access_part & (READ_BODY | PARSE_BODY)) != 0)
+		len = rec.size;
+	else
+		len = I_MIN(rec.size, mail->open_file->msg_header_size +
+			    MAIL_READ_HDR_BLOCK_SIZE);
+	if ((errno = posix_fadvise(mail->open_file->fd, rec.offset, len,
+				   POSIX_FADV_WILLNEED)) != 0) {
+		e_error(mail_event(_mail), "posix_fadvise(%s) failed: %m",
+			mail->open_file->cur_path);
+	}
+	data->prefetch_sent = TRUE;
+#endif
+	return !mail->imail.data.prefetch_sent;
+}
+
 static int mdbox_mail_get_save_date(struct mail *mail, time_t *date_r)
 {
 	struct mdbox_mailbox *mbox = MDBOX_MAILBOX(mail->transaction->box);
@@ -244,7 +298,7 @@ struct mail_vfuncs mdbox_mail_vfuncs = {
 	index_mail_set_seq,
 	index_mail_set_uid,
 	index_mail_set_uid_cache_updates,
-	index_mail_prefetch,
+	mdbox_mail_prefetch,
 	index_mail_precache,
 	index_mail_add_temp_wanted_fields,
 
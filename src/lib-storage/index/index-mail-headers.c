@@ -268,6 +268,12 @@ void index_mail_parse_header_init(struct index_mail *mail,
 		array_idx_set(&mail->header_match, field_idx,
 			      &mail->header_match_value);
 	}
+	/* mime.parts.data also contains the message's ENVELOPE */
+	data->save_parts_data_envelope = data->save_bodystructure_header &&
+		!data->parsed_bodystructure_header &&
+		index_mail_want_parts_data(mail);
+	if (data->save_parts_data_envelope)
+		data->parts_data_envelope = NULL;
 	mail->data.header_parser_initialized = TRUE;
 	mail->data.parse_line_num = 0;
 	i_zero(&mail->data.parse_line);
@@ -309,6 +315,11 @@ void index_mail_parse_header(struct message_part *part,
 	    !data->parsed_bodystructure_header) {
 		i_assert(part != NULL);
 		message_part_data_parse_from_header(mail->mail.data_pool, part, hdr);
+		if (data->save_parts_data_envelope && part->parent == NULL) {
+			message_part_envelope_parse_from_header(
+				mail->mail.data_pool,
+				&data->parts_data_envelope, hdr);
+		}
 	}
 
 	if (data->save_envelope) {
@@ -456,9 +467,11 @@ int index_mail_parse_headers_internal(struct index_mail *mail,
 				      struct mailbox_header_lookup_ctx *headers)
 {
 	struct index_mail_data *data = &mail->data;
+	uint64_t parse_start_usecs;
 
 	i_assert(data->stream != NULL);
 
+	parse_start_usecs = index_mail_cache_parse_stats_start(mail);
 	index_mail_parse_header_init(mail, headers);
 
 	if (data->parts == NULL || data->save_bodystructure_header ||
@@ -481,6 +494,8 @@ int index_mail_parse_headers_internal(struct index_mail *mail,
 		index_mail_parse_header_deinit(mail);
 		return -1;
 	}
+	index_mail_cache_parse_stats_finish(mail, parse_start_usecs,
+					    data->hdr_size.physical_size);
 	i_assert(!mail->data.header_parser_initialized);
 	data->hdr_size_set = TRUE;
 	data->access_part &= ENUM_NEGATE(PARSE_HDR);
@@ -532,6 +547,8 @@ int index_mail_headers_get_envelope(struct index_mail *mail)
 		return 0;
 	}
 	str_free(&str);
+	if (index_mail_get_cached_parts_data_envelope(mail))
+		return 0;
 
 	old_offset = mail->data.stream == NULL ? 0 :
 		mail->data.stream->v_offset;
@@ -673,10 +690,12 @@ index_mail_get_raw_headers(struct index_mail *mail, const char *field,
 	field_idx = get_header_field_idx(_mail->box, field);
 
 	dest = str_new(mail->mail.data_pool, 128);
-	if (mail_cache_lookup_headers(_mail->transaction->cache_view, dest,
-				      _mail->seq, &field_idx, 1) <= 0) {
+	if ((ret = mail_cache_lookup_headers(_mail->transaction->cache_view, dest,
+					     _mail->seq, &field_idx, 1)) <= 0) {
 		/* not in cache / error - first see if it's already parsed */
 		p_free(mail->mail.data_pool, dest);
+		if (ret == 0)
+			index_mail_cache_add_missed_fields(mail, &field_idx, 1);
 		if (mail->data.header_parser_initialized) {
 			/* don't try to parse headers recursively. we're here
 			   because message size was wrong and istream-mail
@@ -905,6 +924,12 @@ header_cache_callback(struct header_filter_istream *input ATTR_UNUSED,
 		      bool *matched ATTR_UNUSED, struct index_mail *mail)
 {
 	index_mail_parse_header(NULL, hdr, mail);
+	if (hdr == NULL) {
+		index_mail_cache_parse_stats_finish(mail,
+			mail->data.filter_parse_start_usecs,
+			mail->data.stream->v_offset);
+		mail->data.filter_parse_start_usecs = 0;
+	}
 }
 
 static void index_mail_filter_stream_destroy(struct index_mail *mail)
@@ -968,6 +993,8 @@ int index_mail_get_header_stream(struct mail *_mail,
 					    _mail->seq, headers->idx[i]) <= 0) {
 			if (not_found_count++ == 0)
 				first_not_found = i;
+			index_mail_cache_add_missed_fields(mail,
+							   &headers->idx[i], 1);
 		}
 	}
 
@@ -984,6 +1011,8 @@ int index_mail_get_header_stream(struct mail *_mail,
 	if (mail_get_hdr_stream_because(_mail, NULL, reason, &input) < 0)
 		return -1;
 
+	mail->data.filter_parse_start_usecs =
+		index_mail_cache_parse_stats_start(mail);
 	index_mail_parse_header_init(mail, headers);
 	mail->data.filter_stream =
 		i_stream_create_header_filter(mail->data.stream,
@@ -7,6 +7,7 @@
 #include "istream.h"
 #include "hex-binary.h"
 #include "str.h"
+#include "time-util.h"
 #include "mailbox-recent-flags.h"
 #include "message-date.h"
 #include "message-part-data.h"
@@ -63,6 +64,8 @@ static struct mail_cache_field global_cache_fields[] = {
 	{ .name = "binary.parts",
 	  .type = MAIL_CACHE_FIELD_VARIABLE_SIZE },
 	{ .name = "body.snippet",
+	  .type = MAIL_CACHE_FIELD_VARIABLE_SIZE },
+	{ .name = "mime.parts.data",
 	  .type = MAIL_CACHE_FIELD_VARIABLE_SIZE }
 	/* FIXME: for now need to update get_metadata_precache_fields() in
 	   index-status.c when adding more fields. those fields should probably
@@ -90,6 +93,8 @@ int index_mail_cache_lookup_field(struct index_mail *mail, buffer_t *buf,
 				      buf, mail->mail.mail.seq, field_idx);
 	if (ret > 0)
 		mail->mail.mail.transaction->stats.cache_hit_count++;
+	else if (ret == 0)
+		index_mail_cache_add_missed_fields(mail, &field_idx, 1);
 
 	/* If the request was lazy mark the field as cache wanted. */
 	if (_mail->lookup_abort == MAIL_LOOKUP_ABORT_NOT_IN_CACHE_START_CACHING &&
@@ -103,6 +108,52 @@ int index_mail_cache_lookup_field(struct index_mail *mail, buffer_t *buf,
 	return ret;
 }
 
+void index_mail_cache_add_missed_fields(struct index_mail *mail,
+					const unsigned int field_idxs[],
+					unsigned int count)
+{
+	ARRAY_TYPE(uint) *missed = &mail->data.cache_missed_fields;
+	const unsigned int *missed_idxs;
+	unsigned int i, j, missed_count;
+
+	if (!array_is_created(missed))
+		p_array_init(missed, mail->mail.data_pool, 8);
+	for (i = 0; i < count; i++) {
+		missed_idxs = array_get(missed, &missed_count);
+		for (j = 0; j < missed_count; j++) {
+			if (missed_idxs[j] == field_idxs[i])
+				break;
+		}
+		if (j == missed_count)
+			array_push_back(missed, &field_idxs[i]);
+	}
+}
+
+uint64_t index_mail_cache_parse_stats_start(struct index_mail *mail)
+{
+	/* Avoid the clock lookups unless a cache miss caused the parse */
+	if (!array_is_created(&mail->data.cache_missed_fields) ||
+	    array_is_empty(&mail->data.cache_missed_fields))
+		return 0;
+	return i_microseconds();
+}
+
+void index_mail_cache_parse_stats_finish(struct index_mail *mail,
+					 uint64_t start_usecs, uoff_t bytes)
+{
+	const unsigned int *field_idxs;
+	unsigned int count;
+
+	if (start_usecs == 0)
+		return;
+
+	field_idxs = array_get(&mail->data.cache_missed_fields, &count);
+	mail_cache_fields_add_parse_stats(mail->mail.mail.box->cache,
+					  field_idxs, count, bytes,
+					  i_microseconds() - start_usecs);
+	array_clear(&mail->data.cache_missed_fields);
+}
+
 static void index_mail_try_set_attachment_keywords(struct index_mail *mail)
 {
 	if (mail->data.attachment_flags_updating) {
@@ -190,6 +241,79 @@ static bool get_cached_parts(struct index_mail *mail)
 	return TRUE;
 }
 
+bool index_mail_want_parts_data(struct index_mail *mail)
+{
+	const unsigned int field_idx =
+		mail->ibox->cache_fields[MAIL_CACHE_MESSAGE_PARTS_DATA].idx;
+	enum mail_cache_decision_type decision;
+
+	/* mime.parts.data is used only when it's explicitly enabled with
+	   mail_cache_fields or mail_always_cache_fields. Don't look it up
+	   otherwise, because the lookup would start caching it. */
+	decision = mail_cache_field_get_decision(mail->mail.mail.box->cache,
+						 field_idx);
+	return (decision & ENUM_NEGATE(MAIL_CACHE_DECISION_FORCED)) !=
+		MAIL_CACHE_DECISION_NO;
+}
+
+static struct message_part *get_cached_parts_data(struct index_mail *mail)
+{
+	const unsigned int field_idx =
+		mail->ibox->cache_fields[MAIL_CACHE_MESSAGE_PARTS_DATA].idx;
+	struct message_part *parts;
+	buffer_t *part_buf, *data_buf;
+	const char *error;
+
+	if (mail->data.cached_parts_data != NULL)
+		return mail->data.cached_parts_data;
+	if (!index_mail_want_parts_data(mail) ||
+	    mail->data.parser_ctx != NULL)
+		return NULL;
+
+	/* Deserialize a separate parts tree, so data.parts won't get
+	   part->data that the message parser doesn't expect. */
+	data_buf = t_buffer_create(256);
+	if (index_mail_cache_lookup_field(mail, data_buf, field_idx) <= 0 ||
+	    get_serialized_parts(mail, &part_buf) <= 0)
+		return NULL;
+
+	parts = message_part_deserialize(mail->mail.data_pool, part_buf->data,
+					 part_buf->used, &error);
+	if (parts == NULL) {
+		mail_set_mail_cache_corrupted(&mail->mail.mail,
+			"Corrupted cached mime.parts data: %s (parts=%s)",
+			error, binary_to_hex(part_buf->data, part_buf->used));
+		return NULL;
+	}
+	if (message_part_data_deserialize(mail->mail.data_pool, parts,
+					  data_buf->data, data_buf->used,
+					  &error) < 0) {
+		mail_set_mail_cache_corrupted(&mail->mail.mail,
+			"Corrupted cached mime.parts.data: %s", error);
+		return NULL;
+	}
+	mail->data.cached_parts_data = parts;
+	return parts;
+}
+
+bool index_mail_get_cached_parts_data_envelope(struct index_mail *mail)
+{
+	struct message_part *parts;
+	string_t *str;
+
+	T_BEGIN {
+		parts = get_cached_parts_data(mail);
+	} T_END;
+	/* the root part's envelope is the message's own ENVELOPE */
+	if (parts == NULL || parts->data->envelope == NULL)
+		return FALSE;
+
+	str = str_new(mail->mail.data_pool, 256);
+	imap_envelope_write(parts->data->envelope, str);
+	mail->data.envelope = str_c(str);
+	return TRUE;
+}
+
 void index_mail_set_message_parts_corrupted(struct mail *mail, const char *error)
 {
 	buffer_t *part_buf;
@@ -814,6 +938,54 @@ static void index_mail_body_parsed_cache_message_parts(struct index_mail *mail)
 	data->messageparts_saved_to_cache = TRUE;
 }
 
+static bool
+index_mail_body_parsed_cache_parts_data(struct index_mail *mail)
+{
+	struct mail *_mail = &mail->mail.mail;
+	struct index_mail_data *data = &mail->data;
+	const unsigned int cache_field =
+		mail->ibox->cache_fields[MAIL_CACHE_MESSAGE_PARTS_DATA].idx;
+	const unsigned int cache_field_parts =
+		mail->ibox->cache_fields[MAIL_CACHE_MESSAGE_PARTS].idx;
+	struct message_part_data *root_data;
+	buffer_t *buffer;
+
+	if (!index_mail_want_parts_data(mail))
+		return FALSE;
+
+	/* BODY and BODYSTRUCTURE are written from mime.parts +
+	   mime.parts.data, so make sure mime.parts gets cached as well.
+	   mime.parts.data is useless without it. */
+	data->save_message_parts = TRUE;
+	index_mail_body_parsed_cache_message_parts(mail);
+	if (!data->messageparts_saved_to_cache &&
+	    mail_cache_field_exists(_mail->transaction->cache_view,
+				    _mail->seq, cache_field_parts) <= 0)
+		return FALSE;
+
+	if (mail_cache_field_exists(_mail->transaction->cache_view,
+				    _mail->seq, cache_field) > 0)
+		return TRUE;
+	if (!mail_cache_field_want_add(_mail->transaction->cache_trans,
+				       _mail->seq, cache_field))
+		return FALSE;
+
+	/* The root part doesn't otherwise have an envelope. Store the
+	   message's own ENVELOPE there. */
+	root_data = data->parts->data;
+	i_assert(root_data->envelope == NULL);
+	root_data->envelope = data->parts_data_envelope;
+
+	pool_t pool = pool_alloconly_create("mail parts data", 2048);
+	buffer = buffer_create_dynamic(pool, 1024);
+	message_part_data_serialize(data->parts, buffer);
+	index_mail_cache_add_idx(mail, cache_field,
+				 buffer->data, buffer->used);
+	pool_unref(&pool);
+	root_data->envelope = NULL;
+	return TRUE;
+}
+
 static int
 index_mail_write_bodystructure(struct index_mail *mail, string_t *str,
 			       bool extended)
@@ -860,6 +1032,12 @@ index_mail_body_parsed_cache_bodystructure(struct index_mail *mail,
 		return;
 	i_assert(data->parts != NULL);
 
+	if (!plain_bodystructure &&
+	    index_mail_body_parsed_cache_parts_data(mail)) {
+		/* cached it as message_parts + their data */
+		plain_bodystructure = TRUE;
+	}
+
 	/* If BODY is fetched first but BODYSTRUCTURE is also wanted, we don't
 	   normally want to first cache BODY and then BODYSTRUCTURE. So check
 	   the wanted_fields also in here. */
@@ -1305,11 +1483,13 @@ static int index_mail_parse_body(struct index_mail *mail,
 				 enum index_cache_field field)
 {
 	struct index_mail_data *data = &mail->data;
+	uint64_t parse_start_usecs;
 	uoff_t old_offset;
 	int ret;
 
 	i_assert(data->parser_ctx != NULL);
 
+	parse_start_usecs = index_mail_cache_parse_stats_start(mail);
 	old_offset = data->stream->v_offset;
 	i_stream_seek(data->stream, data->hdr_size.physical_size);
 
@@ -1325,6 +1505,8 @@ static int index_mail_parse_body(struct index_mail *mail,
 			*null_message_part_header_callback, NULL);
 	}
 	ret = index_mail_stream_check_failure(mail);
+	index_mail_cache_parse_stats_finish(mail, parse_start_usecs,
+		data->stream->v_offset - data->hdr_size.physical_size);
 	if (index_mail_parse_body_finish(mail, field, TRUE) < 0)
 		ret = -1;
 
@@ -1585,6 +1767,33 @@ index_mail_get_plain_bodystructure(struct index_mail *mail, string_t *str,
 		str_append(str, " NIL NIL NIL NIL");
 }
 
+static bool
+index_mail_get_cached_parts_data_bodystructure(struct index_mail *mail,
+					       string_t *str, bool extended)
+{
+	struct message_part *parts;
+	const char *error;
+	bool ret;
+
+	T_BEGIN {
+		parts = get_cached_parts_data(mail);
+	} T_END;
+	if (parts == NULL)
+		return FALSE;
+
+	T_BEGIN {
+		ret = imap_bodystructure_write(parts, str, extended,
+					       &error) == 0;
+		if (!ret) {
+			str_truncate(str, 0);
+			mail_set_cache_corrupted(&mail->mail.mail,
+				MAIL_FETCH_IMAP_BODYSTRUCTURE, t_strdup_printf(
+				"Invalid mime.parts.data: %s", error));
+		}
+	} T_END;
+	return ret;
+}
+
 static int
 index_mail_fetch_body_snippet(struct index_mail *mail, const char **value_r)
 {
@@ -1639,12 +1848,17 @@ bool index_mail_get_cached_body(struct index_mail *mail, const char **value_r)
 		return TRUE;
 	}
 
-	/* 2) get BODY if it exists */
+	/* 2) write BODY from cached message_parts + their data */
+	if (index_mail_get_cached_parts_data_bodystructure(mail, str, FALSE)) {
+		*value_r = data->body = str_c(str);
+		return TRUE;
+	}
+	/* 3) get BODY if it exists */
 	if (index_mail_cache_lookup_field(mail, str, body_cache_field) > 0) {
 		*value_r = data->body = str_c(str);
 		return TRUE;
 	}
-	/* 3) get it using BODYSTRUCTURE if it exists */
+	/* 4) get it using BODYSTRUCTURE if it exists */
 	if (index_mail_cache_lookup_field(mail, str, bodystructure_cache_field) > 0) {
 		data->bodystructure =
 			p_strdup(mail->mail.data_pool, str_c(str));
@@ -1685,7 +1899,9 @@ bool index_mail_get_cached_bodystructure(struct index_mail *mail,
 	if ((data->cache_flags & MAIL_CACHE_FLAG_TEXT_PLAIN_7BIT_ASCII) != 0 &&
 	    get_cached_parts(mail))
 		index_mail_get_plain_bodystructure(mail, str, TRUE);
-	else if (index_mail_cache_lookup_field(mail, str,
+	else if (!index_mail_get_cached_parts_data_bodystructure(mail, str,
+								 TRUE) &&
+		 index_mail_cache_lookup_field(mail, str,
 			bodystructure_cache_field) <= 0) {
 		str_free(&str);
 		return FALSE;
@@ -1941,6 +2157,9 @@ static void check_envelope(struct index_mail *mail)
 	if (mail_cache_field_exists(_mail->transaction->cache_view,
 				    _mail->seq, cache_field_envelope) > 0)
 		return;
+	/* the same if it can be written from mime.parts.data */
+	if (index_mail_get_cached_parts_data_envelope(mail))
+		return;
 
 	/* don't waste time doing full checks for all required
 	   headers. assume that if we have "hdr.message-id" cached,
@@ -24,6 +24,7 @@ enum index_cache_field {
 	MAIL_CACHE_MESSAGE_PARTS,
 	MAIL_CACHE_BINARY_PARTS,
 	MAIL_CACHE_BODY_SNIPPET,
+	MAIL_CACHE_MESSAGE_PARTS_DATA,
 
 	MAIL_INDEX_CACHE_FIELD_COUNT
 };
@@ -84,6 +85,10 @@ struct index_mail_data {
 	const char *envelope, *body, *bodystructure, *guid, *filename;
 	const char *from_envelope, *body_snippet;
 	struct message_part_envelope *envelope_data;
+	/* Parts tree deserialized from mime.parts + mime.parts.data */
+	struct message_part *cached_parts_data;
+	/* The message's own envelope, stored into mime.parts.data */
+	struct message_part_envelope *parts_data_envelope;
 
 	uint32_t cache_flags;
 	uint64_t modseq, pvt_modseq;
@@ -105,11 +110,16 @@ struct index_mail_data {
 	int parsing_count;
 	ARRAY_TYPE(keywords) keywords;
 	ARRAY_TYPE(keyword_indexes) keyword_indexes;
+	/* Cache fields whose lookups missed since the mail was last parsed */
+	ARRAY_TYPE(uint) cache_missed_fields;
+	/* index_mail_cache_parse_stats_start() of the header filter stream */
+	uint64_t filter_parse_start_usecs;
 
 	bool initialized:1;
 	bool save_sent_date:1;
 	bool sent_date_parsed:1;
 	bool save_envelope:1;
+	bool save_parts_data_envelope:1;
 	bool save_bodystructure_header:1;
 	bool save_bodystructure_body:1;
 	bool save_message_parts:1;
@@ -207,6 +217,11 @@ int index_mail_parse_headers_internal(struct index_mail *mail,
 				      struct mailbox_header_lookup_ctx *headers)
 	ATTR_NULL(2);
 int index_mail_headers_get_envelope(struct index_mail *mail);
+/* Returns TRUE if mime.parts.data is enabled for the mailbox. */
+bool index_mail_want_parts_data(struct index_mail *mail);
+/* Set data->envelope from the cached mime.parts.data. Returns TRUE if it
+   was found there. */
+bool index_mail_get_cached_parts_data_envelope(struct index_mail *mail);
 void index_mail_parts_reset(struct index_mail *mail);
 
 int index_mail_get_first_header(struct mail *_mail, const char *field,
@@ -297,6 +312,16 @@ void index_mail_cache_parse_deinit(struct mail *mail, time_t received_date,
 
 int index_mail_cache_lookup_field(struct index_mail *mail, buffer_t *buf,
 				  unsigned int field_idx);
+/* Remember that the cache fields weren't found, so the following parse gets
+   accounted to them in the cache field statistics. */
+void index_mail_cache_add_missed_fields(struct index_mail *mail,
+					const unsigned int field_idxs[],
+					unsigned int count);
+/* Returns the start timestamp for index_mail_cache_parse_stats_finish(),
+   or 0 if no cache field lookups have missed. */
+uint64_t index_mail_cache_parse_stats_start(struct index_mail *mail);
+void index_mail_cache_parse_stats_finish(struct index_mail *mail,
+					 uint64_t start_usecs, uoff_t bytes);
 void index_mail_save_finish(struct mail_save_context *ctx);
 
 const char *index_mail_cache_reason(struct mail *mail, const char *reason);
@@ -59,6 +59,9 @@ struct search_body_context {
         struct index_search_context *index_ctx;
 	struct istream *input;
 	struct message_part *part;
+
+	ARRAY(struct mail_search_arg *) args;
+	ARRAY(struct message_search_context *) msg_search_ctxs;
 };
 
 static void search_parse_msgset_args(unsigned int messages_count,
@@ -702,12 +705,10 @@ static void search_header(struct message_header_line *hdr,
 	}
 }
 
-static void search_body(struct mail_search_arg *arg,
-			struct search_body_context *ctx)
+static void search_body_add(struct mail_search_arg *arg,
+			    struct search_body_context *ctx)
 {
 	struct message_search_context *msg_search_ctx;
-	const char *error;
-	int ret;
 
 	switch (arg->type) {
 	case SEARCH_BODY:
@@ -722,15 +723,35 @@ static void search_body(struct mail_search_arg *arg,
 		ARG_SET_RESULT(arg, 0);
 		return;
 	}
+	array_push_back(&ctx->args, &arg);
+	array_push_back(&ctx->msg_search_ctxs, &msg_search_ctx);
+}
+
+static void search_body(struct search_body_context *ctx)
+{
+	struct mail_search_arg *const *args;
+	struct message_search_context *const *msg_search_ctxs;
+	const char *error;
+	unsigned int i, count;
+	bool *matches;
+	int ret;
+
+	/* search all the keys while reading the message only once */
+	args = array_get(&ctx->args, &count);
+	msg_search_ctxs = array_front(&ctx->msg_search_ctxs);
+	matches = t_new(bool, count);
 
 	i_stream_seek(ctx->input, 0);
-	ret = message_search_msg(msg_search_ctx, ctx->input, ctx->part, &error);
+	ret = message_search_msg_multi(msg_search_ctxs, count, ctx->input,
+				       ctx->part, matches, &error);
 	if (ret < 0 && ctx->input->stream_errno == 0) {
 		/* try again without cached parts */
 		index_mail_set_message_parts_corrupted(ctx->index_ctx->cur_mail, error);
 
 		i_stream_seek(ctx->input, 0);
-		ret = message_search_msg(msg_search_ctx, ctx->input, NULL, &error);
+		ret = message_search_msg_multi(msg_search_ctxs, count,
+					       ctx->input, NULL, matches,
+					       &error);
 		i_assert(ret >= 0 || ctx->input->stream_errno != 0);
 	}
 	if (ctx->input->stream_errno != 0) {
@@ -739,7 +760,8 @@ static void search_body(struct mail_search_arg *arg,
 			i_stream_get_error(ctx->input));
 	}
 
-	ARG_SET_RESULT(arg, ret);
+	for (i = 0; i < count; i++)
+		ARG_SET_RESULT(args[i], ret < 0 ? -1 : (matches[i] ? 1 : 0));
 }
 
 static int search_arg_match_text(struct mail_search_arg *args,
@@ -874,7 +896,14 @@ static int search_arg_match_text(struct mail_search_arg *args,
 	(void)mail_get_parts(ctx->cur_mail, &body_ctx.part);
 	ctx->cur_mail->lookup_abort = MAIL_LOOKUP_ABORT_NEVER;
 
-	return mail_search_args_foreach(args, search_body, &body_ctx);
+	t_array_init(&body_ctx.args, 8);
+	t_array_init(&body_ctx.msg_search_ctxs, 8);
+	ret = mail_search_args_foreach(args, search_body_add, &body_ctx);
+	if (ret >= 0 || array_count(&body_ctx.args) == 0)
+		return ret;
+
+	search_body(&body_ctx);
+	return mail_search_args_foreach(args, search_none, NULL);
 }
 
 static bool
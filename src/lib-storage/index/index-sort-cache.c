@@ -0,0 +1,783 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "buffer.h"
+#include "str.h"
+#include "ostream.h"
+#include "read-full.h"
+#include "safe-mkstemp.h"
+#include "seq-range-array.h"
+#include "index-storage.h"
+#include "index-sort-private.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+/* How many different sort programs are remembered per mailbox */
+#define INDEX_SORT_CACHE_MAX_PROGRAMS 4
+/* If more than 1/n of the mailbox consists of new mails, it's faster to just
+   sort everything again than to merge the new mails to the cached order. */
+#define INDEX_SORT_CACHE_MAX_NEW_MAILS_DIV 8
+#define INDEX_SORT_CACHE_MIN_NEW_MAILS 16
+/* Build a new cache only if the search matched at least this many percent
+   of the mailbox. Otherwise sorting all the mails would cost much more than
+   sorting just the matched ones. */
+#define INDEX_SORT_CACHE_BUILD_MIN_PERCENT 50
+
+/* The sort orders are written to <index_prefix>.index.sort when the
+   mailbox is closed, so that they survive over sessions. */
+#define INDEX_SORT_CACHE_FILE_SUFFIX ".index.sort"
+#define INDEX_SORT_CACHE_FILE_VERSION 1
+
+struct index_sort_cache_file_header {
+	uint32_t version;
+	uint32_t uid_validity;
+	uint32_t programs_count;
+};
+
+struct index_sort_cache_file_program {
+	uint32_t sort_program[MAX_SORT_PROGRAM_SIZE];
+	uint32_t next_uid;
+	uint32_t uids_count;
+	/* uint32_t uids[uids_count]; */
+};
+
+struct index_sort_cache_rec {
+	uint32_t uid;
+	/* Sequence of the mail when the cache was last used. Only valid if
+	   seqs_valid=TRUE. */
+	uint32_t seq;
+};
+ARRAY_DEFINE_TYPE(index_sort_cache_rec, struct index_sort_cache_rec);
+
+struct index_sort_cache {
+	enum mail_sort_type sort_program[MAX_SORT_PROGRAM_SIZE];
+	uint32_t uid_validity;
+	/* All mails with UID lower than this are in recs[] in the sorted
+	   order, except for the ones that have been expunged afterwards. */
+	uint32_t next_uid;
+	ARRAY_TYPE(index_sort_cache_rec) recs;
+	/* FALSE if the cache was read from the file and the sequences
+	   haven't been looked up yet. */
+	bool seqs_valid;
+};
+
+static bool
+index_sort_program_is_cacheable(const enum mail_sort_type *sort_program)
+{
+	for (unsigned int i = 0; sort_program[i] != MAIL_SORT_END; i++) {
+		switch (sort_program[i] & MAIL_SORT_MASK) {
+		case MAIL_SORT_RELEVANCY:
+			/* depends on the search query */
+		case MAIL_SORT_POP3_ORDER:
+			/* may change after the mail was saved */
+			return FALSE;
+		default:
+			break;
+		}
+	}
+	return TRUE;
+}
+
+static bool
+index_sort_program_equals(const enum mail_sort_type *p1,
+			  const enum mail_sort_type *p2)
+{
+	unsigned int i;
+
+	for (i = 0; p1[i] != MAIL_SORT_END; i++) {
+		if (p1[i] != p2[i])
+			return FALSE;
+	}
+	return p2[i] == MAIL_SORT_END;
+}
+
+static void index_sort_cache_free(struct index_sort_cache **_cache)
+{
+	struct index_sort_cache *cache = *_cache;
+
+	*_cache = NULL;
+	array_free(&cache->recs);
+	i_free(cache);
+}
+
+static const char *index_sort_cache_get_path(struct mailbox *box)
+{
+	const char *dir;
+
+	if (MAIL_INDEX_IS_IN_MEMORY(box->index))
+		return NULL;
+	if (mailbox_get_path_to(box, MAILBOX_LIST_PATH_TYPE_INDEX, &dir) <= 0)
+		return NULL;
+	return t_strconcat(dir, "/", box->index_prefix,
+			   INDEX_SORT_CACHE_FILE_SUFFIX, NULL);
+}
+
+static const char *
+index_sort_cache_parse_uids(struct index_sort_cache *cache,
+			    const unsigned char *data, unsigned int count)
+{
+	ARRAY_TYPE(seq_range) seen_uids;
+	struct index_sort_cache_rec *rec;
+	const char *error = NULL;
+	unsigned int i;
+
+	t_array_init(&seen_uids, 32);
+	for (i = 0; i < count; i++) {
+		rec = array_append_space(&cache->recs);
+		memcpy(&rec->uid, data + i * sizeof(uint32_t),
+		       sizeof(rec->uid));
+		if (rec->uid == 0 || rec->uid >= cache->next_uid) {
+			error = t_strdup_printf("UID %u not below next_uid %u",
+						rec->uid, cache->next_uid);
+			break;
+		}
+		if (seq_range_array_add(&seen_uids, rec->uid)) {
+			error = t_strdup_printf("Duplicate UID %u", rec->uid);
+			break;
+		}
+	}
+	return error;
+}
+
+static const char *
+index_sort_cache_parse(struct index_mailbox_context *ibox,
+		       const unsigned char *data, size_t size)
+{
+	const struct index_sort_cache_file_header *hdr = (const void *)data;
+	struct index_sort_cache_file_program prog;
+	struct index_sort_cache *cache;
+	const char *error;
+	size_t pos = sizeof(*hdr);
+	unsigned int i, j;
+
+	if (size < sizeof(*hdr))
+		return "File too small";
+	if (hdr->version != INDEX_SORT_CACHE_FILE_VERSION)
+		return "Unsupported version";
+	if (hdr->programs_count > INDEX_SORT_CACHE_MAX_PROGRAMS)
+		return "Too many programs";
+
+	for (i = 0; i < hdr->programs_count; i++) {
+		if (size - pos < sizeof(prog))
+			return "Truncated program header";
+		memcpy(&prog, data + pos, sizeof(prog));
+		pos += sizeof(prog);
+		if ((size - pos) / sizeof(uint32_t) < prog.uids_count)
+			return "Truncated UIDs";
+		for (j = 0; j < MAX_SORT_PROGRAM_SIZE; j++) {
+			if (prog.sort_program[j] == MAIL_SORT_END)
+				break;
+		}
+		if (j == MAX_SORT_PROGRAM_SIZE)
+			return "Sort program not terminated";
+		if (prog.next_uid == 0)
+			return "next_uid is 0";
+
+		cache = i_new(struct index_sort_cache, 1);
+		for (j = 0; j < MAX_SORT_PROGRAM_SIZE; j++)
+			cache->sort_program[j] = prog.sort_program[j];
+		cache->uid_validity = hdr->uid_validity;
+		cache->next_uid = prog.next_uid;
+		i_array_init(&cache->recs, I_MAX(prog.uids_count, 1));
+		/* added before the check, so it's freed by the caller */
+		array_push_back(&ibox->sort_caches, &cache);
+		error = index_sort_cache_parse_uids(cache, data + pos,
+						    prog.uids_count);
+		if (error != NULL)
+			return error;
+		pos += prog.uids_count * sizeof(uint32_t);
+	}
+	if (pos != size)
+		return "Trailing garbage";
+	return NULL;
+}
+
+static void index_sort_cache_read(struct mailbox *box)
+{
+	struct index_mailbox_context *ibox = INDEX_STORAGE_CONTEXT(box);
+	struct index_sort_cache *cache;
+	const char *path, *error;
+	struct stat st;
+	void *data;
+	int fd, ret;
+
+	i_array_init(&ibox->sort_caches, INDEX_SORT_CACHE_MAX_PROGRAMS);
+	path = index_sort_cache_get_path(box);
+	if (path == NULL)
+		return;
+
+	fd = open(path, O_RDONLY);
+	if (fd == -1) {
+		if (errno != ENOENT)
+			mailbox_set_critical(box, "open(%s) failed: %m", path);
+		return;
+	}
+	if (fstat(fd, &st) < 0) {
+		mailbox_set_critical(box, "fstat(%s) failed: %m", path);
+		i_close_fd(&fd);
+		return;
+	}
+	data = i_malloc(I_MAX(st.st_size, 1));
+	ret = read_full(fd, data, st.st_size);
+	if (ret < 0)
+		mailbox_set_critical(box, "read(%s) failed: %m", path);
+	else if (ret == 0) {
+		/* replaced while reading - just ignore it */
+	} else if ((error = index_sort_cache_parse(ibox, data,
+						   st.st_size)) != NULL) {
+		e_warning(box->event, "Corrupted sort cache %s: %s - "
+			  "ignoring", path, error);
+		array_foreach_elem(&ibox->sort_caches, cache)
+			index_sort_cache_free(&cache);
+		array_clear(&ibox->sort_caches);
+		i_unlink_if_exists(path);
+	}
+	i_free(data);
+	i_close_fd(&fd);
+}
+
+static void
+index_sort_cache_write_to(struct index_mailbox_context *ibox,
+			  struct ostream *output)
+{
+	struct index_sort_cache_file_header hdr;
+	struct index_sort_cache_file_program prog;
+	struct index_sort_cache *cache;
+	const struct index_sort_cache_rec *rec;
+	unsigned int i;
+
+	i_zero(&hdr);
+	hdr.version = INDEX_SORT_CACHE_FILE_VERSION;
+	hdr.uid_validity = array_idx_elem(&ibox->sort_caches, 0)->uid_validity;
+	hdr.programs_count = array_count(&ibox->sort_caches);
+	o_stream_nsend(output, &hdr, sizeof(hdr));
+
+	array_foreach_elem(&ibox->sort_caches, cache) {
+		i_zero(&prog);
+		for (i = 0; i < MAX_SORT_PROGRAM_SIZE; i++)
+			prog.sort_program[i] = cache->sort_program[i];
+		prog.next_uid = cache->next_uid;
+		prog.uids_count = array_count(&cache->recs);
+		o_stream_nsend(output, &prog, sizeof(prog));
+		array_foreach(&cache->recs, rec)
+			o_stream_nsend(output, &rec->uid, sizeof(rec->uid));
+	}
+}
+
+static void index_sort_cache_write(struct mailbox *box)
+{
+	struct index_mailbox_context *ibox = INDEX_STORAGE_CONTEXT(box);
+	const struct mailbox_permissions *perm = mailbox_get_permissions(box);
+	struct ostream *output;
+	const char *path, *temp_path;
+	string_t *str;
+	int fd, ret = 0;
+
+	path = index_sort_cache_get_path(box);
+	if (path == NULL || box->deleting)
+		return;
+	if (array_count(&ibox->sort_caches) == 0) {
+		i_unlink_if_exists(path);
+		return;
+	}
+
+	str = t_str_new(256);
+	str_append(str, path);
+	fd = safe_mkstemp_hostpid_group(str, perm->file_create_mode,
+					perm->file_create_gid,
+					perm->file_create_gid_origin);
+	temp_path = str_c(str);
+	if (fd == -1) {
+		if (errno != ENOENT) {
+			mailbox_set_critical(box,
+				"safe_mkstemp(%s) failed: %m", temp_path);
+		}
+		return;
+	}
+	output = o_stream_create_fd(fd, 0);
+	o_stream_cork(output);
+	index_sort_cache_write_to(ibox, output);
+	if (o_stream_finish(output) < 0) {
+		mailbox_set_critical(box, "write(%s) failed: %s",
+				     temp_path, o_stream_get_error(output));
+		ret = -1;
+	}
+	o_stream_destroy(&output);
+	if (close(fd) < 0) {
+		mailbox_set_critical(box, "close(%s) failed: %m", temp_path);
+		ret = -1;
+	} else if (ret == 0 && rename(temp_path, path) < 0) {
+		mailbox_set_critical(box, "rename(%s, %s) failed: %m",
+				     temp_path, path);
+		ret = -1;
+	}
+	if (ret < 0)
+		i_unlink(temp_path);
+}
+
+static struct index_sort_cache *
+index_sort_cache_find(struct mail_search_sort_program *program,
+		      const struct mail_index_header *hdr)
+{
+	struct index_mailbox_context *ibox =
+		INDEX_STORAGE_CONTEXT(program->t->box);
+	struct index_sort_cache *const *caches, *cache;
+	unsigned int i, count;
+
+	if (!array_is_created(&ibox->sort_caches))
+		index_sort_cache_read(program->t->box);
+
+	caches = array_get(&ibox->sort_caches, &count);
+	for (i = 0; i < count; i++) {
+		if (index_sort_program_equals(caches[i]->sort_program,
+					      program->sort_program))
+			break;
+	}
+	if (i == count)
+		return NULL;
+
+	cache = caches[i];
+	array_delete(&ibox->sort_caches, i, 1);
+	if (i > 0)
+		ibox->sort_caches_changed = TRUE;
+	if (cache->uid_validity != hdr->uid_validity) {
+		/* mailbox was recreated */
+		ibox->sort_caches_changed = TRUE;
+		index_sort_cache_free(&cache);
+		return NULL;
+	}
+	if (cache->next_uid > hdr->next_uid) {
+		e_warning(program->t->box->event,
+			  "Sort cache has next_uid %u > %u - rebuilding",
+			  cache->next_uid, hdr->next_uid);
+		ibox->sort_caches_changed = TRUE;
+		index_sort_cache_free(&cache);
+		return NULL;
+	}
+	/* keep the most recently used cache first */
+	array_push_front(&ibox->sort_caches, &cache);
+	return cache;
+}
+
+static void
+index_sort_cache_remove(struct mail_search_sort_program *program,
+			struct index_sort_cache *cache)
+{
+	struct index_mailbox_context *ibox =
+		INDEX_STORAGE_CONTEXT(program->t->box);
+	struct index_sort_cache *const *caches;
+	unsigned int i, count;
+
+	caches = array_get(&ibox->sort_caches, &count);
+	for (i = 0; i < count; i++) {
+		if (caches[i] == cache) {
+			array_delete(&ibox->sort_caches, i, 1);
+			break;
+		}
+	}
+	ibox->sort_caches_changed = TRUE;
+	index_sort_cache_free(&cache);
+}
+
+static void
+index_sort_cache_add(struct mail_search_sort_program *program,
+		     uint32_t uid_validity, uint32_t next_uid)
+{
+	struct index_mailbox_context *ibox =
+		INDEX_STORAGE_CONTEXT(program->t->box);
+	struct index_sort_cache *cache;
+	struct index_sort_cache_rec *rec;
+	const uint32_t *seqp;
+
+	cache = i_new(struct index_sort_cache, 1);
+	memcpy(cache->sort_program, program->sort_program,
+	       sizeof(cache->sort_program));
+	cache->uid_validity = uid_validity;
+	cache->next_uid = next_uid;
+	cache->seqs_valid = TRUE;
+	i_array_init(&cache->recs, I_MAX(array_count(&program->seqs), 1));
+	array_foreach(&program->seqs, seqp) {
+		rec = array_append_space(&cache->recs);
+		rec->seq = *seqp;
+		mail_index_lookup_uid(program->t->view, *seqp, &rec->uid);
+	}
+
+	ibox->sort_caches_changed = TRUE;
+	for (unsigned int i = array_count(&ibox->sort_caches); i > 0; i--) {
+		struct index_sort_cache *old_cache =
+			array_idx_elem(&ibox->sort_caches, i - 1);
+
+		if (old_cache->uid_validity != uid_validity) {
+			/* mailbox was recreated */
+			array_delete(&ibox->sort_caches, i - 1, 1);
+			index_sort_cache_free(&old_cache);
+		}
+	}
+	if (array_count(&ibox->sort_caches) >=
+	    INDEX_SORT_CACHE_MAX_PROGRAMS) {
+		struct index_sort_cache *old_cache =
+			array_idx_elem(&ibox->sort_caches,
+				       INDEX_SORT_CACHE_MAX_PROGRAMS - 1);
+		array_delete(&ibox->sort_caches,
+			     INDEX_SORT_CACHE_MAX_PROGRAMS - 1, 1);
+		index_sort_cache_free(&old_cache);
+	}
+	array_push_front(&ibox->sort_caches, &cache);
+}
+
+static bool
+index_sort_cache_is_wanted(const buffer_t *wanted, uint32_t seq)
+{
+	const unsigned char *bits = wanted->data;
+	size_t idx = seq / CHAR_BIT;
+
+	return idx < wanted->used &&
+		(bits[idx] & (1 << (seq % CHAR_BIT))) != 0;
+}
+
+static void
+index_sort_cache_filter_wanted(struct mail_search_sort_program *program,
+			       const buffer_t *wanted)
+{
+	uint32_t *seqs;
+	unsigned int i, j, count;
+
+	seqs = array_get_modifiable(&program->seqs, &count);
+	for (i = j = 0; i < count; i++) {
+		if (index_sort_cache_is_wanted(wanted, seqs[i]))
+			seqs[j++] = seqs[i];
+	}
+	array_delete(&program->seqs, j, count - j);
+}
+
+static void
+index_sort_cache_set_seqs(struct mail_search_sort_program *program,
+			  ARRAY_TYPE(uint32_t) *seqs)
+{
+	if (array_is_created(&program->seqs))
+		array_free(&program->seqs);
+	program->seqs = *seqs;
+	i_zero(seqs);
+}
+
+static void
+index_sort_cache_sort_seqs(struct mail_search_sort_program *program,
+			   uint32_t seq1, uint32_t seq2,
+			   const buffer_t *wanted)
+{
+	struct mail *mail = program->temp_mail;
+	ARRAY_TYPE(uint32_t) seqs;
+	uint32_t seq;
+	unsigned int i, count;
+
+	for (seq = seq1; seq <= seq2; seq++) {
+		if (wanted != NULL && !index_sort_cache_is_wanted(wanted, seq))
+			continue;
+		mail_set_seq(mail, seq);
+		/* comparisons may have left this set */
+		mail->lookup_abort = MAIL_LOOKUP_ABORT_NEVER;
+		index_sort_list_add(program, mail);
+	}
+	program->sort_list_finish(program);
+
+	/* The sorted nodes may have been converted to program->seqs as-is,
+	   so the array's elements aren't necessarily plain sequences. */
+	count = array_count(&program->seqs);
+	i_array_init(&seqs, I_MAX(count, 1));
+	for (i = 0; i < count; i++)
+		array_push_back(&seqs, array_idx(&program->seqs, i));
+	index_sort_cache_set_seqs(program, &seqs);
+}
+
+static unsigned int
+index_sort_cache_find_insert_pos(struct mail_search_sort_program *program,
+				 const struct index_sort_cache_rec *recs,
+				 unsigned int left_idx, unsigned int right_idx,
+				 uint32_t seq)
+{
+	unsigned int idx;
+	int ret;
+
+	while (left_idx < right_idx) {
+		idx = (left_idx + right_idx) / 2;
+		ret = index_sort_node_cmp_type(program, program->sort_program,
+					       seq, recs[idx].seq);
+		if (ret < 0)
+			right_idx = idx;
+		else
+			left_idx = idx + 1;
+	}
+	return left_idx;
+}
+
+/* Returns FALSE if the cache read from the file doesn't contain exactly the
+   mails that have UID < next_uid. */
+static bool
+index_sort_cache_remap_seqs(struct mail_index_view *view,
+			    struct index_sort_cache *cache)
+{
+	struct index_sort_cache_rec *recs;
+	uint32_t *uids, *seq_map, seq, seq1, seq2, uid;
+	unsigned int i, j, count;
+
+	recs = array_get_modifiable(&cache->recs, &count);
+	if (!cache->seqs_valid) {
+		/* read from the file - look up the sequences once. The UIDs
+		   are unique, so if the number of found mails matches, their
+		   sequences are 1..count in some order. */
+		for (i = j = 0; i < count; i++) {
+			if (mail_index_lookup_seq(view, recs[i].uid,
+						  &recs[j].seq))
+				recs[j++].uid = recs[i].uid;
+		}
+		array_delete(&cache->recs, j, count - j);
+		if (!mail_index_lookup_seq_range(view, 1, cache->next_uid - 1,
+						 &seq1, &seq2))
+			seq2 = 0;
+		if (seq2 != j)
+			return FALSE;
+		cache->seqs_valid = TRUE;
+		return TRUE;
+	}
+
+	/* The cache has all the mails that had UID < next_uid and their
+	   sequences were 1..count. If none of them were expunged, the
+	   sequences are still the same. */
+	if (!mail_index_lookup_seq_range(view, 1, cache->next_uid - 1,
+					 &seq1, &seq2))
+		seq2 = 0;
+	if (seq2 == count)
+		return TRUE;
+
+	/* Some were expunged. Walk through the old sequences in UID order
+	   and map them to the current sequences. */
+	uids = i_new(uint32_t, count);
+	seq_map = i_new(uint32_t, count);
+	for (i = 0; i < count; i++) {
+		i_assert(recs[i].seq > 0 && recs[i].seq <= count);
+		uids[recs[i].seq - 1] = recs[i].uid;
+	}
+	for (i = 0, seq = 1; i < count; i++) {
+		if (seq > seq2)
+			break;
+		mail_index_lookup_uid(view, seq, &uid);
+		if (uid == uids[i])
+			seq_map[i] = seq++;
+	}
+	for (i = j = 0; i < count; i++) {
+		if (seq_map[recs[i].seq - 1] != 0) {
+			recs[j].uid = recs[i].uid;
+			recs[j++].seq = seq_map[recs[i].seq - 1];
+		}
+	}
+	array_delete(&cache->recs, j, count - j);
+	i_free(uids);
+	i_free(seq_map);
+	return TRUE;
+}
+
+static void
+index_sort_cache_set_wanted_seqs(struct mail_search_sort_program *program,
+				 const ARRAY_TYPE(index_sort_cache_rec) *recs,
+				 const buffer_t *wanted)
+{
+	const struct index_sort_cache_rec *rec;
+	ARRAY_TYPE(uint32_t) seqs;
+
+	i_array_init(&seqs, program->cache_wanted_count);
+	array_foreach(recs, rec) {
+		if (index_sort_cache_is_wanted(wanted, rec->seq))
+			array_push_back(&seqs, &rec->seq);
+	}
+	index_sort_cache_set_seqs(program, &seqs);
+}
+
+/* Update the cache with the new mails and set program->seqs to the wanted
+   mails in the cached order. Returns FALSE if the cache couldn't be used. */
+static bool
+index_sort_cache_update(struct mail_search_sort_program *program,
+			struct index_sort_cache *cache, uint32_t next_uid,
+			const buffer_t *wanted)
+{
+	struct index_mailbox_context *ibox =
+		INDEX_STORAGE_CONTEXT(program->t->box);
+	struct mail_index_view *view = program->t->view;
+	ARRAY_TYPE(index_sort_cache_rec) new_recs;
+	const struct index_sort_cache_rec *recs;
+	struct index_sort_cache_rec *rec;
+	const uint32_t *new_seqs;
+	uint32_t seq, seq1, seq2;
+	unsigned int i, idx, prev_idx, count, new_count;
+	bool partial = FALSE;
+
+	count = array_count(&cache->recs);
+	if (!index_sort_cache_remap_seqs(view, cache)) {
+		e_warning(program->t->box->event,
+			  "Sort cache doesn't match the mailbox - rebuilding");
+		return FALSE;
+	}
+	if (array_count(&cache->recs) != count)
+		ibox->sort_caches_changed = TRUE;
+
+	if (!mail_index_lookup_seq_range(view, cache->next_uid, (uint32_t)-1,
+					 &seq1, &seq2)) {
+		/* nothing to sort */
+		program->sort_list_finish(program);
+		if (cache->next_uid != next_uid) {
+			cache->next_uid = next_uid;
+			ibox->sort_caches_changed = TRUE;
+		}
+		index_sort_cache_set_wanted_seqs(program, &cache->recs, wanted);
+		return TRUE;
+	}
+
+	count = array_count(&cache->recs);
+	new_count = seq2 - seq1 + 1;
+	if (new_count > INDEX_SORT_CACHE_MIN_NEW_MAILS &&
+	    new_count > count / INDEX_SORT_CACHE_MAX_NEW_MAILS_DIV)
+		return FALSE;
+
+	/* Sorting the new mails that weren't wanted could hit
+	   mail_sort_max_read_count even though the wanted ones alone
+	   wouldn't. Then only the wanted ones are merged to the result,
+	   and the cache is left as it is. */
+	if (program->t->box->storage->set->mail_sort_max_read_count != 0) {
+		for (seq = seq1; seq <= seq2 && !partial; seq++)
+			partial = !index_sort_cache_is_wanted(wanted, seq);
+	}
+
+	/* Sort the new mails and merge them to the cached order. Each new
+	   mail's position is searched only after the previous one's, so
+	   this is O(k log n) comparisons and O(n + k) copying. */
+	index_sort_cache_sort_seqs(program, seq1, seq2,
+				   partial ? wanted : NULL);
+	if (program->failed)
+		return FALSE;
+
+	recs = array_front(&cache->recs);
+	i_array_init(&new_recs, count + new_count);
+	new_seqs = array_get(&program->seqs, &new_count);
+	for (i = 0, prev_idx = 0; i < new_count; i++) {
+		idx = index_sort_cache_find_insert_pos(program, recs,
+						       prev_idx, count,
+						       new_seqs[i]);
+		array_append(&new_recs, recs + prev_idx, idx - prev_idx);
+		rec = array_append_space(&new_recs);
+		rec->seq = new_seqs[i];
+		mail_index_lookup_uid(view, rec->seq, &rec->uid);
+		prev_idx = idx;
+	}
+	array_append(&new_recs, recs + prev_idx, count - prev_idx);
+	if (program->failed) {
+		array_free(&new_recs);
+		return FALSE;
+	}
+	if (partial) {
+		index_sort_cache_set_wanted_seqs(program, &new_recs, wanted);
+		array_free(&new_recs);
+		return TRUE;
+	}
+	array_free(&cache->recs);
+	cache->recs = new_recs;
+	cache->next_uid = next_uid;
+	ibox->sort_caches_changed = TRUE;
+	index_sort_cache_set_wanted_seqs(program, &cache->recs, wanted);
+	return TRUE;
+}
+
+void index_sort_cache_program_init(struct mail_search_sort_program *program)
+{
+	if (!index_sort_program_is_cacheable(program->sort_program))
+		return;
+
+	program->cache_wanted_seqs = buffer_create_dynamic(default_pool, 128);
+}
+
+void index_sort_cache_list_add(struct mail_search_sort_program *program,
+			       uint32_t seq)
+{
+	unsigned char *bits;
+	size_t idx = seq / CHAR_BIT;
+
+	if (idx >= program->cache_wanted_seqs->used)
+		buffer_write_zero(program->cache_wanted_seqs, idx, 1);
+	bits = buffer_get_modifiable_data(program->cache_wanted_seqs, NULL);
+	bits[idx] |= 1 << (seq % CHAR_BIT);
+	program->cache_wanted_count++;
+}
+
+void index_sort_cache_list_finish(struct mail_search_sort_program *program)
+{
+	struct mail_index_view *view = program->t->view;
+	const struct mail_index_header *hdr = mail_index_get_header(view);
+	uint32_t messages_count = mail_index_view_get_messages_count(view);
+	struct index_sort_cache *cache;
+	buffer_t *wanted = program->cache_wanted_seqs;
+	unsigned int wanted_percent;
+
+	/* from now on index_sort_list_add() must do the actual sorting */
+	program->cache_wanted_seqs = NULL;
+
+	if (program->cache_wanted_count == 0) {
+		index_sort_cache_sort_seqs(program, 1, 0, NULL);
+		buffer_free(&wanted);
+		return;
+	}
+
+	cache = index_sort_cache_find(program, hdr);
+	if (cache != NULL) {
+		if (index_sort_cache_update(program, cache, hdr->next_uid,
+					    wanted)) {
+			buffer_free(&wanted);
+			return;
+		}
+		index_sort_cache_remove(program, cache);
+		if (program->context == NULL) {
+			/* sorting the new mails failed */
+			i_assert(program->failed);
+			buffer_free(&wanted);
+			return;
+		}
+	}
+
+	wanted_percent = program->cache_wanted_count * 100ULL / messages_count;
+	if (program->failed ||
+	    wanted_percent < INDEX_SORT_CACHE_BUILD_MIN_PERCENT ||
+	    (program->cache_wanted_count != messages_count &&
+	     program->t->box->storage->set->mail_sort_max_read_count != 0)) {
+		/* Sort only the wanted mails. Sorting all of them could also
+		   hit mail_sort_max_read_count even though the wanted ones
+		   alone wouldn't. */
+		index_sort_cache_sort_seqs(program, 1, messages_count, wanted);
+	} else {
+		index_sort_cache_sort_seqs(program, 1, messages_count, NULL);
+		if (!program->failed) {
+			index_sort_cache_add(program, hdr->uid_validity,
+					     hdr->next_uid);
+		}
+		if (program->cache_wanted_count != messages_count)
+			index_sort_cache_filter_wanted(program, wanted);
+	}
+	buffer_free(&wanted);
+}
+
+void index_sort_cache_deinit(struct mailbox *box)
+{
+	struct index_mailbox_context *ibox = INDEX_STORAGE_CONTEXT(box);
+	struct index_sort_cache *cache;
+
+	if (!array_is_created(&ibox->sort_caches))
+		return;
+
+	if (ibox->sort_caches_changed) T_BEGIN {
+		index_sort_cache_write(box);
+	} T_END;
+	array_foreach_elem(&ibox->sort_caches, cache)
+		index_sort_cache_free(&cache);
+	array_free(&ibox->sort_caches);
+	ibox->sort_caches_changed = FALSE;
+}
@@ -14,6 +14,11 @@ struct mail_search_sort_program {
 	void (*sort_list_finish)(struct mail_search_sort_program *program);
 	void *context;
 
+	/* Bitmask of the wanted sequences, when the sort order is looked up
+	   from the per-mailbox sort cache. */
+	buffer_t *cache_wanted_seqs;
+	unsigned int cache_wanted_count;
+
 	ARRAY_TYPE(uint32_t) seqs;
 	unsigned int iter_idx;
 
@@ -27,6 +32,11 @@ int index_sort_node_cmp_type(struct mail_search_sort_program *program,
 			     const enum mail_sort_type *sort_program,
 			     uint32_t seq1, uint32_t seq2);
 
+void index_sort_cache_program_init(struct mail_search_sort_program *program);
+void index_sort_cache_list_add(struct mail_search_sort_program *program,
+			       uint32_t seq);
+void index_sort_cache_list_finish(struct mail_search_sort_program *program);
+
 void index_sort_list_init_string(struct mail_search_sort_program *program);
 void index_sort_list_add_string(struct mail_search_sort_program *program,
 				struct mail *mail);
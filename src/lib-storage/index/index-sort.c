@@ -175,6 +175,11 @@ void index_sort_list_add(struct mail_search_sort_program *program,
 		mail->mail_metadata_accessed;
 
 	i_assert(mail->transaction == program->t);
+	if (program->cache_wanted_seqs != NULL) {
+		/* the mails are sorted only when the list is finished */
+		index_sort_cache_list_add(program, mail->seq);
+		return;
+	}
 	/* if lookup_abort isn't NEVER, mail_sort_max_read_count handling
 	   doesn't work right. */
 	i_assert(mail->lookup_abort == MAIL_LOOKUP_ABORT_NEVER);
@@ -287,7 +292,10 @@ void index_sort_list_finish(struct mail_search_sort_program *program)
 		(program->sort_program[0] & MAIL_SORT_FLAG_REVERSE) != 0;
 
 	struct event_reason *reason = event_reason_begin("mailbox:sort");
-	program->sort_list_finish(program);
+	if (program->cache_wanted_seqs != NULL)
+		index_sort_cache_list_finish(program);
+	else
+		program->sort_list_finish(program);
 	event_reason_end(&reason);
 }
 
@@ -463,6 +471,7 @@ index_sort_program_init(struct mailbox_transaction_context *t,
 	default:
 		i_unreached();
 	}
+	index_sort_cache_program_init(program);
 	return program;
 }
 
@@ -472,6 +481,8 @@ int index_sort_program_deinit(struct mail_search_sort_program **_program)
 
 	*_program = NULL;
 
+	/* don't bother sorting anything if the search was aborted */
+	buffer_free(&program->cache_wanted_seqs);
 	if (program->context != NULL)
 		index_sort_list_finish(program);
 	mail_free(&program->temp_mail);
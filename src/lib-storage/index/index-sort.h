@@ -15,4 +15,8 @@ void index_sort_list_finish(struct mail_search_sort_program *program);
 bool index_sort_list_next(struct mail_search_sort_program *program,
 			  uint32_t *seq_r);
 
+/* Write the mailbox's changed sort orders to the index directory and free
+   them. */
+void index_sort_cache_deinit(struct mailbox *box);
+
 #endif
@@ -217,6 +217,7 @@ static void get_metadata_precache_fields(struct mailbox *box,
 		    strcmp(name, "imap.envelope") == 0)
 			cache |= MAIL_FETCH_STREAM_HEADER;
 		else if (strcmp(name, "mime.parts") == 0 ||
+			 strcmp(name, "mime.parts.data") == 0 ||
 			 strcmp(name, "binary.parts") == 0 ||
 			 strcmp(name, "imap.body") == 0 ||
 			 strcmp(name, "imap.bodystructure") == 0 ||
@@ -20,6 +20,7 @@
 #include "index-storage.h"
 #include "index-mail.h"
 #include "index-attachment.h"
+#include "index-sort.h"
 #include "index-thread-private.h"
 #include "index-mailbox-size.h"
 #include "settings-parser.h"
@@ -76,6 +77,28 @@ static void set_cache_decisions(struct mailbox *box,
 	}
 }
 
+static void index_cache_register_columns(struct mailbox *box)
+{
+	const struct mail_storage_settings *set = box->storage->set;
+	const char *const *arr;
+	unsigned int idx;
+
+	for (arr = settings_boollist_get(&set->mail_cache_column_fields);
+	     *arr != NULL; arr++) {
+		idx = mail_cache_register_lookup(box->cache, *arr);
+		if (idx == UINT_MAX) {
+			e_error(box->event,
+				"mail_cache_column_fields: "
+				"Unknown cache field name '%s', ignoring", *arr);
+		} else if (!mail_cache_register_column(box->cache, idx)) {
+			e_error(box->event,
+				"mail_cache_column_fields: "
+				"Cache field '%s' isn't a fixed size field, ignoring",
+				*arr);
+		}
+	}
+}
+
 static void index_cache_register_defaults(struct mailbox *box)
 {
 	struct index_mailbox_context *ibox = INDEX_STORAGE_CONTEXT(box);
@@ -104,6 +127,7 @@ static void index_cache_register_defaults(struct mailbox *box)
 			    &set->mail_never_cache_fields,
 			    MAIL_CACHE_DECISION_NO |
 			    MAIL_CACHE_DECISION_FORCED);
+	index_cache_register_columns(box);
 }
 
 void index_storage_lock_notify(struct mailbox *box,
@@ -447,6 +471,9 @@ void index_storage_mailbox_close(struct mailbox *box)
 
 	mailbox_watch_remove_all(box);
 	i_stream_unref(&box->input);
+	index_sort_cache_deinit(box);
+	if (box->cache != NULL)
+		mail_cache_flush_field_stats(box->cache);
 
 	if (box->view_pvt != NULL)
 		mail_index_view_close(&box->view_pvt);
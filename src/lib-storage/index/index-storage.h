@@ -27,6 +27,8 @@ enum index_storage_list_change {
 	INDEX_STORAGE_LIST_CHANGE_MTIME_CHANGED
 };
 
+struct index_sort_cache;
+
 struct index_mailbox_context {
 	union mailbox_module_context module_ctx;
 	enum mail_index_open_flags index_flags;
@@ -44,6 +46,12 @@ struct index_mailbox_context {
 
 	time_t sync_last_check;
 	uint32_t list_index_sync_ext_id;
+
+	/* Sort orders of recent SORT requests, most recently used first.
+	   Read lazily from the index directory and written back when the
+	   mailbox is closed if sort_caches_changed=TRUE. */
+	ARRAY(struct index_sort_cache *) sort_caches;
+	bool sort_caches_changed;
 };
 
 #define INDEX_STORAGE_CONTEXT(obj) \
@@ -45,6 +45,7 @@ static const struct setting_define mail_storage_setting_defines[] = {
 	DEF(BOOLLIST, mail_cache_fields),
 	DEF(BOOLLIST, mail_always_cache_fields),
 	DEF(BOOLLIST, mail_never_cache_fields),
+	DEF(BOOLLIST, mail_cache_column_fields),
 	DEF(STR, mail_server_comment),
 	DEF(STR, mail_server_admin),
 	DEF(TIME_HIDDEN, mail_cache_unaccessed_field_drop),
@@ -72,6 +73,9 @@ static const struct setting_define mail_storage_setting_defines[] = {
 	DEF(BOOL_HIDDEN, mail_save_crlf),
 	DEF(ENUM, mail_fsync),
 	DEF(BOOL, mmap_disable),
+	DEF(BOOL, mail_index_mmap_shared),
+	DEF(BOOL, mail_index_log_checksums),
+	DEF(BOOL, mail_index_log_packed_flag_updates),
 	DEF(BOOL, dotlock_use_excl),
 	DEF(BOOL, mail_nfs_storage),
 	DEF(BOOL, mail_nfs_index),
@@ -119,6 +123,7 @@ const struct mail_storage_settings mail_storage_default_settings = {
 	.mail_attachment_detection_options = ARRAY_INIT,
 	.mail_prefetch_count = 0,
 	.mail_always_cache_fields = ARRAY_INIT,
+	.mail_cache_column_fields = ARRAY_INIT,
 	.mail_server_comment = "",
 	.mail_server_admin = "",
 	.mail_cache_min_mail_count = 0,
@@ -146,6 +151,9 @@ const struct mail_storage_settings mail_storage_default_settings = {
 	.mail_save_crlf = FALSE,
 	.mail_fsync = "optimized:never:always",
 	.mmap_disable = FALSE,
+	.mail_index_mmap_shared = FALSE,
+	.mail_index_log_checksums = FALSE,
+	.mail_index_log_packed_flag_updates = FALSE,
 	.dotlock_use_excl = TRUE,
 	.mail_nfs_storage = FALSE,
 	.mail_nfs_index = FALSE,
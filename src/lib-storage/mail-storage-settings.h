@@ -36,6 +36,7 @@ struct mail_storage_settings {
 	ARRAY_TYPE(const_string) mail_cache_fields;
 	ARRAY_TYPE(const_string) mail_always_cache_fields;
 	ARRAY_TYPE(const_string) mail_never_cache_fields;
+	ARRAY_TYPE(const_string) mail_cache_column_fields;
 	const char *mail_server_comment;
 	const char *mail_server_admin;
 	unsigned int mail_cache_min_mail_count;
@@ -63,6 +64,9 @@ struct mail_storage_settings {
 	bool mail_save_crlf;
 	const char *mail_fsync;
 	bool mmap_disable;
+	bool mail_index_mmap_shared;
+	bool mail_index_log_checksums;
+	bool mail_index_log_packed_flag_updates;
 	bool dotlock_use_excl;
 	bool mail_nfs_storage;
 	bool mail_nfs_index;
@@ -3528,6 +3528,12 @@ mail_storage_settings_to_index_flags(const struct mail_storage_settings *set)
 	if (set->mmap_disable)
 #endif
 		index_flags |= MAIL_INDEX_OPEN_FLAG_MMAP_DISABLE;
+	if (set->mail_index_mmap_shared)
+		index_flags |= MAIL_INDEX_OPEN_FLAG_MMAP_SHARED;
+	if (set->mail_index_log_checksums && !set->mail_nfs_index)
+		index_flags |= MAIL_INDEX_OPEN_FLAG_LOG_CHECKSUMS;
+	if (set->mail_index_log_packed_flag_updates)
+		index_flags |= MAIL_INDEX_OPEN_FLAG_LOG_PACKED_FLAG_UPDATES;
 	if (set->dotlock_use_excl)
 		index_flags |= MAIL_INDEX_OPEN_FLAG_DOTLOCK_USE_EXCL;
 	if (set->mail_nfs_index)
@@ -300,6 +300,9 @@ struct mailbox_status {
 	bool have_save_guids:1;
 	/* GUIDs are always 128bit (always set) */
 	bool have_only_guid128:1;
+	/* FTS backend can index the mailbox in parallel chunks
+	   (STATUS_FTS_LAST_INDEXED_UID) */
+	bool fts_index_chunks:1;
 };
 
 struct mailbox_cache_field {
@@ -0,0 +1,404 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "test-common.h"
+#include "istream.h"
+#include "write-full.h"
+#include "master-service.h"
+#include "mail-search-build.h"
+#include "mail-storage-private.h"
+#include "test-mail-storage-common.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+static const enum mail_sort_type sort_date[] = {
+	MAIL_SORT_DATE, MAIL_SORT_END
+};
+static const enum mail_sort_type sort_date_reverse[] = {
+	MAIL_SORT_DATE | MAIL_SORT_FLAG_REVERSE, MAIL_SORT_END
+};
+
+static void test_mail_save(struct mailbox *box, unsigned int day)
+{
+	struct mailbox_transaction_context *trans;
+	struct mail_save_context *save_ctx;
+	struct istream *input;
+	const char *mail_input;
+	int ret;
+
+	mail_input = t_strdup_printf(
+		"Date: Mon, %u Jan 2024 00:00:00 +0000\n"
+		"Subject: %u\n\nbody\n", day, day);
+	input = i_stream_create_from_data(mail_input, strlen(mail_input));
+	trans = mailbox_transaction_begin(box,
+			MAILBOX_TRANSACTION_FLAG_EXTERNAL, __func__);
+	save_ctx = mailbox_save_alloc(trans);
+	if (mailbox_save_begin(&save_ctx, input) < 0)
+		ret = -1;
+	else {
+		do {
+			if (mailbox_save_continue(save_ctx) < 0) {
+				mailbox_save_cancel(&save_ctx);
+				break;
+			}
+		} while ((ret = i_stream_read(input)) > 0);
+		if (save_ctx != NULL)
+			ret = mailbox_save_finish(&save_ctx);
+		else
+			ret = -1;
+	}
+	i_stream_unref(&input);
+	if (ret < 0)
+		mailbox_transaction_rollback(&trans);
+	else
+		ret = mailbox_transaction_commit(&trans);
+	if (ret < 0) {
+		i_fatal("Failed to save mail: %s",
+			mailbox_get_last_internal_error(box, NULL));
+	}
+	if (mailbox_sync(box, 0) < 0)
+		i_fatal("Failed to sync mailbox: %s",
+			mailbox_get_last_internal_error(box, NULL));
+}
+
+static void test_mail_expunge(struct mailbox *box, uint32_t seq)
+{
+	struct mailbox_transaction_context *trans;
+	struct mail *mail;
+
+	trans = mailbox_transaction_begin(box, 0, __func__);
+	mail = mail_alloc(trans, 0, NULL);
+	mail_set_seq(mail, seq);
+	mail_expunge(mail);
+	mail_free(&mail);
+	test_assert(mailbox_transaction_commit(&trans) == 0);
+	test_assert(mailbox_sync(box, 0) == 0);
+}
+
+/* Sort seq1..seq2 and check that the UIDs come in the expected order.
+   Returns the number of mail lookups done while sorting. */
+static unsigned long
+test_sort_check(struct mailbox *box, const enum mail_sort_type *sort,
+		uint32_t seq1, uint32_t seq2, const uint32_t *expected_uids,
+		unsigned int expected_count)
+{
+	struct mailbox_transaction_context *trans;
+	struct mail_search_args *args;
+	struct mail_search_context *search_ctx;
+	struct mail *mail;
+	unsigned long lookups;
+	unsigned int i = 0;
+
+	args = mail_search_build_init();
+	mail_search_build_add_seqset(args, seq1, seq2);
+
+	trans = mailbox_transaction_begin(box, 0, __func__);
+	search_ctx = mailbox_search_init(trans, args, sort, 0, NULL);
+	while (mailbox_search_next(search_ctx, &mail)) {
+		test_assert_idx(i < expected_count &&
+				mail->uid == expected_uids[i], i);
+		i++;
+	}
+	test_assert(i == expected_count);
+	test_assert(mailbox_search_deinit(&search_ctx) == 0);
+	lookups = trans->stats.cache_hit_count +
+		trans->stats.open_lookup_count +
+		trans->stats.stat_lookup_count +
+		trans->stats.fstat_lookup_count +
+		trans->stats.files_read_count;
+	test_assert(mailbox_transaction_commit(&trans) == 0);
+	mail_search_args_unref(&args);
+	return lookups;
+}
+
+static bool test_sort_cache_file_exists(struct mailbox *box)
+{
+	struct stat st;
+	const char *dir;
+
+	test_assert(mailbox_get_path_to(box, MAILBOX_LIST_PATH_TYPE_INDEX,
+					&dir) > 0);
+	return stat(t_strconcat(dir, "/", box->index_prefix, ".index.sort",
+				NULL), &st) == 0;
+}
+
+static const char *test_sort_cache_path(struct mailbox *box)
+{
+	const char *dir;
+
+	test_assert(mailbox_get_path_to(box, MAILBOX_LIST_PATH_TYPE_INDEX,
+					&dir) > 0);
+	return t_strconcat(dir, "/", box->index_prefix, ".index.sort", NULL);
+}
+
+/* Write a sort cache file for sort_date with the given UIDs */
+static void
+test_sort_cache_file_write(struct mailbox *box, uint32_t next_uid,
+			   const uint32_t *uids, unsigned int uids_count)
+{
+	struct mailbox_status status;
+	const char *path = test_sort_cache_path(box);
+	buffer_t *buf = t_buffer_create(256);
+	uint32_t value;
+	unsigned int i;
+	int fd;
+
+	mailbox_get_open_status(box, STATUS_UIDVALIDITY, &status);
+	/* header: version, uid_validity, programs_count */
+	value = 1; buffer_append(buf, &value, sizeof(value));
+	buffer_append(buf, &status.uidvalidity, sizeof(uint32_t));
+	value = 1; buffer_append(buf, &value, sizeof(value));
+	/* program: sort_program[], next_uid, uids_count, uids[] */
+	for (i = 0; i < MAX_SORT_PROGRAM_SIZE; i++) {
+		value = i < N_ELEMENTS(sort_date) ? sort_date[i] : 0;
+		buffer_append(buf, &value, sizeof(value));
+	}
+	buffer_append(buf, &next_uid, sizeof(next_uid));
+	buffer_append(buf, &uids_count, sizeof(uids_count));
+	buffer_append(buf, uids, sizeof(*uids) * uids_count);
+
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd == -1)
+		i_fatal("open(%s) failed: %m", path);
+	if (write_full(fd, buf->data, buf->used) < 0)
+		i_fatal("write(%s) failed: %m", path);
+	i_close_fd(&fd);
+}
+
+static void test_index_sort_cache(void)
+{
+	struct test_mail_storage_settings set = {
+		.driver = "sdbox",
+	};
+	static const unsigned int days[] = { 28, 10, 25, 15, 20, 12 };
+
+	test_begin("index sort cache");
+	struct test_mail_storage_ctx *ctx = test_mail_storage_init();
+	test_mail_storage_init_user(ctx, &set);
+
+	struct mailbox *box =
+		mailbox_alloc(ctx->user->namespaces->list, "INBOX", 0);
+	test_assert(mailbox_open(box) == 0);
+	for (unsigned int i = 0; i < N_ELEMENTS(days) - 1; i++) T_BEGIN {
+		test_mail_save(box, days[i]);
+	} T_END;
+
+	/* a narrow search doesn't build the cache */
+	const uint32_t uids_narrow[] = { 2 };
+	test_assert(test_sort_check(box, sort_date, 2, 2, uids_narrow,
+				    N_ELEMENTS(uids_narrow)) > 0);
+	mailbox_free(&box);
+	box = mailbox_alloc(ctx->user->namespaces->list, "INBOX", 0);
+	test_assert(mailbox_open(box) == 0);
+	test_assert(!test_sort_cache_file_exists(box));
+
+	/* the first sort builds the cache, the following ones are answered
+	   from it without looking up the mails */
+	const uint32_t uids1[] = { 2, 4, 5, 3, 1 };
+	test_assert(test_sort_check(box, sort_date, 1, 5, uids1,
+				    N_ELEMENTS(uids1)) > 0);
+	test_assert(test_sort_check(box, sort_date, 1, 5, uids1,
+				    N_ELEMENTS(uids1)) == 0);
+	const uint32_t uids1_filtered[] = { 4, 5, 3 };
+	test_assert(test_sort_check(box, sort_date, 3, 5, uids1_filtered,
+				    N_ELEMENTS(uids1_filtered)) == 0);
+	const uint32_t uids1_reverse[] = { 1, 3, 5, 4, 2 };
+	test_sort_check(box, sort_date_reverse, 1, 5, uids1_reverse,
+			N_ELEMENTS(uids1_reverse));
+	test_assert(test_sort_check(box, sort_date_reverse, 1, 5,
+				    uids1_reverse,
+				    N_ELEMENTS(uids1_reverse)) == 0);
+
+	/* new mails are merged into the cached order */
+	T_BEGIN {
+		test_mail_save(box, days[5]);
+	} T_END;
+	const uint32_t uids2[] = { 2, 6, 4, 5, 3, 1 };
+	test_sort_check(box, sort_date, 1, 6, uids2, N_ELEMENTS(uids2));
+	test_assert(test_sort_check(box, sort_date, 1, 6, uids2,
+				    N_ELEMENTS(uids2)) == 0);
+	const uint32_t uids2_reverse[] = { 1, 3, 5, 4, 6, 2 };
+	test_sort_check(box, sort_date_reverse, 1, 6, uids2_reverse,
+			N_ELEMENTS(uids2_reverse));
+
+	/* expunged mails are dropped from the cached order */
+	test_mail_expunge(box, 4);
+	const uint32_t uids3[] = { 2, 6, 5, 3, 1 };
+	test_assert(test_sort_check(box, sort_date, 1, 5, uids3,
+				    N_ELEMENTS(uids3)) == 0);
+	const uint32_t uids3_filtered[] = { 6, 5 };
+	test_assert(test_sort_check(box, sort_date, 4, 5, uids3_filtered,
+				    N_ELEMENTS(uids3_filtered)) == 0);
+
+	/* the cache is written when the mailbox is closed and read back
+	   by the next session */
+	mailbox_free(&box);
+	box = mailbox_alloc(ctx->user->namespaces->list, "INBOX", 0);
+	test_assert(mailbox_open(box) == 0);
+	test_assert(test_sort_cache_file_exists(box));
+	test_assert(test_sort_check(box, sort_date, 1, 5, uids3,
+				    N_ELEMENTS(uids3)) == 0);
+	const uint32_t uids3_reverse[] = { 1, 3, 5, 6, 2 };
+	test_assert(test_sort_check(box, sort_date_reverse, 1, 5,
+				    uids3_reverse,
+				    N_ELEMENTS(uids3_reverse)) == 0);
+
+	/* expunges and appends done while the mailbox was closed */
+	mailbox_free(&box);
+	box = mailbox_alloc(ctx->user->namespaces->list, "INBOX", 0);
+	test_assert(mailbox_open(box) == 0);
+	test_mail_expunge(box, 1);
+	T_BEGIN {
+		test_mail_save(box, 22);
+	} T_END;
+	mailbox_free(&box);
+	box = mailbox_alloc(ctx->user->namespaces->list, "INBOX", 0);
+	test_assert(mailbox_open(box) == 0);
+	const uint32_t uids4[] = { 2, 6, 5, 7, 3 };
+	test_sort_check(box, sort_date, 1, 5, uids4, N_ELEMENTS(uids4));
+	test_assert(test_sort_check(box, sort_date, 1, 5, uids4,
+				    N_ELEMENTS(uids4)) == 0);
+
+	mailbox_free(&box);
+	test_mail_storage_deinit_user(ctx);
+	test_mail_storage_deinit(&ctx);
+	test_end();
+}
+
+static void test_index_sort_cache_corrupted(void)
+{
+	struct test_mail_storage_settings set = {
+		.driver = "sdbox",
+	};
+	static const unsigned int days[] = { 28, 10, 25, 15, 20 };
+	const uint32_t uids_sorted[] = { 2, 4, 5, 3, 1 };
+	const uint32_t uids_duplicate[] = { 2, 4, 4, 3, 1 };
+	const uint32_t uids_too_large[] = { 2, 4, 5, 3, 9 };
+	const uint32_t uids_missing[] = { 2, 4, 3, 1 };
+	const uint32_t uids_zero[] = { 2, 4, 5, 0, 1 };
+	const uint32_t uids_expunged[] = { 2, 4, 3, 1 };
+	const struct {
+		uint32_t next_uid;
+		const uint32_t *uids;
+		unsigned int count;
+	} tests[] = {
+		{ 6, uids_duplicate, N_ELEMENTS(uids_duplicate) },
+		{ 6, uids_too_large, N_ELEMENTS(uids_too_large) },
+		{ 6, uids_missing, N_ELEMENTS(uids_missing) },
+		{ 6, uids_zero, N_ELEMENTS(uids_zero) },
+		/* next_uid is larger than the mailbox's */
+		{ 100, uids_sorted, N_ELEMENTS(uids_sorted) },
+	};
+
+	test_begin("index sort cache corrupted");
+	struct test_mail_storage_ctx *ctx = test_mail_storage_init();
+	for (unsigned int i = 0; i < N_ELEMENTS(tests); i++) {
+		test_mail_storage_init_user(ctx, &set);
+		struct mailbox *box =
+			mailbox_alloc(ctx->user->namespaces->list, "INBOX", 0);
+		test_assert_idx(mailbox_open(box) == 0, i);
+		for (unsigned int j = 0; j < N_ELEMENTS(days); j++) T_BEGIN {
+			test_mail_save(box, days[j]);
+		} T_END;
+		mailbox_free(&box);
+
+		/* the broken cache is ignored, and a new one is built */
+		box = mailbox_alloc(ctx->user->namespaces->list, "INBOX", 0);
+		test_assert_idx(mailbox_open(box) == 0, i);
+		test_sort_cache_file_write(box, tests[i].next_uid,
+					   tests[i].uids, tests[i].count);
+		test_expect_error_string("ort cache");
+		test_sort_check(box, sort_date, 1, 5, uids_sorted,
+				N_ELEMENTS(uids_sorted));
+		test_expect_no_more_errors();
+		test_assert_idx(test_sort_check(box, sort_date, 1, 5,
+						uids_sorted,
+						N_ELEMENTS(uids_sorted)) == 0, i);
+		test_mail_expunge(box, 5);
+		test_assert_idx(test_sort_check(box, sort_date, 1, 4,
+						uids_expunged,
+						N_ELEMENTS(uids_expunged)) == 0, i);
+		mailbox_free(&box);
+
+		/* the new cache was written over the broken one */
+		box = mailbox_alloc(ctx->user->namespaces->list, "INBOX", 0);
+		test_assert_idx(mailbox_open(box) == 0, i);
+		test_assert_idx(test_sort_check(box, sort_date, 1, 4,
+						uids_expunged,
+						N_ELEMENTS(uids_expunged)) == 0, i);
+		mailbox_free(&box);
+		test_mail_storage_deinit_user(ctx);
+	}
+	test_mail_storage_deinit(&ctx);
+	test_end();
+}
+
+static void test_index_sort_cache_max_read_count(void)
+{
+	const char *const extra_input[] = {
+		"mail_sort_max_read_count=100",
+		NULL
+	};
+	struct test_mail_storage_settings set = {
+		.driver = "sdbox",
+		.extra_input = extra_input,
+	};
+	static const unsigned int days[] = { 28, 10, 25, 15, 20, 12, 22 };
+	unsigned int i;
+
+	test_begin("index sort cache mail_sort_max_read_count");
+	struct test_mail_storage_ctx *ctx = test_mail_storage_init();
+	test_mail_storage_init_user(ctx, &set);
+
+	struct mailbox *box =
+		mailbox_alloc(ctx->user->namespaces->list, "INBOX", 0);
+	test_assert(mailbox_open(box) == 0);
+	for (i = 0; i < 5; i++) T_BEGIN {
+		test_mail_save(box, days[i]);
+	} T_END;
+	const uint32_t uids1[] = { 2, 4, 5, 3, 1 };
+	test_sort_check(box, sort_date, 1, 5, uids1, N_ELEMENTS(uids1));
+	test_assert(test_sort_check(box, sort_date, 1, 5, uids1,
+				    N_ELEMENTS(uids1)) == 0);
+
+	/* only the wanted one of the new mails is sorted */
+	for (; i < N_ELEMENTS(days); i++) T_BEGIN {
+		test_mail_save(box, days[i]);
+	} T_END;
+	const uint32_t uids2[] = { 2, 6, 4, 5, 3 };
+	test_sort_check(box, sort_date, 2, 6, uids2, N_ELEMENTS(uids2));
+	/* the cache is updated once all of them are wanted */
+	const uint32_t uids3[] = { 2, 6, 4, 5, 7, 3, 1 };
+	test_sort_check(box, sort_date, 1, 7, uids3, N_ELEMENTS(uids3));
+	test_assert(test_sort_check(box, sort_date, 1, 7, uids3,
+				    N_ELEMENTS(uids3)) == 0);
+
+	mailbox_free(&box);
+	test_mail_storage_deinit_user(ctx);
+	test_mail_storage_deinit(&ctx);
+	test_end();
+}
+
+int main(int argc, char **argv)
+{
+	void (*const tests[])(void) = {
+		test_index_sort_cache,
+		test_index_sort_cache_corrupted,
+		test_index_sort_cache_max_read_count,
+		NULL
+	};
+	int ret;
+
+	master_service = master_service_init("test-index-sort",
+					     MASTER_SERVICE_FLAG_STANDALONE |
+					     MASTER_SERVICE_FLAG_DONT_SEND_STATS |
+					     MASTER_SERVICE_FLAG_NO_CONFIG_SETTINGS |
+					     MASTER_SERVICE_FLAG_NO_SSL_INIT |
+					     MASTER_SERVICE_FLAG_NO_INIT_DATASTACK_FRAME,
+					     &argc, &argv, "");
+	ret = test_run(tests);
+	master_service_deinit(&master_service);
+	return ret;
+}
@@ -79,7 +79,8 @@ void test_mail_storage_init_user(struct test_mail_storage_ctx *ctx,
 		t_strdup_printf("home=%s", home),
 	};
 
-	if (unlink_directory(home, UNLINK_DIRECTORY_FLAG_RMDIR, &error) < 0)
+	if (!set->keep_home &&
+	    unlink_directory(home, UNLINK_DIRECTORY_FLAG_RMDIR, &error) < 0)
 		i_error("%s", error);
 	i_assert(mkdir_parents(home, S_IRWXU)==0 || errno == EEXIST);
 
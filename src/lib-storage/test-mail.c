@@ -478,6 +478,107 @@ static void test_bodystructure_corruption_reparsing(void)
 	test_end();
 }
 
+static const char *test_mime_parts_data_input =
+	"From: Sender <sender@example.com>\r\n"
+	"To: rcpt@example.com\r\n"
+	"Subject: test\r\n"
+	"Message-ID: <msgid@example.com>\r\n"
+	"Mime-Version: 1.0\r\n"
+	"Content-Type: multipart/mixed; boundary=foo\r\n"
+	"\r\n"
+	"--foo\r\n"
+	"Content-Type: text/plain; charset=utf-8\r\n"
+	"\r\n"
+	"body\r\n"
+	"--foo--\r\n";
+
+/* Fetch BODYSTRUCTURE and ENVELOPE. Returns TRUE if the mail stream had
+   to be opened. */
+static bool
+test_mime_parts_data_fetch(struct mailbox *box, const char **bodystructure_r,
+			   const char **envelope_r)
+{
+	struct mailbox_transaction_context *trans;
+	struct mail *mail;
+	const char *value;
+	bool accessed;
+
+	trans = mailbox_transaction_begin(box, 0, __func__);
+	mail = mail_alloc(trans, 0, NULL);
+	mail_set_seq(mail, 1);
+	test_assert(mail_get_special(mail, MAIL_FETCH_IMAP_BODYSTRUCTURE,
+				     &value) == 0);
+	*bodystructure_r = t_strdup(value);
+	test_assert(mail_get_special(mail, MAIL_FETCH_IMAP_ENVELOPE,
+				     &value) == 0);
+	*envelope_r = t_strdup(value);
+	accessed = mail->mail_stream_accessed;
+	mail_free(&mail);
+	test_assert(mailbox_transaction_commit(&trans) == 0);
+	return accessed;
+}
+
+static void
+test_mime_parts_data_run(const char *const *extra_input)
+{
+	struct test_mail_storage_ctx *ctx;
+	struct test_mail_storage_settings set = {
+		.driver = "sdbox",
+		.extra_input = extra_input,
+	};
+	const char *bodystructure, *envelope, *bodystructure2, *envelope2;
+
+	ctx = test_mail_storage_init();
+	test_mail_storage_init_user(ctx, &set);
+
+	struct mailbox *box =
+		mailbox_alloc(ctx->user->namespaces->list, "INBOX", 0);
+	test_assert(mailbox_open(box) == 0);
+	test_mail_save(box, test_mime_parts_data_input);
+
+	(void)test_mime_parts_data_fetch(box, &bodystructure, &envelope);
+	test_assert_strcmp(envelope,
+		"NIL \"test\" ((\"Sender\" NIL \"sender\" \"example.com\")) "
+		"((\"Sender\" NIL \"sender\" \"example.com\")) "
+		"((\"Sender\" NIL \"sender\" \"example.com\")) "
+		"((NIL NIL \"rcpt\" \"example.com\")) NIL NIL NIL "
+		"\"<msgid@example.com>\"");
+	mailbox_free(&box);
+
+	/* everything is answered from the cache in a new session */
+	box = mailbox_alloc(ctx->user->namespaces->list, "INBOX", 0);
+	test_assert(mailbox_open(box) == 0);
+	test_assert(!test_mime_parts_data_fetch(box, &bodystructure2,
+						&envelope2));
+	test_assert_strcmp(bodystructure, bodystructure2);
+	test_assert_strcmp(envelope, envelope2);
+	mailbox_free(&box);
+
+	test_mail_storage_deinit_user(ctx);
+	test_mail_storage_deinit(&ctx);
+}
+
+static void test_mime_parts_data(void)
+{
+	test_begin("mime.parts.data");
+	/* ENVELOPE can come only from mime.parts.data */
+	test_mime_parts_data_run((const char *const[]) {
+		"mail_always_cache_fields=mime.parts.data",
+		"mail_never_cache_fields=imap.envelope hdr.date hdr.subject "
+		"hdr.from hdr.sender hdr.reply-to hdr.to hdr.cc hdr.bcc "
+		"hdr.in-reply-to hdr.message-id",
+		NULL
+	});
+	/* mime.parts.data is useless without mime.parts, so
+	   BODYSTRUCTURE gets cached instead */
+	test_mime_parts_data_run((const char *const[]) {
+		"mail_always_cache_fields=mime.parts.data imap.envelope",
+		"mail_never_cache_fields=mime.parts",
+		NULL
+	});
+	test_end();
+}
+
 static void test_mail_set_critical(void)
 {
 	struct test_mail_storage_settings set = {
@@ -733,6 +834,7 @@ int main(int argc, char **argv)
 		test_attachment_flags_during_header_fetch,
 		test_bodystructure_reparsing,
 		test_bodystructure_corruption_reparsing,
+		test_mime_parts_data,
 		test_mail_set_critical,
 		test_mail_set_critical_different_mailboxes,
 		test_mail_get_last_internal_error,
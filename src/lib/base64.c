@@ -1,9 +1,188 @@
 /* Copyright (c) 2007-2018 Dovecot authors, see the included COPYING file */
 
 #include "lib.h"
+#include "cpu-features.h"
 #include "base64.h"
 #include "buffer.h"
 
+#ifdef HAVE_X86_SIMD_DISPATCH
+#  include <immintrin.h>
+#endif
+
+/*
+ * AVX2 kernels
+ */
+
+#ifdef HAVE_X86_SIMD_DISPATCH
+/* The encoder reads 28 bytes to encode 24 bytes into 32 characters */
+#define BASE64_AVX2_ENCODE_READ_SIZE 28
+#define BASE64_AVX2_DECODE_BLOCK_SIZE 32
+/* Maximum number of blocks to decode into the destination buffer at once */
+#define BASE64_AVX2_DECODE_MAX_BLOCKS 128
+
+/* Returns TRUE if the scheme uses the standard alphabet for the first 62
+   characters. The encoder can handle any characters for the last two. */
+static inline bool
+base64_scheme_can_encode_avx2(const struct base64_scheme *b64)
+{
+	return b64 == &base64_scheme || b64 == &base64url_scheme;
+}
+
+/* Encode as many full 24 byte blocks as possible. Returns the number of
+   bytes encoded from src. */
+static size_t __attribute__((target("avx2")))
+base64_encode_avx2(const char *encmap, const unsigned char *src,
+		   size_t src_size, unsigned char *dest, size_t dest_size)
+{
+	/* Split each 3 bytes into the 4 bytes, where the 6 bit values are
+	   extracted from. */
+	const __m256i shuf = _mm256_setr_epi8(
+		1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10,
+		1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10);
+	/* Offsets from the 6 bit value to the character, indexed by the
+	   value range: A-Z, a-z, 0-9 (10 times) and the last two. */
+	const __m256i lut = _mm256_setr_epi8(
+		65, 71, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4,
+		encmap[62] - 62, encmap[63] - 63, 0, 0,
+		65, 71, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4,
+		encmap[62] - 62, encmap[63] - 63, 0, 0);
+	__m256i in, t0, t1, t2, t3, idx;
+	size_t src_pos = 0, dest_pos = 0;
+
+	while (src_size - src_pos >= BASE64_AVX2_ENCODE_READ_SIZE &&
+	       dest_size - dest_pos >= 32) {
+		/* 12 bytes into each 128 bit lane */
+		in = _mm256_inserti128_si256(_mm256_castsi128_si256(
+			_mm_loadu_si128((const __m128i *)(src + src_pos))),
+			_mm_loadu_si128((const __m128i *)(src + src_pos + 12)),
+			1);
+		in = _mm256_shuffle_epi8(in, shuf);
+		t0 = _mm256_and_si256(in, _mm256_set1_epi32(0x0fc0fc00));
+		t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+		t2 = _mm256_and_si256(in, _mm256_set1_epi32(0x003f03f0));
+		t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+		in = _mm256_or_si256(t1, t3);
+
+		/* translate the 6 bit values into characters */
+		idx = _mm256_subs_epu8(in, _mm256_set1_epi8(51));
+		idx = _mm256_sub_epi8(idx, _mm256_cmpgt_epi8(
+			in, _mm256_set1_epi8(25)));
+		in = _mm256_add_epi8(in, _mm256_shuffle_epi8(lut, idx));
+		_mm256_storeu_si256((__m256i *)(dest + dest_pos), in);
+
+		src_pos += 24;
+		dest_pos += 32;
+	}
+	return src_pos;
+}
+
+/* Decode as many 32 character blocks as possible. Only the standard
+   alphabet is supported. Stops at the first block containing any other
+   characters, including whitespace and padding, and sets *skip_r to the
+   offset following the first such character. Otherwise *skip_r is set to 0.
+   Returns the number of characters decoded from src. */
+static size_t __attribute__((target("avx2")))
+base64_decode_avx2(const unsigned char *src, size_t src_size,
+		   unsigned char *dest, size_t dest_size, size_t *skip_r)
+{
+	/* Valid characters have no common bits in their low and high nibble
+	   lookup results. */
+	const __m256i lut_lo = _mm256_setr_epi8(
+		0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+		0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a,
+		0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+		0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+	const __m256i lut_hi = _mm256_setr_epi8(
+		0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+		0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+		0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+		0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+	/* Offsets from the character to the 6 bit value, indexed by the high
+	   nibble ('/' is moved to index 1). */
+	const __m256i lut_roll = _mm256_setr_epi8(
+		0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0,
+		0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+	const __m256i mask_2f = _mm256_set1_epi8(0x2f);
+	const __m256i shuf = _mm256_setr_epi8(
+		2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+		2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+	const __m256i perm = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, -1, -1);
+	__m256i in, hi_nibbles, lo_nibbles, hi, lo, roll;
+	unsigned char out[32];
+	size_t src_pos = 0, dest_pos = 0;
+
+	while (src_size - src_pos >= BASE64_AVX2_DECODE_BLOCK_SIZE &&
+	       dest_size - dest_pos >= 24) {
+		in = _mm256_loadu_si256((const __m256i *)(src + src_pos));
+		hi_nibbles = _mm256_and_si256(_mm256_srli_epi32(in, 4),
+					      mask_2f);
+		lo_nibbles = _mm256_and_si256(in, mask_2f);
+		hi = _mm256_shuffle_epi8(lut_hi, hi_nibbles);
+		lo = _mm256_shuffle_epi8(lut_lo, lo_nibbles);
+		if (!_mm256_testz_si256(lo, hi)) {
+			unsigned int invalid = ~(unsigned int)
+				_mm256_movemask_epi8(_mm256_cmpeq_epi8(
+					_mm256_and_si256(lo, hi),
+					_mm256_setzero_si256()));
+			*skip_r = src_pos + __builtin_ctz(invalid) + 1;
+			return src_pos;
+		}
+
+		roll = _mm256_shuffle_epi8(lut_roll, _mm256_add_epi8(
+			_mm256_cmpeq_epi8(in, mask_2f), hi_nibbles));
+		in = _mm256_add_epi8(in, roll);
+
+		/* pack the 6 bit values into bytes */
+		in = _mm256_maddubs_epi16(in, _mm256_set1_epi32(0x01400140));
+		in = _mm256_madd_epi16(in, _mm256_set1_epi32(0x00011000));
+		in = _mm256_shuffle_epi8(in, shuf);
+		in = _mm256_permutevar8x32_epi32(in, perm);
+		_mm256_storeu_si256((__m256i *)out, in);
+		memcpy(dest + dest_pos, out, 24);
+
+		src_pos += BASE64_AVX2_DECODE_BLOCK_SIZE;
+		dest_pos += 24;
+	}
+	*skip_r = 0;
+	return src_pos;
+}
+
+/* Decode the bulk of the input with AVX2 starting from *src_pos. If a
+   character not handled by the AVX2 kernel is found, *skip_pos_r is set to
+   the position following it. The caller needs to handle it with the scalar
+   decoder before trying again. */
+static void
+base64_decode_more_avx2(const unsigned char *src_c, size_t src_size,
+			size_t *src_pos, size_t *skip_pos_r,
+			buffer_t *dest, size_t *dst_avail)
+{
+	size_t blocks, used, n = 0, decoded, skip = 0;
+	unsigned char *ptr;
+
+	do {
+		/* don't reserve more than needed if the input is split into
+		   short lines */
+		blocks = I_MIN((src_size - *src_pos) /
+			       BASE64_AVX2_DECODE_BLOCK_SIZE, *dst_avail / 24);
+		blocks = I_MIN(blocks, BASE64_AVX2_DECODE_MAX_BLOCKS);
+		if (blocks == 0)
+			break;
+
+		used = dest->used;
+		ptr = buffer_append_space_unsafe(dest, blocks * 24);
+		n = base64_decode_avx2(src_c + *src_pos, src_size - *src_pos,
+				       ptr, blocks * 24, &skip);
+		decoded = n / BASE64_AVX2_DECODE_BLOCK_SIZE * 24;
+		buffer_set_used_size(dest, used + decoded);
+		*dst_avail -= decoded;
+		*src_pos += n;
+	} while (skip == 0);
+
+	if (skip != 0)
+		*skip_pos_r = *src_pos - n + skip;
+}
+#endif
+
 /*
  * Low-level Base64 encoder
  */
@@ -307,6 +486,17 @@ base64_encode_more_data(struct base64_encoder *enc,
 	}
 
 	/* Convert the bulk */
+#ifdef HAVE_X86_SIMD_DISPATCH
+	if (src_size - src_pos >= BASE64_AVX2_ENCODE_READ_SIZE &&
+	    base64_scheme_can_encode_avx2(b64) &&
+	    cpu_has_feature(CPU_FEATURE_AVX2)) {
+		size_t n = base64_encode_avx2(b64enc, src_c + src_pos,
+					      src_size - src_pos,
+					      ptr, end - ptr);
+		src_pos += n;
+		ptr += n / 3 * 4;
+	}
+#endif
 	for (; src_size - src_pos > 2 && &ptr[3] < end;
 	     src_pos += 3, ptr += 4) {
 		ptr[0] = b64enc[src_c[src_pos] >> 2];
@@ -612,6 +802,12 @@ int base64_decode_more(struct base64_decoder *dec,
 	bool no_padding = HAS_ALL_BITS(
 		dec->flags, BASE64_DECODE_FLAG_NO_PADDING);
 	size_t src_pos, dst_avail;
+#ifdef HAVE_X86_SIMD_DISPATCH
+	bool use_avx2 = b64 == &base64_scheme &&
+		src_size >= BASE64_AVX2_DECODE_BLOCK_SIZE &&
+		cpu_has_feature(CPU_FEATURE_AVX2);
+	size_t avx2_skip_pos = 0;
+#endif
 	int ret = 1;
 
 	i_assert(!dec->finished);
@@ -661,8 +857,22 @@ int base64_decode_more(struct base64_decoder *dec,
 	}
 
 	for (; !dec->seen_padding && src_pos < src_size; src_pos++) {
-		unsigned char in = src_c[src_pos];
-		unsigned char dm = b64->decmap[in];
+		unsigned char in, dm;
+
+#ifdef HAVE_X86_SIMD_DISPATCH
+		if (use_avx2 && dec->sub_pos == 0 &&
+		    src_pos >= avx2_skip_pos &&
+		    src_size - src_pos >= BASE64_AVX2_DECODE_BLOCK_SIZE &&
+		    dst_avail >= 24) {
+			base64_decode_more_avx2(src_c, src_size,
+						&src_pos, &avx2_skip_pos,
+						dest, &dst_avail);
+			if (src_pos == src_size)
+				break;
+		}
+#endif
+		in = src_c[src_pos];
+		dm = b64->decmap[in];
 
 		if (dm == 0xff) {
 			if (no_whitespace) {
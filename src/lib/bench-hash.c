@@ -0,0 +1,200 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "strnum.h"
+#include "time-util.h"
+#include "hash.h"
+
+#include <stdio.h>
+
+/**
+ * Micro-benchmark for the hash table. Measures inserting, looking up
+ * existing and missing keys, iterating and removing with both direct
+ * pointer keys (e.g. anvil's connection lists) and string keys (e.g. auth
+ * cache and mail-index-strmap).
+ */
+
+#define BENCH_REPEAT_COUNT 5
+#define BENCH_DIRECT_KEY_SIZE 16
+
+struct bench_result {
+	uint64_t insert, lookup, lookup_miss, iterate, remove;
+};
+
+static void bench_print(const char *name, unsigned int count,
+			const struct bench_result *res)
+{
+	double div = (double)count * BENCH_REPEAT_COUNT;
+
+	printf("%s:\n", name);
+	printf("\tinsert:      %6.1lf ns/op\n", res->insert / div);
+	printf("\tlookup:      %6.1lf ns/op\n", res->lookup / div);
+	printf("\tlookup miss: %6.1lf ns/op\n", res->lookup_miss / div);
+	printf("\titerate:     %6.1lf ns/op\n", res->iterate / div);
+	printf("\tremove:      %6.1lf ns/op\n", res->remove / div);
+}
+
+#define BENCH_KEY(i) (keys + (i) * BENCH_DIRECT_KEY_SIZE)
+
+/* Returns the numbers 0..count-1 in random order, so the keys aren't
+   accessed in the order they were allocated. */
+static unsigned int *bench_get_order(unsigned int count)
+{
+	unsigned int i, j, tmp, *order;
+
+	order = i_new(unsigned int, count);
+	for (i = 0; i < count; i++)
+		order[i] = i;
+	for (i = count - 1; i > 0; i--) {
+		j = i_rand_limit(i + 1);
+		tmp = order[i]; order[i] = order[j]; order[j] = tmp;
+	}
+	return order;
+}
+
+static void bench_direct(unsigned int count)
+{
+	HASH_TABLE(char *, char *) hash;
+	struct hash_iterate_context *iter;
+	struct bench_result res;
+	char *keys, *key, *value;
+	unsigned int i, n, found, *order;
+	uint64_t ts;
+
+	i_zero(&res);
+	/* pointers to the same buffer look like real malloc()ed pointers:
+	   aligned and close to each other */
+	keys = i_malloc(count * 2 * BENCH_DIRECT_KEY_SIZE);
+	order = bench_get_order(count);
+	for (n = 0; n < BENCH_REPEAT_COUNT; n++) {
+		hash_table_create_direct(&hash, default_pool, 0);
+
+		ts = i_nanoseconds();
+		for (i = 0; i < count; i++) {
+			key = BENCH_KEY(order[i]);
+			hash_table_insert(hash, key, key);
+		}
+		res.insert += i_nanoseconds() - ts;
+
+		ts = i_nanoseconds();
+		for (i = found = 0; i < count; i++) {
+			if (hash_table_lookup(hash, BENCH_KEY(order[i])) != NULL)
+				found++;
+		}
+		res.lookup += i_nanoseconds() - ts;
+		i_assert(found == count);
+
+		ts = i_nanoseconds();
+		for (i = found = 0; i < count; i++) {
+			key = BENCH_KEY(count + order[i]);
+			if (hash_table_lookup(hash, key) != NULL)
+				found++;
+		}
+		res.lookup_miss += i_nanoseconds() - ts;
+		i_assert(found == 0);
+
+		ts = i_nanoseconds();
+		iter = hash_table_iterate_init(hash);
+		for (found = 0; hash_table_iterate(iter, hash, &key, &value); )
+			found++;
+		hash_table_iterate_deinit(&iter);
+		res.iterate += i_nanoseconds() - ts;
+		i_assert(found == count);
+
+		ts = i_nanoseconds();
+		for (i = 0; i < count; i++)
+			hash_table_remove(hash, BENCH_KEY(order[i]));
+		res.remove += i_nanoseconds() - ts;
+
+		hash_table_destroy(&hash);
+	}
+	i_free(order);
+	i_free(keys);
+	bench_print("direct keys", count, &res);
+}
+
+static void bench_str(unsigned int count)
+{
+	HASH_TABLE(char *, char *) hash;
+	struct hash_iterate_context *iter;
+	struct bench_result res;
+	ARRAY(char *) keys;
+	char *const *keyp, *key, *value;
+	unsigned int i, n, found, *order;
+	pool_t pool;
+	uint64_t ts;
+
+	i_zero(&res);
+	pool = pool_alloconly_create("bench hash keys", 1024*64);
+	p_array_init(&keys, pool, count * 2);
+	for (i = 0; i < count * 2; i++) {
+		char *str = p_strdup_printf(pool,
+			"user%u@example%u.com", i, i % 100);
+		array_push_back(&keys, &str);
+	}
+	keyp = array_front(&keys);
+	order = bench_get_order(count);
+
+	for (n = 0; n < BENCH_REPEAT_COUNT; n++) {
+		hash_table_create(&hash, default_pool, 0, str_hash, strcmp);
+
+		ts = i_nanoseconds();
+		for (i = 0; i < count; i++)
+			hash_table_insert(hash, keyp[order[i]],
+					  keyp[order[i]]);
+		res.insert += i_nanoseconds() - ts;
+
+		ts = i_nanoseconds();
+		for (i = found = 0; i < count; i++) {
+			if (hash_table_lookup(hash, keyp[order[i]]) != NULL)
+				found++;
+		}
+		res.lookup += i_nanoseconds() - ts;
+		i_assert(found == count);
+
+		ts = i_nanoseconds();
+		for (i = found = 0; i < count; i++) {
+			if (hash_table_lookup(hash, keyp[count + order[i]]) != NULL)
+				found++;
+		}
+		res.lookup_miss += i_nanoseconds() - ts;
+		i_assert(found == 0);
+
+		ts = i_nanoseconds();
+		iter = hash_table_iterate_init(hash);
+		for (found = 0; hash_table_iterate(iter, hash, &key, &value); )
+			found++;
+		hash_table_iterate_deinit(&iter);
+		res.iterate += i_nanoseconds() - ts;
+		i_assert(found == count);
+
+		ts = i_nanoseconds();
+		for (i = 0; i < count; i++)
+			hash_table_remove(hash, keyp[order[i]]);
+		res.remove += i_nanoseconds() - ts;
+
+		hash_table_destroy(&hash);
+	}
+	i_free(order);
+	pool_unref(&pool);
+	bench_print("string keys", count, &res);
+}
+
+int main(int argc, const char *argv[])
+{
+	unsigned int count = 1000000;
+
+	lib_init();
+	if (argc > 2 || (argc == 2 && (str_to_uint(argv[1], &count) < 0 ||
+				       count == 0))) {
+		fprintf(stderr, "Usage: %s [<count>]\n", argv[0]);
+		lib_exit(1);
+	}
+
+	bench_direct(count);
+	bench_str(count);
+
+	lib_deinit();
+	return 0;
+}
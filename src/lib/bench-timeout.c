@@ -0,0 +1,100 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "strnum.h"
+#include "time-util.h"
+#include "ioloop-private.h"
+
+#include <stdio.h>
+
+/**
+ * Micro-benchmark for ioloop timeouts. Simulates processes with many idle
+ * connections (imap-login, anvil, imap-hibernate), each having an
+ * inactivity timeout that is reset whenever there is input. The timeouts
+ * are first kept in the timing wheel, and then in the priority queue only.
+ */
+
+#define BENCH_TIMEOUT_MSECS (30*60*1000)
+#define BENCH_RESET_ROUNDS 10
+
+struct bench_result {
+	uint64_t add, reset, remove;
+};
+
+static void bench_timeout_callback(void *context ATTR_UNUSED)
+{
+	i_unreached();
+}
+
+static void bench_print(const char *name, unsigned int count,
+			const struct bench_result *res)
+{
+	printf("%s:\n", name);
+	printf("\tadd:    %6.1lf ns/op\n", (double)res->add / count);
+	printf("\treset:  %6.1lf ns/op\n",
+	       (double)res->reset / (count * BENCH_RESET_ROUNDS));
+	printf("\tremove: %6.1lf ns/op\n", (double)res->remove / count);
+}
+
+static void bench_timeouts(unsigned int count, bool use_wheel)
+{
+	struct ioloop *ioloop;
+	struct timeout **timeouts, *to;
+	struct bench_result res;
+	unsigned int i, n;
+	uint64_t ts;
+
+	i_zero(&res);
+	ioloop = io_loop_create();
+	if (!use_wheel)
+		ioloop->timeouts_wheel_min_msecs = UINT_MAX;
+	timeouts = i_new(struct timeout *, count);
+
+	ts = i_nanoseconds();
+	for (i = 0; i < count; i++) {
+		/* spread the timeouts a bit, like connections created at
+		   different times */
+		timeouts[i] = timeout_add(BENCH_TIMEOUT_MSECS + i % 10000,
+					  bench_timeout_callback, NULL);
+	}
+	/* start the timeouts */
+	to = timeout_add_short(0, io_loop_stop, ioloop);
+	io_loop_run(ioloop);
+	timeout_remove(&to);
+	res.add = i_nanoseconds() - ts;
+
+	ts = i_nanoseconds();
+	for (n = 0; n < BENCH_RESET_ROUNDS; n++) {
+		for (i = 0; i < count; i++)
+			timeout_reset(timeouts[(i * 7919) % count]);
+	}
+	res.reset = i_nanoseconds() - ts;
+
+	ts = i_nanoseconds();
+	for (i = 0; i < count; i++)
+		timeout_remove(&timeouts[i]);
+	res.remove = i_nanoseconds() - ts;
+
+	i_free(timeouts);
+	io_loop_destroy(&ioloop);
+	bench_print(use_wheel ? "timing wheel" : "priority queue",
+		    count, &res);
+}
+
+int main(int argc, const char *argv[])
+{
+	unsigned int count = 100000;
+
+	lib_init();
+	if (argc > 2 || (argc == 2 && (str_to_uint(argv[1], &count) < 0 ||
+				       count == 0))) {
+		fprintf(stderr, "Usage: %s [<connection count>]\n", argv[0]);
+		lib_exit(1);
+	}
+
+	printf("%u timeouts:\n", count);
+	bench_timeouts(count, TRUE);
+	bench_timeouts(count, FALSE);
+	lib_deinit();
+	return 0;
+}
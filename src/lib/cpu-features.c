@@ -0,0 +1,46 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "cpu-features.h"
+
+static bool cpu_features_initialized = FALSE;
+static bool cpu_features_disabled = FALSE;
+static bool cpu_have_pclmul, cpu_have_avx2;
+
+static void cpu_features_init(void)
+{
+#ifdef HAVE_X86_SIMD_DISPATCH
+	__builtin_cpu_init();
+	cpu_have_pclmul = __builtin_cpu_supports("pclmul") &&
+		__builtin_cpu_supports("sse4.1");
+	cpu_have_avx2 = __builtin_cpu_supports("avx2");
+#endif
+	cpu_features_initialized = TRUE;
+}
+
+bool cpu_has_feature(enum cpu_feature feature)
+{
+	if (cpu_features_disabled)
+		return FALSE;
+	if (!cpu_features_initialized)
+		cpu_features_init();
+
+	switch (feature) {
+	case CPU_FEATURE_SSE2:
+#ifdef __SSE2__
+		return TRUE;
+#else
+		return FALSE;
+#endif
+	case CPU_FEATURE_PCLMUL:
+		return cpu_have_pclmul;
+	case CPU_FEATURE_AVX2:
+		return cpu_have_avx2;
+	}
+	i_unreached();
+}
+
+void cpu_features_set_disabled(bool disabled)
+{
+	cpu_features_disabled = disabled;
+}
@@ -0,0 +1,18 @@
+#ifndef CPU_FEATURES_H
+#define CPU_FEATURES_H
+
+/* CPU features that have SIMD implementations selected at runtime. */
+enum cpu_feature {
+	CPU_FEATURE_SSE2,
+	CPU_FEATURE_PCLMUL,
+	CPU_FEATURE_AVX2,
+};
+
+/* Returns TRUE if the CPU supports the feature and Dovecot was compiled
+   with code that uses it. */
+bool cpu_has_feature(enum cpu_feature feature);
+/* Disable (or enable back) all the SIMD implementations. This is mainly
+   for tests and benchmarks that compare them against the generic code. */
+void cpu_features_set_disabled(bool disabled);
+
+#endif
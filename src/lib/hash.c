@@ -4,11 +4,24 @@
 
 #include "lib.h"
 #include "hash.h"
-#include "primes.h"
 
 #include <ctype.h>
 
-#define HASH_TABLE_MIN_SIZE 67
+/* The table is an open addressed array with linear probing. Its size is
+   always a power of two, so the hash code is spread over the array with
+   Fibonacci hashing instead of a modulo. The hash codes are stored in the
+   nodes, so key_compare_cb() is called only for nodes whose hash code
+   matches and rehashing doesn't need to call hash_cb(). */
+#define HASH_TABLE_MIN_SIZE 64
+/* Grow the table when it's more than 3/4 full */
+#define HASH_TABLE_MAX_LOAD(size) ((size) - (size) / 4)
+/* Shrink the table when it's less than 1/8 full */
+#define HASH_TABLE_SHRINK_LOAD(size) ((size) / 8)
+
+/* Values used in hash_node.hash for slots that don't have a node.
+   The hash codes of the nodes are mapped away from them. */
+#define HASH_SLOT_EMPTY 0
+#define HASH_SLOT_REMOVED 1
 
 #undef hash_table_create
 #undef hash_table_create_direct
@@ -27,20 +40,28 @@
 #undef hash_table_copy
 
 struct hash_node {
-	struct hash_node *next;
 	void *key;
 	void *value;
+	/* hash_slot_hash() of the key, or HASH_SLOT_* */
+	unsigned int hash;
 };
 
 struct hash_table {
 	pool_t node_pool;
 
 	int frozen;
+	/* removed_count is the number of HASH_SLOT_REMOVED slots. They exist
+	   only while the table is frozen. nodes_count doesn't include the
+	   overflow nodes. */
 	unsigned int initial_size, nodes_count, removed_count;
 
-	unsigned int size;
+	unsigned int size, shift;
 	struct hash_node *nodes;
-	struct hash_node *free_nodes;
+	/* The nodes can't be moved while the table is frozen, so it can't
+	   grow then. Nodes added to a frozen table that is full are placed
+	   into this table instead. They're moved to the nodes array when the
+	   table is thawed. */
+	struct hash_table *overflow;
 
 	hash_callback_t *hash_cb;
 	hash_cmp_callback_t *key_compare_cb;
@@ -48,17 +69,44 @@ struct hash_table {
 
 struct hash_iterate_context {
 	struct hash_table *table;
-	struct hash_node *next;
 	unsigned int pos;
+	/* Iterating the overflow nodes after all the other nodes */
+	struct hash_iterate_context *overflow_iter;
 };
 
 enum hash_table_operation{
 	HASH_TABLE_OP_INSERT,
 	HASH_TABLE_OP_UPDATE,
-	HASH_TABLE_OP_RESIZE
 };
 
-static bool hash_table_resize(struct hash_table *table, bool grow);
+static inline unsigned int hash_slot_hash(unsigned int hash)
+{
+	return hash <= HASH_SLOT_REMOVED ? hash + 2 : hash;
+}
+
+static inline unsigned int ATTR_NO_SANITIZE_INTEGER
+hash_table_home(const struct hash_table *table, unsigned int hash)
+{
+	return (unsigned int)((uint32_t)(hash * 2654435769U) >> table->shift);
+}
+
+static unsigned int hash_table_size_for(unsigned int count)
+{
+	unsigned int size = HASH_TABLE_MIN_SIZE;
+
+	while (HASH_TABLE_MAX_LOAD(size) < count) {
+		i_assert(size < (1U << 31));
+		size <<= 1;
+	}
+	return size;
+}
+
+static void hash_table_alloc(struct hash_table *table, unsigned int size)
+{
+	table->size = size;
+	table->shift = 32 - bits_required32(size - 1);
+	table->nodes = i_new(struct hash_node, size);
+}
 
 void hash_table_create(struct hash_table **table_r, pool_t node_pool,
 		       unsigned int initial_size, hash_callback_t *hash_cb,
@@ -69,14 +117,12 @@ void hash_table_create(struct hash_table **table_r, pool_t node_pool,
 	pool_ref(node_pool);
 	table = i_new(struct hash_table, 1);
 	table->node_pool = node_pool;
-	table->initial_size =
-		I_MAX(primes_closest(initial_size), HASH_TABLE_MIN_SIZE);
+	table->initial_size = hash_table_size_for(initial_size);
 
 	table->hash_cb = hash_cb;
 	table->key_compare_cb = key_compare_cb;
 
-	table->size = table->initial_size;
-	table->nodes = i_new(struct hash_node, table->size);
+	hash_table_alloc(table, table->initial_size);
 	*table_r = table;
 }
 
@@ -91,6 +137,12 @@ static int direct_cmp(const void *p1, const void *p2)
 	return p1 == p2 ? 0 : 1;
 }
 
+static inline unsigned int
+hash_table_key_hash(const struct hash_table *table, const void *key)
+{
+	return hash_slot_hash(table->hash_cb(key));
+}
+
 void hash_table_create_direct(struct hash_table **table_r, pool_t node_pool,
 			      unsigned int initial_size)
 {
@@ -98,92 +150,134 @@ void hash_table_create_direct(struct hash_table **table_r, pool_t node_pool,
 			  direct_hash, direct_cmp);
 }
 
-static void free_node(struct hash_table *table, struct hash_node *node)
+void hash_table_destroy(struct hash_table **_table)
 {
-	if (!table->node_pool->alloconly_pool)
-		p_free(table->node_pool, node);
-	else {
-		node->next = table->free_nodes;
-		table->free_nodes = node;
-	}
+	struct hash_table *table = *_table;
+
+	if (table == NULL)
+		return;
+	*_table = NULL;
+
+	i_assert(table->frozen == 0);
+	i_assert(table->overflow == NULL);
+
+	pool_unref(&table->node_pool);
+	i_free(table->nodes);
+	i_free(table);
 }
 
-static void destroy_node_list(struct hash_table *table, struct hash_node *node)
+void hash_table_clear(struct hash_table *table, bool free_nodes)
 {
-	struct hash_node *next;
+	i_assert(table->frozen == 0);
+	i_assert(table->overflow == NULL);
 
-	while (node != NULL) {
-		next = node->next;
-		p_free(table->node_pool, node);
-		node = next;
+	if (free_nodes && table->size != table->initial_size) {
+		i_free(table->nodes);
+		hash_table_alloc(table, table->initial_size);
+	} else {
+		memset(table->nodes, 0, sizeof(*table->nodes) * table->size);
 	}
+
+	table->nodes_count = 0;
+	table->removed_count = 0;
 }
 
-static void hash_table_destroy_nodes(struct hash_table *table)
+static inline struct hash_node *
+hash_table_lookup_slot(const struct hash_table *table, const void *key,
+		       unsigned int hash)
 {
-	unsigned int i;
+	unsigned int mask = table->size - 1;
+	unsigned int idx = hash_table_home(table, hash);
+	struct hash_node *node;
 
-	for (i = 0; i < table->size; i++) {
-		if (table->nodes[i].next != NULL)
-			destroy_node_list(table, table->nodes[i].next);
+	if (table->key_compare_cb == direct_cmp) {
+		/* avoid the callback for the most common comparison */
+		while ((node = &table->nodes[idx])->hash != HASH_SLOT_EMPTY) {
+			if (node->hash == hash && node->key == key)
+				return node;
+			idx = (idx + 1) & mask;
+		}
+		return NULL;
 	}
+
+	while ((node = &table->nodes[idx])->hash != HASH_SLOT_EMPTY) {
+		if (node->hash == hash &&
+		    table->key_compare_cb(node->key, key) == 0)
+			return node;
+		idx = (idx + 1) & mask;
+	}
+	return NULL;
 }
 
-void hash_table_destroy(struct hash_table **_table)
+static unsigned int
+hash_table_find_empty_slot(const struct hash_table *table, unsigned int hash)
 {
-	struct hash_table *table = *_table;
+	unsigned int mask = table->size - 1;
+	unsigned int idx = hash_table_home(table, hash);
 
-	if (table == NULL)
-		return;
-	*_table = NULL;
+	while (table->nodes[idx].hash != HASH_SLOT_EMPTY)
+		idx = (idx + 1) & mask;
+	return idx;
+}
 
-	i_assert(table->frozen == 0);
+static void
+hash_table_move_nodes(struct hash_table *table,
+		      const struct hash_node *nodes, unsigned int count)
+{
+	unsigned int i, idx;
 
-	if (!table->node_pool->alloconly_pool) {
-		hash_table_destroy_nodes(table);
-		destroy_node_list(table, table->free_nodes);
+	for (i = 0; i < count; i++) {
+		if (nodes[i].hash <= HASH_SLOT_REMOVED)
+			continue;
+		idx = hash_table_find_empty_slot(table, nodes[i].hash);
+		table->nodes[idx] = nodes[i];
 	}
-
-	pool_unref(&table->node_pool);
-	i_free(table->nodes);
-	i_free(table);
 }
 
-void hash_table_clear(struct hash_table *table, bool free_nodes)
+static void hash_table_resize(struct hash_table *table, unsigned int new_size)
 {
+	struct hash_node *old_nodes = table->nodes;
+	unsigned int old_size = table->size;
+
 	i_assert(table->frozen == 0);
 
-	if (!table->node_pool->alloconly_pool)
-		hash_table_destroy_nodes(table);
+	hash_table_alloc(table, new_size);
+	hash_table_move_nodes(table, old_nodes, old_size);
+	table->removed_count = 0;
 
-	if (free_nodes) {
-		if (!table->node_pool->alloconly_pool)
-			destroy_node_list(table, table->free_nodes);
-		table->free_nodes = NULL;
-	}
+	i_free(old_nodes);
+}
+
+static void hash_table_try_shrink(struct hash_table *table)
+{
+	unsigned int new_size;
 
-	memset(table->nodes, 0, sizeof(struct hash_node) * table->size);
+	i_assert(table->frozen == 0);
 
-	table->nodes_count = 0;
-	table->removed_count = 0;
+	if (table->size <= table->initial_size ||
+	    table->nodes_count >= HASH_TABLE_SHRINK_LOAD(table->size))
+		return;
+
+	/* leave room to grow again before the next resize */
+	new_size = I_MAX(hash_table_size_for(table->nodes_count * 2),
+			 table->initial_size);
+	if (new_size < table->size)
+		hash_table_resize(table, new_size);
 }
 
-static struct hash_node *
-hash_table_lookup_node(const struct hash_table *table,
-		       const void *key, unsigned int hash)
+/* Find the node from the table or its overflow table. */
+static inline struct hash_node *
+hash_table_lookup_node(const struct hash_table *table, const void *key,
+		       unsigned int hash)
 {
 	struct hash_node *node;
 
-	node = &table->nodes[hash % table->size];
-
 	do {
-		if (node->key != NULL) {
-			if (table->key_compare_cb(node->key, key) == 0)
-				return node;
-		}
-		node = node->next;
-	} while (node != NULL);
-
+		node = hash_table_lookup_slot(table, key, hash);
+		if (node != NULL)
+			return node;
+		table = table->overflow;
+	} while (unlikely(table != NULL));
 	return NULL;
 }
 
@@ -191,8 +285,9 @@ void *hash_table_lookup(const struct hash_table *table, const void *key)
 {
 	struct hash_node *node;
 
-	node = hash_table_lookup_node(table, key, table->hash_cb(key));
-	return node != NULL ? node->value : NULL;
+	node = hash_table_lookup_node(table, key,
+				      hash_table_key_hash(table, key));
+	return node == NULL ? NULL : node->value;
 }
 
 bool hash_table_lookup_full(const struct hash_table *table,
@@ -202,7 +297,7 @@ bool hash_table_lookup_full(const struct hash_table *table,
 	struct hash_node *node;
 
 	node = hash_table_lookup_node(table, lookup_key,
-				      table->hash_cb(lookup_key));
+			hash_table_key_hash(table, lookup_key));
 	if (node == NULL)
 		return FALSE;
 
@@ -213,159 +308,145 @@ bool hash_table_lookup_full(const struct hash_table *table,
 
 static void
 hash_table_insert_node(struct hash_table *table, void *key, void *value,
-			     enum hash_table_operation opcode)
+		       unsigned int hash, enum hash_table_operation opcode)
 {
-	struct hash_node *node, *prev;
-	unsigned int hash;
-	bool check_existing = TRUE;
+	unsigned int mask = table->size - 1;
+	unsigned int idx, slot_hash, removed_idx = UINT_MAX;
+	unsigned int used_count;
 
 	i_assert(table->nodes_count < UINT_MAX);
 	i_assert(key != NULL);
 
-	if(opcode == HASH_TABLE_OP_RESIZE)
-		check_existing = FALSE;
-	hash = table->hash_cb(key);
-
-	if (check_existing && table->removed_count > 0) {
-		/* there may be holes, have to check everything */
-		node = hash_table_lookup_node(table, key, hash);
-		if (node != NULL) {
+	idx = hash_table_home(table, hash);
+	while ((slot_hash = table->nodes[idx].hash) != HASH_SLOT_EMPTY) {
+		if (slot_hash == hash &&
+		    table->key_compare_cb(table->nodes[idx].key, key) == 0) {
 			i_assert(opcode == HASH_TABLE_OP_UPDATE);
-			node->value = value;
+			table->nodes[idx].value = value;
 			return;
 		}
-
-		check_existing = FALSE;
+		if (slot_hash == HASH_SLOT_REMOVED && removed_idx == UINT_MAX)
+			removed_idx = idx;
+		idx = (idx + 1) & mask;
 	}
 
-	/* a) primary node */
-	node = &table->nodes[hash % table->size];
-	if (node->key == NULL) {
-		table->nodes_count++;
-
-		node->key = key;
-		node->value = value;
+	if (table->overflow != NULL &&
+	    hash_table_lookup_node(table->overflow, key, hash) != NULL) {
+		hash_table_insert_node(table->overflow, key, value,
+				       hash, opcode);
 		return;
 	}
-	if (check_existing) {
-		if (table->key_compare_cb(node->key, key) == 0) {
-			i_assert(opcode == HASH_TABLE_OP_UPDATE);
-			node->value = value;
-			return;
-		}
-	}
 
-	/* b) collisions list */
-	prev = node; node = node->next;
-	while (node != NULL) {
-		if (node->key == NULL)
-			break;
-
-		if (check_existing) {
-			if (table->key_compare_cb(node->key, key) == 0) {
-				i_assert(opcode == HASH_TABLE_OP_UPDATE);
-				node->value = value;
-				return;
+	if (removed_idx != UINT_MAX) {
+		/* reuse a slot removed while the table was frozen */
+		idx = removed_idx;
+		table->removed_count--;
+	} else {
+		used_count = table->nodes_count + table->removed_count + 1;
+		if (used_count <= HASH_TABLE_MAX_LOAD(table->size)) {
+			/* there's still room */
+		} else if (table->frozen == 0) {
+			hash_table_resize(table, table->size * 2);
+			idx = hash_table_find_empty_slot(table, hash);
+		} else {
+			/* growing would move the nodes under iterators */
+			if (table->overflow == NULL) {
+				hash_table_create(&table->overflow,
+						  table->node_pool, 0,
+						  table->hash_cb,
+						  table->key_compare_cb);
 			}
-		}
-		prev = node;
-		node = node->next;
-	}
-
-	if (node == NULL) {
-		if (table->frozen == 0 && hash_table_resize(table, TRUE)) {
-			/* resized table, try again */
-			hash_table_insert_node(table, key, value, HASH_TABLE_OP_RESIZE);
+			hash_table_insert_node(table->overflow, key, value,
+					       hash, opcode);
 			return;
 		}
-
-		if (table->free_nodes == NULL)
-			node = p_new(table->node_pool, struct hash_node, 1);
-		else {
-			node = table->free_nodes;
-			table->free_nodes = node->next;
-			node->next = NULL;
-		}
-		prev->next = node;
 	}
 
-	node->key = key;
-	node->value = value;
-
+	table->nodes[idx].hash = hash;
+	table->nodes[idx].key = key;
+	table->nodes[idx].value = value;
 	table->nodes_count++;
 }
 
 void hash_table_insert(struct hash_table *table, void *key, void *value)
 {
-	hash_table_insert_node(table, key, value, HASH_TABLE_OP_INSERT);
+	hash_table_insert_node(table, key, value,
+			       hash_table_key_hash(table, key),
+			       HASH_TABLE_OP_INSERT);
 }
 
 void hash_table_update(struct hash_table *table, void *key, void *value)
 {
-	hash_table_insert_node(table, key, value, HASH_TABLE_OP_UPDATE);
+	hash_table_insert_node(table, key, value,
+			       hash_table_key_hash(table, key),
+			       HASH_TABLE_OP_UPDATE);
 }
 
-static void
-hash_table_compress(struct hash_table *table, struct hash_node *root)
+static void hash_table_remove_slot(struct hash_table *table, unsigned int idx)
 {
-	struct hash_node *node, *next;
-
-	i_assert(table->frozen == 0);
-
-	/* remove deleted nodes from the list */
-	for (node = root; node->next != NULL; ) {
-		next = node->next;
-
-		if (next->key == NULL) {
-			node->next = next->next;
-			free_node(table, next);
-		} else {
-			node = next;
+	unsigned int mask = table->size - 1;
+	unsigned int next, home;
+
+	/* Move the following nodes of the same probe sequence backwards,
+	   so lookups don't need any markers for the removed node. */
+	for (next = (idx + 1) & mask;
+	     table->nodes[next].hash != HASH_SLOT_EMPTY;
+	     next = (next + 1) & mask) {
+		home = hash_table_home(table, table->nodes[next].hash);
+		/* the node can be moved unless its home is cyclically
+		   within (idx, next] */
+		if (idx <= next ? (home <= idx || home > next) :
+		    (home <= idx && home > next)) {
+			table->nodes[idx] = table->nodes[next];
+			idx = next;
 		}
 	}
-
-	/* update root */
-	if (root->key == NULL && root->next != NULL) {
-		next = root->next;
-		*root = *next;
-		free_node(table, next);
-	}
-}
-
-static void hash_table_compress_removed(struct hash_table *table)
-{
-	unsigned int i;
-
-	for (i = 0; i < table->size; i++)
-		hash_table_compress(table, &table->nodes[i]);
-
-	table->removed_count = 0;
+	i_zero(&table->nodes[idx]);
 }
 
-bool hash_table_try_remove(struct hash_table *table, const void *key)
+static bool
+hash_table_remove_node(struct hash_table *table, const void *key,
+		       unsigned int hash)
 {
 	struct hash_node *node;
-	unsigned int hash;
-
-	hash = table->hash_cb(key);
+	unsigned int idx;
 
-	node = hash_table_lookup_node(table, key, hash);
-	if (unlikely(node == NULL))
-		return FALSE;
+	node = hash_table_lookup_slot(table, key, hash);
+	if (node == NULL) {
+		return table->overflow != NULL &&
+			hash_table_remove_node(table->overflow, key, hash);
+	}
+	idx = node - table->nodes;
 
-	node->key = NULL;
 	table->nodes_count--;
-
-	if (table->frozen != 0)
+	if (table->frozen != 0) {
+		/* the nodes must stay where they are while iterating */
+		table->nodes[idx].hash = HASH_SLOT_REMOVED;
+		table->nodes[idx].key = NULL;
+		table->nodes[idx].value = NULL;
 		table->removed_count++;
-	else if (!hash_table_resize(table, FALSE))
-		hash_table_compress(table, &table->nodes[hash % table->size]);
+	} else {
+		hash_table_remove_slot(table, idx);
+		hash_table_try_shrink(table);
+	}
 	return TRUE;
 }
 
+bool hash_table_try_remove(struct hash_table *table, const void *key)
+{
+	return hash_table_remove_node(table, key,
+				      hash_table_key_hash(table, key));
+}
+
 unsigned int hash_table_count(const struct hash_table *table)
 {
-	return table->nodes_count;
+	unsigned int count = 0;
+
+	do {
+		count += table->nodes_count;
+		table = table->overflow;
+	} while (table != NULL);
+	return count;
 }
 
 struct hash_iterate_context *hash_table_iterate_init(struct hash_table *table)
@@ -376,45 +457,30 @@ struct hash_iterate_context *hash_table_iterate_init(struct hash_table *table)
 
 	ctx = i_new(struct hash_iterate_context, 1);
 	ctx->table = table;
-	ctx->next = &table->nodes[0];
 	return ctx;
 }
 
-static struct hash_node *
-hash_table_iterate_next(struct hash_iterate_context *ctx,
-			struct hash_node *node)
-{
-	do {
-		node = node->next;
-		if (node == NULL) {
-			if (++ctx->pos == ctx->table->size) {
-				ctx->pos--;
-				return NULL;
-			}
-			node = &ctx->table->nodes[ctx->pos];
-		}
-	} while (node->key == NULL);
-
-	return node;
-}
-
 bool hash_table_iterate(struct hash_iterate_context *ctx,
 			void **key_r, void **value_r)
 {
-	struct hash_node *node;
-
-	node = ctx->next;
-	if (node != NULL && node->key == NULL)
-		node = hash_table_iterate_next(ctx, node);
-	if (node == NULL) {
-		*key_r = *value_r = NULL;
-		return FALSE;
+	const struct hash_table *table = ctx->table;
+
+	for (; ctx->pos < table->size; ctx->pos++) {
+		if (table->nodes[ctx->pos].hash > HASH_SLOT_REMOVED) {
+			*key_r = table->nodes[ctx->pos].key;
+			*value_r = table->nodes[ctx->pos].value;
+			ctx->pos++;
+			return TRUE;
+		}
 	}
-	*key_r = node->key;
-	*value_r = node->value;
-
-	ctx->next = hash_table_iterate_next(ctx, node);
-	return TRUE;
+	/* The overflow table exists only while this table is frozen, so it
+	   can't be freed before the iteration finishes. */
+	if (ctx->overflow_iter == NULL && table->overflow != NULL)
+		ctx->overflow_iter = hash_table_iterate_init(table->overflow);
+	if (ctx->overflow_iter != NULL)
+		return hash_table_iterate(ctx->overflow_iter, key_r, value_r);
+	*key_r = *value_r = NULL;
+	return FALSE;
 }
 
 void hash_table_iterate_deinit(struct hash_iterate_context **_ctx)
@@ -425,6 +491,7 @@ void hash_table_iterate_deinit(struct hash_iterate_context **_ctx)
 		return;
 
 	*_ctx = NULL;
+	hash_table_iterate_deinit(&ctx->overflow_iter);
 	hash_table_thaw(ctx->table);
 	i_free(ctx);
 }
@@ -436,87 +503,51 @@ void hash_table_freeze(struct hash_table *table)
 
 void hash_table_thaw(struct hash_table *table)
 {
+	struct hash_table *overflow = table->overflow;
+	unsigned int new_size;
+
 	i_assert(table->frozen > 0);
 
 	if (--table->frozen > 0)
 		return;
 
-	if (table->removed_count > 0) {
-		if (!hash_table_resize(table, FALSE))
-			hash_table_compress_removed(table);
-	}
-}
-
-static bool hash_table_resize(struct hash_table *table, bool grow)
-{
-	struct hash_node *old_nodes, *node, *next;
-	unsigned int next_size, old_size, i;
-	float nodes_per_list;
-
-	i_assert(table->frozen == 0);
-
-	nodes_per_list = (float) table->nodes_count / (float) table->size;
-	if (nodes_per_list > 0.3 && nodes_per_list < 2.0)
-		return FALSE;
-
-	next_size = I_MAX(primes_closest(table->nodes_count+1),
-			  table->initial_size);
-	if (next_size == table->size)
-		return FALSE;
-
-	if (grow && table->size >= next_size)
-		return FALSE;
-
-	/* recreate primary table */
-	old_size = table->size;
-	old_nodes = table->nodes;
-
-	table->size = I_MAX(next_size, HASH_TABLE_MIN_SIZE);
-	table->nodes = i_new(struct hash_node, table->size);
-
-	table->nodes_count = 0;
-	table->removed_count = 0;
-
-	table->frozen++;
-
-	/* move the data */
-	for (i = 0; i < old_size; i++) {
-		node = &old_nodes[i];
-		if (node->key != NULL) {
-			hash_table_insert_node(table, node->key,
-					       node->value, HASH_TABLE_OP_RESIZE);
-		}
-
-		for (node = node->next; node != NULL; node = next) {
-			next = node->next;
-
-			if (node->key != NULL) {
-				hash_table_insert_node(table, node->key,
-						       node->value, HASH_TABLE_OP_RESIZE);
-			}
-			free_node(table, node);
-		}
+	if (overflow != NULL) {
+		/* all the iterators are gone, so the overflow table isn't
+		   frozen either. Move its nodes here. */
+		i_assert(overflow->overflow == NULL);
+		table->overflow = NULL;
+		new_size = hash_table_size_for(table->nodes_count +
+					       overflow->nodes_count);
+		hash_table_resize(table, I_MAX(new_size, table->size));
+		hash_table_move_nodes(table, overflow->nodes, overflow->size);
+		table->nodes_count += overflow->nodes_count;
+		overflow->nodes_count = 0;
+		hash_table_destroy(&overflow);
+	} else if (table->removed_count > 0) {
+		/* rehash to get rid of the removed slots */
+		hash_table_resize(table, table->size);
+		hash_table_try_shrink(table);
 	}
-
-	table->frozen--;
-
-	i_free(old_nodes);
-	return TRUE;
 }
 
 void hash_table_copy(struct hash_table *dest, struct hash_table *src)
 {
 	struct hash_iterate_context *iter;
+	unsigned int new_size;
 	void *key, *value;
 
-	hash_table_freeze(dest);
+	if (dest->frozen == 0) {
+		/* grow only once */
+		new_size = hash_table_size_for(dest->nodes_count +
+					       src->nodes_count);
+		if (new_size > dest->size)
+			hash_table_resize(dest, new_size);
+	}
 
 	iter = hash_table_iterate_init(src);
 	while (hash_table_iterate(iter, &key, &value))
 		hash_table_insert(dest, key, value);
 	hash_table_iterate_deinit(&iter);
-
-	hash_table_thaw(dest);
 }
 
 /* a char* hash function from ASU -- from glib */
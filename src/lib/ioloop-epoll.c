@@ -6,11 +6,20 @@
 #include "ioloop-private.h"
 #include "ioloop-iolist.h"
 
-#ifdef IOLOOP_EPOLL
+#if defined(IOLOOP_EPOLL) || defined(IOLOOP_URING)
 
 #include <sys/epoll.h>
 #include <unistd.h>
 
+#ifdef IOLOOP_URING
+/* ioloop-uring.c falls back to these */
+#  define io_loop_handler_init io_loop_epoll_handler_init
+#  define io_loop_handler_deinit io_loop_epoll_handler_deinit
+#  define io_loop_handle_add io_loop_epoll_handle_add
+#  define io_loop_handle_remove io_loop_epoll_handle_remove
+#  define io_loop_handler_run_internal io_loop_epoll_handler_run_internal
+#endif
+
 struct ioloop_handler_context {
 	int epfd;
 
@@ -227,4 +236,4 @@ void io_loop_handler_run_internal(struct ioloop *ioloop)
 	}
 }
 
-#endif	/* IOLOOP_EPOLL */
+#endif	/* IOLOOP_EPOLL || IOLOOP_URING */
@@ -2,6 +2,7 @@
 #define IOLOOP_PRIVATE_H
 
 #include "priorityq.h"
+#include "timing-wheel.h"
 #include "ioloop.h"
 #include "array-decl.h"
 
@@ -17,6 +18,10 @@ struct ioloop {
 	struct io_file *io_files;
 	struct io_file *next_io_file;
 	struct priorityq *timeouts;
+	/* Timeouts of at least timeouts_wheel_min_msecs are kept here until
+	   they're about to expire, so they can be reset in O(1). */
+	struct timing_wheel *timeouts_wheel;
+	unsigned int timeouts_wheel_min_msecs;
 	ARRAY(struct timeout *) timeouts_new;
 	struct io_wait_timer *wait_timers;
 
@@ -69,6 +74,7 @@ struct io_file {
 
 struct timeout {
 	struct priorityq_item item;
+	struct timing_wheel_item wheel_item;
 	const char *source_filename;
 	unsigned int source_linenum;
 
@@ -121,6 +127,16 @@ void io_loop_handle_remove(struct io_file *io, bool closed);
 void io_loop_handler_init(struct ioloop *ioloop, unsigned int initial_fd_count);
 void io_loop_handler_deinit(struct ioloop *ioloop);
 
+#ifdef IOLOOP_URING
+/* epoll handler, used when io_uring isn't supported by the kernel */
+void io_loop_epoll_handle_add(struct io_file *io);
+void io_loop_epoll_handle_remove(struct io_file *io, bool closed);
+void io_loop_epoll_handler_init(struct ioloop *ioloop,
+				unsigned int initial_fd_count);
+void io_loop_epoll_handler_deinit(struct ioloop *ioloop);
+void io_loop_epoll_handler_run_internal(struct ioloop *ioloop);
+#endif
+
 void io_loop_notify_remove(struct io *io);
 void io_loop_notify_handler_deinit(struct ioloop *ioloop);
 
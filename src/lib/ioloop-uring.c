@@ -0,0 +1,626 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "sleep.h"
+#include "ioloop-private.h"
+#include "ioloop-iolist.h"
+
+#ifdef IOLOOP_URING
+
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/* The ring is used only for readiness notifications: each fd with IOs has a
+   one-shot IORING_OP_POLL_ADD armed. Once it completes, it's re-armed on the
+   next loop iteration, which gives the same level-triggered behavior as
+   epoll. All the (re)arms and removals are submitted with the same
+   io_uring_enter() call that waits for the completions.
+
+   If the kernel doesn't support io_uring (or it's disabled with the
+   kernel.io_uring_disabled sysctl), epoll is used instead.
+
+   Only the readiness notifications go through the ring. File reads, writes
+   and fsyncs done by istream-file, ostream-file and fdatasync_path() are
+   still blocking syscalls, because their callers expect them to complete
+   before returning. */
+
+#define IOLOOP_URING_ENTRIES 256
+/* user_data for SQEs whose completions are ignored */
+#define IOLOOP_URING_USER_DATA_IGNORE 0
+
+#define IO_URING_ERROR (POLLERR | POLLHUP)
+#define IO_URING_INPUT (POLLIN | POLLPRI | IO_URING_ERROR)
+#define IO_URING_OUTPUT (POLLOUT | IO_URING_ERROR)
+
+struct uring_fd {
+	struct io_list list;
+
+	/* Incremented whenever the armed poll is removed, so its completion
+	   can be recognized as stale. */
+	uint32_t generation;
+	/* Poll events currently armed, 0 if not armed */
+	unsigned int armed_events;
+	bool rearm_queued;
+};
+
+struct uring_queue {
+	unsigned int *head, *tail, *mask, *entries;
+};
+
+struct ioloop_handler_context {
+	int ring_fd;
+
+	void *sq_ptr, *cq_ptr;
+	size_t sq_ptr_size, cq_ptr_size;
+	struct uring_queue sq, cq;
+	unsigned int *sq_array;
+	struct io_uring_sqe *sqes;
+	size_t sqes_size;
+	struct io_uring_cqe *cqes;
+	unsigned int sq_pending;
+
+	ARRAY(struct uring_fd *) fd_index;
+	ARRAY(int) rearm_fds;
+	ARRAY(struct io_uring_cqe) events;
+};
+
+static bool uring_checked = FALSE, uring_unsupported = FALSE;
+
+static int
+sys_io_uring_setup(unsigned int entries, struct io_uring_params *params)
+{
+	return syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int
+sys_io_uring_enter(int fd, unsigned int to_submit, unsigned int min_complete,
+		   unsigned int flags, const void *arg, size_t argsz)
+{
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+		       flags, arg, argsz);
+}
+
+static void uring_ring_unmap(struct ioloop_handler_context *ctx)
+{
+	if (ctx->sqes != NULL && ctx->sqes != MAP_FAILED) {
+		if (munmap(ctx->sqes, ctx->sqes_size) < 0)
+			i_error("munmap(io_uring sqes) failed: %m");
+	}
+	if (ctx->cq_ptr != NULL && ctx->cq_ptr != MAP_FAILED &&
+	    ctx->cq_ptr != ctx->sq_ptr) {
+		if (munmap(ctx->cq_ptr, ctx->cq_ptr_size) < 0)
+			i_error("munmap(io_uring cq) failed: %m");
+	}
+	if (ctx->sq_ptr != NULL && ctx->sq_ptr != MAP_FAILED) {
+		if (munmap(ctx->sq_ptr, ctx->sq_ptr_size) < 0)
+			i_error("munmap(io_uring sq) failed: %m");
+	}
+	ctx->sqes = NULL;
+	ctx->cq_ptr = ctx->sq_ptr = NULL;
+}
+
+static int uring_ring_init(struct ioloop_handler_context *ctx)
+{
+	struct io_uring_params params;
+	unsigned char *sq_ptr, *cq_ptr;
+
+	i_zero(&params);
+	ctx->ring_fd = sys_io_uring_setup(IOLOOP_URING_ENTRIES, &params);
+	if (ctx->ring_fd < 0)
+		return -1;
+	fd_close_on_exec(ctx->ring_fd, TRUE);
+
+	if ((params.features & IORING_FEAT_EXT_ARG) == 0 ||
+	    (params.features & IORING_FEAT_NODROP) == 0) {
+		/* waiting with a timeout and not losing completions require
+		   these, both available since Linux v5.11 */
+		i_close_fd(&ctx->ring_fd);
+		errno = ENOSYS;
+		return -1;
+	}
+
+	ctx->sq_ptr_size = params.sq_off.array +
+		params.sq_entries * sizeof(unsigned int);
+	ctx->cq_ptr_size = params.cq_off.cqes +
+		params.cq_entries * sizeof(struct io_uring_cqe);
+	if ((params.features & IORING_FEAT_SINGLE_MMAP) != 0) {
+		ctx->sq_ptr_size = I_MAX(ctx->sq_ptr_size, ctx->cq_ptr_size);
+		ctx->cq_ptr_size = ctx->sq_ptr_size;
+	}
+
+	ctx->sq_ptr = mmap(NULL, ctx->sq_ptr_size, PROT_READ | PROT_WRITE,
+			   MAP_SHARED | MAP_POPULATE, ctx->ring_fd,
+			   IORING_OFF_SQ_RING);
+	if (ctx->sq_ptr == MAP_FAILED)
+		i_fatal("mmap(io_uring sq) failed: %m");
+	if ((params.features & IORING_FEAT_SINGLE_MMAP) != 0)
+		ctx->cq_ptr = ctx->sq_ptr;
+	else {
+		ctx->cq_ptr = mmap(NULL, ctx->cq_ptr_size,
+				   PROT_READ | PROT_WRITE,
+				   MAP_SHARED | MAP_POPULATE, ctx->ring_fd,
+				   IORING_OFF_CQ_RING);
+		if (ctx->cq_ptr == MAP_FAILED)
+			i_fatal("mmap(io_uring cq) failed: %m");
+	}
+	ctx->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	ctx->sqes = mmap(NULL, ctx->sqes_size, PROT_READ | PROT_WRITE,
+			 MAP_SHARED | MAP_POPULATE, ctx->ring_fd,
+			 IORING_OFF_SQES);
+	if (ctx->sqes == MAP_FAILED)
+		i_fatal("mmap(io_uring sqes) failed: %m");
+
+	sq_ptr = ctx->sq_ptr;
+	ctx->sq.head = (void *)(sq_ptr + params.sq_off.head);
+	ctx->sq.tail = (void *)(sq_ptr + params.sq_off.tail);
+	ctx->sq.mask = (void *)(sq_ptr + params.sq_off.ring_mask);
+	ctx->sq.entries = (void *)(sq_ptr + params.sq_off.ring_entries);
+	ctx->sq_array = (void *)(sq_ptr + params.sq_off.array);
+
+	cq_ptr = ctx->cq_ptr;
+	ctx->cq.head = (void *)(cq_ptr + params.cq_off.head);
+	ctx->cq.tail = (void *)(cq_ptr + params.cq_off.tail);
+	ctx->cq.mask = (void *)(cq_ptr + params.cq_off.ring_mask);
+	ctx->cq.entries = (void *)(cq_ptr + params.cq_off.ring_entries);
+	ctx->cqes = (void *)(cq_ptr + params.cq_off.cqes);
+	ctx->sq_pending = 0;
+	return 0;
+}
+
+static void uring_ring_deinit(struct ioloop_handler_context *ctx)
+{
+	uring_ring_unmap(ctx);
+	if (close(ctx->ring_fd) < 0)
+		i_error("close(io_uring) failed: %m");
+	ctx->ring_fd = -1;
+}
+
+static void uring_reap_completions(struct ioloop_handler_context *ctx);
+
+static int uring_enter(struct ioloop_handler_context *ctx,
+		       unsigned int min_complete, const struct timespec *ts)
+{
+	struct io_uring_getevents_arg arg;
+
+	if (min_complete == 0) {
+		return sys_io_uring_enter(ctx->ring_fd, ctx->sq_pending, 0,
+					  0, NULL, 0);
+	}
+	i_zero(&arg);
+	arg.sigmask_sz = _NSIG / 8;
+	arg.ts = (uintptr_t)ts;
+	return sys_io_uring_enter(ctx->ring_fd, ctx->sq_pending, min_complete,
+				  IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+				  &arg, sizeof(arg));
+}
+
+static int uring_submit(struct ioloop_handler_context *ctx,
+			unsigned int min_complete, const struct timespec *ts)
+{
+	int ret;
+
+	while ((ret = uring_enter(ctx, min_complete, ts)) < 0 &&
+	       errno == EBUSY) {
+		/* The completion queue is full, and the kernel won't accept
+		   more submissions until it's reaped. Reap it and retry.
+		   Don't wait for more completions, since there are now
+		   events to handle. */
+		uring_reap_completions(ctx);
+		min_complete = 0;
+	}
+	if (ret < 0) {
+		/* ETIME: timeout reached */
+		if (errno == EINTR || errno == ETIME)
+			return 0;
+		return -1;
+	}
+	i_assert((unsigned int)ret <= ctx->sq_pending);
+	ctx->sq_pending -= ret;
+	return 0;
+}
+
+static struct io_uring_sqe *uring_get_sqe(struct ioloop_handler_context *ctx)
+{
+	struct io_uring_sqe *sqe;
+	unsigned int head, tail, idx;
+
+	tail = *ctx->sq.tail;
+	head = __atomic_load_n(ctx->sq.head, __ATOMIC_ACQUIRE);
+	if (tail - head >= *ctx->sq.entries) {
+		/* submission queue is full - submit what we have */
+		if (uring_submit(ctx, 0, NULL) < 0)
+			i_fatal("io_uring_enter() failed: %m");
+		head = __atomic_load_n(ctx->sq.head, __ATOMIC_ACQUIRE);
+		i_assert(tail - head < *ctx->sq.entries);
+	}
+
+	idx = tail & *ctx->sq.mask;
+	sqe = &ctx->sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+	ctx->sq_array[idx] = idx;
+	__atomic_store_n(ctx->sq.tail, tail + 1, __ATOMIC_RELEASE);
+	ctx->sq_pending++;
+	return sqe;
+}
+
+static uint64_t uring_user_data(int fd, const struct uring_fd *ufd)
+{
+	/* fd + 1 so that the user_data is never
+	   IOLOOP_URING_USER_DATA_IGNORE */
+	return ((uint64_t)(fd + 1) << 32) | ufd->generation;
+}
+
+static unsigned int uring_event_mask(struct io_list *list)
+{
+	unsigned int events = 0;
+	struct io_file *io;
+	int i;
+
+	for (i = 0; i < IOLOOP_IOLIST_IOS_PER_FD; i++) {
+		io = list->ios[i];
+
+		if (io == NULL)
+			continue;
+
+		if ((io->io.condition & IO_READ) != 0)
+			events |= IO_URING_INPUT;
+		if ((io->io.condition & IO_WRITE) != 0)
+			events |= IO_URING_OUTPUT;
+		if ((io->io.condition & IO_ERROR) != 0)
+			events |= IO_URING_ERROR;
+	}
+	return events;
+}
+
+static void
+uring_disarm(struct ioloop_handler_context *ctx, int fd, struct uring_fd *ufd)
+{
+	struct io_uring_sqe *sqe;
+
+	if (ufd->armed_events == 0)
+		return;
+
+	/* The armed poll keeps a reference to the file, so it must be removed
+	   even if the fd was already closed. */
+	sqe = uring_get_sqe(ctx);
+	sqe->opcode = IORING_OP_POLL_REMOVE;
+	sqe->fd = -1;
+	sqe->addr = uring_user_data(fd, ufd);
+	sqe->user_data = IOLOOP_URING_USER_DATA_IGNORE;
+
+	ufd->generation++;
+	ufd->armed_events = 0;
+}
+
+static void
+uring_queue_rearm(struct ioloop_handler_context *ctx, int fd,
+		  struct uring_fd *ufd)
+{
+	if (!ufd->rearm_queued) {
+		ufd->rearm_queued = TRUE;
+		array_push_back(&ctx->rearm_fds, &fd);
+	}
+}
+
+static void uring_rearm_fds(struct ioloop_handler_context *ctx,
+			    unsigned int count)
+{
+	struct io_uring_sqe *sqe;
+	struct uring_fd *ufd;
+	unsigned int i = count, events;
+	int fd;
+
+	/* Polls that are already ready complete in the submission order.
+	   Submit the newest fds first, which is the same order as
+	   ioloop->io_files has them. */
+	while (i > 0) {
+		fd = *array_idx(&ctx->rearm_fds, --i);
+		ufd = array_idx_elem(&ctx->fd_index, fd);
+		ufd->rearm_queued = FALSE;
+
+		events = uring_event_mask(&ufd->list);
+		if (events == ufd->armed_events)
+			continue;
+		uring_disarm(ctx, fd, ufd);
+		if (events == 0)
+			continue;
+
+		sqe = uring_get_sqe(ctx);
+		sqe->opcode = IORING_OP_POLL_ADD;
+		sqe->fd = fd;
+		sqe->poll32_events = events;
+		sqe->user_data = uring_user_data(fd, ufd);
+		ufd->armed_events = events;
+	}
+}
+
+static void uring_rearm_all(struct ioloop_handler_context *ctx)
+{
+	unsigned int count;
+
+	/* Completions reaped while submitting may queue more fds */
+	while ((count = array_count(&ctx->rearm_fds)) > 0) {
+		uring_rearm_fds(ctx, count);
+		array_delete(&ctx->rearm_fds, 0, count);
+	}
+}
+
+static void uring_handler_init(struct ioloop *ioloop,
+			       unsigned int initial_fd_count)
+{
+	struct ioloop_handler_context *ctx;
+
+	ctx = i_new(struct ioloop_handler_context, 1);
+	if (uring_ring_init(ctx) < 0) {
+		if (!uring_checked &&
+		    (errno == ENOSYS || errno == EPERM || errno == EINVAL)) {
+			/* not supported by the kernel */
+			i_free(ctx);
+			uring_unsupported = TRUE;
+			uring_checked = TRUE;
+			io_loop_epoll_handler_init(ioloop, initial_fd_count);
+			return;
+		}
+		if (errno != EMFILE)
+			i_fatal("io_uring_setup(): %m");
+		else {
+			i_fatal("io_uring_setup(): %m (you may need to "
+				"increase the process's fd limit)");
+		}
+	}
+	uring_checked = TRUE;
+
+	i_array_init(&ctx->fd_index, initial_fd_count);
+	i_array_init(&ctx->rearm_fds, initial_fd_count);
+	i_array_init(&ctx->events, IOLOOP_URING_ENTRIES);
+	ioloop->handler_context = ctx;
+}
+
+void io_loop_handler_init(struct ioloop *ioloop, unsigned int initial_fd_count)
+{
+	if (uring_unsupported)
+		io_loop_epoll_handler_init(ioloop, initial_fd_count);
+	else
+		uring_handler_init(ioloop, initial_fd_count);
+}
+
+void io_loop_handler_deinit(struct ioloop *ioloop)
+{
+	struct ioloop_handler_context *ctx = ioloop->handler_context;
+	struct uring_fd **list;
+	unsigned int i, count;
+
+	if (uring_unsupported) {
+		io_loop_epoll_handler_deinit(ioloop);
+		return;
+	}
+
+	list = array_get_modifiable(&ctx->fd_index, &count);
+	for (i = 0; i < count; i++)
+		i_free(list[i]);
+
+	/* closing the ring cancels all the armed polls */
+	uring_ring_deinit(ctx);
+	array_free(&ctx->fd_index);
+	array_free(&ctx->rearm_fds);
+	array_free(&ctx->events);
+	i_free(ioloop->handler_context);
+}
+
+void io_loop_recreate(struct ioloop *ioloop)
+{
+	struct ioloop_handler_context *ctx;
+	struct uring_fd *const *ufds;
+	unsigned int fd, count;
+
+	if (uring_unsupported || ioloop == NULL ||
+	    ioloop->handler_context == NULL)
+		return;
+
+	/* The ring memory is shared with the parent process after fork(),
+	   so the child must get its own ring. */
+	ctx = ioloop->handler_context;
+	uring_ring_unmap(ctx);
+	i_close_fd(&ctx->ring_fd);
+	if (uring_ring_init(ctx) < 0)
+		i_fatal("io_uring_setup(): %m");
+
+	array_clear(&ctx->rearm_fds);
+	ufds = array_get(&ctx->fd_index, &count);
+	for (fd = 0; fd < count; fd++) {
+		if (ufds[fd] == NULL)
+			continue;
+		ufds[fd]->generation++;
+		ufds[fd]->armed_events = 0;
+		ufds[fd]->rearm_queued = FALSE;
+		uring_queue_rearm(ctx, fd, ufds[fd]);
+	}
+}
+
+void io_loop_handle_add(struct io_file *io)
+{
+	struct ioloop_handler_context *ctx = io->io.ioloop->handler_context;
+	struct uring_fd **ufdp;
+
+	if (uring_unsupported) {
+		io_loop_epoll_handle_add(io);
+		return;
+	}
+
+	ufdp = array_idx_get_space(&ctx->fd_index, io->fd);
+	if (*ufdp == NULL)
+		*ufdp = i_new(struct uring_fd, 1);
+
+	(void)ioloop_iolist_add(&(*ufdp)->list, io);
+	uring_queue_rearm(ctx, io->fd, *ufdp);
+}
+
+void io_loop_handle_remove(struct io_file *io, bool closed)
+{
+	struct ioloop_handler_context *ctx = io->io.ioloop->handler_context;
+	struct uring_fd *ufd;
+
+	if (uring_unsupported) {
+		io_loop_epoll_handle_remove(io, closed);
+		return;
+	}
+
+	ufd = array_idx_elem(&ctx->fd_index, io->fd);
+	if (ioloop_iolist_del(&ufd->list, io) || closed) {
+		/* Remove the poll immediately. It keeps the file referenced
+		   even after the fd is closed. */
+		uring_disarm(ctx, io->fd, ufd);
+	}
+	uring_queue_rearm(ctx, io->fd, ufd);
+	i_free(io);
+}
+
+/* Move the completions to ctx->events. This may also be called by
+   uring_submit() while the callbacks are running, so the completed one-shot
+   polls are queued for re-arming here. Otherwise a completion whose callback
+   isn't called in this iteration would leave the fd without a poll. */
+static void uring_reap_completions(struct ioloop_handler_context *ctx)
+{
+	const struct io_uring_cqe *cqe;
+	struct uring_fd *ufd;
+	unsigned int head, tail;
+	int fd;
+
+	head = *ctx->cq.head;
+	tail = __atomic_load_n(ctx->cq.tail, __ATOMIC_ACQUIRE);
+	for (; head != tail; head++) {
+		cqe = &ctx->cqes[head & *ctx->cq.mask];
+		if (cqe->user_data == IOLOOP_URING_USER_DATA_IGNORE)
+			continue;
+
+		fd = (cqe->user_data >> 32) - 1;
+		ufd = array_idx_elem(&ctx->fd_index, fd);
+		if ((uint32_t)cqe->user_data == ufd->generation &&
+		    ufd->armed_events != 0) {
+			/* the one-shot poll is done */
+			ufd->armed_events = 0;
+			uring_queue_rearm(ctx, fd, ufd);
+		}
+		array_push_back(&ctx->events, cqe);
+	}
+	__atomic_store_n(ctx->cq.head, head, __ATOMIC_RELEASE);
+}
+
+static void uring_handle_events(struct ioloop *ioloop)
+{
+	struct ioloop_handler_context *ctx = ioloop->handler_context;
+	const struct io_uring_cqe *cqe;
+	struct uring_fd *ufd;
+	struct io_file *io;
+	unsigned int i, j, events_count;
+	unsigned int events;
+	uint32_t generation;
+	bool call;
+	int fd;
+
+	/* The completed polls were already queued for re-arming when they
+	   were reaped, so it doesn't matter if the ioloop is stopped in the
+	   middle of calling the callbacks. */
+	events_count = array_count(&ctx->events);
+	for (i = 0; i < events_count; i++) {
+		/* io_loop_handle_add() may cause events array reallocation,
+		   so we have use array_idx() */
+		cqe = array_idx(&ctx->events, i);
+		fd = (cqe->user_data >> 32) - 1;
+		generation = (uint32_t)cqe->user_data;
+		ufd = array_idx_elem(&ctx->fd_index, fd);
+		if (ufd->generation != generation) {
+			/* poll was already removed */
+			continue;
+		}
+		if (cqe->res < 0) {
+			errno = -cqe->res;
+			i_error("io_uring poll(%d) failed: %m", fd);
+			events = POLLERR;
+		} else {
+			events = cqe->res;
+		}
+
+		for (j = 0; j < IOLOOP_IOLIST_IOS_PER_FD; j++) {
+			ufd = array_idx_elem(&ctx->fd_index, fd);
+			if (ufd->generation != generation) {
+				/* fd was removed by a callback */
+				break;
+			}
+			io = ufd->list.ios[j];
+			if (io == NULL)
+				continue;
+
+			call = FALSE;
+			if ((events & (POLLHUP | POLLERR)) != 0)
+				call = TRUE;
+			else if ((io->io.condition & IO_READ) != 0)
+				call = (events & (POLLIN | POLLPRI)) != 0;
+			else if ((io->io.condition & IO_WRITE) != 0)
+				call = (events & POLLOUT) != 0;
+			else if ((io->io.condition & IO_ERROR) != 0)
+				call = (events & IO_URING_ERROR) != 0;
+
+			if (call) {
+				io_loop_call_io(&io->io);
+				if (!ioloop->running)
+					return;
+			}
+		}
+	}
+}
+
+void io_loop_handler_run_internal(struct ioloop *ioloop)
+{
+	struct ioloop_handler_context *ctx = ioloop->handler_context;
+	struct timespec ts;
+	struct timeval tv;
+	int msecs;
+
+	if (uring_unsupported) {
+		io_loop_epoll_handler_run_internal(ioloop);
+		return;
+	}
+	i_assert(ctx != NULL);
+
+        /* get the time left for next timeout task */
+	msecs = io_loop_run_get_wait_time(ioloop, &tv);
+
+	/* submit all the poll changes with the same syscall that waits */
+	array_clear(&ctx->events);
+	uring_rearm_all(ctx);
+	if (ioloop->io_files != NULL) {
+		if (msecs >= 0) {
+			ts.tv_sec = msecs / 1000;
+			ts.tv_nsec = (msecs % 1000) * 1000000L;
+		}
+		/* don't wait if completions were already reaped while
+		   submitting the re-arms */
+		if (uring_submit(ctx, array_count(&ctx->events) > 0 ? 0 : 1,
+				 msecs < 0 ? NULL : &ts) < 0)
+			i_fatal("io_uring_enter(): %m");
+	} else {
+		/* no I/Os, but we should have some timeouts.
+		   just wait for them. */
+		i_assert(msecs >= 0);
+		if (ctx->sq_pending > 0 && uring_submit(ctx, 0, NULL) < 0)
+			i_fatal("io_uring_enter(): %m");
+		i_sleep_intr_msecs(msecs);
+	}
+	uring_reap_completions(ctx);
+
+	/* execute timeout handlers */
+        io_loop_handle_timeouts(ioloop);
+
+	if (!ioloop->running)
+		return;
+
+	uring_handle_events(ioloop);
+}
+
+#endif	/* IOLOOP_URING */
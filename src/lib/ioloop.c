@@ -23,6 +23,12 @@
    10000ms, it might think it's okay to stop after 10100ms or more. So use
    a larger value for larger timeouts. */
 #define IOLOOP_TIME_MOVED_FORWARDS_MIN_USECS_LARGE (1000000)
+/* Timeouts at least this long are kept in a timing wheel. These are
+   typically idle/inactivity timeouts that are reset on every input, so a
+   cheaper reset matters more than for short timeouts. */
+#define IOLOOP_TIMEOUT_WHEEL_MIN_MSECS 1000
+/* The timing wheel's tick is 2^6 = 64 milliseconds */
+#define IOLOOP_TIMEOUT_WHEEL_TICK_BITS 6
 
 time_t ioloop_time = 0;
 struct timeval ioloop_timeval;
@@ -268,6 +274,7 @@ timeout_add_common(struct ioloop *ioloop, const char *source_filename,
 
 	timeout = i_new(struct timeout, 1);
 	timeout->item.idx = UINT_MAX;
+	timeout->wheel_item.slot = UINT_MAX;
 	timeout->source_filename = source_filename;
 	timeout->source_linenum = source_linenum;
 	timeout->ioloop = ioloop;
@@ -283,6 +290,42 @@ timeout_add_common(struct ioloop *ioloop, const char *source_filename,
 	return timeout;
 }
 
+static uint64_t timeval_to_wheel_msecs(const struct timeval *tv)
+{
+	return (uint64_t)tv->tv_sec * 1000 + tv->tv_usec / 1000;
+}
+
+static bool timeout_is_queued(const struct timeout *timeout)
+{
+	return timeout->item.idx != UINT_MAX ||
+		timing_wheel_item_is_added(&timeout->wheel_item);
+}
+
+static void timeout_queue_add(struct timeout *timeout)
+{
+	struct ioloop *ioloop = timeout->ioloop;
+
+	/* the timing wheel is only tick-accurate, so the timeouts are moved
+	   from it to the priority queue shortly before they expire */
+	if (!timeout->one_shot &&
+	    timeout->msecs >= ioloop->timeouts_wheel_min_msecs) {
+		timing_wheel_add(ioloop->timeouts_wheel, &timeout->wheel_item,
+				 timeval_to_wheel_msecs(&timeout->next_run));
+	} else {
+		priorityq_add(ioloop->timeouts, &timeout->item);
+	}
+}
+
+static void timeout_queue_remove(struct timeout *timeout)
+{
+	if (timing_wheel_item_is_added(&timeout->wheel_item)) {
+		timing_wheel_remove(timeout->ioloop->timeouts_wheel,
+				    &timeout->wheel_item);
+	} else {
+		priorityq_remove(timeout->ioloop->timeouts, &timeout->item);
+	}
+}
+
 #undef timeout_add_to
 struct timeout *timeout_add_to(struct ioloop *ioloop, unsigned int msecs,
 			       const char *source_filename,
@@ -382,8 +425,8 @@ timeout_copy(const struct timeout *old_to, struct ioloop *ioloop)
 	new_to->msecs = old_to->msecs;
 	new_to->next_run = old_to->next_run;
 
-	if (old_to->item.idx != UINT_MAX)
-		priorityq_add(new_to->ioloop->timeouts, &new_to->item);
+	if (timeout_is_queued(old_to))
+		timeout_queue_add(new_to);
 	else if (!new_to->one_shot) {
 		i_assert(new_to->msecs > 0);
 		array_push_back(&new_to->ioloop->timeouts_new, &new_to);
@@ -410,8 +453,8 @@ void timeout_remove(struct timeout **_timeout)
 	ioloop = timeout->ioloop;
 
 	*_timeout = NULL;
-	if (timeout->item.idx != UINT_MAX)
-		priorityq_remove(timeout->ioloop->timeouts, &timeout->item);
+	if (timeout_is_queued(timeout))
+		timeout_queue_remove(timeout);
 	else if (!timeout->one_shot && timeout->msecs > 0) {
 		unsigned int idx;
 
@@ -425,7 +468,7 @@ void timeout_remove(struct timeout **_timeout)
 static void ATTR_NULL(2)
 timeout_reset_timeval(struct timeout *timeout, struct timeval *tv_now)
 {
-	if (timeout->item.idx == UINT_MAX)
+	if (!timeout_is_queued(timeout))
 		return;
 
 	timeout_update_next(timeout, tv_now);
@@ -442,8 +485,8 @@ timeout_reset_timeval(struct timeout *timeout, struct timeval *tv_now)
 		timeout->next_run = *tv_now;
 		timeval_add_usecs(&timeout->next_run, 1);
 	}
-	priorityq_remove(timeout->ioloop->timeouts, &timeout->item);
-	priorityq_add(timeout->ioloop->timeouts, &timeout->item);
+	timeout_queue_remove(timeout);
+	timeout_queue_add(timeout);
 }
 
 void timeout_reset(struct timeout *timeout)
@@ -452,7 +495,8 @@ void timeout_reset(struct timeout *timeout)
 	timeout_reset_timeval(timeout, NULL);
 }
 
-static int timeout_get_wait_time(struct timeout *timeout, struct timeval *tv_r,
+static int timeout_get_wait_time(const struct timeval *next_run,
+				 struct timeval *tv_r,
 				 struct timeval *tv_now, bool in_timeout_loop)
 {
 	int ret;
@@ -463,10 +507,10 @@ static int timeout_get_wait_time(struct timeout *timeout, struct timeval *tv_r,
 	tv_r->tv_usec = tv_now->tv_usec;
 
 	i_assert(tv_r->tv_sec > 0);
-	i_assert(timeout->next_run.tv_sec > 0);
+	i_assert(next_run->tv_sec > 0);
 
-	tv_r->tv_sec = timeout->next_run.tv_sec - tv_r->tv_sec;
-	tv_r->tv_usec = timeout->next_run.tv_usec - tv_r->tv_usec;
+	tv_r->tv_sec = next_run->tv_sec - tv_r->tv_sec;
+	tv_r->tv_usec = next_run->tv_usec - tv_r->tv_usec;
 	if (tv_r->tv_usec < 0) {
 		tv_r->tv_sec--;
 		tv_r->tv_usec += 1000000;
@@ -493,20 +537,45 @@ static int timeout_get_wait_time(struct timeout *timeout, struct timeval *tv_r,
 	return ret;
 }
 
+/* Get the time when the next timeout may need to be handled. timeout_r is
+   set to NULL if this is when the timing wheel needs to be processed. */
+static bool
+io_loop_get_next_run(struct ioloop *ioloop, struct timeval *next_run_r,
+		     struct timeout **timeout_r)
+{
+	struct timeout *timeout;
+	struct timeval wheel_tv;
+	uint64_t wheel_msecs;
+
+	timeout = (struct timeout *)priorityq_peek(ioloop->timeouts);
+	if (timeout != NULL)
+		*next_run_r = timeout->next_run;
+	*timeout_r = timeout;
+
+	if (!timing_wheel_get_next_msecs(ioloop->timeouts_wheel, &wheel_msecs))
+		return timeout != NULL;
+	wheel_tv.tv_sec = wheel_msecs / 1000;
+	wheel_tv.tv_usec = (wheel_msecs % 1000) * 1000;
+	if (timeout == NULL || timeval_cmp(&wheel_tv, next_run_r) < 0) {
+		*next_run_r = wheel_tv;
+		*timeout_r = NULL;
+	}
+	return TRUE;
+}
+
 static int io_loop_get_wait_time(struct ioloop *ioloop, struct timeval *tv_r)
 {
-	struct timeval tv_now;
-	struct priorityq_item *item;
+	struct timeval tv_now, next_run;
 	struct timeout *timeout;
+	bool have_timeouts;
 	int msecs;
 
-	item = priorityq_peek(ioloop->timeouts);
-	timeout = (struct timeout *)item;
+	have_timeouts = io_loop_get_next_run(ioloop, &next_run, &timeout);
 
 	/* we need to see if there are pending IO waiting,
 	   if there is, we set msecs = 0 to ensure they are
 	   processed without delay */
-	if (timeout == NULL && ioloop->io_pending_count == 0) {
+	if (!have_timeouts && ioloop->io_pending_count == 0) {
 		/* no timeouts. use INT_MAX msecs for timeval and
 		   return -1 for poll/epoll infinity. */
 		tv_r->tv_sec = INT_MAX / 1000;
@@ -523,7 +592,7 @@ static int io_loop_get_wait_time(struct ioloop *ioloop, struct timeval *tv_r)
 		tv_r->tv_usec = 0;
 	} else {
 		tv_now.tv_sec = 0;
-		msecs = timeout_get_wait_time(timeout, tv_r, &tv_now, FALSE);
+		msecs = timeout_get_wait_time(&next_run, tv_r, &tv_now, FALSE);
 	}
 	ioloop->next_max_time = tv_now;
 	timeval_add_msecs(&ioloop->next_max_time, msecs);
@@ -533,7 +602,8 @@ static int io_loop_get_wait_time(struct ioloop *ioloop, struct timeval *tv_r)
 	   ioloop and after that we update ioloop_timeval immediately again. */
 	ioloop_timeval = tv_now;
 	ioloop_time = tv_now.tv_sec;
-	i_assert(msecs == 0 || timeout->msecs > 0 || timeout->one_shot);
+	i_assert(msecs == 0 || timeout == NULL ||
+		 timeout->msecs > 0 || timeout->one_shot);
 	return msecs;
 }
 
@@ -589,16 +659,33 @@ static void io_loop_timeouts_start_new(struct ioloop *ioloop)
 		i_assert(!timeout->one_shot);
 		i_assert(timeout->msecs > 0);
 		timeout_update_next(timeout, &ioloop_timeval);
-		priorityq_add(ioloop->timeouts, &timeout->item);
+		timeout_queue_add(timeout);
 	}
 	array_clear(&ioloop->timeouts_new);
 }
 
+static void io_loop_timeouts_wheel_flush(struct ioloop *ioloop)
+{
+	struct timing_wheel_item *item;
+
+	while ((item = timing_wheel_pop_any(ioloop->timeouts_wheel)) != NULL) {
+		struct timeout *to =
+			container_of(item, struct timeout, wheel_item);
+		priorityq_add(ioloop->timeouts, &to->item);
+	}
+}
+
 static void io_loop_timeouts_update(struct ioloop *ioloop, long long diff_usecs)
 {
 	struct priorityq_item *const *items;
 	unsigned int i, count;
 
+	/* The timing wheel can't handle time jumps. Move its timeouts to the
+	   priority queue - they get back to the wheel when they're reset. */
+	io_loop_timeouts_wheel_flush(ioloop);
+	timing_wheel_set_time(ioloop->timeouts_wheel,
+			      timeval_to_wheel_msecs(&ioloop_timeval));
+
 	count = priorityq_count(ioloop->timeouts);
 	items = priorityq_items(ioloop->timeouts);
 	for (i = 0; i < count; i++) {
@@ -639,6 +726,7 @@ static void ioloop_add_wait_time(struct ioloop *ioloop)
 
 static void io_loop_handle_timeouts_real(struct ioloop *ioloop)
 {
+	struct timing_wheel_item *wheel_item;
 	struct priorityq_item *item;
 	struct timeval tv_old, tv, tv_call;
 	long long diff_usecs;
@@ -675,13 +763,23 @@ static void io_loop_handle_timeouts_real(struct ioloop *ioloop)
 	ioloop_time = ioloop_timeval.tv_sec;
 	tv_call = ioloop_timeval;
 
+	/* move the timeouts that expire soon from the timing wheel to the
+	   priority queue, which handles the exact expiration times */
+	while ((wheel_item = timing_wheel_pop_expired(ioloop->timeouts_wheel,
+			timeval_to_wheel_msecs(&tv_call))) != NULL) {
+		struct timeout *timeout =
+			container_of(wheel_item, struct timeout, wheel_item);
+		priorityq_add(ioloop->timeouts, &timeout->item);
+	}
+
 	while (ioloop->running &&
 	       (item = priorityq_peek(ioloop->timeouts)) != NULL) {
 		struct timeout *timeout = (struct timeout *)item;
 
 		/* use tv_call to make sure we don't get to infinite loop in
 		   case callbacks update ioloop_timeval. */
-		if (timeout_get_wait_time(timeout, &tv, &tv_call, TRUE) > 0)
+		if (timeout_get_wait_time(&timeout->next_run, &tv,
+					  &tv_call, TRUE) > 0)
 			break;
 
 		if (timeout->one_shot) {
@@ -847,6 +945,10 @@ struct ioloop *io_loop_create(void)
 
         ioloop = i_new(struct ioloop, 1);
 	ioloop->timeouts = priorityq_init(timeout_cmp, 32);
+	ioloop->timeouts_wheel =
+		timing_wheel_init(IOLOOP_TIMEOUT_WHEEL_TICK_BITS,
+				  timeval_to_wheel_msecs(&ioloop_timeval));
+	ioloop->timeouts_wheel_min_msecs = IOLOOP_TIMEOUT_WHEEL_MIN_MSECS;
 	i_array_init(&ioloop->timeouts_new, 8);
 
 	ioloop->time_moved_callback = current_ioloop != NULL ?
@@ -914,6 +1016,8 @@ void io_loop_destroy(struct ioloop **_ioloop)
 	}
 	array_free(&ioloop->timeouts_new);
 
+	io_loop_timeouts_wheel_flush(ioloop);
+	timing_wheel_deinit(&ioloop->timeouts_wheel);
 	while ((item = priorityq_pop(ioloop->timeouts)) != NULL) {
 		struct timeout *to = (struct timeout *)item;
 		const char *error = t_strdup_printf(
@@ -1297,6 +1401,7 @@ bool io_loop_is_empty(struct ioloop *ioloop)
 {
 	return ioloop->io_files == NULL &&
 		priorityq_count(ioloop->timeouts) == 0 &&
+		timing_wheel_count(ioloop->timeouts_wheel) == 0 &&
 		array_count(&ioloop->timeouts_new) == 0;
 }
 
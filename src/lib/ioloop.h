@@ -321,7 +321,7 @@ uint64_t io_loop_get_wait_usecs(struct ioloop *ioloop);
    all the file ios in the ioloop. */
 enum io_condition io_loop_find_fd_conditions(struct ioloop *ioloop, int fd);
 
-#ifdef IOLOOP_KQUEUE
+#if defined(IOLOOP_KQUEUE) || defined(IOLOOP_URING)
 void io_loop_recreate(struct ioloop *ioloop);
 #else
 #  define io_loop_recreate(x)
@@ -22,8 +22,21 @@ struct iostream_private {
 				    size_t max_size);
 
 	ARRAY(struct iostream_destroy_callback) destroy_callbacks;
+
+	/* The stream struct was allocated with io_stream_new() */
+	bool slab_allocated:1;
 };
 
+/* Allocate memory for a new stream struct from a slab pool shared by all the
+   streams. The struct must begin with struct iostream_private. The memory is
+   freed by io_stream_free(). Streams allocated with i_new() are still freed
+   correctly. The pool isn't thread-safe, so streams must be created and
+   freed only in the thread that created the first one, normally the main
+   thread. This is asserted. */
+void *io_stream_malloc(size_t size) ATTR_MALLOC ATTR_RETURNS_NONNULL;
+#define io_stream_new(type) \
+	((type *)io_stream_malloc(sizeof(type)))
+
 void io_stream_init(struct iostream_private *stream);
 void io_stream_ref(struct iostream_private *stream);
 bool io_stream_unref(struct iostream_private *stream);
@@ -315,7 +315,7 @@ struct ostream *iostream_temp_create_sized(const char *temp_path_prefix,
 	struct temp_ostream *tstream;
 	struct ostream *output;
 
-	tstream = i_new(struct temp_ostream, 1);
+	tstream = io_stream_new(struct temp_ostream);
 	tstream->ostream.ostream.blocking = TRUE;
 	tstream->ostream.sendv = o_stream_temp_sendv;
 	tstream->ostream.send_istream = o_stream_temp_send_istream;
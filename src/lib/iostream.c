@@ -6,6 +6,43 @@
 #include "ostream.h"
 #include "iostream-private.h"
 
+/* Stream structs are allocated and freed all the time, so they're kept in
+   a process-wide slab pool. It's not protected by any locks, which is fine
+   since streams are used only by the main thread. The pool asserts that. */
+static pool_t iostream_pool = NULL;
+
+static void io_stream_pool_deinit(void)
+{
+	struct pool_slab_stats stats;
+
+	if (iostream_pool == NULL)
+		return;
+	/* leaked streams are still using the pool */
+	pool_slab_get_stats(iostream_pool, &stats);
+	if (stats.used_size == 0)
+		pool_unref(&iostream_pool);
+}
+
+void *io_stream_malloc(size_t size)
+{
+	static bool atexit_added = FALSE;
+	struct iostream_private *stream;
+
+	i_assert(size >= sizeof(*stream));
+
+	if (iostream_pool == NULL) {
+		iostream_pool = pool_slab_create("iostreams");
+		if (!atexit_added) {
+			lib_atexit_priority(io_stream_pool_deinit,
+					    LIB_ATEXIT_PRIORITY_LOW);
+			atexit_added = TRUE;
+		}
+	}
+	stream = p_malloc(iostream_pool, size);
+	stream->slab_allocated = TRUE;
+	return stream;
+}
+
 static void
 io_stream_default_close(struct iostream_private *stream ATTR_UNUSED,
 			bool close_parent ATTR_UNUSED)
@@ -58,7 +95,10 @@ void io_stream_free(struct iostream_private *stream)
 
         i_free(stream->error);
         i_free(stream->name);
-        i_free(stream);
+	if (stream->slab_allocated)
+		p_free(iostream_pool, stream);
+	else
+		i_free(stream);
 }
 
 void io_stream_close(struct iostream_private *stream, bool close_parent)
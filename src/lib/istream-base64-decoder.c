@@ -142,7 +142,7 @@ i_stream_create_base64_decoder_common(const struct base64_scheme *b64,
 {
 	struct base64_decoder_istream *bstream;
 
-	bstream = i_new(struct base64_decoder_istream, 1);
+	bstream = io_stream_new(struct base64_decoder_istream);
 	bstream->istream.max_buffer_size = input->real_stream->max_buffer_size;
 
 	bstream->istream.read = i_stream_base64_decoder_read;
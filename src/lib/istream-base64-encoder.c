@@ -190,7 +190,7 @@ i_stream_create_base64_encoder_common(const struct base64_scheme *b64,
 
 	i_assert(chars_per_line % 4 == 0);
 
-	bstream = i_new(struct base64_encoder_istream, 1);
+	bstream = io_stream_new(struct base64_encoder_istream);
 	bstream->istream.max_buffer_size = input->real_stream->max_buffer_size;
 
 	bstream->istream.read = i_stream_base64_encoder_read;
@@ -73,7 +73,7 @@ i_stream_create_callback(istream_callback_read_t *callback, void *context)
 
 	i_assert(callback != NULL);
 
-	cstream = i_new(struct callback_istream, 1);
+	cstream = io_stream_new(struct callback_istream);
 	cstream->callback = callback;
 	cstream->context = context;
 	cstream->buf = buffer_create_dynamic(default_pool, 1024);
@@ -328,7 +328,7 @@ struct istream *i_stream_create_chain(struct istream_chain **chain_r,
 {
 	struct chain_istream *cstream;
 
-	cstream = i_new(struct chain_istream, 1);
+	cstream = io_stream_new(struct chain_istream);
 	cstream->chain.stream = cstream;
 	cstream->istream.max_buffer_size = max_buffer_size;
 
@@ -375,7 +375,7 @@ struct istream *i_stream_create_concat(struct istream *input[])
 	if (max_buffer_size < I_STREAM_MIN_SIZE)
 		max_buffer_size = I_STREAM_MIN_SIZE;
 
-	cstream = i_new(struct concat_istream, 1);
+	cstream = io_stream_new(struct concat_istream);
 	cstream->input_count = count;
 	cstream->input = p_memdup(default_pool, input, sizeof(*input) * count);
 	cstream->input_size = i_new(uoff_t, count);
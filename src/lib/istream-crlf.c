@@ -185,7 +185,7 @@ i_stream_create_crlf_full(struct istream *input, bool crlf)
 {
 	struct crlf_istream *cstream;
 
-	cstream = i_new(struct crlf_istream, 1);
+	cstream = io_stream_new(struct crlf_istream);
 	cstream->istream.max_buffer_size = input->real_stream->max_buffer_size;
 	cstream->istream.read = crlf ? i_stream_crlf_read_crlf :
 		i_stream_crlf_read_lf;
@@ -70,7 +70,7 @@ i_stream_create_failure_at(struct istream *input, uoff_t failure_offset,
 {
 	struct failure_at_istream *fstream;
 
-	fstream = i_new(struct failure_at_istream, 1);
+	fstream = io_stream_new(struct failure_at_istream);
 	fstream->istream.max_buffer_size = input->real_stream->max_buffer_size;
 	fstream->istream.stream_size_passthrough = TRUE;
 
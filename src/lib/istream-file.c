@@ -250,7 +250,7 @@ struct istream *i_stream_create_fd(int fd, size_t max_buffer_size)
 
 	i_assert(fd != -1);
 
-	fstream = i_new(struct file_istream, 1);
+	fstream = io_stream_new(struct file_istream);
 	return i_stream_create_file_common(fstream, fd, NULL,
 					   max_buffer_size, FALSE);
 }
@@ -262,7 +262,7 @@ struct istream *i_stream_create_fd_autoclose(int *fd, size_t max_buffer_size)
 
 	i_assert(*fd != -1);
 
-	fstream = i_new(struct file_istream, 1);
+	fstream = io_stream_new(struct file_istream);
 	input = i_stream_create_file_common(fstream, *fd, NULL,
 					   max_buffer_size, TRUE);
 	*fd = -1;
@@ -274,7 +274,7 @@ struct istream *i_stream_create_file(const char *path, size_t max_buffer_size)
 	struct file_istream *fstream;
 	struct istream *input;
 
-	fstream = i_new(struct file_istream, 1);
+	fstream = io_stream_new(struct file_istream);
 	input = i_stream_create_file_common(fstream, -1, path,
 					    max_buffer_size, TRUE);
 	i_stream_set_name(input, path);
@@ -69,7 +69,7 @@ i_stream_create_hash(struct istream *input, const struct hash_method *method,
 {
 	struct hash_istream *hstream;
 
-	hstream = i_new(struct hash_istream, 1);
+	hstream = io_stream_new(struct hash_istream);
 	hstream->istream.max_buffer_size = input->real_stream->max_buffer_size;
 	hstream->istream.stream_size_passthrough = TRUE;
 
@@ -115,7 +115,7 @@ struct istream *i_stream_create_limit(struct istream *input, uoff_t v_size)
 {
 	struct limit_istream *lstream;
 
-	lstream = i_new(struct limit_istream, 1);
+	lstream = io_stream_new(struct limit_istream);
 	lstream->v_size = v_size;
 	lstream->istream.max_buffer_size = input->real_stream->max_buffer_size;
 
@@ -64,7 +64,7 @@ struct istream *i_stream_create_nonuls(struct istream *input, char replace_chr)
 {
 	struct nonuls_istream *nstream;
 
-	nstream = i_new(struct nonuls_istream, 1);
+	nstream = io_stream_new(struct nonuls_istream);
 	nstream->istream.max_buffer_size = input->real_stream->max_buffer_size;
 	nstream->istream.stream_size_passthrough = TRUE;
 
@@ -30,7 +30,7 @@ i_stream_create_noop(struct istream *input)
 {
 	struct noop_istream *nstream;
 
-	nstream = i_new(struct noop_istream, 1);
+	nstream = io_stream_new(struct noop_istream);
 	nstream->istream.max_buffer_size = input->real_stream->max_buffer_size;
 	nstream->istream.stream_size_passthrough = TRUE;
 
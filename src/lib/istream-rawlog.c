@@ -102,7 +102,7 @@ i_stream_create_rawlog_from_stream(struct istream *input,
 {
 	struct rawlog_istream *rstream;
 
-	rstream = i_new(struct rawlog_istream, 1);
+	rstream = io_stream_new(struct rawlog_istream);
 	rstream->istream.max_buffer_size = input->real_stream->max_buffer_size;
 	rstream->istream.stream_size_passthrough = TRUE;
 
@@ -478,7 +478,7 @@ i_streams_merge(struct istream *input[], size_t max_buffer_size,
 	}
 	i_assert(count != 0);
 
-	sstream = i_new(struct seekable_istream, 1);
+	sstream = io_stream_new(struct seekable_istream);
 	sstream->fd_callback = fd_callback;
 	sstream->context = context;
         sstream->istream.max_buffer_size = max_buffer_size;
@@ -156,7 +156,7 @@ i_stream_create_sized_common(struct istream *input, uoff_t size)
 {
 	struct sized_istream *sstream;
 
-	sstream = i_new(struct sized_istream, 1);
+	sstream = io_stream_new(struct sized_istream);
 	sstream->size = size;
 	sstream->istream.max_buffer_size = input->real_stream->max_buffer_size;
 
@@ -224,7 +224,7 @@ struct istream *tee_i_stream_create_child(struct tee_istream *tee)
 	struct tee_child_istream *tstream;
 	struct istream *ret, *input = tee->input;
 
-	tstream = i_new(struct tee_child_istream, 1);
+	tstream = io_stream_new(struct tee_child_istream);
 	tstream->tee = tee;
 
 	tstream->istream.max_buffer_size = input->real_stream->max_buffer_size;
@@ -132,7 +132,7 @@ i_stream_create_timeout(struct istream *input, unsigned int timeout_msecs)
 {
 	struct timeout_istream *tstream;
 
-	tstream = i_new(struct timeout_istream, 1);
+	tstream = io_stream_new(struct timeout_istream);
 	tstream->timeout_msecs = timeout_msecs;
 	tstream->istream.max_buffer_size = input->real_stream->max_buffer_size;
 	tstream->istream.stream_size_passthrough = TRUE;
@@ -147,7 +147,7 @@ struct istream *istream_try_create(struct istream *const input[],
 	}
 	i_assert(count != 0);
 
-	tstream = i_new(struct try_istream, 1);
+	tstream = io_stream_new(struct try_istream);
 	tstream->min_buffer_full_size = min_buffer_full_size;
 	tstream->try_input_count = count;
 	tstream->try_input = p_memdup(default_pool, input,
@@ -73,7 +73,7 @@ struct istream *i_stream_create_unix(int fd, size_t max_buffer_size)
 
 	i_assert(fd != -1);
 
-	ustream = i_new(struct unix_istream, 1);
+	ustream = io_stream_new(struct unix_istream);
 	ustream->read_fd = -1;
 	input = i_stream_create_file_common(&ustream->fstream, fd, NULL,
 					    max_buffer_size, FALSE);
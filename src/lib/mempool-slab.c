@@ -0,0 +1,535 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+/* @UNSAFE: whole file */
+#include "lib.h"
+#include "llist.h"
+#include "hash.h"
+#include "mempool.h"
+
+/*
+ * Slab pools keep freed memory in per-size-class free lists, so that
+ * long-lived processes which keep allocating and freeing objects of the
+ * same sizes (e.g. stream structs) don't need to go through
+ * malloc() for each of them, and so that these objects are packed together
+ * instead of fragmenting the heap.
+ *
+ * Implementation
+ * ==============
+ *
+ * The allocation size is rounded up to the nearest size class. Each size
+ * class (struct slab_class) has a list of chunks (struct slab_chunk). A
+ * chunk is a SLAB_CHUNK_SIZE sized and aligned block of memory, which
+ * starts with the chunk header followed by the objects:
+ *
+ * +-------------+--------+--------+--------+-----+
+ * | slab chunk  | object | object | object | ... |
+ * +-------------+--------+--------+--------+-----+
+ *
+ * Because the chunks are aligned, the chunk of an object is found by
+ * masking the low bits of its address. All the chunks are also kept in a
+ * hash table, so that the pool can safely check whether any pointer
+ * belongs to it without dereferencing it (see pool_slab_contains()).
+ *
+ * Allocation & Freeing
+ * --------------------
+ *
+ * Each chunk has a free list of its freed objects. If it's empty, the next
+ * never used object at the end of the chunk is used. Chunks that have free
+ * objects are kept in the class's partial_chunks list and full chunks in
+ * its full_chunks list. Allocations come from the first partial chunk, so
+ * the same chunks keep getting reused.
+ *
+ * When the last object in a chunk is freed, the chunk is kept as the
+ * class's empty_chunk, unless there already is one, in which case the chunk
+ * is freed. This way the pool shrinks when its usage drops, but it doesn't
+ * keep allocating and freeing a chunk when a single object is allocated and
+ * freed repeatedly.
+ *
+ * Allocations larger than the largest size class are allocated directly
+ * with calloc(). They are kept in their own hash table.
+ *
+ * Reallocation
+ * ------------
+ *
+ * If the new size fits into the same size class, the same object is
+ * returned. Otherwise a new object is allocated and the data is copied.
+ *
+ * Clearing
+ * --------
+ *
+ * Clearing frees all the chunks and the large allocations.
+ *
+ * Destruction
+ * -----------
+ *
+ * Destroying a pool first clears it and then frees the pool structure.
+ *
+ * Threads
+ * =======
+ *
+ * The pool has no locking. It may be used only by the thread that created
+ * it, which is asserted on each allocation and free. The thread is
+ * identified by the address of a thread-local variable, so this works
+ * without linking to the pthread library.
+ */
+
+#define SLAB_CHUNK_SIZE (64*1024)
+
+/* Each thread has its own copy, so its address identifies the thread */
+static _Thread_local char slab_thread_marker;
+#define SLAB_POOL_ASSERT_OWNER_THREAD(spool) \
+	i_assert((spool)->owner_thread == &slab_thread_marker)
+
+static const size_t slab_object_sizes[] = {
+	16, 32, 48, 64, 96, 128, 160, 192, 256, 320, 384, 448, 512,
+	640, 768, 1024, 1280, 1536, 2048
+};
+#define SLAB_CLASS_COUNT N_ELEMENTS(slab_object_sizes)
+
+struct slab_class {
+	size_t object_size;
+	unsigned int objects_per_chunk;
+	unsigned int chunk_count, used_count;
+
+	struct slab_chunk *partial_chunks, *full_chunks;
+	struct slab_chunk *empty_chunk;
+};
+
+struct slab_chunk {
+	struct slab_chunk *prev, *next;
+	struct slab_class *class;
+
+	/* linked list of freed objects */
+	void *free_list;
+	unsigned int used_count;
+	/* objects starting from this index have never been allocated */
+	unsigned int unused_idx;
+};
+
+struct slab_pool {
+	struct pool pool;
+	int refcount;
+
+	struct slab_class classes[SLAB_CLASS_COUNT];
+	HASH_TABLE(struct slab_chunk *, struct slab_chunk *) chunks;
+	/* large allocation => its size */
+	HASH_TABLE(void *, void *) large_blocks;
+	size_t large_used;
+	/* &slab_thread_marker of the thread that created the pool */
+	const char *owner_thread;
+#ifdef DEBUG
+	char *name;
+#endif
+};
+
+#define SIZEOF_SLAB_CHUNK MEM_ALIGN(sizeof(struct slab_chunk))
+#define SLAB_CHUNK_OBJECTS(chunk) PTR_OFFSET(chunk, SIZEOF_SLAB_CHUNK)
+#define SLAB_CHUNK_OF(mem) \
+	((struct slab_chunk *)((uintptr_t)(mem) & ~(uintptr_t)(SLAB_CHUNK_SIZE-1)))
+
+static const char *pool_slab_get_name(pool_t pool);
+static void pool_slab_ref(pool_t pool);
+static void pool_slab_unref(pool_t *pool);
+static void *pool_slab_malloc(pool_t pool, size_t size);
+static void pool_slab_free(pool_t pool, void *mem);
+static void *pool_slab_realloc(pool_t pool, void *mem,
+			       size_t old_size, size_t new_size);
+static void pool_slab_clear(pool_t pool);
+static size_t pool_slab_get_max_easy_alloc_size(pool_t pool);
+
+static const struct pool_vfuncs static_slab_pool_vfuncs = {
+	pool_slab_get_name,
+
+	pool_slab_ref,
+	pool_slab_unref,
+
+	pool_slab_malloc,
+	pool_slab_free,
+
+	pool_slab_realloc,
+
+	pool_slab_clear,
+	pool_slab_get_max_easy_alloc_size
+};
+
+static const struct pool static_slab_pool = {
+	.v = &static_slab_pool_vfuncs,
+
+	.alloconly_pool = FALSE,
+	.datastack_pool = FALSE
+};
+
+pool_t pool_slab_create(const char *name ATTR_UNUSED)
+{
+	struct slab_pool *spool;
+	unsigned int i;
+
+	spool = calloc(1, sizeof(*spool));
+	if (spool == NULL)
+		i_fatal_status(FATAL_OUTOFMEM, "calloc(1, %zu): Out of memory",
+			       sizeof(*spool));
+#ifdef DEBUG
+	spool->name = strdup(name);
+#endif
+	spool->pool = static_slab_pool;
+	spool->refcount = 1;
+	spool->owner_thread = &slab_thread_marker;
+	for (i = 0; i < SLAB_CLASS_COUNT; i++) {
+		spool->classes[i].object_size = slab_object_sizes[i];
+		spool->classes[i].objects_per_chunk =
+			(SLAB_CHUNK_SIZE - SIZEOF_SLAB_CHUNK) /
+			slab_object_sizes[i];
+	}
+	hash_table_create_direct(&spool->chunks, default_pool, 0);
+	hash_table_create_direct(&spool->large_blocks, default_pool, 0);
+	return &spool->pool;
+}
+
+static void pool_slab_destroy(struct slab_pool *spool)
+{
+	pool_slab_clear(&spool->pool);
+	hash_table_destroy(&spool->chunks);
+	hash_table_destroy(&spool->large_blocks);
+#ifdef DEBUG
+	free(spool->name);
+#endif
+	free(spool);
+}
+
+static const char *pool_slab_get_name(pool_t pool ATTR_UNUSED)
+{
+#ifdef DEBUG
+	struct slab_pool *spool = container_of(pool, struct slab_pool, pool);
+	return spool->name;
+#else
+	return "slab";
+#endif
+}
+
+static void pool_slab_ref(pool_t pool)
+{
+	struct slab_pool *spool = container_of(pool, struct slab_pool, pool);
+	i_assert(spool->refcount > 0);
+
+	spool->refcount++;
+}
+
+static void pool_slab_unref(pool_t *_pool)
+{
+	pool_t pool = *_pool;
+	struct slab_pool *spool = container_of(pool, struct slab_pool, pool);
+	i_assert(spool->refcount > 0);
+
+	/* erase the pointer before freeing anything, as the pointer may
+	   exist inside the pool's memory area */
+	*_pool = NULL;
+
+	if (--spool->refcount > 0)
+		return;
+
+	pool_slab_destroy(spool);
+}
+
+static struct slab_class *
+pool_slab_get_class(struct slab_pool *spool, size_t size)
+{
+	unsigned int i;
+
+	for (i = 0; i < SLAB_CLASS_COUNT; i++) {
+		if (size <= slab_object_sizes[i])
+			return &spool->classes[i];
+	}
+	return NULL;
+}
+
+static struct slab_chunk *
+pool_slab_find_chunk(struct slab_pool *spool, const void *mem)
+{
+	struct slab_chunk *chunk = SLAB_CHUNK_OF(mem);
+
+	return hash_table_lookup(spool->chunks, chunk);
+}
+
+static struct slab_chunk *
+pool_slab_chunk_alloc(struct slab_pool *spool, struct slab_class *class)
+{
+	struct slab_chunk *chunk;
+	void *mem;
+	int ret;
+
+	if (class->empty_chunk != NULL) {
+		chunk = class->empty_chunk;
+		class->empty_chunk = NULL;
+		return chunk;
+	}
+
+	if ((ret = posix_memalign(&mem, SLAB_CHUNK_SIZE, SLAB_CHUNK_SIZE)) != 0) {
+		errno = ret;
+		i_fatal_status(FATAL_OUTOFMEM,
+			       "posix_memalign(%d) failed: %m", SLAB_CHUNK_SIZE);
+	}
+	chunk = mem;
+	i_zero(chunk);
+	chunk->class = class;
+	class->chunk_count++;
+	hash_table_insert(spool->chunks, chunk, chunk);
+	return chunk;
+}
+
+static void
+pool_slab_chunk_free(struct slab_pool *spool, struct slab_chunk *chunk)
+{
+	i_assert(chunk->class->chunk_count > 0);
+
+	chunk->class->chunk_count--;
+	hash_table_remove(spool->chunks, chunk);
+	free(chunk);
+}
+
+static void *
+pool_slab_class_alloc(struct slab_pool *spool, struct slab_class *class)
+{
+	struct slab_chunk *chunk;
+	void *mem;
+
+	chunk = class->partial_chunks;
+	if (chunk == NULL) {
+		chunk = pool_slab_chunk_alloc(spool, class);
+		DLLIST_PREPEND(&class->partial_chunks, chunk);
+	}
+
+	if (chunk->free_list != NULL) {
+		mem = chunk->free_list;
+		chunk->free_list = *(void **)mem;
+	} else {
+		i_assert(chunk->unused_idx < class->objects_per_chunk);
+		mem = PTR_OFFSET(SLAB_CHUNK_OBJECTS(chunk),
+				 chunk->unused_idx * class->object_size);
+		chunk->unused_idx++;
+	}
+	chunk->used_count++;
+	class->used_count++;
+
+	if (chunk->used_count == class->objects_per_chunk) {
+		DLLIST_REMOVE(&class->partial_chunks, chunk);
+		DLLIST_PREPEND(&class->full_chunks, chunk);
+	}
+	memset(mem, 0, class->object_size);
+	return mem;
+}
+
+static void
+pool_slab_class_free(struct slab_pool *spool, struct slab_chunk *chunk,
+		     void *mem)
+{
+	struct slab_class *class = chunk->class;
+
+	i_assert(chunk->used_count > 0);
+	i_assert(((char *)mem - (char *)SLAB_CHUNK_OBJECTS(chunk)) %
+		 class->object_size == 0);
+
+	if (chunk->used_count == class->objects_per_chunk) {
+		DLLIST_REMOVE(&class->full_chunks, chunk);
+		DLLIST_PREPEND(&class->partial_chunks, chunk);
+	}
+	*(void **)mem = chunk->free_list;
+	chunk->free_list = mem;
+	chunk->used_count--;
+	class->used_count--;
+
+	if (chunk->used_count == 0) {
+		DLLIST_REMOVE(&class->partial_chunks, chunk);
+		chunk->free_list = NULL;
+		chunk->unused_idx = 0;
+		chunk->prev = chunk->next = NULL;
+		if (class->empty_chunk == NULL)
+			class->empty_chunk = chunk;
+		else
+			pool_slab_chunk_free(spool, chunk);
+	}
+}
+
+static void *pool_slab_large_alloc(struct slab_pool *spool, size_t size)
+{
+	void *mem;
+
+	mem = calloc(1, size);
+	if (mem == NULL)
+		i_fatal_status(FATAL_OUTOFMEM, "calloc(1, %zu): Out of memory",
+			       size);
+	hash_table_insert(spool->large_blocks, mem, POINTER_CAST(size));
+	spool->large_used += size;
+	return mem;
+}
+
+static size_t pool_slab_large_detach(struct slab_pool *spool, void *mem)
+{
+	size_t size;
+
+	size = POINTER_CAST_TO(hash_table_lookup(spool->large_blocks, mem),
+			       size_t);
+	if (size == 0)
+		i_panic("pool_slab: Freeing memory not allocated from the pool");
+	hash_table_remove(spool->large_blocks, mem);
+	i_assert(spool->large_used >= size);
+	spool->large_used -= size;
+	return size;
+}
+
+static void *pool_slab_malloc(pool_t pool, size_t size)
+{
+	struct slab_pool *spool = container_of(pool, struct slab_pool, pool);
+	struct slab_class *class;
+
+	SLAB_POOL_ASSERT_OWNER_THREAD(spool);
+	class = pool_slab_get_class(spool, size);
+	if (class == NULL)
+		return pool_slab_large_alloc(spool, size);
+	return pool_slab_class_alloc(spool, class);
+}
+
+static void pool_slab_free(pool_t pool, void *mem)
+{
+	struct slab_pool *spool = container_of(pool, struct slab_pool, pool);
+	struct slab_chunk *chunk;
+
+	SLAB_POOL_ASSERT_OWNER_THREAD(spool);
+	chunk = pool_slab_find_chunk(spool, mem);
+	if (chunk != NULL)
+		pool_slab_class_free(spool, chunk, mem);
+	else {
+		(void)pool_slab_large_detach(spool, mem);
+		free(mem);
+	}
+}
+
+static void *pool_slab_realloc(pool_t pool, void *mem,
+			       size_t old_size, size_t new_size)
+{
+	struct slab_pool *spool = container_of(pool, struct slab_pool, pool);
+	struct slab_chunk *chunk;
+	void *new_mem;
+	size_t size, object_size;
+
+	SLAB_POOL_ASSERT_OWNER_THREAD(spool);
+	chunk = pool_slab_find_chunk(spool, mem);
+	if (chunk == NULL) {
+		size = pool_slab_large_detach(spool, mem);
+		if (old_size == SIZE_MAX || old_size > size)
+			old_size = size;
+		if ((new_mem = realloc(mem, new_size)) == NULL)
+			i_fatal_status(FATAL_OUTOFMEM, "realloc(mem, %zu)",
+				       new_size);
+		/* zero out new memory */
+		if (new_size > old_size)
+			memset(PTR_OFFSET(new_mem, old_size), 0,
+			       new_size - old_size);
+		hash_table_insert(spool->large_blocks, new_mem,
+				  POINTER_CAST(new_size));
+		spool->large_used += new_size;
+		return new_mem;
+	}
+
+	object_size = chunk->class->object_size;
+	if (old_size == SIZE_MAX || old_size > object_size)
+		old_size = object_size;
+	if (new_size <= object_size) {
+		/* fits into the same object */
+		if (new_size > old_size)
+			memset(PTR_OFFSET(mem, old_size), 0, new_size - old_size);
+		return mem;
+	}
+
+	new_mem = pool_slab_malloc(pool, new_size);
+	memcpy(new_mem, mem, old_size);
+	pool_slab_class_free(spool, chunk, mem);
+	return new_mem;
+}
+
+static void pool_slab_clear(pool_t pool)
+{
+	struct slab_pool *spool = container_of(pool, struct slab_pool, pool);
+	struct hash_iterate_context *iter;
+	struct slab_chunk *chunk, *value;
+	void *mem, *size;
+	unsigned int i;
+
+	SLAB_POOL_ASSERT_OWNER_THREAD(spool);
+	iter = hash_table_iterate_init(spool->chunks);
+	while (hash_table_iterate(iter, spool->chunks, &chunk, &value))
+		free(chunk);
+	hash_table_iterate_deinit(&iter);
+	hash_table_clear(spool->chunks, TRUE);
+
+	iter = hash_table_iterate_init(spool->large_blocks);
+	while (hash_table_iterate(iter, spool->large_blocks, &mem, &size))
+		free(mem);
+	hash_table_iterate_deinit(&iter);
+	hash_table_clear(spool->large_blocks, TRUE);
+	spool->large_used = 0;
+
+	for (i = 0; i < SLAB_CLASS_COUNT; i++) {
+		struct slab_class *class = &spool->classes[i];
+
+		class->partial_chunks = class->full_chunks = NULL;
+		class->empty_chunk = NULL;
+		class->chunk_count = class->used_count = 0;
+	}
+}
+
+static size_t pool_slab_get_max_easy_alloc_size(pool_t pool ATTR_UNUSED)
+{
+	return 0;
+}
+
+bool pool_slab_contains(pool_t pool, const void *mem)
+{
+	struct slab_pool *spool = container_of(pool, struct slab_pool, pool);
+
+	i_assert(pool->v == &static_slab_pool_vfuncs);
+
+	return pool_slab_find_chunk(spool, mem) != NULL ||
+		hash_table_lookup(spool->large_blocks, mem) != NULL;
+}
+
+bool pool_slab_get_class_stats(pool_t pool, unsigned int idx,
+			       struct pool_slab_class_stats *stats_r)
+{
+	struct slab_pool *spool = container_of(pool, struct slab_pool, pool);
+	const struct slab_class *class;
+
+	i_assert(pool->v == &static_slab_pool_vfuncs);
+
+	if (idx >= SLAB_CLASS_COUNT)
+		return FALSE;
+	class = &spool->classes[idx];
+
+	i_zero(stats_r);
+	stats_r->object_size = class->object_size;
+	stats_r->chunk_count = class->chunk_count;
+	stats_r->used_count = class->used_count;
+	stats_r->free_count =
+		class->chunk_count * class->objects_per_chunk -
+		class->used_count;
+	return TRUE;
+}
+
+void pool_slab_get_stats(pool_t pool, struct pool_slab_stats *stats_r)
+{
+	struct slab_pool *spool = container_of(pool, struct slab_pool, pool);
+	struct pool_slab_class_stats class_stats;
+	unsigned int i;
+
+	i_zero(stats_r);
+	for (i = 0; pool_slab_get_class_stats(pool, i, &class_stats); i++) {
+		stats_r->chunk_count += class_stats.chunk_count;
+		stats_r->used_size +=
+			class_stats.used_count * class_stats.object_size;
+		stats_r->free_size +=
+			class_stats.free_count * class_stats.object_size;
+	}
+	stats_r->large_count = hash_table_count(spool->large_blocks);
+	stats_r->used_size += spool->large_used;
+	stats_r->alloc_size = stats_r->chunk_count * SLAB_CHUNK_SIZE +
+		spool->large_used + sizeof(*spool);
+}
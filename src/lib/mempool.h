@@ -87,6 +87,14 @@ pool_t pool_allocfree_create(const char *name);
    See pool_alloconly_create_clean. */
 pool_t pool_allocfree_create_clean(const char *name);
 
+/* Create a new slab pool. It's meant for long-lived processes that keep
+   allocating and freeing objects of the same sizes: freed memory is kept in
+   per-size-class free lists and reused for the next allocations of the same
+   size class. Allocations larger than 2 kB go directly to calloc().
+   The pool isn't thread-safe: it can be used only by the thread that
+   created it, which is asserted. */
+pool_t pool_slab_create(const char *name);
+
 /* Similar to nearest_power(), but try not to exceed buffer's easy
    allocation size. If you don't have any explicit minimum size, use
    old_size + 1. */
@@ -189,6 +197,40 @@ size_t pool_allocfree_get_total_used_size(pool_t pool);
 /* Returns how much system memory has been allocated for this pool. */
 size_t pool_allocfree_get_total_alloc_size(pool_t pool);
 
+/* These functions are only for pools created with pool_slab_create(): */
+
+struct pool_slab_class_stats {
+	/* Allocation sizes are rounded up to this size */
+	size_t object_size;
+	/* Number of chunks allocated for this size class */
+	unsigned int chunk_count;
+	/* Number of allocated and free objects in the chunks */
+	unsigned int used_count, free_count;
+};
+
+struct pool_slab_stats {
+	/* How much system memory has been allocated for this pool */
+	size_t alloc_size;
+	/* How much of it is used by the current allocations, including the
+	   rounding up to the size classes */
+	size_t used_size;
+	/* How much of it is in free objects waiting to be reused */
+	size_t free_size;
+
+	unsigned int chunk_count;
+	/* Number of allocations too large for any size class */
+	unsigned int large_count;
+};
+
+/* Returns TRUE if mem was allocated from the slab pool. mem isn't
+   dereferenced, so it can be any pointer. */
+bool pool_slab_contains(pool_t pool, const void *mem);
+/* Get statistics for the idx'th size class. Returns FALSE if there's no
+   such size class. */
+bool pool_slab_get_class_stats(pool_t pool, unsigned int idx,
+			       struct pool_slab_class_stats *stats_r);
+void pool_slab_get_stats(pool_t pool, struct pool_slab_stats *stats_r);
+
 /* private: */
 void pool_system_free(pool_t pool, void *mem);
 void pool_external_refs_unref(pool_t pool);
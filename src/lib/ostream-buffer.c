@@ -70,7 +70,7 @@ struct ostream *o_stream_create_buffer(buffer_t *buf)
 	struct buffer_ostream *bstream;
 	struct ostream *output;
 
-	bstream = i_new(struct buffer_ostream, 1);
+	bstream = io_stream_new(struct buffer_ostream);
 	/* we don't set buffer as blocking, because if max_buffer_size is
 	   changed it can get truncated. this is used in various places in
 	   unit tests. */
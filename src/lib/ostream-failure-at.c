@@ -98,7 +98,7 @@ o_stream_create_failure_at(struct ostream *output, uoff_t failure_offset,
 {
 	struct failure_at_ostream *fstream;
 
-	fstream = i_new(struct failure_at_ostream, 1);
+	fstream = io_stream_new(struct failure_at_ostream);
 	fstream->ostream.sendv = o_stream_failure_at_sendv;
 	fstream->ostream.flush = o_stream_failure_at_flush;
 	fstream->ostream.iostream.destroy = o_stream_failure_at_destroy;
@@ -113,7 +113,7 @@ o_stream_create_failure_at_flush(struct ostream *output, const char *error_strin
 {
 	struct failure_at_ostream *fstream;
 
-	fstream = i_new(struct failure_at_ostream, 1);
+	fstream = io_stream_new(struct failure_at_ostream);
 	fstream->ostream.flush = o_stream_failure_at_flush;
 	fstream->ostream.iostream.destroy = o_stream_failure_at_destroy;
 	fstream->error_string = i_strdup(error_string);
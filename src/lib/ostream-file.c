@@ -2,13 +2,14 @@
 
 /* @UNSAFE: whole file */
 
+#define _GNU_SOURCE /* for splice() */
 #include "lib.h"
 #include "ioloop.h"
 #include "write-full.h"
 #include "net.h"
 #include "sendfile-util.h"
 #include "istream.h"
-#include "istream-private.h"
+#include "istream-file-private.h"
 #include "ostream-file-private.h"
 
 #include <unistd.h>
@@ -26,6 +27,10 @@
 #define IS_STREAM_EMPTY(fstream) \
 	((fstream)->head == (fstream)->tail && !(fstream)->full)
 
+/* Maximum number of bytes to splice() at once. This is the default pipe
+   capacity in Linux. */
+#define OSTREAM_SPLICE_MAX_SIZE (64*1024)
+
 #define MAX_SSIZE_T(size) \
 	((size) < SSIZE_T_MAX ? (size_t)(size) : SSIZE_T_MAX)
 
@@ -864,6 +869,207 @@ io_stream_sendfile(struct ostream_private *outstream,
 	return TRUE;
 }
 
+#ifdef HAVE_SPLICE
+/* All the file ostreams in the process share the same pipe for splice(), so
+   it costs 2 fds per process rather than per stream. The pipe is always left
+   empty when io_stream_splice() returns. */
+static int splice_pipe[2] = { -1, -1 };
+static pid_t splice_pipe_pid;
+
+static void o_stream_file_splice_pipe_deinit(void)
+{
+	if (splice_pipe[0] == -1)
+		return;
+	i_close_fd(&splice_pipe[0]);
+	i_close_fd(&splice_pipe[1]);
+}
+
+static bool o_stream_file_splice_pipe_init(void)
+{
+	if (splice_pipe[0] != -1) {
+		if (splice_pipe_pid == getpid())
+			return TRUE;
+		/* inherited from the parent process - don't share it */
+		o_stream_file_splice_pipe_deinit();
+	}
+
+	if (pipe(splice_pipe) < 0) {
+		splice_pipe[0] = splice_pipe[1] = -1;
+		return FALSE;
+	}
+	fd_set_nonblock(splice_pipe[0], TRUE);
+	fd_set_nonblock(splice_pipe[1], TRUE);
+	fd_close_on_exec(splice_pipe[0], TRUE);
+	fd_close_on_exec(splice_pipe[1], TRUE);
+	splice_pipe_pid = getpid();
+	lib_atexit(o_stream_file_splice_pipe_deinit);
+	return TRUE;
+}
+
+/* Send size bytes from the splice pipe to the output fd. Whatever can't be
+   sent without blocking is read back from the pipe into the buffer, so the
+   pipe is empty afterwards. Returns 1 if everything was sent, 0 if some of it
+   was buffered, -1 on error. */
+static int o_stream_file_splice_out(struct file_ostream *fstream, size_t size)
+{
+	struct ostream_private *stream = &fstream->ostream;
+	size_t pos = 0, added;
+	ssize_t ret;
+
+	while (size > 0) {
+		ret = splice(splice_pipe[0], NULL, fstream->fd, NULL, size,
+			     SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN)
+				break;
+			io_stream_set_error(&stream->iostream,
+					    "splice() failed: %m");
+			stream->ostream.stream_errno = errno;
+			stream_closed(fstream);
+			/* the unsent data is dropped along with the pipe */
+			o_stream_file_splice_pipe_deinit();
+			return -1;
+		}
+		i_assert(ret > 0);
+		size -= ret;
+		fstream->real_offset += ret;
+		fstream->buffer_offset += ret;
+		stream->ostream.offset += ret;
+	}
+	if (size == 0)
+		return 1;
+
+	/* the output would block - move the rest into the buffer */
+	i_assert(IS_STREAM_EMPTY(fstream));
+	T_BEGIN {
+		unsigned char *data = t_malloc_no0(size);
+
+		while (pos < size) {
+			ret = read(splice_pipe[0], data + pos, size - pos);
+			if (ret < 0) {
+				if (errno == EINTR)
+					continue;
+				io_stream_set_error(&stream->iostream,
+					"read(splice pipe) failed: %m");
+				stream->ostream.stream_errno = errno;
+				break;
+			}
+			i_assert(ret > 0);
+			pos += ret;
+		}
+		if (pos == size) {
+			added = o_stream_add(fstream, data, size);
+			i_assert(added == size);
+			stream->ostream.offset += size;
+		}
+	} T_END;
+	if (pos < size) {
+		stream_closed(fstream);
+		o_stream_file_splice_pipe_deinit();
+		return -1;
+	}
+	return 0;
+}
+
+/* Move data from a non-seekable fd (socket, pipe) to the output fd via a
+   pipe without copying it to userspace. Returns FALSE if splice() can't be
+   used, and the caller needs to fall back to copying. */
+static bool
+io_stream_splice(struct ostream_private *outstream,
+		 struct istream *instream, int in_fd,
+		 enum ostream_send_istream_result *res_r)
+{
+	struct file_ostream *foutstream =
+		container_of(outstream, struct file_ostream, ostream);
+	struct file_istream *finstream =
+		container_of(instream->real_stream, struct file_istream,
+			     istream);
+	struct const_iovec iov;
+	size_t size, max_size;
+	ssize_t ret;
+
+	if (finstream->skip_left > 0) {
+		/* the skipped data needs to be read and dropped first */
+		return FALSE;
+	}
+	/* data that can't be sent immediately is moved from the pipe to the
+	   buffer, so splice only as much as the buffer can hold */
+	max_size = I_MIN(OSTREAM_SPLICE_MAX_SIZE,
+			 I_MAX(outstream->max_buffer_size,
+			       foutstream->buffer_size));
+	if (max_size == 0)
+		return FALSE;
+	if (!o_stream_file_splice_pipe_init()) {
+		foutstream->no_splice = TRUE;
+		return FALSE;
+	}
+
+	/* send what the istream has already read into its buffer */
+	iov.iov_base = i_stream_get_data(instream, &size);
+	iov.iov_len = size;
+	if (size > 0) {
+		if ((ret = o_stream_file_sendv(outstream, &iov, 1)) < 0) {
+			*res_r = OSTREAM_SEND_ISTREAM_RESULT_ERROR_OUTPUT;
+			return TRUE;
+		}
+		i_stream_skip(instream, ret);
+		if ((size_t)ret < size) {
+			*res_r = OSTREAM_SEND_ISTREAM_RESULT_WAIT_OUTPUT;
+			return TRUE;
+		}
+	}
+
+	o_stream_socket_cork(foutstream);
+	for (;;) {
+		/* the buffer must be empty to keep the data in order */
+		if ((ret = buffer_flush(foutstream)) < 0) {
+			*res_r = OSTREAM_SEND_ISTREAM_RESULT_ERROR_OUTPUT;
+			return TRUE;
+		} else if (ret == 0) {
+			*res_r = OSTREAM_SEND_ISTREAM_RESULT_WAIT_OUTPUT;
+			return TRUE;
+		}
+
+		ret = splice(in_fd, NULL, splice_pipe[1], NULL, max_size,
+			     SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		if (ret == 0) {
+			instream->eof = TRUE;
+			*res_r = OSTREAM_SEND_ISTREAM_RESULT_FINISHED;
+			return TRUE;
+		}
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN) {
+				*res_r = OSTREAM_SEND_ISTREAM_RESULT_WAIT_INPUT;
+				return TRUE;
+			}
+			if (errno == EINVAL) {
+				/* not supported with these fds */
+				foutstream->no_splice = TRUE;
+				return FALSE;
+			}
+			io_stream_set_error(&instream->real_stream->iostream,
+					    "splice() failed: %m");
+			instream->stream_errno = errno;
+			*res_r = OSTREAM_SEND_ISTREAM_RESULT_ERROR_INPUT;
+			return TRUE;
+		}
+
+		instream->v_offset += ret;
+		if ((ret = o_stream_file_splice_out(foutstream, ret)) < 0) {
+			*res_r = OSTREAM_SEND_ISTREAM_RESULT_ERROR_OUTPUT;
+			return TRUE;
+		} else if (ret == 0) {
+			*res_r = OSTREAM_SEND_ISTREAM_RESULT_WAIT_OUTPUT;
+			return TRUE;
+		}
+	}
+}
+#endif
+
 static enum ostream_send_istream_result
 io_stream_copy_backwards(struct ostream_private *outstream,
 			 struct istream *instream, uoff_t in_size)
@@ -1005,6 +1211,15 @@ o_stream_file_send_istream(struct ostream_private *outstream,
 		   regular sending. */
 		foutstream->no_sendfile = TRUE;
 	}
+#ifdef HAVE_SPLICE
+	if (!foutstream->no_splice && in_fd != -1 &&
+	    in_fd != foutstream->fd && !instream->seekable &&
+	    instream->real_stream->read == i_stream_file_read) {
+		/* plain socket or pipe without any layers in between */
+		if (io_stream_splice(outstream, instream, in_fd, &res))
+			return res;
+	}
+#endif
 
 	same_stream = i_stream_get_fd(instream) == foutstream->fd &&
 		foutstream->fd != -1;
@@ -1063,6 +1278,7 @@ static void fstream_init_file(struct file_ostream *fstream)
 	struct stat st;
 
 	fstream->no_sendfile = TRUE;
+	fstream->no_splice = TRUE;
 	if (fstat(fstream->fd, &st) < 0)
 		return;
 
@@ -1088,7 +1304,7 @@ struct ostream * o_stream_create_fd_common(int fd, size_t max_buffer_size,
 	struct ostream *ostream;
 	off_t offset;
 
-	fstream = i_new(struct file_ostream, 1);
+	fstream = io_stream_new(struct file_ostream);
 	ostream = o_stream_create_file_common
 		(fstream, fd, max_buffer_size, autoclose_fd);
 
@@ -1142,7 +1358,7 @@ o_stream_create_fd_file(int fd, uoff_t offset, bool autoclose_fd)
 	if (offset == UOFF_T_MAX)
 		offset = lseek(fd, 0, SEEK_CUR);
 
-	fstream = i_new(struct file_ostream, 1);
+	fstream = io_stream_new(struct file_ostream);
 	ostream = o_stream_create_file_common(fstream, fd, 0, autoclose_fd);
 	fstream_init_file(fstream);
 	fstream->real_offset = offset;
@@ -1180,7 +1396,7 @@ struct ostream *o_stream_create_fd_blocking(int fd)
 	struct file_ostream *fstream;
 	struct ostream *ostream;
 
-	fstream = i_new(struct file_ostream, 1);
+	fstream = io_stream_new(struct file_ostream);
 	ostream = o_stream_create_file_common(fstream, fd, 0, FALSE);
 	/* disable buffering entirely */
 	fstream->ostream.max_buffer_size = 0;
@@ -46,7 +46,7 @@ o_stream_create_hash(struct ostream *output, const struct hash_method *method,
 {
 	struct hash_ostream *hstream;
 
-	hstream = i_new(struct hash_ostream, 1);
+	hstream = io_stream_new(struct hash_ostream);
 	hstream->ostream.sendv = o_stream_hash_sendv;
 	hstream->method = method;
 	hstream->hash_context = hash_context;
@@ -87,7 +87,7 @@ o_stream_create_rawlog_from_stream(struct ostream *output,
 {
 	struct rawlog_ostream *rstream;
 
-	rstream = i_new(struct rawlog_ostream, 1);
+	rstream = io_stream_new(struct rawlog_ostream);
 	rstream->ostream.sendv = o_stream_rawlog_sendv;
 	rstream->ostream.iostream.close = o_stream_rawlog_close;
 	rstream->ostream.flush = o_stream_rawlog_flush;
@@ -68,12 +68,14 @@ struct ostream *o_stream_create_unix(int fd, size_t max_buffer_size)
 
 	i_assert(fd != -1);
 
-	ustream = i_new(struct unix_ostream, 1);
+	ustream = io_stream_new(struct unix_ostream);
 	ustream->write_fd = -1;
 	output = o_stream_create_file_common(&ustream->fstream, fd,
 					    max_buffer_size, FALSE);
 	output->real_stream->iostream.close = o_stream_unix_close;
 	ustream->fstream.writev = o_stream_unix_writev;
+	/* splice() would bypass sending the fds */
+	ustream->fstream.no_splice = TRUE;
 
 	return output;
 }
@@ -240,6 +240,11 @@ void o_stream_set_no_error_handling(struct ostream *stream, bool set);
    This means that the number of bytes written to outstream is always equal to
    the number of bytes skipped in instream.
 
+   If both streams are plain fds, the data is moved without copying it to
+   userspace using sendfile() or splice(). splice() goes through a pipe that
+   is shared by all the streams in the process, so once it's used, the
+   process keeps 2 more fds open.
+
    It's also possible to use this function to copy data within same file
    descriptor, even if the source and destination overlaps. If the file must
    be grown, you have to do it manually before calling this function. */
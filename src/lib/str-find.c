@@ -142,9 +142,25 @@ bool str_find_more(struct str_find_context *ctx,
 		j = 0;
 	} else {
 		/* Boyer-Moore searching */
+		const unsigned char last_char = ctx->key[key_len - 1];
+		const unsigned char *p;
+
 		j = 0;
 		while (j + key_len <= size) {
 			i = key_len - 1;
+			if (data[i + j] != last_char) {
+				/* Any match must end with the key's last
+				   character. memchr() is typically vectorized,
+				   so it skips through the non-matching data
+				   much faster than the shift tables. */
+				p = memchr(data + i + j, last_char,
+					   size - (i + j));
+				if (p == NULL) {
+					j = size - key_len + 1;
+					break;
+				}
+				j = (p - data) - i;
+			}
 			while (ctx->key[i] == data[i + j]) {
 				if (i == 0) {
 					ctx->match_end_pos = j + key_len;
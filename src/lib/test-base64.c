@@ -2,6 +2,7 @@
 
 #include "test-lib.h"
 #include "str.h"
+#include "cpu-features.h"
 #include "base64.h"
 
 static unsigned int loop_count;
@@ -1304,6 +1305,72 @@ static void test_base64_encode_lines(void)
 	test_end();
 }
 
+static void
+test_base64_accel_scheme(const struct base64_scheme *b64,
+			 const unsigned char *data, size_t size,
+			 size_t max_line_len, unsigned int idx)
+{
+	buffer_t *enc_accel, *enc_scalar, *dec_accel, *dec_scalar;
+	unsigned char *p;
+	int ret_accel, ret_scalar;
+
+	enc_accel = t_buffer_create(MAX_BASE64_ENCODED_SIZE(size) * 2);
+	enc_scalar = t_buffer_create(MAX_BASE64_ENCODED_SIZE(size) * 2);
+	dec_accel = t_buffer_create(size);
+	dec_scalar = t_buffer_create(size);
+
+	base64_scheme_encode(b64, BASE64_ENCODE_FLAG_CRLF, max_line_len,
+			     data, size, enc_accel);
+	cpu_features_set_disabled(TRUE);
+	base64_scheme_encode(b64, BASE64_ENCODE_FLAG_CRLF, max_line_len,
+			     data, size, enc_scalar);
+	cpu_features_set_disabled(FALSE);
+	test_assert_idx(buffer_cmp(enc_accel, enc_scalar), idx);
+
+	test_assert_idx(base64_scheme_decode(b64, 0, enc_accel->data,
+					     enc_accel->used, dec_accel) == 0,
+			idx);
+	test_assert_idx(dec_accel->used == size &&
+			memcmp(dec_accel->data, data, size) == 0, idx);
+
+	/* both implementations must fail in the same way on garbage */
+	if (enc_accel->used == 0)
+		return;
+	p = buffer_get_modifiable_data(enc_accel, NULL);
+	p[i_rand_limit(enc_accel->used)] = '*';
+	buffer_set_used_size(dec_accel, 0);
+	ret_accel = base64_scheme_decode(b64, 0, enc_accel->data,
+					 enc_accel->used, dec_accel);
+	cpu_features_set_disabled(TRUE);
+	ret_scalar = base64_scheme_decode(b64, 0, enc_accel->data,
+					  enc_accel->used, dec_scalar);
+	cpu_features_set_disabled(FALSE);
+	test_assert_idx(ret_accel == -1 && ret_scalar == -1, idx);
+	test_assert_idx(buffer_cmp(dec_accel, dec_scalar), idx);
+}
+
+static void test_base64_accel(void)
+{
+	unsigned char data[2048];
+	unsigned int i, j;
+	size_t size, max_line_len;
+
+	test_begin("base64 accelerated and scalar code");
+	for (i = 0; i < loop_count; i++) {
+		size = i < 200 ? i : i_rand_limit(sizeof(data));
+		for (j = 0; j < size; j++)
+			data[j] = i_rand_uchar();
+		max_line_len = i % 3 == 0 ? SIZE_MAX : 4 + i_rand_limit(100);
+		T_BEGIN {
+			test_base64_accel_scheme(&base64_scheme, data, size,
+						 max_line_len, i);
+			test_base64_accel_scheme(&base64url_scheme, data, size,
+						 max_line_len, i);
+		} T_END;
+	}
+	test_end();
+}
+
 void test_base64(void)
 {
 	loop_count = ON_VALGRIND ? 100 : 1000;
@@ -1317,4 +1384,5 @@ void test_base64(void)
 	test_base64_decode_lowlevel();
 	test_base64_random_lowlevel();
 	test_base64_encode_lines();
+	test_base64_accel();
 }
@@ -3,6 +3,44 @@
 #include "test-lib.h"
 #include "crc32.h"
 
+static uint32_t test_crc32_bitwise(const unsigned char *data, size_t size)
+{
+	uint32_t crc = 0xffffffff;
+	unsigned int i;
+
+	while (size-- > 0) {
+		crc ^= *data++;
+		for (i = 0; i < 8; i++)
+			crc = (crc >> 1) ^ (0xedb88320 & (0U - (crc & 1)));
+	}
+	return crc ^ 0xffffffff;
+}
+
+static void test_crc32_random(void)
+{
+	unsigned char buf[4096 + 16];
+	unsigned int i, offset, size, split;
+	uint32_t crc;
+
+	test_begin("crc32 random");
+	for (i = 0; i < sizeof(buf); i++)
+		buf[i] = i_rand_uchar();
+	for (i = 0; i < 1000; i++) {
+		/* test all the alignments and the sizes around the
+		   accelerated code's block sizes */
+		offset = i % 16;
+		size = i < 300 ? i : i_rand_limit(sizeof(buf) - offset);
+		crc = test_crc32_bitwise(buf + offset, size);
+		test_assert_idx(crc32_data(buf + offset, size) == crc, i);
+
+		split = size == 0 ? 0 : i_rand_limit(size);
+		test_assert_idx(crc32_data_more(crc32_data(buf + offset, split),
+						buf + offset + split,
+						size - split) == crc, i);
+	}
+	test_end();
+}
+
 void test_crc32(void)
 {
 	const char str[] = "foo\0bar";
@@ -11,4 +49,6 @@ void test_crc32(void)
 	test_assert(crc32_str(str) == 0x8c736521);
 	test_assert(crc32_data(str, sizeof(str)) == 0x32c9723d);
 	test_end();
+
+	test_crc32_random();
 }
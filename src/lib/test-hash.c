@@ -35,6 +35,169 @@ static void test_hash_random_pool(pool_t pool)
 	i_free(keys);
 }
 
+static void test_hash_iterate(void)
+{
+	const unsigned int keymax = 1000;
+	HASH_TABLE(void *, void *) hash, hash2;
+	struct hash_iterate_context *iter;
+	unsigned int *seen;
+	void *key, *value, *orig_key;
+	unsigned int i, count = 0;
+
+	seen = i_new(unsigned int, keymax + 1);
+	hash_table_create_direct(&hash, default_pool, 0);
+	for (i = 1; i <= keymax; i++)
+		hash_table_insert(hash, POINTER_CAST(i), POINTER_CAST(i));
+
+	/* remove the even nodes while iterating, some of them before the
+	   iteration reaches them: the rest must be returned exactly once */
+	iter = hash_table_iterate_init(hash);
+	while (hash_table_iterate(iter, hash, &key, &value)) {
+		i = POINTER_CAST_TO(key, unsigned int);
+		test_assert_idx(value == key, i);
+		seen[i]++;
+		count++;
+		if (i % 2 == 0)
+			hash_table_remove(hash, key);
+		if (i + 1 <= keymax && (i + 1) % 2 == 0 && seen[i + 1] == 0) {
+			hash_table_remove(hash, POINTER_CAST(i + 1));
+			seen[i + 1]++;
+			count++;
+		}
+	}
+	hash_table_iterate_deinit(&iter);
+	test_assert(count == keymax);
+	for (i = 1; i <= keymax; i++)
+		test_assert_idx(seen[i] == 1, i);
+	test_assert(hash_table_count(hash) == keymax / 2);
+
+	for (i = 1; i <= keymax; i++) {
+		value = hash_table_lookup(hash, POINTER_CAST(i));
+		test_assert_idx(value == (i % 2 == 0 ? NULL : POINTER_CAST(i)), i);
+	}
+
+	/* inserting as many nodes as the table has while iterating doesn't
+	   resize it, so the old nodes are returned exactly once */
+	memset(seen, 0, sizeof(*seen) * (keymax + 1));
+	iter = hash_table_iterate_init(hash);
+	while (hash_table_iterate(iter, hash, &key, &value)) {
+		i = POINTER_CAST_TO(key, unsigned int);
+		if (i > keymax)
+			continue;
+		seen[i]++;
+		hash_table_insert(hash, POINTER_CAST(i + keymax),
+				  POINTER_CAST(i + keymax));
+	}
+	hash_table_iterate_deinit(&iter);
+	for (i = 1; i <= keymax; i++)
+		test_assert_idx(seen[i] == (i % 2 == 0 ? 0 : 1), i);
+	test_assert(hash_table_count(hash) == keymax);
+	for (i = 1; i <= keymax; i += 2) {
+		test_assert_idx(hash_table_lookup(hash,
+			POINTER_CAST(i + keymax)) == POINTER_CAST(i + keymax), i);
+		hash_table_remove(hash, POINTER_CAST(i + keymax));
+	}
+
+	/* update keeps the original key */
+	hash_table_update(hash, POINTER_CAST(1), POINTER_CAST(12345));
+	test_assert(hash_table_lookup_full(hash, POINTER_CAST(1),
+					   &orig_key, &value));
+	test_assert(value == POINTER_CAST(12345));
+	test_assert(!hash_table_lookup_full(hash, POINTER_CAST(2),
+					    &orig_key, &value));
+
+	hash_table_create_direct(&hash2, default_pool, 0);
+	hash_table_copy(hash2, hash);
+	test_assert(hash_table_count(hash2) == keymax / 2);
+	for (i = 1; i <= keymax; i += 2)
+		test_assert_idx(hash_table_lookup(hash2, POINTER_CAST(i)) != NULL, i);
+
+	hash_table_clear(hash, TRUE);
+	test_assert(hash_table_count(hash) == 0);
+	test_assert(hash_table_lookup(hash, POINTER_CAST(1)) == NULL);
+
+	hash_table_destroy(&hash);
+	hash_table_destroy(&hash2);
+	i_free(seen);
+}
+
+static void test_hash_iterate_grow(void)
+{
+	const unsigned int keymax = 100, add_count = 20;
+	const unsigned int total = keymax * (add_count + 1);
+	HASH_TABLE(void *, void *) hash;
+	struct hash_iterate_context *iter, *iter2;
+	unsigned int *seen, *seen2;
+	void *key, *value;
+	unsigned int i, j, count, old_count = 0;
+
+	seen = i_new(unsigned int, total + 1);
+	seen2 = i_new(unsigned int, total + 1);
+	hash_table_create_direct(&hash, default_pool, 0);
+	for (i = 1; i <= keymax; i++)
+		hash_table_insert(hash, POINTER_CAST(i), POINTER_CAST(i));
+
+	/* add much more nodes than the table has room for while iterating:
+	   the old nodes must still be returned exactly once */
+	iter = hash_table_iterate_init(hash);
+	while (hash_table_iterate(iter, hash, &key, &value)) {
+		i = POINTER_CAST_TO(key, unsigned int);
+		seen[i]++;
+		if (i > keymax)
+			continue;
+		for (j = 0; j < add_count; j++) {
+			key = POINTER_CAST(keymax + (i - 1) * add_count + j + 1);
+			hash_table_insert(hash, key, key);
+		}
+		if (++old_count != keymax / 2)
+			continue;
+
+		/* a nested iteration sees all the nodes that exist, including
+		   the ones that didn't fit into the frozen table */
+		count = 0;
+		iter2 = hash_table_iterate_init(hash);
+		while (hash_table_iterate(iter2, hash, &key, &value)) {
+			seen2[POINTER_CAST_TO(key, unsigned int)]++;
+			count++;
+		}
+		hash_table_iterate_deinit(&iter2);
+		test_assert(count == keymax * (add_count + 1) / 2 + keymax / 2);
+		test_assert(count == hash_table_count(hash));
+		for (j = 1; j <= total; j++)
+			test_assert_idx(seen2[j] <= 1, j);
+	}
+	for (i = 1; i <= keymax; i++)
+		test_assert_idx(seen[i] == 1, i);
+	/* the new nodes may or may not have been returned */
+	for (; i <= total; i++)
+		test_assert_idx(seen[i] <= 1, i);
+	test_assert(hash_table_count(hash) == total);
+
+	/* update and remove both old and new nodes while still frozen */
+	hash_table_update(hash, POINTER_CAST(total), POINTER_CAST(1));
+	test_assert(hash_table_lookup(hash, POINTER_CAST(total)) == POINTER_CAST(1));
+	for (i = 1; i <= total; i += 3)
+		hash_table_remove(hash, POINTER_CAST(i));
+	hash_table_iterate_deinit(&iter);
+
+	count = 0;
+	for (i = 1; i <= total; i++) {
+		value = hash_table_lookup(hash, POINTER_CAST(i));
+		if (i % 3 == 1)
+			test_assert_idx(value == NULL, i);
+		else {
+			test_assert_idx(value == (i == total ? POINTER_CAST(1) :
+						  POINTER_CAST(i)), i);
+			count++;
+		}
+	}
+	test_assert(hash_table_count(hash) == count);
+
+	hash_table_destroy(&hash);
+	i_free(seen);
+	i_free(seen2);
+}
+
 void test_hash(void)
 {
 	pool_t pool;
@@ -46,4 +209,12 @@ void test_hash(void)
 	test_hash_random_pool(pool);
 	pool_unref(&pool);
 	test_end();
+
+	test_begin("hash table (iterate)");
+	test_hash_iterate();
+	test_end();
+
+	test_begin("hash table (iterate while growing)");
+	test_hash_iterate_grow();
+	test_end();
 }
@@ -89,6 +89,73 @@ static void test_ioloop_fd(void)
 	test_end();
 }
 
+#define TEST_IOLOOP_MANY_FDS_COUNT 400
+#define TEST_IOLOOP_MANY_FDS_CALLS 3
+
+struct test_many_fds_ctx {
+	struct io *ios[TEST_IOLOOP_MANY_FDS_COUNT];
+	unsigned int calls[TEST_IOLOOP_MANY_FDS_COUNT];
+	unsigned int removed_count;
+	bool got_to;
+};
+
+static struct test_many_fds_ctx *test_many_fds_ctx;
+
+static void test_ioloop_many_fds_cb(struct io **iop)
+{
+	struct test_many_fds_ctx *ctx = test_many_fds_ctx;
+	unsigned int idx = iop - ctx->ios;
+
+	/* the data isn't read, so the fd stays readable */
+	if (++ctx->calls[idx] < TEST_IOLOOP_MANY_FDS_CALLS)
+		return;
+	io_remove(iop);
+	if (++ctx->removed_count == TEST_IOLOOP_MANY_FDS_COUNT)
+		io_loop_stop(current_ioloop);
+}
+
+static void test_ioloop_many_fds_to(struct test_many_fds_ctx *ctx)
+{
+	ctx->got_to = TRUE;
+	io_loop_stop(current_ioloop);
+}
+
+static void test_ioloop_many_fds(void)
+{
+	struct test_many_fds_ctx ctx;
+	int fds[TEST_IOLOOP_MANY_FDS_COUNT][2];
+	unsigned int i;
+
+	test_begin("ioloop many fds");
+	i_zero(&ctx);
+	test_many_fds_ctx = &ctx;
+
+	struct ioloop *ioloop = io_loop_create();
+	for (i = 0; i < TEST_IOLOOP_MANY_FDS_COUNT; i++) {
+		if (pipe(fds[i]) < 0)
+			i_fatal("pipe() failed: %m");
+		if (write(fds[i][1], "x", 1) != 1)
+			i_fatal("write() failed: %m");
+		ctx.ios[i] = io_add(fds[i][0], IO_READ,
+				    test_ioloop_many_fds_cb, &ctx.ios[i]);
+	}
+	struct timeout *to = timeout_add(5000, test_ioloop_many_fds_to, &ctx);
+
+	io_loop_run(ioloop);
+
+	timeout_remove(&to);
+	test_assert(!ctx.got_to);
+	for (i = 0; i < TEST_IOLOOP_MANY_FDS_COUNT; i++) {
+		test_assert_idx(ctx.calls[i] == TEST_IOLOOP_MANY_FDS_CALLS, i);
+		io_remove(&ctx.ios[i]);
+		i_close_fd(&fds[i][0]);
+		i_close_fd(&fds[i][1]);
+	}
+	io_loop_destroy(&ioloop);
+	test_many_fds_ctx = NULL;
+	test_end();
+}
+
 static void test_ioloop_timeout(void)
 {
 	struct ioloop *ioloop, *ioloop2;
@@ -399,6 +466,7 @@ void test_ioloop(void)
 	test_ioloop_find_fd_conditions();
 	test_ioloop_pending_io();
 	test_ioloop_fd();
+	test_ioloop_many_fds();
 	test_ioloop_context();
 	test_ioloop_context_events();
 }
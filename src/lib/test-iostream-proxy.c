@@ -105,9 +105,124 @@ void test_iostream_proxy_simple(void)
 	test_end();
 }
 
+struct test_proxy_large_ctx {
+	struct ostream *output;
+	struct istream *input;
+	struct io *io;
+
+	buffer_t *data, *received;
+	size_t sent;
+};
+
+static int test_iostream_proxy_large_send(struct test_proxy_large_ctx *ctx)
+{
+	ssize_t ret;
+
+	while (ctx->sent < ctx->data->used) {
+		ret = o_stream_send(ctx->output,
+				    CONST_PTR_OFFSET(ctx->data->data, ctx->sent),
+				    I_MIN(ctx->data->used - ctx->sent, 4096));
+		test_assert(ret >= 0);
+		if (ret <= 0)
+			return 0;
+		ctx->sent += ret;
+	}
+	return o_stream_flush(ctx->output);
+}
+
+static void test_iostream_proxy_large_read(struct test_proxy_large_ctx *ctx)
+{
+	const unsigned char *data;
+	size_t size;
+
+	while (i_stream_read_more(ctx->input, &data, &size) > 0) {
+		buffer_append(ctx->received, data, size);
+		i_stream_skip(ctx->input, size);
+	}
+	if (ctx->received->used >= ctx->data->used)
+		io_loop_stop(current_ioloop);
+}
+
+static void test_iostream_proxy_large(void)
+{
+	struct test_proxy_large_ctx ctx;
+	struct iostream_proxy *proxy;
+	struct istream *left_in, *right_in;
+	struct ostream *left_out, *right_out;
+	struct ioloop *ioloop;
+	int sfdl[2], sfdr[2], counter = 0, sndbuf_size = 4096;
+	unsigned int i;
+
+	test_begin("iostream_proxy large transfer");
+	i_zero(&ctx);
+	ctx.data = t_buffer_create(1024*1024);
+	for (i = 0; i < 1024*1024; i++)
+		buffer_append_c(ctx.data, i_rand_uchar());
+	ctx.received = t_buffer_create(ctx.data->used);
+
+	test_assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sfdl) == 0);
+	test_assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sfdr) == 0);
+	fd_set_nonblock(sfdl[0], TRUE);
+	fd_set_nonblock(sfdl[1], TRUE);
+	fd_set_nonblock(sfdr[0], TRUE);
+	fd_set_nonblock(sfdr[1], TRUE);
+	/* make the proxy's output block often, so that spliced data has to be
+	   buffered */
+	test_assert(setsockopt(sfdr[1], SOL_SOCKET, SO_SNDBUF,
+			       &sndbuf_size, sizeof(sndbuf_size)) == 0);
+
+	ioloop = io_loop_create();
+
+	/* the output side is smaller than the data in flight, so the proxy
+	   has to wait for output in the middle of the transfer */
+	left_in = i_stream_create_fd(sfdl[1], IO_BLOCK_SIZE);
+	left_out = o_stream_create_fd(sfdl[1], IO_BLOCK_SIZE);
+	right_in = i_stream_create_fd(sfdr[1], IO_BLOCK_SIZE);
+	right_out = o_stream_create_fd(sfdr[1], IO_BLOCK_SIZE);
+	proxy = iostream_proxy_create(left_in, left_out, right_in, right_out);
+	i_stream_unref(&left_in);
+	o_stream_unref(&left_out);
+	i_stream_unref(&right_in);
+	o_stream_unref(&right_out);
+	iostream_proxy_set_completion_callback(proxy, completed, &counter);
+	iostream_proxy_start(proxy);
+
+	ctx.output = o_stream_create_fd(sfdl[0], IO_BLOCK_SIZE);
+	o_stream_set_flush_callback(ctx.output, test_iostream_proxy_large_send,
+				    &ctx);
+	o_stream_set_flush_pending(ctx.output, TRUE);
+	ctx.input = i_stream_create_fd(sfdr[0], IO_BLOCK_SIZE);
+	ctx.io = io_add_istream(ctx.input, test_iostream_proxy_large_read,
+				&ctx);
+
+	io_loop_run(ioloop);
+
+	test_assert(buffer_cmp(ctx.data, ctx.received));
+	io_remove(&ctx.io);
+
+	/* wait for the proxy to see EOF on both sides */
+	test_assert(o_stream_finish(ctx.output) > 0);
+	test_assert(shutdown(sfdl[0], SHUT_WR) == 0);
+	test_assert(shutdown(sfdr[0], SHUT_WR) == 0);
+	counter = 2;
+	io_loop_run(ioloop);
+
+	o_stream_unref(&ctx.output);
+	i_stream_unref(&ctx.input);
+	iostream_proxy_unref(&proxy);
+	io_loop_destroy(&ioloop);
+
+	i_close_fd(&sfdl[0]);
+	i_close_fd(&sfdl[1]);
+	i_close_fd(&sfdr[0]);
+	i_close_fd(&sfdr[1]);
+	test_end();
+}
+
 void test_iostream_proxy(void)
 {
 	T_BEGIN {
 		test_iostream_proxy_simple();
+		test_iostream_proxy_large();
 	} T_END;
 }
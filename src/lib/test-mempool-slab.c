@@ -0,0 +1,123 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "test-lib.h"
+
+static bool mem_is_zero(const void *mem, size_t size)
+{
+	const unsigned char *bytes = mem;
+	size_t i;
+
+	for (i = 0; i < size; i++) {
+		if (bytes[i] != 0)
+			return FALSE;
+	}
+	return TRUE;
+}
+
+static void test_mempool_slab_alloc(void)
+{
+	struct pool_slab_stats stats;
+	struct pool_slab_class_stats class_stats;
+	pool_t pool;
+	void *mem[1000], *mem2, *stack_mem = &stats;
+	unsigned int i;
+
+	test_begin("mempool_slab alloc");
+	pool = pool_slab_create("test");
+
+	for (i = 0; i < N_ELEMENTS(mem); i++) {
+		mem[i] = p_malloc(pool, 100);
+		test_assert_idx(mem_is_zero(mem[i], 100), i);
+		test_assert_idx(pool_slab_contains(pool, mem[i]), i);
+		memset(mem[i], 0xff, 100);
+	}
+	test_assert(!pool_slab_contains(pool, stack_mem));
+
+	/* all of them are in the 128 byte size class */
+	pool_slab_get_stats(pool, &stats);
+	test_assert(stats.used_size == N_ELEMENTS(mem) * 128);
+	test_assert(stats.large_count == 0);
+	test_assert(stats.chunk_count == 2);
+	test_assert(stats.alloc_size >= stats.used_size + stats.free_size);
+	for (i = 0; pool_slab_get_class_stats(pool, i, &class_stats); i++) {
+		if (class_stats.object_size == 128) {
+			test_assert(class_stats.used_count == N_ELEMENTS(mem));
+			test_assert(class_stats.chunk_count == 2);
+		} else {
+			test_assert(class_stats.used_count == 0);
+		}
+	}
+
+	/* freed memory is reused and zeroed again */
+	mem2 = mem[500];
+	p_free(pool, mem[500]);
+	mem[500] = p_malloc(pool, 120);
+	test_assert(mem[500] == mem2);
+	test_assert(mem_is_zero(mem[500], 120));
+
+	for (i = 0; i < N_ELEMENTS(mem); i++)
+		p_free(pool, mem[i]);
+	/* one empty chunk is kept for reuse */
+	pool_slab_get_stats(pool, &stats);
+	test_assert(stats.used_size == 0);
+	test_assert(stats.chunk_count == 1);
+
+	pool_unref(&pool);
+	test_end();
+}
+
+static void test_mempool_slab_realloc(void)
+{
+	struct pool_slab_stats stats;
+	pool_t pool;
+	unsigned char *mem, *mem2;
+
+	test_begin("mempool_slab realloc");
+	pool = pool_slab_create("test");
+
+	/* within the same size class */
+	mem = p_malloc(pool, 20);
+	memset(mem, 'a', 20);
+	mem2 = p_realloc(pool, mem, 20, 30);
+	test_assert(mem2 == mem);
+	test_assert(mem[19] == 'a' && mem_is_zero(mem + 20, 10));
+
+	/* to a larger size class */
+	mem = p_realloc(pool, mem, 30, 200);
+	test_assert(mem[0] == 'a' && mem[19] == 'a');
+	test_assert(mem_is_zero(mem + 20, 180));
+	memset(mem, 'b', 200);
+
+	/* to a large allocation and back */
+	mem = p_realloc(pool, mem, 200, 10000);
+	test_assert(mem[199] == 'b' && mem_is_zero(mem + 200, 9800));
+	test_assert(pool_slab_contains(pool, mem));
+	pool_slab_get_stats(pool, &stats);
+	test_assert(stats.large_count == 1);
+	test_assert(stats.used_size == 10000);
+
+	mem = p_realloc(pool, mem, 10000, 20000);
+	test_assert(mem[199] == 'b' && mem_is_zero(mem + 200, 19800));
+	p_free(pool, mem);
+	pool_slab_get_stats(pool, &stats);
+	test_assert(stats.large_count == 0);
+	test_assert(stats.used_size == 0);
+
+	/* clearing frees everything */
+	(void)p_malloc(pool, 10);
+	(void)p_malloc(pool, 5000);
+	p_clear(pool);
+	pool_slab_get_stats(pool, &stats);
+	test_assert(stats.chunk_count == 0);
+	test_assert(stats.large_count == 0);
+	test_assert(stats.used_size == 0);
+
+	pool_unref(&pool);
+	test_end();
+}
+
+void test_mempool_slab(void)
+{
+	test_mempool_slab_alloc();
+	test_mempool_slab_realloc();
+}
@@ -51,6 +51,43 @@ static bool test_str_find_substring(const char *key, int expected_pos)
 	return TRUE;
 }
 
+static bool test_str_find_random_text(void)
+{
+	unsigned char text[256];
+	char key[8];
+	struct str_find_context *ctx;
+	unsigned int i, text_len, key_len, pos, block_len, expected_pos;
+	bool found;
+
+	text_len = i_rand_minmax(1, sizeof(text));
+	for (i = 0; i < text_len; i++)
+		text[i] = 'a' + i_rand_limit(4);
+	key_len = i_rand_minmax(1, sizeof(key) - 1);
+	for (i = 0; i < key_len; i++)
+		key[i] = 'a' + i_rand_limit(4);
+	key[key_len] = '\0';
+
+	expected_pos = UINT_MAX;
+	for (i = 0; i + key_len <= text_len; i++) {
+		if (memcmp(text + i, key, key_len) == 0) {
+			expected_pos = i + key_len;
+			break;
+		}
+	}
+
+	ctx = str_find_init(pool_datastack_create(), key);
+	found = FALSE;
+	for (pos = 0; pos < text_len && !found; pos += block_len) {
+		block_len = i_rand_minmax(1, text_len - pos);
+		if (str_find_more(ctx, text + pos, block_len)) {
+			found = TRUE;
+			if (pos + str_find_get_match_end_pos(ctx) != expected_pos)
+				return FALSE;
+		}
+	}
+	return found == (expected_pos != UINT_MAX);
+}
+
 struct str_find_input {
 	const char *str;
 	int pos;
@@ -83,4 +120,10 @@ void test_str_find(void)
 	for (i = 0; i < N_ELEMENTS(fail_input) && success; i++)
 		success = test_str_find_substring(fail_input[i], -1);
 	test_out("str_find()", success);
+
+	success = TRUE;
+	for (i = 0; i < 1000 && success; i++) T_BEGIN {
+		success = test_str_find_random_text();
+	} T_END;
+	test_out("str_find() random", success);
 }
@@ -0,0 +1,153 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "test-lib.h"
+#include "timing-wheel.h"
+
+#define TEST_TICK_BITS 6
+#define TEST_TICK_MSECS (1U << TEST_TICK_BITS)
+
+struct tw_test_item {
+	struct timing_wheel_item item;
+	uint64_t expire_msecs;
+};
+
+static void test_timing_wheel_items_init(struct tw_test_item *items,
+					 unsigned int count)
+{
+	for (unsigned int i = 0; i < count; i++) {
+		i_zero(&items[i]);
+		items[i].item.slot = UINT_MAX;
+	}
+}
+
+static void test_timing_wheel_basic(void)
+{
+	struct timing_wheel *wheel;
+	struct tw_test_item items[3];
+	struct timing_wheel_item *item;
+	uint64_t now = 1000000, msecs;
+
+	test_begin("timing wheel basic");
+	test_timing_wheel_items_init(items, N_ELEMENTS(items));
+	wheel = timing_wheel_init(TEST_TICK_BITS, now);
+	test_assert(!timing_wheel_get_next_msecs(wheel, &msecs));
+	test_assert(timing_wheel_pop_expired(wheel, now) == NULL);
+
+	timing_wheel_add(wheel, &items[0].item, now + 1000);
+	timing_wheel_add(wheel, &items[1].item, now + 5000);
+	timing_wheel_add(wheel, &items[2].item, now + 200000);
+	test_assert(timing_wheel_count(wheel) == 3);
+	test_assert(timing_wheel_item_is_added(&items[1].item));
+
+	test_assert(timing_wheel_get_next_msecs(wheel, &msecs));
+	test_assert(msecs <= now + 1000);
+	test_assert(timing_wheel_pop_expired(wheel, now + 500) == NULL);
+
+	/* removing doesn't affect the others */
+	timing_wheel_remove(wheel, &items[1].item);
+	test_assert(!timing_wheel_item_is_added(&items[1].item));
+	test_assert(timing_wheel_count(wheel) == 2);
+
+	/* returned at most one tick early */
+	item = timing_wheel_pop_expired(wheel, now + 1000);
+	test_assert(item == &items[0].item);
+	test_assert(timing_wheel_pop_expired(wheel, now + 1000) == NULL);
+	test_assert(timing_wheel_get_next_msecs(wheel, &msecs));
+	test_assert(msecs > now + 1000 && msecs <= now + 200000);
+
+	test_assert(timing_wheel_pop_expired(wheel,
+		now + 200000 - TEST_TICK_MSECS - 1) == NULL);
+	item = timing_wheel_pop_expired(wheel, now + 200000);
+	test_assert(item == &items[2].item);
+	test_assert(timing_wheel_count(wheel) == 0);
+	test_assert(!timing_wheel_get_next_msecs(wheel, &msecs));
+
+	/* expiration times in the past */
+	timing_wheel_add(wheel, &items[0].item, now);
+	test_assert(timing_wheel_pop_expired(wheel, now + 200000) ==
+		    &items[0].item);
+
+	/* pop_any() ignores the times, and the time can be changed when the
+	   wheel is empty */
+	timing_wheel_add(wheel, &items[0].item, now + 300000);
+	timing_wheel_add(wheel, &items[1].item, now + 3000000000ULL);
+	test_assert(timing_wheel_pop_any(wheel) != NULL);
+	test_assert(timing_wheel_pop_any(wheel) != NULL);
+	test_assert(timing_wheel_pop_any(wheel) == NULL);
+	timing_wheel_set_time(wheel, now);
+	timing_wheel_add(wheel, &items[0].item, now + 100);
+	test_assert(timing_wheel_pop_expired(wheel, now + 100) ==
+		    &items[0].item);
+
+	timing_wheel_deinit(&wheel);
+	test_end();
+}
+
+static void test_timing_wheel_random(void)
+{
+#define TEST_ITEM_COUNT 1000
+	struct timing_wheel *wheel;
+	struct tw_test_item items[TEST_ITEM_COUNT];
+	struct timing_wheel_item *item;
+	uint64_t now = i_rand_limit(1000000), msecs, min_expire;
+	unsigned int i, n, added = 0;
+
+	test_begin("timing wheel random");
+	test_timing_wheel_items_init(items, N_ELEMENTS(items));
+	wheel = timing_wheel_init(TEST_TICK_BITS, now);
+
+	for (n = 0; n < 20000 && !test_has_failed(); n++) {
+		/* add, reset or remove a random item */
+		i = i_rand_limit(TEST_ITEM_COUNT);
+		if (timing_wheel_item_is_added(&items[i].item)) {
+			timing_wheel_remove(wheel, &items[i].item);
+			added--;
+		}
+		if (i_rand_limit(4) != 0) {
+			/* mostly short times, some very long */
+			items[i].expire_msecs = now +
+				(i_rand_limit(10) == 0 ?
+				 i_rand_limit(1U << 31) :
+				 i_rand_limit(100000));
+			timing_wheel_add(wheel, &items[i].item,
+					 items[i].expire_msecs);
+			added++;
+		}
+		test_assert(timing_wheel_count(wheel) == added);
+
+		/* next_msecs must not be later than any expiration */
+		min_expire = UINT64_MAX;
+		for (i = 0; i < TEST_ITEM_COUNT; i++) {
+			if (timing_wheel_item_is_added(&items[i].item))
+				min_expire = I_MIN(min_expire,
+						   items[i].expire_msecs);
+		}
+		if (timing_wheel_get_next_msecs(wheel, &msecs))
+			test_assert(msecs <= min_expire);
+		else
+			test_assert(added == 0);
+
+		/* move time forward, sometimes a lot */
+		now += i_rand_limit(10) == 0 ? i_rand_limit(1000000) :
+			i_rand_limit(100);
+		while ((item = timing_wheel_pop_expired(wheel, now)) != NULL) {
+			struct tw_test_item *titem =
+				container_of(item, struct tw_test_item, item);
+			test_assert(titem->expire_msecs < now + TEST_TICK_MSECS);
+			added--;
+		}
+		/* everything expired must have been returned */
+		for (i = 0; i < TEST_ITEM_COUNT; i++) {
+			if (timing_wheel_item_is_added(&items[i].item))
+				test_assert_idx(items[i].expire_msecs > now, i);
+		}
+	}
+	timing_wheel_deinit(&wheel);
+	test_end();
+}
+
+void test_timing_wheel(void)
+{
+	test_timing_wheel_basic();
+	test_timing_wheel_random();
+}
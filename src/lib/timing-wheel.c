@@ -0,0 +1,248 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "llist.h"
+#include "timing-wheel.h"
+
+/* Each level has 64 slots. Level 0 slots are one tick long, level 1 slots
+   64 ticks, level 2 slots 64*64 ticks, etc. When the current tick reaches
+   the beginning of a higher level slot, its items are cascaded down to the
+   lower levels. */
+#define WHEEL_LEVEL_BITS 6
+#define WHEEL_LEVEL_SLOTS (1U << WHEEL_LEVEL_BITS)
+#define WHEEL_LEVEL_MASK (WHEEL_LEVEL_SLOTS - 1)
+#define WHEEL_LEVELS 5
+#define WHEEL_SLOT_COUNT (WHEEL_LEVELS * WHEEL_LEVEL_SLOTS)
+
+struct timing_wheel {
+	unsigned int tick_bits;
+	unsigned int count;
+	/* All the items whose tick is <= cur_tick are in the level 0 slot
+	   of cur_tick. */
+	uint64_t cur_tick;
+	/* If next_tick_valid, the wheel doesn't need to be processed before
+	   next_tick. */
+	uint64_t next_tick;
+	bool next_tick_valid;
+
+	struct timing_wheel_item *slots[WHEEL_SLOT_COUNT];
+};
+
+struct timing_wheel *
+timing_wheel_init(unsigned int tick_bits, uint64_t now_msecs)
+{
+	struct timing_wheel *wheel;
+
+	i_assert(tick_bits < 32);
+
+	wheel = i_new(struct timing_wheel, 1);
+	wheel->tick_bits = tick_bits;
+	wheel->cur_tick = now_msecs >> tick_bits;
+	return wheel;
+}
+
+void timing_wheel_deinit(struct timing_wheel **_wheel)
+{
+	struct timing_wheel *wheel = *_wheel;
+
+	*_wheel = NULL;
+	i_free(wheel);
+}
+
+unsigned int timing_wheel_count(const struct timing_wheel *wheel)
+{
+	return wheel->count;
+}
+
+static unsigned int
+timing_wheel_get_slot(const struct timing_wheel *wheel, uint64_t tick,
+		      uint64_t *process_tick_r)
+{
+	uint64_t diff;
+	unsigned int level, shift = 0;
+
+	if (tick < wheel->cur_tick)
+		tick = wheel->cur_tick;
+	diff = tick - wheel->cur_tick;
+
+	for (level = 0; level < WHEEL_LEVELS - 1; level++) {
+		if (diff < (1ULL << (WHEEL_LEVEL_BITS * (level + 1))))
+			break;
+	}
+	shift = level * WHEEL_LEVEL_BITS;
+	if (diff >= (1ULL << (shift + WHEEL_LEVEL_BITS))) {
+		/* too far in the future - put it to the furthest slot. It's
+		   placed again using its real tick when it's cascaded. */
+		tick = wheel->cur_tick + ((uint64_t)WHEEL_LEVEL_MASK << shift);
+	}
+	*process_tick_r = (tick >> shift) << shift;
+	return level * WHEEL_LEVEL_SLOTS + ((tick >> shift) & WHEEL_LEVEL_MASK);
+}
+
+static void
+timing_wheel_add_tick(struct timing_wheel *wheel,
+		      struct timing_wheel_item *item, uint64_t tick)
+{
+	uint64_t process_tick;
+	unsigned int slot;
+
+	slot = timing_wheel_get_slot(wheel, tick, &process_tick);
+	item->tick = tick;
+	item->slot = slot;
+	DLLIST_PREPEND(&wheel->slots[slot], item);
+	wheel->count++;
+
+	if (wheel->next_tick_valid && process_tick < wheel->next_tick)
+		wheel->next_tick = process_tick;
+}
+
+void timing_wheel_add(struct timing_wheel *wheel,
+		      struct timing_wheel_item *item, uint64_t expire_msecs)
+{
+	i_assert(!timing_wheel_item_is_added(item));
+
+	timing_wheel_add_tick(wheel, item, expire_msecs >> wheel->tick_bits);
+}
+
+void timing_wheel_remove(struct timing_wheel *wheel,
+			 struct timing_wheel_item *item)
+{
+	i_assert(timing_wheel_item_is_added(item));
+	i_assert(wheel->count > 0);
+
+	DLLIST_REMOVE(&wheel->slots[item->slot], item);
+	item->slot = UINT_MAX;
+	wheel->count--;
+}
+
+static uint64_t timing_wheel_find_next_tick(const struct timing_wheel *wheel)
+{
+	uint64_t base, next_tick = UINT64_MAX;
+	unsigned int level, shift, i;
+
+	for (level = 0; level < WHEEL_LEVELS; level++) {
+		shift = level * WHEEL_LEVEL_BITS;
+		base = wheel->cur_tick >> shift;
+		/* Level 0 slots contain the ticks cur_tick..cur_tick+63.
+		   Higher level slots are processed once the current tick
+		   reaches them, which can be up to a full round later. */
+		for (i = (level == 0 ? 0 : 1);
+		     i < WHEEL_LEVEL_SLOTS + (level == 0 ? 0 : 1); i++) {
+			unsigned int slot = level * WHEEL_LEVEL_SLOTS +
+				((base + i) & WHEEL_LEVEL_MASK);
+
+			if (wheel->slots[slot] != NULL) {
+				next_tick = I_MIN(next_tick,
+						  (base + i) << shift);
+				break;
+			}
+		}
+	}
+	i_assert(next_tick != UINT64_MAX);
+	return next_tick;
+}
+
+bool timing_wheel_get_next_msecs(struct timing_wheel *wheel,
+				 uint64_t *msecs_r)
+{
+	if (wheel->count == 0)
+		return FALSE;
+
+	if (!wheel->next_tick_valid) {
+		wheel->next_tick = timing_wheel_find_next_tick(wheel);
+		wheel->next_tick_valid = TRUE;
+	}
+	*msecs_r = wheel->next_tick << wheel->tick_bits;
+	return TRUE;
+}
+
+static void timing_wheel_cascade(struct timing_wheel *wheel, unsigned int slot)
+{
+	struct timing_wheel_item *item, *next;
+
+	item = wheel->slots[slot];
+	wheel->slots[slot] = NULL;
+	for (; item != NULL; item = next) {
+		next = item->next;
+		item->prev = item->next = NULL;
+		wheel->count--;
+		timing_wheel_add_tick(wheel, item, item->tick);
+	}
+}
+
+static void timing_wheel_advance(struct timing_wheel *wheel)
+{
+	unsigned int level, shift;
+
+	wheel->cur_tick++;
+	for (level = 1; level < WHEEL_LEVELS; level++) {
+		shift = level * WHEEL_LEVEL_BITS;
+		if ((wheel->cur_tick & ((1ULL << shift) - 1)) != 0)
+			break;
+		timing_wheel_cascade(wheel, level * WHEEL_LEVEL_SLOTS +
+				     ((wheel->cur_tick >> shift) &
+				      WHEEL_LEVEL_MASK));
+	}
+}
+
+struct timing_wheel_item *
+timing_wheel_pop_expired(struct timing_wheel *wheel, uint64_t now_msecs)
+{
+	uint64_t now_tick = now_msecs >> wheel->tick_bits;
+	struct timing_wheel_item *item;
+
+	if (wheel->count == 0) {
+		if (wheel->cur_tick < now_tick)
+			wheel->cur_tick = now_tick;
+		wheel->next_tick_valid = FALSE;
+		return NULL;
+	}
+
+	for (;;) {
+		item = wheel->slots[wheel->cur_tick & WHEEL_LEVEL_MASK];
+		if (item != NULL) {
+			timing_wheel_remove(wheel, item);
+			return item;
+		}
+		if (wheel->cur_tick >= now_tick)
+			break;
+
+		if (wheel->next_tick_valid &&
+		    wheel->next_tick > wheel->cur_tick + 1) {
+			/* nothing to do before next_tick - skip over the
+			   empty ticks, but let timing_wheel_advance()
+			   handle next_tick itself. */
+			wheel->cur_tick = I_MIN(wheel->next_tick, now_tick) - 1;
+		}
+		timing_wheel_advance(wheel);
+	}
+	/* the current tick's slot is now empty, so next_tick can't be the
+	   current tick anymore */
+	if (wheel->next_tick_valid && wheel->next_tick <= wheel->cur_tick)
+		wheel->next_tick_valid = FALSE;
+	return NULL;
+}
+
+struct timing_wheel_item *timing_wheel_pop_any(struct timing_wheel *wheel)
+{
+	struct timing_wheel_item *item;
+	unsigned int i;
+
+	if (wheel->count == 0)
+		return NULL;
+	for (i = 0; i < WHEEL_SLOT_COUNT; i++) {
+		if ((item = wheel->slots[i]) != NULL) {
+			timing_wheel_remove(wheel, item);
+			return item;
+		}
+	}
+	i_unreached();
+}
+
+void timing_wheel_set_time(struct timing_wheel *wheel, uint64_t now_msecs)
+{
+	i_assert(wheel->count == 0);
+
+	wheel->cur_tick = now_msecs >> wheel->tick_bits;
+	wheel->next_tick_valid = FALSE;
+}
@@ -0,0 +1,59 @@
+#ifndef TIMING_WHEEL_H
+#define TIMING_WHEEL_H
+
+/* Hierarchical timing wheel. Items are kept in lists by their expiration
+   tick, so adding and removing them is O(1) regardless of how many items
+   there are. The expiration times are only tick-accurate: an item may be
+   returned by timing_wheel_pop_expired() up to one tick before its
+   expiration time, so callers needing more accuracy must check the exact
+   time themselves. The items you add must begin with a struct
+   timing_wheel_item. */
+
+struct timing_wheel_item {
+	/* Updated automatically */
+	struct timing_wheel_item *prev, *next;
+	uint64_t tick;
+	/* Slot index in the wheel, or UINT_MAX if not added. */
+	unsigned int slot;
+	/* [your own data] */
+};
+
+/* Create a new wheel with 2^tick_bits msecs long ticks. now_msecs is the
+   current time, from which the ticks are counted. */
+struct timing_wheel *
+timing_wheel_init(unsigned int tick_bits, uint64_t now_msecs);
+void timing_wheel_deinit(struct timing_wheel **wheel);
+
+/* Return number of items in the wheel. */
+unsigned int timing_wheel_count(const struct timing_wheel *wheel) ATTR_PURE;
+
+/* Add a new item to expire at the given time. Times in the past expire at
+   the next timing_wheel_pop_expired() call. */
+void timing_wheel_add(struct timing_wheel *wheel,
+		      struct timing_wheel_item *item, uint64_t expire_msecs);
+/* Remove the specified item from the wheel. */
+void timing_wheel_remove(struct timing_wheel *wheel,
+			 struct timing_wheel_item *item);
+static inline bool
+timing_wheel_item_is_added(const struct timing_wheel_item *item)
+{
+	return item->slot != UINT_MAX;
+}
+
+/* Returns the time by which timing_wheel_pop_expired() should be called
+   next, or FALSE if the wheel is empty. This may be earlier than the
+   earliest item's expiration time. */
+bool timing_wheel_get_next_msecs(struct timing_wheel *wheel,
+				 uint64_t *msecs_r);
+/* Remove and return an item whose tick has been reached by now_msecs.
+   Returns NULL when there are no more such items. */
+struct timing_wheel_item *
+timing_wheel_pop_expired(struct timing_wheel *wheel, uint64_t now_msecs);
+/* Remove and return any item, ignoring expiration times. Returns NULL if the
+   wheel is empty. */
+struct timing_wheel_item *timing_wheel_pop_any(struct timing_wheel *wheel);
+/* Change the wheel's current time. This can be used only while the wheel is
+   empty, e.g. after the system time has jumped. */
+void timing_wheel_set_time(struct timing_wheel *wheel, uint64_t now_msecs);
+
+#endif
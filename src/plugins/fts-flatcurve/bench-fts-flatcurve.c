@@ -0,0 +1,210 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "istream.h"
+#include "module-dir.h"
+#include "str.h"
+#include "strnum.h"
+#include "time-util.h"
+#include "settings.h"
+#include "master-service.h"
+#include "mail-search-build.h"
+#include "test-mail-storage-common.h"
+#include "fts-settings.h"
+#include "fts-plugin.h"
+#include "fts-flatcurve-settings.h"
+#include "fts-flatcurve-plugin.h"
+
+#include <stdio.h>
+
+/**
+ * Measures how fast messages are indexed to fts-flatcurve with the
+ * documents written inline (fts_flatcurve_write_queue_size=0) and with
+ * the writer thread.
+ *
+ * The messages are generated from a small vocabulary of short words. The
+ * mailbox is indexed the same way as the indexer-worker does it. The
+ * writer thread is disabled by default, and this is meant for deciding
+ * whether it's worth enabling on a given system.
+ */
+
+#define BENCH_WORD_COUNT 2000
+#define BENCH_MAIL_WORDS 300
+
+static struct module bench_fts_module, bench_flatcurve_module;
+
+static void bench_word_append(string_t *str, unsigned int word)
+{
+	/* short words of letters, all unique */
+	do {
+		str_append_c(str, 'a' + word % 26);
+		word /= 26;
+	} while (word > 0);
+	str_append(str, "xy");
+}
+
+static void bench_mail_save(struct mailbox *box, unsigned int i)
+{
+	struct mailbox_transaction_context *trans;
+	struct mail_save_context *save_ctx;
+	struct istream *input;
+	string_t *str = t_str_new(4096);
+	unsigned int j;
+
+	str_printfa(str, "Subject: mail %u\n\n", i);
+	for (j = 0; j < BENCH_MAIL_WORDS; j++) {
+		/* the same pseudo-random words for each run */
+		bench_word_append(str, (uint32_t)((i * BENCH_MAIL_WORDS + j) *
+						  2654435761U) %
+				  BENCH_WORD_COUNT);
+		str_append_c(str, j % 12 == 11 ? '\n' : ' ');
+	}
+	input = i_stream_create_from_data(str_data(str), str_len(str));
+	trans = mailbox_transaction_begin(box,
+			MAILBOX_TRANSACTION_FLAG_EXTERNAL, __func__);
+	save_ctx = mailbox_save_alloc(trans);
+	if (mailbox_save_begin(&save_ctx, input) < 0 ||
+	    mailbox_save_continue(save_ctx) < 0 ||
+	    mailbox_save_finish(&save_ctx) < 0 ||
+	    mailbox_transaction_commit(&trans) < 0) {
+		i_fatal("Failed to save mail: %s",
+			mailbox_get_last_internal_error(box, NULL));
+	}
+	i_stream_unref(&input);
+}
+
+static uint64_t bench_mailbox_index(struct mailbox *box)
+{
+	struct mailbox_transaction_context *trans;
+	struct mail_search_args *args;
+	struct mail_search_context *search_ctx;
+	struct mail *mail;
+	uint64_t ts;
+	int ret = 0;
+
+	args = mail_search_build_init();
+	mail_search_build_add_all(args);
+
+	ts = i_nanoseconds();
+	trans = mailbox_transaction_begin(box,
+			MAILBOX_TRANSACTION_FLAG_NO_CACHE_DEC, __func__);
+	search_ctx = mailbox_search_init(trans, args, NULL,
+					 MAIL_FETCH_STREAM_HEADER |
+					 MAIL_FETCH_STREAM_BODY, NULL);
+	while (mailbox_search_next(search_ctx, &mail)) {
+		if (mail_precache(mail) < 0)
+			ret = -1;
+	}
+	if (mailbox_search_deinit(&search_ctx) < 0)
+		ret = -1;
+	if (mailbox_transaction_commit(&trans) < 0)
+		ret = -1;
+	ts = i_nanoseconds() - ts;
+	if (ret < 0) {
+		i_fatal("Indexing failed: %s",
+			mailbox_get_last_internal_error(box, NULL));
+	}
+	mail_search_args_unref(&args);
+	return ts;
+}
+
+static uint64_t
+bench_index(unsigned int messages_count, unsigned int write_queue_size)
+{
+	const char *const extra_input[] = {
+		"mail_plugins=fts fts_flatcurve",
+		"fts+=flatcurve",
+		"language+=en",
+		"language/en/language_default=yes",
+		t_strdup_printf("fts_flatcurve_write_queue_size=%u",
+				write_queue_size),
+		NULL
+	};
+	struct test_mail_storage_settings set = {
+		.driver = "sdbox",
+		.extra_input = extra_input,
+	};
+	struct test_mail_storage_ctx *ctx;
+	struct mailbox *box;
+	unsigned int i;
+	uint64_t nsecs;
+
+	ctx = test_mail_storage_init();
+	test_mail_storage_init_user(ctx, &set);
+	box = mailbox_alloc(ctx->user->namespaces->list, "INBOX", 0);
+	if (mailbox_open(box) < 0)
+		i_fatal("mailbox_open() failed");
+	for (i = 1; i <= messages_count; i++) T_BEGIN {
+		bench_mail_save(box, i);
+	} T_END;
+	if (mailbox_sync(box, 0) < 0)
+		i_fatal("mailbox_sync() failed");
+
+	nsecs = bench_mailbox_index(box);
+
+	mailbox_free(&box);
+	test_mail_storage_deinit_user(ctx);
+	test_mail_storage_deinit(&ctx);
+	return nsecs;
+}
+
+static void print_usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [<messages> [<write queue size>]]\n", prog);
+	fprintf(stderr, "Indexes 10000 messages with queue size 16 "
+		"if nothing given\n");
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int messages_count = 10000, write_queue_size = 16;
+	uint64_t inline_nsecs, thread_nsecs;
+
+	master_service = master_service_init("bench-fts-flatcurve",
+					     MASTER_SERVICE_FLAG_STANDALONE |
+					     MASTER_SERVICE_FLAG_DONT_SEND_STATS |
+					     MASTER_SERVICE_FLAG_NO_CONFIG_SETTINGS |
+					     MASTER_SERVICE_FLAG_NO_SSL_INIT |
+					     MASTER_SERVICE_FLAG_NO_INIT_DATASTACK_FRAME,
+					     &argc, &argv, "");
+	argv += optind;
+	argc -= optind;
+	if (argc > 2 ||
+	    (argc > 0 && (str_to_uint(argv[0], &messages_count) < 0 ||
+			  messages_count == 0)) ||
+	    (argc > 1 && (str_to_uint(argv[1], &write_queue_size) < 0 ||
+			  write_queue_size == 0)))
+		print_usage(master_service_get_name(master_service));
+
+	bench_fts_module.path = i_strdup("lib20_fts_plugin.so");
+	bench_fts_module.name = i_strdup("fts_plugin");
+	bench_flatcurve_module.path = i_strdup("lib21_fts_flatcurve_plugin.so");
+	bench_flatcurve_module.name = i_strdup("fts_flatcurve_plugin");
+	settings_info_register(&fts_setting_parser_info);
+	settings_info_register(&fts_flatcurve_setting_parser_info);
+	fts_plugin_init(&bench_fts_module);
+	fts_flatcurve_plugin_init(&bench_flatcurve_module);
+
+	inline_nsecs = bench_index(messages_count, 0);
+	thread_nsecs = bench_index(messages_count, write_queue_size);
+
+	printf("%u messages\n", messages_count);
+	printf("\tInline: %0.02lf ms, %0.0lf messages/s\n",
+	       inline_nsecs / 1000000.0,
+	       messages_count * 1000000000.0 / inline_nsecs);
+	printf("\tWriter thread (queue size %u): %0.02lf ms, "
+	       "%0.0lf messages/s\n", write_queue_size,
+	       thread_nsecs / 1000000.0,
+	       messages_count * 1000000000.0 / thread_nsecs);
+	printf("\tSpeedup: %0.02lfx\n", (double)inline_nsecs / thread_nsecs);
+
+	fts_flatcurve_plugin_deinit();
+	fts_plugin_deinit();
+	i_free(bench_fts_module.path);
+	i_free(bench_fts_module.name);
+	i_free(bench_flatcurve_module.path);
+	i_free(bench_flatcurve_module.name);
+	master_service_deinit(&master_service);
+	return 0;
+}
@@ -94,6 +94,7 @@ cmd_fts_flatcurve_mailbox_run_box(struct flatcurve_fts_backend *backend,
 		doveadm_print_num(stats.messages);
 		doveadm_print_num(stats.shards);
 		doveadm_print_num(stats.version);
+		doveadm_print_num(stats.merge_debt);
 		break;
 	default:
 		break;
@@ -207,6 +208,7 @@ cmd_fts_flatcurve_mailbox_init(struct doveadm_mail_cmd_context *_ctx)
 		doveadm_print_header_simple("messages");
 		doveadm_print_header_simple("shards");
 		doveadm_print_header_simple("version");
+		doveadm_print_header_simple("merge_debt");
 		break;
 	default:
 		break;
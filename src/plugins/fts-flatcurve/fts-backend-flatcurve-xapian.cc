@@ -7,6 +7,7 @@ extern "C" {
 #include "file-create-locked.h"
 #include "hash.h"
 #include "hex-binary.h"
+#include "ioloop.h"
 #include "message-header-parser.h"
 #include "path-util.h"
 #include "mail-storage-private.h"
@@ -18,6 +19,7 @@ extern "C" {
 #include "time-util.h"
 #include "fts-backend-flatcurve.h"
 #include "fts-backend-flatcurve-xapian.h"
+#include "fts-indexer.h"
 #include <dirent.h>
 };
 #include <cstdio>
@@ -39,6 +41,17 @@ extern "C" {
 #include <algorithm>
 #include <sstream>
 #include <string>
+#include <vector>
+#ifdef HAVE_FLATCURVE_WRITER_THREAD
+#  include <atomic>
+#  include <chrono>
+#  include <condition_variable>
+#  include <deque>
+#  include <mutex>
+#  include <system_error>
+#  include <thread>
+#  include <signal.h>
+#endif
 
 /* How Xapian DBs work in fts-flatcurve: all data lives in under one
  * per-mailbox directory (FTS_FLATCURVE_LABEL) stored at the root of the
@@ -76,6 +89,33 @@ extern "C" {
  * are not intended to persist between sessions. */
 #define FLATCURVE_XAPIAN_DB_OPTIMIZE "optimize"
 
+/* Shards of a mailbox that is indexed in chunks by multiple processes in
+ * parallel. A chunk is written to "building.<set>.<idx>", which is renamed to
+ * "built.<set>.<idx>" once the chunk has been fully indexed. The process
+ * that finishes the last chunk of the set renames all of them to index
+ * shards. Until then they are never read, so the chunks can't leave holes
+ * in the UIDs visible to readers. Shards of sets that never complete (a
+ * chunk failed or its process died) are deleted once they are stale. */
+#define FLATCURVE_XAPIAN_DB_BUILDING_PREFIX "building."
+#define FLATCURVE_XAPIAN_DB_BUILT_PREFIX "built."
+#define FLATCURVE_XAPIAN_DB_BUILD_STALE_SECS (60*60*24)
+
+/* With fts_flatcurve_merge_factor set, index shards are merged
+ * incrementally in tiers by their size instead of optimizing them all at
+ * once when there are optimize_limit of them. Tier N has
+ * the shards with up to rotate_count * merge_factor^N messages. Once a tier
+ * has merge_factor shards, they are merged into a "merge.<timestamp>" shard,
+ * which then replaces them as an index shard of a higher tier. The merged
+ * shards are used by queries until the replacement, and each message gets
+ * rewritten only about log(messages) times. The merges are done by the
+ * indexer: the process that notices a tier needing a merge queues an
+ * OPTIMIZE request for the mailbox. Leftovers of merges that were
+ * interrupted are deleted once they are stale. */
+#define FLATCURVE_XAPIAN_DB_MERGE_PREFIX "merge."
+#define FLATCURVE_XAPIAN_DB_MERGE_STALE_SECS (60*60*24)
+/* Size of the lowest tier if rotate_count is 0 */
+#define FLATCURVE_XAPIAN_MERGE_TIER_MIN_MESSAGES 5000
+
 /* Xapian "recommendations" are that you begin your local prefix identifier
  * with "X" for data that doesn't match with a data type listed as a Xapian
  * "convention". However, this recommendation is for maintaining
@@ -121,6 +161,8 @@ enum flatcurve_xapian_db_type {
 	FLATCURVE_XAPIAN_DB_TYPE_INDEX,
 	FLATCURVE_XAPIAN_DB_TYPE_CURRENT,
 	FLATCURVE_XAPIAN_DB_TYPE_OPTIMIZE,
+	FLATCURVE_XAPIAN_DB_TYPE_BUILD,
+	FLATCURVE_XAPIAN_DB_TYPE_MERGE,
 	FLATCURVE_XAPIAN_DB_TYPE_LOCK,
 	FLATCURVE_XAPIAN_DB_TYPE_UNKNOWN
 };
@@ -130,6 +172,10 @@ struct flatcurve_xapian_db {
 	Xapian::WritableDatabase *dbw;
 	struct flatcurve_xapian_db_path *dbpath;
 	unsigned int changes;
+	/* Looked up when the DB is opened, and tracked while dbw is open,
+	 * so they can be used without waiting for the writer thread. */
+	unsigned int doccount;
+	uint32_t last_uid;
 	enum flatcurve_xapian_db_type type;
 };
 HASH_TABLE_DEFINE_TYPE(xapian_db, char *, struct flatcurve_xapian_db *);
@@ -151,12 +197,15 @@ struct flatcurve_xapian {
 	pool_t pool;
 
 	/* Current document. */
-	Xapian::Document *doc;
+	struct flatcurve_xapian_msg *msg;
 	uint32_t doc_uid;
 	unsigned int doc_updates;
-	bool doc_created:1;
 
-	/* List of mailboxes to optimize at shutdown. */
+	/* Writer thread, NULL if documents are written inline. */
+	struct flatcurve_xapian_writer *writer;
+
+	/* List of mailboxes to optimize at shutdown, or to queue for merging
+	 * to the indexer. */
 	HASH_TABLE(char *, char *) optimize;
 
 	bool deinit:1;
@@ -185,6 +234,66 @@ struct flatcurve_xapian_db_iter {
 	enum flatcurve_xapian_db_type type;
 };
 
+/* The indexed data of a message is collected as-is, and the Xapian document
+ * (with all the substring terms) is built from it only when the message is
+ * written. With fts_flatcurve_write_queue_size > 0 that happens in the
+ * writer thread. */
+struct flatcurve_xapian_msg_field {
+	/* Header only: FLATCURVE_XAPIAN_BOOLEAN_FIELD_PREFIX term of the
+	 * header name, or empty. */
+	std::string bool_term;
+	/* Header only: FLATCURVE_XAPIAN_HEADER_PREFIX prefix of the terms if
+	 * the header is indexed by name, or empty. */
+	std::string hdr_prefix;
+	std::string data;
+	bool header;
+};
+
+struct flatcurve_xapian_msg {
+	uint32_t uid;
+	std::vector<struct flatcurve_xapian_msg_field> fields;
+};
+
+#ifdef HAVE_FLATCURVE_WRITER_THREAD
+/* The writer thread builds the documents of the queued messages and writes
+ * and commits them to Xapian, while the main thread continues parsing the
+ * following messages. Dovecot's lib isn't thread-safe, so the thread uses
+ * only Xapian and the C++ library. The main thread must drain the queue
+ * before it accesses a WritableDatabase itself. */
+struct flatcurve_xapian_write_job {
+	Xapian::WritableDatabase *dbw;
+	/* NULL = commit dbw */
+	struct flatcurve_xapian_msg *msg;
+};
+
+struct flatcurve_xapian_writer {
+	std::thread thread;
+	std::mutex mutex;
+	/* Signalled when a job is queued or the thread is stopped. */
+	std::condition_variable job_cond;
+	/* Signalled when a job is finished. */
+	std::condition_variable done_cond;
+	std::deque<struct flatcurve_xapian_write_job> jobs;
+
+	unsigned int max_jobs;
+	unsigned int min_term_size;
+	unsigned int rotate_time;
+	bool substring_search;
+
+	/* The first failure. The following jobs are dropped until the main
+	 * thread has drained the queue and seen the error. */
+	std::string error;
+	std::string oom_error;
+	uint32_t oom_uid;
+
+	bool busy;
+	bool stop;
+	/* A commit took longer than rotate_time. This is checked for each
+	 * message, so it's read without the mutex. */
+	std::atomic<bool> rotate;
+};
+#endif
+
 enum flatcurve_xapian_db_opts {
 	FLATCURVE_XAPIAN_DB_NOCREATE_CURRENT = BIT(0),
 	FLATCURVE_XAPIAN_DB_IGNORE_EMPTY     = BIT(1),
@@ -235,6 +344,377 @@ fts_flatcurve_xapian_db_populate(struct flatcurve_fts_backend *backend,
 				 enum flatcurve_xapian_db_opts opts,
 				 const char **error_r);
 
+static void ATTR_NORETURN
+fts_flatcurve_xapian_out_of_memory(const char *what, uint32_t uid)
+{
+	i_fatal_status(FATAL_OUTOFMEM,
+		"Out of memory when indexing mail (%s); UID=%d "
+		"(Hint: increase indexing process vsz_limit or "
+		"define smaller commit limit value in "
+		"plugin { fts_flatcurve_commit_limit = ...})", what, uid);
+}
+
+/* This is called also by the writer thread, so it must not use anything
+ * from lib that isn't thread-safe. */
+static void
+fts_flatcurve_xapian_doc_add_terms(Xapian::Document &doc,
+				   const std::string &prefix,
+				   const std::string &data,
+				   unsigned int min_term_size,
+				   bool substring_search)
+{
+	const char *p = data.data(), *end = p + data.size();
+	std::string term;
+
+	for (; end > p; p += uni_utf8_char_bytes((unsigned char) *p)) {
+		size_t len = end - p;
+		if (len < min_term_size)
+			break;
+
+		/* Capital ASCII letters at the beginning of a Xapian term
+		   are treated as a "term prefix". Force to non-uppercase the
+		   first letter of the term to ensure it is not confused with
+		   a "term prefix". */
+		term.assign(prefix);
+		term += i_tolower(*p);
+		term.append(p + 1, len - 1);
+		doc.add_term(term);
+
+		if (!substring_search)
+			break;
+	}
+}
+
+static void
+fts_flatcurve_xapian_msg_build(const struct flatcurve_xapian_msg *msg,
+			       Xapian::Document &doc,
+			       unsigned int min_term_size,
+			       bool substring_search)
+{
+	const std::string all_prefix(FLATCURVE_XAPIAN_ALL_HEADERS_PREFIX);
+	const std::string body_prefix;
+
+	for (const struct flatcurve_xapian_msg_field &field : msg->fields) {
+		if (!field.header) {
+			fts_flatcurve_xapian_doc_add_terms(doc, body_prefix,
+				field.data, min_term_size, substring_search);
+			continue;
+		}
+		if (!field.bool_term.empty())
+			doc.add_boolean_term(field.bool_term);
+		fts_flatcurve_xapian_doc_add_terms(doc, all_prefix,
+			field.data, min_term_size, substring_search);
+		if (!field.hdr_prefix.empty()) {
+			fts_flatcurve_xapian_doc_add_terms(doc,
+				field.hdr_prefix, field.data,
+				min_term_size, substring_search);
+		}
+	}
+}
+
+/* Write the message inline. Frees msg.
+ * Returns: 0 on success, -1 on error */
+static int
+fts_flatcurve_xapian_write_msg(struct flatcurve_fts_backend *backend,
+			       struct flatcurve_xapian_db *xdb,
+			       struct flatcurve_xapian_msg *msg,
+			       const char **error_r)
+{
+	const struct fts_flatcurve_settings *set = backend->fuser->set;
+	int ret = 0;
+
+	try {
+		Xapian::Document doc;
+		fts_flatcurve_xapian_msg_build(msg, doc, set->min_term_size,
+					       set->substring_search);
+		xdb->dbw->replace_document(msg->uid, doc);
+	} catch (std::bad_alloc &b) {
+		fts_flatcurve_xapian_out_of_memory(b.what(), msg->uid);
+	} catch (Xapian::Error &e) {
+		*error_r = t_strdup_printf(
+			"Could not write message data: uid=%u; %s",
+			msg->uid, e.get_description().c_str());
+		ret = -1;
+	}
+	delete msg;
+	return ret;
+}
+
+#ifdef HAVE_FLATCURVE_WRITER_THREAD
+static void
+fts_flatcurve_xapian_writer_run(struct flatcurve_xapian_writer *writer,
+				const struct flatcurve_xapian_write_job &job,
+				std::string &error, std::string &oom_error,
+				bool &rotate)
+{
+	try {
+		if (job.msg == NULL) {
+			auto start = std::chrono::steady_clock::now();
+			job.dbw->commit();
+			rotate = writer->rotate_time > 0 &&
+				std::chrono::steady_clock::now() - start >
+				std::chrono::milliseconds(writer->rotate_time);
+		} else {
+			Xapian::Document doc;
+			fts_flatcurve_xapian_msg_build(job.msg, doc,
+				writer->min_term_size,
+				writer->substring_search);
+			job.dbw->replace_document(job.msg->uid, doc);
+		}
+	} catch (std::bad_alloc &b) {
+		oom_error = b.what();
+	} catch (Xapian::Error &e) {
+		if (job.msg == NULL)
+			error = e.get_description();
+		else {
+			error = "Could not write message data: uid=" +
+				std::to_string(job.msg->uid) + "; " +
+				e.get_description();
+		}
+	}
+}
+
+static void
+fts_flatcurve_xapian_writer_main(struct flatcurve_xapian_writer *writer)
+{
+	std::unique_lock<std::mutex> lock(writer->mutex);
+
+	for (;;) {
+		while (writer->jobs.empty() && !writer->stop)
+			writer->job_cond.wait(lock);
+		if (writer->jobs.empty())
+			break;
+
+		struct flatcurve_xapian_write_job job = writer->jobs.front();
+		writer->jobs.pop_front();
+		bool failed = !writer->error.empty() ||
+			!writer->oom_error.empty();
+		writer->busy = TRUE;
+		lock.unlock();
+
+		std::string error, oom_error;
+		bool rotate = FALSE;
+		if (!failed) {
+			fts_flatcurve_xapian_writer_run(writer, job, error,
+							oom_error, rotate);
+		}
+		uint32_t uid = job.msg == NULL ? 0 : job.msg->uid;
+		delete job.msg;
+
+		lock.lock();
+		writer->busy = FALSE;
+		if (!error.empty() && writer->error.empty())
+			writer->error = error;
+		if (!oom_error.empty() && writer->oom_error.empty()) {
+			writer->oom_error = oom_error;
+			writer->oom_uid = uid;
+		}
+		if (rotate)
+			writer->rotate.store(true);
+		writer->done_cond.notify_all();
+	}
+}
+
+static void
+fts_flatcurve_xapian_writer_start(struct flatcurve_fts_backend *backend)
+{
+	const struct fts_flatcurve_settings *set = backend->fuser->set;
+	struct flatcurve_xapian *x = backend->xapian;
+
+	if (x->writer != NULL || set->write_queue_size == 0)
+		return;
+
+	struct flatcurve_xapian_writer *writer =
+		new flatcurve_xapian_writer();
+	writer->max_jobs = set->write_queue_size;
+	writer->min_term_size = set->min_term_size;
+	writer->rotate_time = set->rotate_time;
+	writer->substring_search = set->substring_search;
+
+	/* Signals must be handled by the main thread. */
+	sigset_t sigset, old_sigset;
+	sigfillset(&sigset);
+	pthread_sigmask(SIG_BLOCK, &sigset, &old_sigset);
+	try {
+		writer->thread = std::thread(
+			fts_flatcurve_xapian_writer_main, writer);
+	} catch (std::system_error &e) {
+		e_error(backend->event, "Cannot start writer thread, "
+			"writing inline: %s", e.what());
+		delete writer;
+		writer = NULL;
+	}
+	pthread_sigmask(SIG_SETMASK, &old_sigset, NULL);
+	x->writer = writer;
+}
+
+/* Returns: 0 on success, -1 if a job has failed. With clear the failure is
+ * forgotten, so the writer continues with the following jobs. */
+static int
+fts_flatcurve_xapian_writer_check(struct flatcurve_xapian_writer *writer,
+				  std::unique_lock<std::mutex> &lock,
+				  bool clear, const char **error_r)
+{
+	if (!writer->oom_error.empty()) {
+		std::string oom_error = writer->oom_error;
+		uint32_t uid = writer->oom_uid;
+		lock.unlock();
+		fts_flatcurve_xapian_out_of_memory(oom_error.c_str(), uid);
+	}
+	if (writer->error.empty())
+		return 0;
+
+	*error_r = t_strdup(writer->error.c_str());
+	if (clear)
+		writer->error.clear();
+	return -1;
+}
+
+/* Queue writing msg, or committing dbw if msg is NULL. Waits if the queue
+ * is full. Frees msg.
+ * Returns: 0 on success, -1 on error */
+static int
+fts_flatcurve_xapian_writer_push(struct flatcurve_fts_backend *backend,
+				 Xapian::WritableDatabase *dbw,
+				 struct flatcurve_xapian_msg *msg,
+				 const char **error_r)
+{
+	struct flatcurve_xapian_writer *writer = backend->xapian->writer;
+	std::unique_lock<std::mutex> lock(writer->mutex);
+
+	while (writer->jobs.size() >= writer->max_jobs &&
+	       writer->error.empty() && writer->oom_error.empty())
+		writer->done_cond.wait(lock);
+	if (fts_flatcurve_xapian_writer_check(
+		writer, lock, FALSE, error_r) < 0) {
+		delete msg;
+		return -1;
+	}
+
+	struct flatcurve_xapian_write_job job = { dbw, msg };
+	writer->jobs.push_back(job);
+	writer->job_cond.notify_one();
+	return 0;
+}
+
+/* Wait until the writer thread has finished all the queued jobs.
+ * Returns: 0 on success, -1 if any of them failed */
+static int
+fts_flatcurve_xapian_writer_drain(struct flatcurve_fts_backend *backend,
+				  const char **error_r)
+{
+	struct flatcurve_xapian_writer *writer = backend->xapian->writer;
+
+	if (writer == NULL)
+		return 0;
+
+	std::unique_lock<std::mutex> lock(writer->mutex);
+	while (!writer->jobs.empty() || writer->busy)
+		writer->done_cond.wait(lock);
+	return fts_flatcurve_xapian_writer_check(writer, lock, TRUE, error_r);
+}
+
+/* Queue commits of all the DBs that have uncommitted changes.
+ * Returns: 0 on success, -1 on error */
+static int
+fts_flatcurve_xapian_writer_commit(struct flatcurve_fts_backend *backend,
+				   const char **error_r)
+{
+	struct flatcurve_xapian *x = backend->xapian;
+	struct hash_iterate_context *iter;
+	void *key, *val;
+	int ret = 0;
+
+	iter = hash_table_iterate_init(x->dbs);
+	while (hash_table_iterate(iter, x->dbs, &key, &val)) {
+		struct flatcurve_xapian_db *xdb =
+			(struct flatcurve_xapian_db *)val;
+		if (xdb->dbw == NULL || xdb->changes == 0)
+			continue;
+		if (fts_flatcurve_xapian_writer_push(
+			backend, xdb->dbw, NULL, error_r) < 0) {
+			ret = -1;
+			break;
+		}
+		xdb->changes = 0;
+	}
+	hash_table_iterate_deinit(&iter);
+	x->doc_updates = 0;
+	return ret;
+}
+
+static bool
+fts_flatcurve_xapian_writer_rotate_requested(struct flatcurve_fts_backend *backend)
+{
+	struct flatcurve_xapian_writer *writer = backend->xapian->writer;
+
+	if (writer == NULL)
+		return FALSE;
+
+	return writer->rotate.exchange(false);
+}
+
+static void
+fts_flatcurve_xapian_writer_stop(struct flatcurve_fts_backend *backend)
+{
+	struct flatcurve_xapian_writer *writer = backend->xapian->writer;
+	const char *error;
+
+	if (writer == NULL)
+		return;
+
+	if (fts_flatcurve_xapian_writer_drain(backend, &error) < 0)
+		e_error(backend->event, "%s", error);
+	{
+		std::unique_lock<std::mutex> lock(writer->mutex);
+		writer->stop = TRUE;
+		writer->job_cond.notify_one();
+	}
+	writer->thread.join();
+	delete writer;
+	backend->xapian->writer = NULL;
+}
+#else
+static void
+fts_flatcurve_xapian_writer_start(struct flatcurve_fts_backend *backend ATTR_UNUSED)
+{
+}
+
+static int
+fts_flatcurve_xapian_writer_push(struct flatcurve_fts_backend *backend ATTR_UNUSED,
+				 Xapian::WritableDatabase *dbw ATTR_UNUSED,
+				 struct flatcurve_xapian_msg *msg ATTR_UNUSED,
+				 const char **error_r ATTR_UNUSED)
+{
+	i_unreached();
+}
+
+static int
+fts_flatcurve_xapian_writer_drain(struct flatcurve_fts_backend *backend ATTR_UNUSED,
+				  const char **error_r ATTR_UNUSED)
+{
+	return 0;
+}
+
+static int
+fts_flatcurve_xapian_writer_commit(struct flatcurve_fts_backend *backend ATTR_UNUSED,
+				   const char **error_r ATTR_UNUSED)
+{
+	i_unreached();
+}
+
+static bool
+fts_flatcurve_xapian_writer_rotate_requested(struct flatcurve_fts_backend *backend ATTR_UNUSED)
+{
+	return FALSE;
+}
+
+static void
+fts_flatcurve_xapian_writer_stop(struct flatcurve_fts_backend *backend ATTR_UNUSED)
+{
+}
+#endif
+
 void fts_flatcurve_xapian_init(struct flatcurve_fts_backend *backend)
 {
 	backend->xapian = p_new(backend->pool, struct flatcurve_xapian, 1);
@@ -244,6 +724,20 @@ void fts_flatcurve_xapian_init(struct flatcurve_fts_backend *backend)
 			  4, str_hash, strcmp);
 }
 
+static void
+fts_flatcurve_xapian_queue_merge(struct flatcurve_fts_backend *backend,
+				 const char *vname)
+{
+	struct mail_user *user = backend->backend.ns->user;
+	const char *const args[] = { user->username, vname, NULL };
+	const char *error;
+
+	if (fts_indexer_queue(user, "OPTIMIZE", args, &error) < 0) {
+		e_error(backend->event, "Can't queue merging shards of %s: %s",
+			vname, error);
+	}
+}
+
 void fts_flatcurve_xapian_deinit(struct flatcurve_fts_backend *backend)
 {
 	struct flatcurve_xapian *x = backend->xapian;
@@ -257,6 +751,11 @@ void fts_flatcurve_xapian_deinit(struct flatcurve_fts_backend *backend)
 
 		void *key, *val;
 		while (hash_table_iterate(iter, x->optimize, &key, &val)) {
+			if (backend->fuser->set->merge_factor > 0) {
+				fts_flatcurve_xapian_queue_merge(
+					backend, (const char *)key);
+				continue;
+			}
 			str_append(backend->boxname, (const char *)key);
 			str_append(backend->db_path, (const char *)val);
 
@@ -270,6 +769,9 @@ void fts_flatcurve_xapian_deinit(struct flatcurve_fts_backend *backend)
 	}
 	if (fts_flatcurve_xapian_close(backend, &error) < 0)
 		e_error(backend->event, "Failed to close Xapian: %s", error);
+	fts_flatcurve_xapian_writer_stop(backend);
+	delete x->msg;
+	x->msg = NULL;
 	hash_table_destroy(&x->dbs);
 	pool_unref(&x->pool);
 	x->deinit = FALSE;
@@ -369,6 +871,11 @@ fts_flatcurve_xapian_db_iter_next(struct flatcurve_xapian_db_iter *iter)
 		iter->type = FLATCURVE_XAPIAN_DB_TYPE_CURRENT;
 	else if (strcmp(dir->d_name, FLATCURVE_XAPIAN_DB_OPTIMIZE) == 0)
 		iter->type = FLATCURVE_XAPIAN_DB_TYPE_OPTIMIZE;
+	else if (str_begins_with(dir->d_name, FLATCURVE_XAPIAN_DB_BUILDING_PREFIX) ||
+		 str_begins_with(dir->d_name, FLATCURVE_XAPIAN_DB_BUILT_PREFIX))
+		iter->type = FLATCURVE_XAPIAN_DB_TYPE_BUILD;
+	else if (str_begins_with(dir->d_name, FLATCURVE_XAPIAN_DB_MERGE_PREFIX))
+		iter->type = FLATCURVE_XAPIAN_DB_TYPE_MERGE;
 
 	return TRUE;
 }
@@ -459,13 +966,15 @@ fts_flatcurve_xapian_write_db_get(struct flatcurve_fts_backend *backend,
 		backend, xdb, db_flags, error_r) < 0)
 		return -1;
 
-	if (xdb->type == FLATCURVE_XAPIAN_DB_TYPE_CURRENT &&
+	if ((xdb->type == FLATCURVE_XAPIAN_DB_TYPE_CURRENT ||
+	     xdb->type == FLATCURVE_XAPIAN_DB_TYPE_BUILD) &&
 	    fts_flatcurve_xapian_check_db_version(backend, xdb, error_r) < 0)
 		return -1;
 
+	xdb->doccount = xdb->dbw->get_doccount();
+	xdb->last_uid = xdb->dbw->get_lastdocid();
 	e_debug(backend->event, "Opened DB (RW, %s) messages=%u version=%u",
-		xdb->dbpath->fname, xdb->dbw->get_doccount(),
-		FLATCURVE_XAPIAN_DB_VERSION);
+		xdb->dbpath->fname, xdb->doccount, FLATCURVE_XAPIAN_DB_VERSION);
 
 	return 0;
 }
@@ -506,11 +1015,89 @@ fts_flatcurve_xapian_rename_db(struct flatcurve_fts_backend *backend,
 	return -1;
 }
 
+static unsigned int
+fts_flatcurve_xapian_merge_tier(const struct fts_flatcurve_settings *set,
+				unsigned int messages)
+{
+	unsigned int factor = I_MAX(set->merge_factor, 2);
+	unsigned int limit = set->rotate_count > 0 ? set->rotate_count :
+		FLATCURVE_XAPIAN_MERGE_TIER_MIN_MESSAGES;
+	unsigned int tier = 0;
+
+	while (messages > limit && limit <= UINT_MAX / factor) {
+		limit *= factor;
+		tier++;
+	}
+	return tier;
+}
+
+static bool
+fts_flatcurve_xapian_merge_source(struct flatcurve_xapian_db *xdb)
+{
+	/* Only the opened index shards are merged. The current shard is
+	 * still being written to. */
+	return xdb->type == FLATCURVE_XAPIAN_DB_TYPE_INDEX && xdb->db != NULL;
+}
+
+struct flatcurve_xapian_merge_tier {
+	unsigned int shards;
+	unsigned int messages;
+};
+
+/* Returns: the lowest tier that has enough shards to be merged, or -1 if
+ * nothing needs merging. debt_r is set to the number of messages in all
+ * such tiers. */
+static int
+fts_flatcurve_xapian_merge_plan(struct flatcurve_fts_backend *backend,
+				unsigned int *debt_r)
+{
+	const struct fts_flatcurve_settings *set = backend->fuser->set;
+	struct flatcurve_xapian *x = backend->xapian;
+	int merge_tier = -1;
+
+	*debt_r = 0;
+	T_BEGIN {
+		ARRAY(struct flatcurve_xapian_merge_tier) tiers;
+		struct flatcurve_xapian_merge_tier *tier;
+		void *key, *val;
+
+		t_array_init(&tiers, 8);
+		struct hash_iterate_context *iter =
+			hash_table_iterate_init(x->dbs);
+		while (hash_table_iterate(iter, x->dbs, &key, &val)) {
+			struct flatcurve_xapian_db *xdb =
+				(struct flatcurve_xapian_db *)val;
+			if (!fts_flatcurve_xapian_merge_source(xdb))
+				continue;
+			tier = array_idx_get_space(&tiers,
+				fts_flatcurve_xapian_merge_tier(
+					set, xdb->doccount));
+			tier->shards++;
+			tier->messages += xdb->doccount;
+		}
+		hash_table_iterate_deinit(&iter);
+
+		array_foreach_modifiable(&tiers, tier) {
+			if (tier->shards < I_MAX(set->merge_factor, 2))
+				continue;
+			if (merge_tier < 0)
+				merge_tier = array_foreach_idx(&tiers, tier);
+			*debt_r += tier->messages;
+		}
+	} T_END;
+	return merge_tier;
+}
+
 static bool
 fts_flatcurve_xapian_need_optimize(struct flatcurve_fts_backend *backend)
 {
 	if (backend->fuser == NULL) return FALSE;
+	/* optimize_limit=0 disables both optimizing and merging */
 	if (backend->fuser->set->optimize_limit == 0) return FALSE;
+	if (backend->fuser->set->merge_factor > 0) {
+		unsigned int debt;
+		return fts_flatcurve_xapian_merge_plan(backend, &debt) >= 0;
+	}
 	return backend->xapian->shards >= backend->fuser->set->optimize_limit;
 }
 
@@ -543,10 +1130,16 @@ fts_flatcurve_xapian_db_add(struct flatcurve_fts_backend *backend,
 	struct flatcurve_xapian *x = backend->xapian;
 
 	if (type != FLATCURVE_XAPIAN_DB_TYPE_INDEX &&
-	    type != FLATCURVE_XAPIAN_DB_TYPE_CURRENT) {
+	    type != FLATCURVE_XAPIAN_DB_TYPE_CURRENT &&
+	    type != FLATCURVE_XAPIAN_DB_TYPE_BUILD) {
 		if (xdb_r != NULL) *xdb_r = NULL;
 		return 0;
 	}
+	/* While indexing a chunk, new messages go to the build shard and
+	 * the current shard is only read. */
+	if (type == FLATCURVE_XAPIAN_DB_TYPE_CURRENT &&
+	    backend->index_chunk_set != NULL)
+		type = FLATCURVE_XAPIAN_DB_TYPE_INDEX;
 
 	struct flatcurve_xapian_db *xdb;
 	xdb = p_new(x->pool, struct flatcurve_xapian_db, 1);
@@ -582,7 +1175,8 @@ fts_flatcurve_xapian_db_add(struct flatcurve_fts_backend *backend,
 		db->type = FLATCURVE_XAPIAN_DB_TYPE_INDEX;
 	}
 
-	if (xdb->type == FLATCURVE_XAPIAN_DB_TYPE_CURRENT)
+	if (xdb->type == FLATCURVE_XAPIAN_DB_TYPE_CURRENT ||
+	    xdb->type == FLATCURVE_XAPIAN_DB_TYPE_BUILD)
 		x->dbw_current = xdb;
 
 	if (xdb_r != NULL) *xdb_r = xdb;
@@ -641,6 +1235,8 @@ fts_flatcurve_xapian_db_read_add(struct flatcurve_fts_backend *backend,
 
 	try {
 		xdb->db = new Xapian::Database(xdb->dbpath->path);
+		if (xdb->dbw == NULL)
+			xdb->doccount = xdb->db->get_doccount();
 	} catch (Xapian::Error &e) {
 		*error_r = t_strdup_printf("Cannot open DB (RO; %s); %s",
 			xdb->dbpath->fname, e.get_description().c_str());
@@ -667,17 +1263,32 @@ fts_flatcurve_xapian_create_current(struct flatcurve_fts_backend *backend,
 	/* The current shard has filename of the format PREFIX.timestamp. This
 	 * ensures that we will catch any current DB renaming done by another
 	 * process (reopen() on the DB will fail, causing the entire DB to be
-	 * closed/reopened). */
+	 * closed/reopened).
+	 *
+	 * When indexing a chunk, the build shard takes the place of the
+	 * current shard. */
 
 	int ret;
 	struct flatcurve_xapian_db *xdb;
 	T_BEGIN {
-		const char *fname = t_strdup_printf(
-			FLATCURVE_XAPIAN_DB_CURRENT_PREFIX "%lu",
-			i_microseconds());
+		enum flatcurve_xapian_db_type type;
+		const char *fname;
+
+		if (backend->index_chunk_set != NULL) {
+			type = FLATCURVE_XAPIAN_DB_TYPE_BUILD;
+			fname = t_strdup_printf(
+				FLATCURVE_XAPIAN_DB_BUILDING_PREFIX "%s.%u",
+				backend->index_chunk_set,
+				backend->index_chunk_idx);
+		} else {
+			type = FLATCURVE_XAPIAN_DB_TYPE_CURRENT;
+			fname = t_strdup_printf(
+				FLATCURVE_XAPIAN_DB_CURRENT_PREFIX "%lu",
+				i_microseconds());
+		}
 		ret = fts_flatcurve_xapian_db_add(backend,
 			fts_flatcurve_xapian_create_db_path(backend, fname),
-			FLATCURVE_XAPIAN_DB_TYPE_CURRENT, TRUE, &xdb, error_r);
+			type, TRUE, &xdb, error_r);
 	} T_END;
 
 	if (ret < 0)
@@ -745,6 +1356,10 @@ fts_flatcurve_xapian_db_populate(struct flatcurve_fts_backend *backend,
 		const char *error, *last_error = NULL;
 		iter = fts_flatcurve_xapian_db_iter_init(backend, opts);
 		while (fts_flatcurve_xapian_db_iter_next(iter)) {
+			/* Build shards are invisible until they are
+			 * published. */
+			if (iter->type == FLATCURVE_XAPIAN_DB_TYPE_BUILD)
+				continue;
 			if (fts_flatcurve_xapian_db_add(
 				backend, iter->path, iter->type,
 				FALSE, NULL, &last_error) < 0)
@@ -955,6 +1570,12 @@ fts_flatcurve_xapian_mailbox_stats(struct flatcurve_fts_backend *backend,
 	stats->messages = x->db_read->get_doccount();
 	stats->shards = x->shards;
 	stats->version = FLATCURVE_XAPIAN_DB_VERSION;
+	stats->merge_debt = 0;
+	if (backend->fuser != NULL && backend->fuser->set->merge_factor > 0)
+		(void)fts_flatcurve_xapian_merge_plan(
+			backend, &stats->merge_debt);
+	else if (fts_flatcurve_xapian_need_optimize(backend))
+		stats->merge_debt = stats->messages;
 	return 1;
 }
 
@@ -1169,6 +1790,10 @@ fts_flatcurve_xapian_check_db_version(struct flatcurve_fts_backend *backend,
 	static const enum flatcurve_xapian_wdb wopts =
 		ENUM_EMPTY(flatcurve_xapian_wdb);
 
+	if (xdb->dbw != NULL &&
+	    fts_flatcurve_xapian_writer_drain(backend, error_r) < 0)
+		return -1;
+
 	Xapian::Database *db = (xdb->dbw == NULL) ? xdb->db : xdb->dbw;
 
 	std::string str = db->get_metadata(FLATCURVE_XAPIAN_DB_VERSION_KEY);
@@ -1293,8 +1918,9 @@ fts_flatcurve_xapian_check_commit_limit(struct flatcurve_fts_backend *backend,
 	++xdb->changes;
 
 	if (xdb->type == FLATCURVE_XAPIAN_DB_TYPE_CURRENT &&
-	    fuser->set->rotate_count > 0 &&
-	    xdb->dbw->get_doccount() >= fuser->set->rotate_count) {
+	    ((fuser->set->rotate_count > 0 &&
+	      xdb->doccount >= fuser->set->rotate_count) ||
+	     fts_flatcurve_xapian_writer_rotate_requested(backend))) {
 		return fts_flatcurve_xapian_close_db(
 			backend, xdb, FLATCURVE_XAPIAN_DB_CLOSE_ROTATE, error_r);
 	}
@@ -1304,6 +1930,9 @@ fts_flatcurve_xapian_check_commit_limit(struct flatcurve_fts_backend *backend,
 		e_debug(backend->event,
 			"Committing DB as update limit was reached; limit=%d",
 			fuser->set->commit_limit);
+		if (x->writer != NULL)
+			return fts_flatcurve_xapian_writer_commit(
+				backend, error_r);
 		return fts_flatcurve_xapian_close_dbs(
 			backend, FLATCURVE_XAPIAN_DB_CLOSE_WDB_COMMIT, error_r);
 	}
@@ -1321,7 +1950,7 @@ fts_flatcurve_xapian_clear_document(struct flatcurve_fts_backend *backend,
 
 	struct flatcurve_xapian *x = backend->xapian;
 
-	if (x->doc == NULL)
+	if (x->msg == NULL)
 		return 0;
 
 	struct flatcurve_xapian_db *xdb;
@@ -1330,33 +1959,25 @@ fts_flatcurve_xapian_clear_document(struct flatcurve_fts_backend *backend,
 	if (ret <= 0)
 		return ret;
 
-	ret = 0;
-	try {
-		xdb->dbw->replace_document(x->doc_uid, *x->doc);
-	} catch (std::bad_alloc &b) {
-		i_fatal_status(FATAL_OUTOFMEM,
-			"Out of memory when indexing mail (%s); UID=%d "
-			"(Hint: increase indexing process vsz_limit or "
-			"define smaller commit limit value in "
-			"plugin { fts_flatcurve_commit_limit = ...})",
-			b.what(), x->doc_uid);
-	} catch (Xapian::Error &e) {
-		*error_r = t_strdup_printf(
-			"Could not write message data: uid=%u; %s",
-			x->doc_uid,
-			e.get_description().c_str());
-		ret = -1;
-	}
-
-	if (x->doc_created)
-		delete(x->doc);
-	x->doc = NULL;
-	x->doc_created = FALSE;
+	struct flatcurve_xapian_msg *msg = x->msg;
+	uint32_t uid = msg->uid;
+	x->msg = NULL;
 	x->doc_uid = 0;
 
+	fts_flatcurve_xapian_writer_start(backend);
+	if (x->writer != NULL) {
+		ret = fts_flatcurve_xapian_writer_push(
+			backend, xdb->dbw, msg, error_r);
+	} else {
+		ret = fts_flatcurve_xapian_write_msg(
+			backend, xdb, msg, error_r);
+	}
 	if (ret < 0)
 		return -1;
 
+	++xdb->doccount;
+	if (uid > xdb->last_uid)
+		xdb->last_uid = uid;
 	return fts_flatcurve_xapian_check_commit_limit(backend, xdb, error_r);
 }
 
@@ -1372,6 +1993,11 @@ fts_flatcurve_xapian_close_db(struct flatcurve_fts_backend *backend,
 	if (fts_flatcurve_xapian_clear_document(backend, error_r) < 0)
 		return -1;
 
+	/* The writer thread must be done with the DB before it's committed
+	 * or closed here. Whatever it did manage to write is still
+	 * committed. */
+	int ret = fts_flatcurve_xapian_writer_drain(backend, error_r);
+
 	struct timeval start;
 	i_gettimeofday(&start);
 
@@ -1379,7 +2005,7 @@ fts_flatcurve_xapian_close_db(struct flatcurve_fts_backend *backend,
 	if (xdb->dbw != NULL) {
 		if (HAS_ANY_BITS(opts, FLATCURVE_XAPIAN_DB_CLOSE_WDB |
 				       FLATCURVE_XAPIAN_DB_CLOSE_MBOX)) {
-			int ret = 0;
+			bool failed = FALSE;
 			try {
 				/* even if xapian documentation states that close
 				auto-commits, GlassWritableDatabase::close() can
@@ -1390,13 +2016,13 @@ fts_flatcurve_xapian_close_db(struct flatcurve_fts_backend *backend,
 			}
 			catch (Xapian::Error &e) {
 				*error_r = t_strdup(e.get_description().c_str());
-				ret = -1;
+				failed = TRUE;
 			}
 			xdb->dbw->close();
 			delete(xdb->dbw);
 			xdb->dbw = NULL;
 			commit = TRUE; // mark anyway as committed
-			if (ret < 0)
+			if (failed)
 				return -1;
 		} else if (HAS_ANY_BITS(opts, FLATCURVE_XAPIAN_DB_CLOSE_WDB_COMMIT |
 					      FLATCURVE_XAPIAN_DB_CLOSE_ROTATE)) {
@@ -1471,7 +2097,7 @@ fts_flatcurve_xapian_close_db(struct flatcurve_fts_backend *backend,
 		xdb->db = NULL;
 	}
 
-	return 0;
+	return ret;
 }
 
 /* Returns: 0 on success, -1 on error */
@@ -1535,6 +2161,132 @@ int fts_flatcurve_xapian_close(struct flatcurve_fts_backend *backend,
 	return ret;
 }
 
+/* Returns: 1 if the set was published, 0 if chunks are still missing,
+ * -1 on error. Must be called locked. */
+static int
+fts_flatcurve_xapian_publish_chunks(struct flatcurve_fts_backend *backend,
+				    const char **error_r)
+{
+	static const enum flatcurve_xapian_db_opts opts =
+		ENUM_EMPTY(flatcurve_xapian_db_opts);
+	ARRAY(struct flatcurve_xapian_db_path *) built;
+	struct flatcurve_xapian_db_path *path;
+	const char *error, *prefix = t_strdup_printf(
+		FLATCURVE_XAPIAN_DB_BUILT_PREFIX "%s.",
+		backend->index_chunk_set);
+	time_t stale_time = ioloop_time - FLATCURVE_XAPIAN_DB_BUILD_STALE_SECS;
+	struct stat st;
+	int ret = 0;
+
+	t_array_init(&built, backend->index_chunk_count);
+	struct flatcurve_xapian_db_iter *iter =
+		fts_flatcurve_xapian_db_iter_init(backend, opts);
+	while (ret == 0 && fts_flatcurve_xapian_db_iter_next(iter)) {
+		if (iter->type != FLATCURVE_XAPIAN_DB_TYPE_BUILD)
+			continue;
+		if (str_begins_with(iter->path->fname, prefix)) {
+			array_push_back(&built, &iter->path);
+			continue;
+		}
+		/* Clean up the leftovers of sets that never completed. */
+		if (stat(iter->path->path, &st) == 0 &&
+		    st.st_mtime < stale_time) {
+			e_debug(backend->event, "Deleting stale build shard %s",
+				iter->path->fname);
+			if (fts_flatcurve_xapian_delete(
+				backend, iter->path, error_r) < 0)
+				ret = -1;
+		}
+	}
+	if (fts_flatcurve_xapian_db_iter_deinit(&iter, &error) < 0) {
+		if (ret < 0)
+			e_error(backend->event, "%s", error);
+		else
+			*error_r = error;
+		ret = -1;
+	}
+	if (ret < 0)
+		return -1;
+
+	if (array_count(&built) < backend->index_chunk_count) {
+		e_debug(backend->event, "Built chunk %u of set %s "
+			"(%u/%u chunks done)", backend->index_chunk_idx,
+			backend->index_chunk_set, array_count(&built),
+			backend->index_chunk_count);
+		return 0;
+	}
+
+	array_foreach_elem(&built, path) {
+		if (fts_flatcurve_xapian_rename_db(
+			backend, path, NULL, error_r) < 0)
+			return -1;
+	}
+	e_debug(event_create_passthrough(backend->event)->
+		set_name("fts_flatcurve_publish")->
+		add_str("mailbox", str_c(backend->boxname))->
+		add_int("chunks", backend->index_chunk_count)->event(),
+		"Published %u chunks of set %s", backend->index_chunk_count,
+		backend->index_chunk_set);
+	return 1;
+}
+
+/* Returns: 0 on success, -1 on error */
+int fts_flatcurve_xapian_index_chunk_finish(struct flatcurve_fts_backend *backend,
+					    bool success, const char **error_r)
+{
+	struct flatcurve_xapian *x = backend->xapian;
+
+	i_assert(backend->index_chunk_set != NULL);
+
+	if (x->dbw_current == NULL) {
+		/* Nothing was indexed */
+		if (!success)
+			return 0;
+		/* All of the chunk's mails were expunged. The set can't be
+		 * published without all of its chunks, so create an empty
+		 * build shard for it. */
+		if (fts_flatcurve_xapian_lock(backend, error_r) < 0)
+			return -1;
+		int ret = fts_flatcurve_xapian_create_current(backend,
+				FLATCURVE_XAPIAN_DB_CLOSE_WDB, error_r);
+		fts_flatcurve_xapian_unlock(backend);
+		if (ret < 0)
+			return -1;
+	}
+	i_assert(x->dbw_current->type == FLATCURVE_XAPIAN_DB_TYPE_BUILD);
+
+	/* The pool is cleared when closing. */
+	const char *building_path = t_strdup(x->dbw_current->dbpath->path);
+	const char *built_path = t_strdup_printf("%s"
+		FLATCURVE_XAPIAN_DB_BUILT_PREFIX "%s.%u",
+		str_c(backend->db_path), backend->index_chunk_set,
+		backend->index_chunk_idx);
+
+	const char *error;
+	if (fts_flatcurve_xapian_close(backend, &error) < 0) {
+		e_error(backend->event, "%s", error);
+		success = FALSE;
+	}
+	if (fts_flatcurve_xapian_lock(backend, error_r) < 0)
+		return -1;
+
+	int ret = 0;
+	if (!success) {
+		e_debug(backend->event, "Indexing chunk %u of set %s failed",
+			backend->index_chunk_idx, backend->index_chunk_set);
+		if (fts_backend_flatcurve_delete_dir(building_path, error_r) < 0)
+			ret = -1;
+	} else if (rename(building_path, built_path) < 0) {
+		*error_r = t_strdup_printf("rename(%s, %s) failed: %m",
+					   building_path, built_path);
+		ret = -1;
+	} else if (fts_flatcurve_xapian_publish_chunks(backend, error_r) < 0) {
+		ret = -1;
+	}
+	fts_flatcurve_xapian_unlock(backend);
+	return ret;
+}
+
 static uint32_t
 fts_flatcurve_xapian_get_last_uid_query(struct flatcurve_fts_backend *backend ATTR_UNUSED,
 					Xapian::Database *db)
@@ -1614,8 +2366,13 @@ int fts_flatcurve_xapian_expunge(struct flatcurve_fts_backend *backend,
 		return 0;
 	}
 
+	if (fts_flatcurve_xapian_writer_drain(backend, error_r) < 0)
+		return -1;
+
 	try {
 		xdb->dbw->delete_document(uid);
+		if (xdb->doccount > 0)
+			--xdb->doccount;
 		if (fts_flatcurve_xapian_check_commit_limit(
 			backend, xdb, error_r) < 0)
 			return -1;
@@ -1651,21 +2408,33 @@ fts_flatcurve_xapian_init_msg(struct flatcurve_fts_backend_update_context *ctx,
 	if (ret <= 0)
 		/* error or x->dbw_current == NULL */
 		return ret;
-	try {
-		(void)xdb->dbw->get_document(ctx->uid);
-		/* document already existed */
-		return 0;
-	} catch (Xapian::DocNotFoundError &e) {
-		x->doc = new Xapian::Document();
-		x->doc_created = TRUE;
-		x->doc_uid = ctx->uid;
-		/* document did not exist */
-		return 1;
-	} catch (Xapian::Error &e) {
-		ctx->ctx.failed = TRUE;
-		*error_r = t_strdup(e.get_description().c_str());
-		return -1;
+
+	/* New mails have UIDs above the last one in the DB, so usually
+	 * there's no need to wait for the writer thread to look up the
+	 * document. */
+	if (ctx->uid <= xdb->last_uid) {
+		if (fts_flatcurve_xapian_writer_drain(
+			ctx->backend, error_r) < 0) {
+			ctx->ctx.failed = TRUE;
+			return -1;
+		}
+		try {
+			(void)xdb->dbw->get_document(ctx->uid);
+			/* document already existed */
+			return 0;
+		} catch (Xapian::DocNotFoundError &e) {
+		} catch (Xapian::Error &e) {
+			ctx->ctx.failed = TRUE;
+			*error_r = t_strdup(e.get_description().c_str());
+			return -1;
+		}
 	}
+
+	/* document did not exist */
+	x->msg = new flatcurve_xapian_msg();
+	x->msg->uid = ctx->uid;
+	x->doc_uid = ctx->uid;
+	return 1;
 }
 
 int
@@ -1673,7 +2442,6 @@ fts_flatcurve_xapian_index_header(struct flatcurve_fts_backend_update_context *c
 				  const unsigned char *data, size_t size,
 				  const char **error_r)
 {
-	struct fts_flatcurve_user *fuser = ctx->backend->fuser;
 	struct flatcurve_xapian *x = ctx->backend->xapian;
 
 	int ret = fts_flatcurve_xapian_init_msg(ctx, error_r);
@@ -1682,51 +2450,22 @@ fts_flatcurve_xapian_index_header(struct flatcurve_fts_backend_update_context *c
 
 	i_assert(uni_utf8_data_is_valid(data, size));
 
+	x->msg->fields.emplace_back();
+	struct flatcurve_xapian_msg_field &field = x->msg->fields.back();
+	field.header = TRUE;
+	field.data.assign((const char *)data, size);
+
 	T_BEGIN {
 		char *hdr_name =
 			str_lcase(t_strdup_noconst(str_c(ctx->hdr_name)));
 
-		if (*hdr_name != '\0')
-			x->doc->add_boolean_term(t_strdup_printf(
-				FLATCURVE_XAPIAN_BOOLEAN_FIELD_PREFIX
-				"%s", hdr_name));
-
-		if (ctx->indexed_hdr)
-			hdr_name = str_ucase(hdr_name);
-
-		string_t *all_term = t_str_new(size);
-		string_t *hdr_term = t_str_new(size + strlen(hdr_name));
-		str_append(hdr_term, FLATCURVE_XAPIAN_HEADER_PREFIX);
-		str_append(hdr_term, hdr_name);
-		size_t hdr_term_start = str_len(hdr_term);
-
-		const unsigned char *end = data + size;
-		for(; end > data; data += uni_utf8_char_bytes((unsigned char) *data)) {
-			size_t len = end - data;
-			if (len < fuser->set->min_term_size)
-				break;
-
-			/* Capital ASCII letters at the beginning of a Xapian
-			   term are treated as a "term prefix". Force to non-
-			   -uppercase the first letter of the header value to
-			   ensure the term is not confused with a
-			   "term prefix". */
-
-			str_truncate(all_term, 0);
-			str_append(all_term, FLATCURVE_XAPIAN_ALL_HEADERS_PREFIX);
-			str_append_c(all_term, i_tolower(*data));
-			str_append_data(all_term, data + 1, len - 1);
-			x->doc->add_term(str_c(all_term));
-
-			if (ctx->indexed_hdr) {
-				str_truncate(hdr_term, hdr_term_start);
-				str_append_c(hdr_term, i_tolower(*data));
-				str_append_data(hdr_term, data + 1, len - 1);
-				x->doc->add_term(str_c(hdr_term));
-			}
-
-			if (!fuser->set->substring_search)
-				break;
+		if (*hdr_name != '\0') {
+			field.bool_term = FLATCURVE_XAPIAN_BOOLEAN_FIELD_PREFIX;
+			field.bool_term += hdr_name;
+		}
+		if (ctx->indexed_hdr) {
+			field.hdr_prefix = FLATCURVE_XAPIAN_HEADER_PREFIX;
+			field.hdr_prefix += str_ucase(hdr_name);
 		}
 	} T_END;
 	return 1;
@@ -1734,41 +2473,21 @@ fts_flatcurve_xapian_index_header(struct flatcurve_fts_backend_update_context *c
 
 int
 fts_flatcurve_xapian_index_body(struct flatcurve_fts_backend_update_context *ctx,
-				const unsigned char *data_ro, size_t size,
+				const unsigned char *data, size_t size,
 				const char **error_r)
 {
-	struct fts_flatcurve_user *fuser = ctx->backend->fuser;
 	struct flatcurve_xapian *x = ctx->backend->xapian;
 
 	int ret = fts_flatcurve_xapian_init_msg(ctx, error_r);
 	if (ret <= 0)
 		return ret;
 
-	i_assert(uni_utf8_data_is_valid(data_ro, size));
-
-	T_BEGIN {
-		string_t *term = t_str_new(size);
-		str_append_data(term, data_ro, size);
-
-		char *data = str_c_modifiable(term);
-		const char *end = data + str_len(term);
-		for(; end > data; data += uni_utf8_char_bytes((unsigned char) *data)) {
-			size_t len = end - data;
-			if (len < fuser->set->min_term_size)
-				break;
-
-			/* Capital ASCII letters at the beginning of a Xapian term are
-			treated as a "term prefix". Check for a leading ASCII
-			capital, and temporary lowercase it in place if necessary,
-			to ensure the term is not confused with a "term prefix". */
-			*data = i_tolower(*data);
-			x->doc->add_term(data);
-
-			if (!fuser->set->substring_search)
-				break;
-		}
-	} T_END;
+	i_assert(uni_utf8_data_is_valid(data, size));
 
+	x->msg->fields.emplace_back();
+	struct flatcurve_xapian_msg_field &field = x->msg->fields.back();
+	field.header = FALSE;
+	field.data.assign((const char *)data, size);
 	return 1;
 }
 
@@ -1845,6 +2564,9 @@ fts_flatcurve_xapian_optimize_box_do(struct flatcurve_fts_backend *backend,
 
 	struct flatcurve_xapian *x = backend->xapian;
 
+	if (fts_flatcurve_xapian_writer_drain(backend, error_r) < 0)
+		return -1;
+
 	/* We need to lock all of the mailboxes so nothing changes while we
 	 * are optimizing. */
 
@@ -1985,6 +2707,241 @@ int fts_flatcurve_xapian_optimize_box(struct flatcurve_fts_backend *backend,
 	return ret;
 }
 
+static void
+fts_flatcurve_xapian_merge_cleanup(struct flatcurve_fts_backend *backend)
+{
+	static const enum flatcurve_xapian_db_opts opts =
+		ENUM_EMPTY(flatcurve_xapian_db_opts);
+	time_t stale_time = ioloop_time - FLATCURVE_XAPIAN_DB_MERGE_STALE_SECS;
+	const char *error;
+	struct stat st;
+
+	struct flatcurve_xapian_db_iter *iter =
+		fts_flatcurve_xapian_db_iter_init(backend, opts);
+	while (fts_flatcurve_xapian_db_iter_next(iter)) {
+		if (iter->type != FLATCURVE_XAPIAN_DB_TYPE_MERGE)
+			continue;
+		if (stat(iter->path->path, &st) == 0 &&
+		    st.st_mtime < stale_time) {
+			e_debug(backend->event, "Deleting stale merge shard %s",
+				iter->path->fname);
+			if (fts_flatcurve_xapian_delete(
+				backend, iter->path, &error) < 0)
+				e_error(backend->event, "%s", error);
+		}
+	}
+	if (fts_flatcurve_xapian_db_iter_deinit(&iter, &error) < 0)
+		e_error(backend->event, "%s", error);
+}
+
+static int
+fts_flatcurve_xapian_db_cmp_doccount(struct flatcurve_xapian_db *const *db1,
+				     struct flatcurve_xapian_db *const *db2)
+{
+	if ((*db1)->doccount < (*db2)->doccount)
+		return -1;
+	if ((*db1)->doccount > (*db2)->doccount)
+		return 1;
+	return 0;
+}
+
+/* Merge the smallest shards of the lowest tier that has enough of them.
+ * The merge is skipped if it doesn't fit in the remaining budget, unless
+ * it's the first one. Otherwise tiers larger than the whole budget would
+ * never get merged.
+ * Returns: 1 if shards were merged, 0 if nothing was merged, -1 on error */
+static int
+fts_flatcurve_xapian_merge_step(struct flatcurve_fts_backend *backend,
+				unsigned int *budget, bool first,
+				const char **error_r)
+{
+	static const enum flatcurve_xapian_db_opts opts =
+		(enum flatcurve_xapian_db_opts)
+			(FLATCURVE_XAPIAN_DB_NOCREATE_CURRENT |
+			 FLATCURVE_XAPIAN_DB_IGNORE_EMPTY);
+	static const enum flatcurve_xapian_wdb wopts =
+		ENUM_EMPTY(flatcurve_xapian_wdb);
+
+	const struct fts_flatcurve_settings *set = backend->fuser->set;
+	struct flatcurve_xapian *x = backend->xapian;
+	struct flatcurve_xapian_db *xdb;
+	const char *error;
+	void *key, *val;
+
+	/* Reading the shards adds the mailbox back if it still needs
+	 * merging after this step, so that another OPTIMIZE request gets
+	 * queued for the rest. */
+	if (hash_table_is_created(x->optimize))
+		(void)hash_table_try_remove(x->optimize,
+					    str_c(backend->boxname));
+	int ret = fts_flatcurve_xapian_read_db(backend, opts, NULL, error_r);
+	if (ret <= 0)
+		return ret;
+
+	unsigned int debt;
+	int tier = fts_flatcurve_xapian_merge_plan(backend, &debt);
+	if (tier < 0)
+		return 0;
+
+	ARRAY(struct flatcurve_xapian_db *) sources;
+	t_array_init(&sources, 8);
+	struct hash_iterate_context *iter = hash_table_iterate_init(x->dbs);
+	while (hash_table_iterate(iter, x->dbs, &key, &val)) {
+		xdb = (struct flatcurve_xapian_db *)val;
+		if (fts_flatcurve_xapian_merge_source(xdb) &&
+		    fts_flatcurve_xapian_merge_tier(set, xdb->doccount) ==
+		    (unsigned int)tier)
+			array_push_back(&sources, &xdb);
+	}
+	hash_table_iterate_deinit(&iter);
+
+	unsigned int factor = I_MAX(set->merge_factor, 2);
+	array_sort(&sources, fts_flatcurve_xapian_db_cmp_doccount);
+	if (array_count(&sources) > factor)
+		array_delete(&sources, factor, array_count(&sources) - factor);
+
+	unsigned int messages = 0;
+	array_foreach_elem(&sources, xdb)
+		messages += xdb->doccount;
+	if (messages > *budget && !first) {
+		e_debug(backend->event, "Merge budget used up; "
+			"%u messages still waiting to be merged", debt);
+		return 0;
+	}
+	*budget = messages >= *budget ? 0 : *budget - messages;
+
+	/* Hold the write locks of the merged shards, so that expunges can't
+	 * modify them in the middle of the merge. Everything else, including
+	 * queries and indexing to the current shard, can continue. */
+	Xapian::Database db;
+	array_foreach_elem(&sources, xdb) {
+		if (fts_flatcurve_xapian_write_db_get(
+			backend, xdb, wopts, error_r) < 0)
+			return -1;
+		try {
+			(void)xdb->db->reopen();
+		} catch (Xapian::Error &e) {
+			*error_r = t_strdup(e.get_description().c_str());
+			return -1;
+		}
+		db.add_database(*xdb->db);
+	}
+
+	struct flatcurve_xapian_db_path *dbpath =
+		fts_flatcurve_xapian_create_db_path(backend, t_strdup_printf(
+			FLATCURVE_XAPIAN_DB_MERGE_PREFIX "%lu",
+			i_microseconds()));
+
+	struct timeval start;
+	i_gettimeofday(&start);
+
+	bool failed = FALSE;
+	try {
+		db.compact(dbpath->path, Xapian::DBCOMPACT_NO_RENUMBER |
+					 Xapian::Compactor::FULLER);
+	} catch (Xapian::InvalidOperationError &e) {
+		/* Shards with overlapping UID ranges, see
+		 * fts_flatcurve_xapian_optimize_box_do(). */
+		failed = fts_flatcurve_xapian_optimize_rebuild(
+				backend, &db, dbpath, error_r) < 0;
+	} catch (Xapian::Error &e) {
+		*error_r = t_strdup(e.get_description().c_str());
+		failed = TRUE;
+	}
+
+	if (!failed && fts_flatcurve_xapian_lock(backend, error_r) < 0)
+		failed = TRUE;
+	if (failed) {
+		if (fts_flatcurve_xapian_delete(backend, dbpath, &error) < 0)
+			e_error(backend->event, "%s", error);
+		return -1;
+	}
+
+	/* Replace the merged shards with the new one. Readers see either of
+	 * them, since they list the shards while locked. A merge shard left
+	 * behind by a failed rename is cleaned up once it's stale. */
+	ret = fts_flatcurve_xapian_rename_db(backend, dbpath, NULL, error_r);
+	if (ret == 0) {
+		array_foreach_elem(&sources, xdb) {
+			ret = fts_flatcurve_xapian_delete(
+				backend, xdb->dbpath, error_r);
+			if (ret < 0)
+				break;
+		}
+	}
+	fts_flatcurve_xapian_unlock(backend);
+	if (ret < 0)
+		return -1;
+
+	struct timeval now;
+	i_gettimeofday(&now);
+	long long elapsed = timeval_diff_msecs(&now, &start);
+	e_debug(event_create_passthrough(backend->event)->
+		set_name("fts_flatcurve_merge")->
+		add_str("mailbox", str_c(backend->boxname))->
+		add_int("tier", tier)->
+		add_int("shards", array_count(&sources))->
+		add_int("messages", messages)->
+		add_int("duration_msecs", elapsed)->event(),
+		"Merged %u shards of tier %d with %u messages "
+		"in %lld.%03lld secs", array_count(&sources), tier, messages,
+		elapsed / 1000, elapsed % 1000);
+	return 1;
+}
+
+/* Merge shards until there's nothing left to merge, or until the budget of
+ * messages is used up.
+ * Returns: 0 on success, -1 on error */
+static int
+fts_flatcurve_xapian_merge_box(struct flatcurve_fts_backend *backend,
+			       unsigned int *budget, const char **error_r)
+{
+	const char *error;
+	bool first = TRUE;
+	int ret;
+
+	fts_flatcurve_xapian_merge_cleanup(backend);
+	do {
+		T_BEGIN {
+			ret = fts_flatcurve_xapian_merge_step(
+				backend, budget, first, error_r);
+		} T_END_PASS_STR_IF(ret < 0, error_r);
+		first = FALSE;
+
+		/* Reopen the shards for the next step. */
+		if (fts_flatcurve_xapian_close(backend, &error) < 0) {
+			if (ret < 0)
+				e_error(backend->event, "%s", error);
+			else
+				*error_r = error;
+			ret = -1;
+		}
+	} while (ret > 0);
+	return ret;
+}
+
+/* Returns: 0 on success, -1 on error */
+int fts_flatcurve_xapian_merge_mailbox(struct flatcurve_fts_backend *backend,
+				       const char **error_r)
+{
+	const struct fts_flatcurve_settings *set = backend->fuser->set;
+	struct flatcurve_xapian *x = backend->xapian;
+
+	if (set->merge_factor == 0)
+		return fts_flatcurve_xapian_optimize_box(backend, error_r);
+
+	unsigned int budget = set->merge_budget == 0 ?
+		UINT_MAX : set->merge_budget;
+	int ret = fts_flatcurve_xapian_merge_box(backend, &budget, error_r);
+	if (ret < 0 && hash_table_is_created(x->optimize)) {
+		/* Don't keep queueing a merge that fails. The next indexing
+		   to the mailbox tries again. */
+		(void)hash_table_try_remove(x->optimize,
+					    str_c(backend->boxname));
+	}
+	return ret;
+}
+
 static void
 fts_flatcurve_build_query_arg_term(struct flatcurve_fts_query *query,
 				   struct mail_search_arg *arg,
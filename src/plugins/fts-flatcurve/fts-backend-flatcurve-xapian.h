@@ -20,6 +20,8 @@ struct fts_flatcurve_xapian_db_stats {
 	int messages;
 	unsigned int shards;
 	unsigned int version;
+	/* Messages in the shards that are waiting to be merged. */
+	unsigned int merge_debt;
 };
 
 HASH_TABLE_DEFINE_TYPE(term_counter, char *, void *);
@@ -53,6 +55,16 @@ fts_flatcurve_xapian_index_body(struct flatcurve_fts_backend_update_context *ctx
 				const char **error_r);
 int fts_flatcurve_xapian_optimize_box(struct flatcurve_fts_backend *backend,
 				      const char **error_r);
+/* Merge the mailbox's index shards within fts_flatcurve_merge_budget, or do
+   a full optimize if merging is disabled. Used for the indexer's OPTIMIZE
+   requests. */
+int fts_flatcurve_xapian_merge_mailbox(struct flatcurve_fts_backend *backend,
+				       const char **error_r);
+/* Finish indexing the chunk. If all the chunks of the set have been built,
+   they are published as index shards. If success is FALSE, the chunk's
+   shard is deleted instead. */
+int fts_flatcurve_xapian_index_chunk_finish(struct flatcurve_fts_backend *backend,
+					    bool success, const char **error_r);
 void
 fts_flatcurve_xapian_build_query_match_all(struct flatcurve_fts_query *query);
 void fts_flatcurve_xapian_build_query(struct flatcurve_fts_query *query);
@@ -207,6 +207,7 @@ fts_backend_flatcurve_update_deinit(struct fts_backend_update_context *_ctx)
 	}
 
 	str_free(&ctx->hdr_name);
+	ctx->backend->index_chunk_set = NULL;
 	p_free(ctx->backend->pool, ctx);
 
 	return ret;
@@ -220,6 +221,15 @@ fts_backend_flatcurve_update_set_mailbox(struct fts_backend_update_context *_ctx
 	struct flatcurve_fts_backend_update_context *ctx =
 		(struct flatcurve_fts_backend_update_context *)_ctx;
 
+	if (box == NULL && ctx->backend->index_chunk_set != NULL &&
+	    str_len(ctx->backend->boxname) > 0) {
+		if (fts_flatcurve_xapian_index_chunk_finish(ctx->backend,
+				!_ctx->failed, &error) < 0) {
+			e_error(ctx->backend->event, "%s", error);
+			_ctx->failed = TRUE;
+		}
+	}
+
 	int ret = box == NULL ?
 		fts_backend_flatcurve_close_mailbox(ctx->backend, &error) :
 		fts_backend_flatcurve_set_mailbox(ctx->backend, box, &error);
@@ -227,6 +237,22 @@ fts_backend_flatcurve_update_set_mailbox(struct fts_backend_update_context *_ctx
 		e_error(ctx->backend->event, "%s", error);
 }
 
+static void
+fts_backend_flatcurve_update_set_index_chunk(struct fts_backend_update_context *_ctx,
+					     const char *set, unsigned int idx,
+					     unsigned int count)
+{
+	struct flatcurve_fts_backend_update_context *ctx =
+		(struct flatcurve_fts_backend_update_context *)_ctx;
+
+	/* The shards must be opened only after this */
+	i_assert(str_len(ctx->backend->boxname) == 0);
+
+	ctx->backend->index_chunk_set = p_strdup(ctx->backend->pool, set);
+	ctx->backend->index_chunk_idx = idx;
+	ctx->backend->index_chunk_count = count;
+}
+
 static void
 fts_backend_flatcurve_update_expunge(struct fts_backend_update_context *_ctx,
 				     uint32_t uid)
@@ -563,6 +589,22 @@ static int fts_backend_flatcurve_optimize(struct fts_backend *backend)
 			FTS_BACKEND_FLATCURVE_ACTION_OPTIMIZE);
 }
 
+static int
+fts_backend_flatcurve_optimize_mailbox(struct fts_backend *_backend,
+				       struct mailbox *box)
+{
+	const char *error;
+	struct flatcurve_fts_backend *backend =
+		(struct flatcurve_fts_backend *)_backend;
+
+	if (fts_backend_flatcurve_set_mailbox(backend, box, &error) < 0 ||
+	    fts_flatcurve_xapian_merge_mailbox(backend, &error) < 0) {
+		e_error(backend->event, "%s", error);
+		return -1;
+	}
+	return 0;
+}
+
 static int fts_backend_flatcurve_rescan(struct fts_backend *backend)
 {
 	return fts_backend_flatcurve_iterate_ns(backend,
@@ -741,9 +783,11 @@ struct fts_backend fts_backend_flatcurve = {
 		.update_set_build_key = fts_backend_flatcurve_update_set_build_key,
 		.update_unset_build_key = fts_backend_flatcurve_update_unset_build_key,
 		.update_build_more = fts_backend_flatcurve_update_build_more,
+		.update_set_index_chunk = fts_backend_flatcurve_update_set_index_chunk,
 		.refresh = fts_backend_flatcurve_refresh,
 		.rescan = fts_backend_flatcurve_rescan,
 		.optimize = fts_backend_flatcurve_optimize,
+		.optimize_mailbox = fts_backend_flatcurve_optimize_mailbox,
 		.can_lookup = fts_backend_default_can_lookup,
 		.lookup = fts_backend_flatcurve_lookup,
 		.lookup_multi = fts_backend_flatcurve_lookup_multi,
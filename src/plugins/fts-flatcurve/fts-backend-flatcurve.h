@@ -21,6 +21,10 @@ struct flatcurve_fts_backend {
 
 	enum file_lock_method parsed_lock_method;
 
+	/* Set while indexing chunk idx of a set of count chunks */
+	const char *index_chunk_set;
+	unsigned int index_chunk_idx, index_chunk_count;
+
 	pool_t pool;
 };
 
@@ -13,20 +13,26 @@ static const struct setting_define fts_flatcurve_setting_defines[] = {
 	   like it is possible in the other fts_backends. */
 	{ .type = SET_FILTER_NAME, .key = FTS_FLATCURVE_FILTER },
 	DEF(UINT, commit_limit),
+	DEF(UINT, merge_budget),
+	DEF(UINT, merge_factor),
 	DEF(UINT, min_term_size),
 	DEF(UINT, optimize_limit),
 	DEF(UINT, rotate_count),
 	DEF(TIME_MSECS, rotate_time),
+	DEF(UINT, write_queue_size),
 	DEF(BOOL, substring_search),
 	SETTING_DEFINE_LIST_END
 };
 
 static const struct fts_flatcurve_settings fts_flatcurve_default_settings = {
 	.commit_limit     =   500,
+	.merge_budget     = 100000,
+	.merge_factor     =     0,
 	.min_term_size    =     2,
 	.optimize_limit   =    10,
 	.rotate_count     =  5000,
 	.rotate_time      =  5000,
+	.write_queue_size =     0,
 	.substring_search = FALSE,
 };
 
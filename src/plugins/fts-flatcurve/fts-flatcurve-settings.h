@@ -8,10 +8,13 @@
 struct fts_flatcurve_settings {
 	pool_t pool;
 	unsigned int commit_limit;
+	unsigned int merge_budget;
+	unsigned int merge_factor;
 	unsigned int min_term_size;
 	unsigned int optimize_limit;
 	unsigned int rotate_count;
 	unsigned int rotate_time;
+	unsigned int write_queue_size;
 	bool substring_search;
 };
 
@@ -0,0 +1,489 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "net.h"
+#include "istream.h"
+#include "module-dir.h"
+#include "settings.h"
+#include "master-service.h"
+#include "mail-search-build.h"
+#include "test-common.h"
+#include "test-mail-storage-common.h"
+#include "fts-settings.h"
+#include "fts-plugin.h"
+#include "fts-flatcurve-settings.h"
+#include "fts-flatcurve-plugin.h"
+
+#define TEST_MAIL_COUNT 7
+
+/* The plugins' hooks are used only if they're in mail_plugins */
+static struct module test_fts_module, test_flatcurve_module;
+
+static void test_mail_save(struct mailbox *box, unsigned int i)
+{
+	struct mailbox_transaction_context *trans;
+	struct mail_save_context *save_ctx;
+	struct istream *input;
+	const char *mail_input;
+	int ret;
+
+	/* odd mails have "banana" in their body */
+	mail_input = t_strdup_printf("Subject: mail %u\n\napple %s\n", i,
+				     i % 2 != 0 ? "banana" : "cherry");
+	input = i_stream_create_from_data(mail_input, strlen(mail_input));
+	trans = mailbox_transaction_begin(box,
+			MAILBOX_TRANSACTION_FLAG_EXTERNAL, __func__);
+	save_ctx = mailbox_save_alloc(trans);
+	if (mailbox_save_begin(&save_ctx, input) < 0)
+		ret = -1;
+	else {
+		do {
+			if (mailbox_save_continue(save_ctx) < 0) {
+				mailbox_save_cancel(&save_ctx);
+				break;
+			}
+		} while ((ret = i_stream_read(input)) > 0);
+		if (save_ctx != NULL)
+			ret = mailbox_save_finish(&save_ctx);
+		else
+			ret = -1;
+	}
+	i_stream_unref(&input);
+	if (ret < 0)
+		mailbox_transaction_rollback(&trans);
+	else
+		ret = mailbox_transaction_commit(&trans);
+	if (ret < 0) {
+		i_fatal("Failed to save mail: %s",
+			mailbox_get_last_internal_error(box, NULL));
+	}
+}
+
+/* Index the mails the same way as the indexer-worker */
+static void
+test_mailbox_index_args(struct mailbox *box, struct mail_search_args *args)
+{
+	struct mailbox_transaction_context *trans;
+	struct mail_search_context *search_ctx;
+	struct mail *mail;
+
+	trans = mailbox_transaction_begin(box,
+			MAILBOX_TRANSACTION_FLAG_NO_CACHE_DEC, __func__);
+	search_ctx = mailbox_search_init(trans, args, NULL,
+					 MAIL_FETCH_STREAM_HEADER |
+					 MAIL_FETCH_STREAM_BODY, NULL);
+	while (mailbox_search_next(search_ctx, &mail))
+		test_assert(mail_precache(mail) == 0);
+	test_assert(mailbox_search_deinit(&search_ctx) == 0);
+	test_assert(mailbox_transaction_commit(&trans) == 0);
+}
+
+static void test_mailbox_index(struct mailbox *box)
+{
+	struct mail_search_args *args;
+
+	args = mail_search_build_init();
+	mail_search_build_add_all(args);
+	test_mailbox_index_args(box, args);
+	mail_search_args_unref(&args);
+}
+
+static void
+test_mailbox_index_seqs(struct mailbox *box, uint32_t seq1, uint32_t seq2)
+{
+	struct mail_search_args *args;
+
+	args = mail_search_build_init();
+	mail_search_build_add_seqset(args, seq1, seq2);
+	test_mailbox_index_args(box, args);
+	mail_search_args_unref(&args);
+}
+
+static void test_mail_expunge(struct mailbox *box, uint32_t uid)
+{
+	struct mailbox_transaction_context *trans;
+	struct mail *mail;
+
+	trans = mailbox_transaction_begin(box, 0, __func__);
+	mail = mail_alloc(trans, 0, NULL);
+	test_assert(mail_set_uid(mail, uid));
+	mail_expunge(mail);
+	mail_free(&mail);
+	test_assert(mailbox_transaction_commit(&trans) == 0);
+	test_assert(mailbox_sync(box, 0) == 0);
+}
+
+static void
+test_body_search(struct mailbox *box, const char *key,
+		 const uint32_t *expected_uids, unsigned int expected_count)
+{
+	struct mailbox_transaction_context *trans;
+	struct mail_search_args *args;
+	struct mail_search_arg *arg;
+	struct mail_search_context *search_ctx;
+	struct mail *mail;
+	unsigned int i = 0;
+
+	args = mail_search_build_init();
+	arg = mail_search_build_add(args, SEARCH_BODY);
+	arg->value.str = p_strdup(args->pool, key);
+
+	trans = mailbox_transaction_begin(box, 0, __func__);
+	search_ctx = mailbox_search_init(trans, args, NULL, 0, NULL);
+	while (mailbox_search_next(search_ctx, &mail)) {
+		test_assert_idx(i < expected_count &&
+				mail->uid == expected_uids[i], i);
+		i++;
+	}
+	test_assert(i == expected_count);
+	test_assert(mailbox_search_deinit(&search_ctx) == 0);
+	test_assert(mailbox_transaction_commit(&trans) == 0);
+	mail_search_args_unref(&args);
+}
+
+static void test_fts_flatcurve_index(unsigned int write_queue_size)
+{
+	const char *const extra_input[] = {
+		"mail_plugins=fts fts_flatcurve",
+		"fts+=flatcurve",
+		"fts_search_read_fallback=no",
+		"language+=en",
+		"language/en/language_default=yes",
+		/* commit and rotate while indexing */
+		"fts_flatcurve_commit_limit=2",
+		"fts_flatcurve_rotate_count=3",
+		t_strdup_printf("fts_flatcurve_write_queue_size=%u",
+				write_queue_size),
+		NULL
+	};
+	struct test_mail_storage_settings set = {
+		.driver = "sdbox",
+		.extra_input = extra_input,
+	};
+	struct mailbox_status status;
+	unsigned int i;
+
+	test_begin(t_strdup_printf("fts flatcurve write_queue_size=%u",
+				   write_queue_size));
+	struct test_mail_storage_ctx *ctx = test_mail_storage_init();
+	test_mail_storage_init_user(ctx, &set);
+
+	struct mailbox *box =
+		mailbox_alloc(ctx->user->namespaces->list, "INBOX", 0);
+	test_assert(mailbox_open(box) == 0);
+	for (i = 1; i <= TEST_MAIL_COUNT; i++) T_BEGIN {
+		test_mail_save(box, i);
+	} T_END;
+	test_assert(mailbox_sync(box, 0) == 0);
+
+	test_mailbox_index(box);
+	test_assert(mailbox_get_status(box, STATUS_FTS_LAST_INDEXED_UID,
+				       &status) == 0);
+	test_assert(status.fts_last_indexed_uid == TEST_MAIL_COUNT);
+
+	const uint32_t uids_banana[] = { 1, 3, 5, 7 };
+	test_body_search(box, "banana", uids_banana, N_ELEMENTS(uids_banana));
+	const uint32_t uids_cherry[] = { 2, 4, 6 };
+	test_body_search(box, "cherry", uids_cherry, N_ELEMENTS(uids_cherry));
+	test_body_search(box, "durian", NULL, 0);
+
+	/* expunged mails are removed from the index */
+	test_mail_expunge(box, 3);
+	test_mail_expunge(box, 4);
+	const uint32_t uids_banana2[] = { 1, 5, 7 };
+	test_body_search(box, "banana", uids_banana2, N_ELEMENTS(uids_banana2));
+	const uint32_t uids_cherry2[] = { 2, 6 };
+	test_body_search(box, "cherry", uids_cherry2, N_ELEMENTS(uids_cherry2));
+
+	/* the index is still there after reopening */
+	mailbox_free(&box);
+	box = mailbox_alloc(ctx->user->namespaces->list, "INBOX", 0);
+	test_assert(mailbox_open(box) == 0);
+	test_body_search(box, "banana", uids_banana2, N_ELEMENTS(uids_banana2));
+
+	mailbox_free(&box);
+	test_mail_storage_deinit_user(ctx);
+	test_mail_storage_deinit(&ctx);
+	test_end();
+}
+
+static struct mailbox *
+test_flatcurve_user_init(struct test_mail_storage_ctx *ctx,
+			 const char *const *settings)
+{
+	const char *const default_input[] = {
+		"mail_plugins=fts fts_flatcurve",
+		"fts+=flatcurve",
+		"fts_search_read_fallback=no",
+		"language+=en",
+		"language/en/language_default=yes",
+		/* the indexer socket is created here */
+		t_strdup_printf("base_dir=%s", ctx->home_root),
+	};
+	struct test_mail_storage_settings set = {
+		.driver = "sdbox",
+		.keep_home = TRUE,
+	};
+	ARRAY_TYPE(const_string) input;
+	struct mailbox *box;
+
+	t_array_init(&input, 16);
+	array_append(&input, default_input, N_ELEMENTS(default_input));
+	if (settings != NULL)
+		array_append(&input, settings, str_array_length(settings));
+	array_append_zero(&input);
+	set.extra_input = array_front(&input);
+
+	test_mail_storage_init_user(ctx, &set);
+	box = mailbox_alloc(ctx->user->namespaces->list, "INBOX", 0);
+	test_assert(mailbox_open(box) == 0);
+	return box;
+}
+
+static uint32_t test_fts_last_indexed_uid(struct mailbox *box)
+{
+	struct mailbox_status status;
+
+	test_assert(mailbox_get_status(box, STATUS_FTS_LAST_INDEXED_UID,
+				       &status) == 0);
+	return status.fts_last_indexed_uid;
+}
+
+static void test_fts_flatcurve_chunks(void)
+{
+	const char *const chunk1_settings[] = {
+		"fts_flatcurve_commit_limit=2",
+		"fts_flatcurve_rotate_count=3",
+		"fts_index_chunk=test:0:2",
+		NULL
+	};
+	const char *const chunk2_settings[] = {
+		"fts_flatcurve_commit_limit=2",
+		"fts_flatcurve_rotate_count=3",
+		"fts_index_chunk=test:1:2",
+		NULL
+	};
+	struct test_mail_storage_ctx *ctx;
+	struct mailbox *box;
+	unsigned int i;
+
+	test_begin("fts flatcurve index chunks");
+	ctx = test_mail_storage_init();
+	box = test_flatcurve_user_init(ctx, NULL);
+	for (i = 1; i <= TEST_MAIL_COUNT; i++) T_BEGIN {
+		test_mail_save(box, i);
+	} T_END;
+	test_assert(mailbox_sync(box, 0) == 0);
+	mailbox_free(&box);
+	test_mail_storage_deinit_user(ctx);
+
+	/* index the first chunk the same way as the indexer-worker */
+	box = test_flatcurve_user_init(ctx, chunk1_settings);
+	test_mailbox_index_seqs(box, 1, 4);
+	mailbox_free(&box);
+	test_mail_storage_deinit_user(ctx);
+
+	/* the set isn't visible until all of its chunks have finished */
+	box = test_flatcurve_user_init(ctx, NULL);
+	test_assert(test_fts_last_indexed_uid(box) == 0);
+	mailbox_free(&box);
+	test_mail_storage_deinit_user(ctx);
+
+	box = test_flatcurve_user_init(ctx, chunk2_settings);
+	test_mailbox_index_seqs(box, 5, TEST_MAIL_COUNT);
+	mailbox_free(&box);
+	test_mail_storage_deinit_user(ctx);
+
+	box = test_flatcurve_user_init(ctx, NULL);
+	test_assert(test_fts_last_indexed_uid(box) == TEST_MAIL_COUNT);
+	const uint32_t uids_banana[] = { 1, 3, 5, 7 };
+	test_body_search(box, "banana", uids_banana, N_ELEMENTS(uids_banana));
+	const uint32_t uids_cherry[] = { 2, 4, 6 };
+	test_body_search(box, "cherry", uids_cherry, N_ELEMENTS(uids_cherry));
+
+	mailbox_free(&box);
+	test_mail_storage_deinit_user(ctx);
+	test_mail_storage_deinit(&ctx);
+	test_end();
+}
+
+static int test_indexer_listen(struct test_mail_storage_ctx *ctx)
+{
+	const char *path = t_strconcat(ctx->home_root, "indexer", NULL);
+	int fd;
+
+	fd = net_listen_unix(path, 16);
+	if (fd == -1)
+		i_fatal("net_listen_unix(%s) failed: %m", path);
+	fd_set_nonblock(fd, TRUE);
+	return fd;
+}
+
+/* Returns the number of OPTIMIZE requests queued to the indexer */
+static unsigned int test_indexer_optimize_requests(int listen_fd)
+{
+	struct istream *input;
+	const char *line;
+	unsigned int count = 0;
+	int fd;
+
+	while ((fd = net_accept(listen_fd, NULL, NULL)) >= 0) {
+		/* the request has already been written and the socket
+		   closed */
+		input = i_stream_create_fd_autoclose(&fd, SIZE_MAX);
+		line = i_stream_read_next_line(input);
+		test_assert(null_strcmp(line,
+					"VERSION\tindexer-client\t1\t0") == 0);
+		while ((line = i_stream_read_next_line(input)) != NULL) {
+			test_assert(strcmp(line,
+				"OPTIMIZE\t0\ttestuser\tINBOX") == 0);
+			count++;
+		}
+		test_assert(input->stream_errno == 0);
+		i_stream_unref(&input);
+	}
+	test_assert(fd == -1);
+	return count;
+}
+
+static void
+test_fts_flatcurve_merge_run(const char *const *settings, bool expect_merge)
+{
+	struct test_mail_storage_ctx *ctx;
+	struct mailbox *box;
+	unsigned int i, requests;
+	int listen_fd;
+
+	ctx = test_mail_storage_init();
+	listen_fd = test_indexer_listen(ctx);
+
+	box = test_flatcurve_user_init(ctx, settings);
+	for (i = 1; i <= TEST_MAIL_COUNT; i++) T_BEGIN {
+		test_mail_save(box, i);
+	} T_END;
+	test_assert(mailbox_sync(box, 0) == 0);
+	test_mailbox_index(box);
+	mailbox_free(&box);
+	test_mail_storage_deinit_user(ctx);
+
+	requests = test_indexer_optimize_requests(listen_fd);
+	if (!expect_merge)
+		test_assert(requests == 0);
+	else {
+		test_assert(requests > 0);
+		/* run the merges the same way as the indexer-worker, until
+		   no more are queued */
+		for (i = 0; i < 10 && requests > 0; i++) {
+			box = test_flatcurve_user_init(ctx, settings);
+			test_assert(mailbox_sync(box,
+				MAILBOX_SYNC_FLAG_OPTIMIZE) == 0);
+			mailbox_free(&box);
+			test_mail_storage_deinit_user(ctx);
+			requests = test_indexer_optimize_requests(listen_fd);
+		}
+		test_assert(requests == 0);
+	}
+
+	/* nothing was lost */
+	box = test_flatcurve_user_init(ctx, settings);
+	test_assert(test_fts_last_indexed_uid(box) == TEST_MAIL_COUNT);
+	const uint32_t uids_banana[] = { 1, 3, 5, 7 };
+	test_body_search(box, "banana", uids_banana, N_ELEMENTS(uids_banana));
+	const uint32_t uids_cherry[] = { 2, 4, 6 };
+	test_body_search(box, "cherry", uids_cherry, N_ELEMENTS(uids_cherry));
+	mailbox_free(&box);
+	test_mail_storage_deinit_user(ctx);
+
+	i_close_fd(&listen_fd);
+	test_mail_storage_deinit(&ctx);
+}
+
+static void test_fts_flatcurve_merge(void)
+{
+	/* 3 full shards of 2 mails need merging with merge_factor=2 */
+	const char *const settings[] = {
+		"fts_flatcurve_commit_limit=1",
+		"fts_flatcurve_rotate_count=2",
+		"fts_flatcurve_merge_factor=2",
+		NULL
+	};
+	const char *const budget_settings[] = {
+		"fts_flatcurve_commit_limit=1",
+		"fts_flatcurve_rotate_count=2",
+		"fts_flatcurve_merge_factor=2",
+		"fts_flatcurve_merge_budget=1",
+		NULL
+	};
+	const char *const disabled_settings[] = {
+		"fts_flatcurve_commit_limit=1",
+		"fts_flatcurve_rotate_count=2",
+		"fts_flatcurve_merge_factor=2",
+		"fts_flatcurve_optimize_limit=0",
+		NULL
+	};
+
+	test_begin("fts flatcurve merge");
+	test_fts_flatcurve_merge_run(settings, TRUE);
+	test_end();
+
+	/* the first merge step runs even if it exceeds the budget */
+	test_begin("fts flatcurve merge budget");
+	test_fts_flatcurve_merge_run(budget_settings, TRUE);
+	test_end();
+
+	test_begin("fts flatcurve merge optimize_limit=0");
+	test_fts_flatcurve_merge_run(disabled_settings, FALSE);
+	test_end();
+}
+
+static void test_fts_flatcurve_inline(void)
+{
+	test_fts_flatcurve_index(0);
+}
+
+static void test_fts_flatcurve_writer_thread(void)
+{
+	test_fts_flatcurve_index(2);
+}
+
+int main(int argc, char **argv)
+{
+	void (*const tests[])(void) = {
+		test_fts_flatcurve_inline,
+		test_fts_flatcurve_writer_thread,
+		test_fts_flatcurve_chunks,
+		test_fts_flatcurve_merge,
+		NULL
+	};
+	int ret;
+
+	master_service = master_service_init("test-fts-flatcurve",
+					     MASTER_SERVICE_FLAG_STANDALONE |
+					     MASTER_SERVICE_FLAG_DONT_SEND_STATS |
+					     MASTER_SERVICE_FLAG_NO_CONFIG_SETTINGS |
+					     MASTER_SERVICE_FLAG_NO_SSL_INIT |
+					     MASTER_SERVICE_FLAG_NO_INIT_DATASTACK_FRAME,
+					     &argc, &argv, "");
+
+	test_fts_module.path = i_strdup("lib20_fts_plugin.so");
+	test_fts_module.name = i_strdup("fts_plugin");
+	test_flatcurve_module.path = i_strdup("lib21_fts_flatcurve_plugin.so");
+	test_flatcurve_module.name = i_strdup("fts_flatcurve_plugin");
+
+	settings_info_register(&fts_setting_parser_info);
+	settings_info_register(&fts_flatcurve_setting_parser_info);
+	fts_plugin_init(&test_fts_module);
+	fts_flatcurve_plugin_init(&test_flatcurve_module);
+
+	ret = test_run(tests);
+
+	fts_flatcurve_plugin_deinit();
+	fts_plugin_deinit();
+	i_free(test_fts_module.path);
+	i_free(test_fts_module.name);
+	i_free(test_flatcurve_module.path);
+	i_free(test_flatcurve_module.name);
+	master_service_deinit(&master_service);
+	return ret;
+}
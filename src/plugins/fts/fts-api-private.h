@@ -37,10 +37,17 @@ struct fts_backend_vfuncs {
 	/* Add data for current build key */
 	int (*update_build_more)(struct fts_backend_update_context *ctx,
 				 const unsigned char *data, size_t size);
+	/* If NULL, indexing in chunks isn't supported */
+	void (*update_set_index_chunk)(struct fts_backend_update_context *ctx,
+				       const char *set, unsigned int idx,
+				       unsigned int count);
 
 	int (*refresh)(struct fts_backend *backend);
 	int (*rescan)(struct fts_backend *backend);
 	int (*optimize)(struct fts_backend *backend);
+	/* If NULL, optimize() is used for the mailbox's OPTIMIZE requests */
+	int (*optimize_mailbox)(struct fts_backend *backend,
+				struct mailbox *box);
 
 	bool (*can_lookup)(struct fts_backend *backend,
 			   const struct mail_search_arg *args);
@@ -291,6 +291,28 @@ int fts_backend_update_build_more(struct fts_backend_update_context *ctx,
 	return ret;
 }
 
+bool fts_backend_can_index_chunks(struct fts_backend *backend)
+{
+	return backend->v.update_set_index_chunk != NULL;
+}
+
+bool fts_backend_update_set_index_chunk(struct fts_backend_update_context *ctx,
+					const char *set, unsigned int idx,
+					unsigned int count)
+{
+	i_assert(idx < count);
+
+	if (ctx->backend->v.update_set_index_chunk == NULL)
+		return FALSE;
+	ctx->backend->v.update_set_index_chunk(ctx, set, idx, count);
+	return TRUE;
+}
+
+void fts_backend_update_open_mailbox(struct fts_backend_update_context *ctx)
+{
+	fts_backend_set_cur_mailbox(ctx);
+}
+
 static int fts_backend_cmp(struct fts_backend *const *lhs_i,
 			   struct fts_backend *const *rhs_i)
 {
@@ -382,6 +404,14 @@ int fts_backend_optimize(struct fts_backend *backend)
 		backend->v.optimize(backend);
 }
 
+int fts_backend_optimize_mailbox(struct fts_backend *backend,
+				 struct mailbox *box)
+{
+	if (backend->v.optimize_mailbox == NULL)
+		return fts_backend_optimize(backend);
+	return backend->v.optimize_mailbox(backend, box);
+}
+
 static void
 fts_merge_maybies(ARRAY_TYPE(seq_range) *dest_maybe,
 		  const ARRAY_TYPE(seq_range) *dest_definite,
@@ -135,6 +135,18 @@ void fts_backend_update_unset_build_key(struct fts_backend_update_context *ctx);
    aborted. */
 int fts_backend_update_build_more(struct fts_backend_update_context *ctx,
 				  const unsigned char *data, size_t size);
+/* Index the following mails into chunk idx of the given set of count chunks.
+   The chunks are indexed in parallel by different processes, and they become
+   visible only after all of them have been successfully indexed. Returns
+   FALSE if the backend doesn't support indexing in chunks. */
+bool fts_backend_update_set_index_chunk(struct fts_backend_update_context *ctx,
+					const char *set, unsigned int idx,
+					unsigned int count);
+/* Returns TRUE if the backend supports indexing in chunks. */
+bool fts_backend_can_index_chunks(struct fts_backend *backend);
+/* Open the current mailbox in the backend, even if nothing is indexed to
+   it. This way a chunk whose mails were all expunged is still finished. */
+void fts_backend_update_open_mailbox(struct fts_backend_update_context *ctx);
 
 /* Refresh index to make sure we see latest changes from lookups.
    Returns 0 if ok, -1 if error. */
@@ -144,6 +156,11 @@ int fts_backend_refresh(struct fts_backend *backend, struct mailbox *box);
 int fts_backend_rescan(struct fts_backend *backend);
 /* Optimize the index. This can be a somewhat heavy operation. */
 int fts_backend_optimize(struct fts_backend *backend);
+/* Optimize the index of the given mailbox. This is done for the indexer's
+   OPTIMIZE requests. Backends that can't do it for a single mailbox
+   optimize the whole index. */
+int fts_backend_optimize_mailbox(struct fts_backend *backend,
+				 struct mailbox *box);
 
 /* Returns TRUE if fts_backend_lookup() should even be tried for the
    given args. */
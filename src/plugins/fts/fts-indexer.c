@@ -3,6 +3,7 @@
 #include "lib.h"
 #include "ioloop.h"
 #include "connection.h"
+#include "str.h"
 #include "write-full.h"
 #include "istream.h"
 #include "ostream.h"
@@ -317,3 +318,34 @@ int fts_indexer_cmd(struct mail_user *user, const char *cmd,
 	*path_r = path;
 	return fd;
 }
+
+int fts_indexer_queue(struct mail_user *user, const char *cmd,
+		      const char *const *args, const char **error_r)
+{
+	string_t *str = t_str_new(256);
+	const char *path;
+	int fd, ret = 0;
+
+	path = t_strconcat(user->set->base_dir, "/"INDEXER_SOCKET_NAME, NULL);
+	fd = net_connect_unix(path);
+	if (fd == -1) {
+		*error_r = t_strdup_printf("net_connect_unix(%s) failed: %m",
+					   path);
+		return -1;
+	}
+
+	str_append(str, INDEXER_HANDSHAKE);
+	str_append(str, cmd);
+	str_append(str, "\t0");
+	for (; *args != NULL; args++) {
+		str_append_c(str, '\t');
+		str_append_tabescaped(str, *args);
+	}
+	str_append_c(str, '\n');
+	if (write_full(fd, str_data(str), str_len(str)) < 0) {
+		*error_r = t_strdup_printf("write(%s) failed: %m", path);
+		ret = -1;
+	}
+	i_close_fd(&fd);
+	return ret;
+}
@@ -18,5 +18,9 @@ int fts_indexer_more(struct fts_indexer_context *ctx);
 /* Returns fd, which you can either read from or close. */
 int fts_indexer_cmd(struct mail_user *user, const char *cmd,
 		    struct event *event, const char **path_r);
+/* Send cmd with the tab-escaped args to the indexer service without waiting
+   for a reply. Returns 0 if ok, -1 if error. */
+int fts_indexer_queue(struct mail_user *user, const char *cmd,
+		      const char *const *args, const char **error_r);
 
 #endif
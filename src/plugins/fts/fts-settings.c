@@ -21,6 +21,7 @@ static const struct setting_define fts_setting_defines[] = {
 	{ .type = SET_FILTER_NAME, .key = FTS_FILTER_DECODER_TIKA },
 	DEF(STR,     decoder_tika_url),
 	DEF(STR,     driver),
+	DEF(STR_HIDDEN, index_chunk),
 	DEF(BOOL,    search),
 	DEF(ENUM,    search_add_missing),
 	DEF(BOOL,    search_read_fallback),
@@ -53,6 +54,7 @@ static const struct fts_settings fts_default_settings = {
 	.decoder_script_socket_path = "",
 	.decoder_tika_url = "",
 	.driver = "",
+	.index_chunk = "",
 	.search = TRUE,
 	.search_add_missing = FTS_SEARCH_ADD_MISSING_BODY_SEARCH_ONLY":yes",
 	.search_read_fallback = TRUE,
@@ -143,7 +145,28 @@ static bool fts_settings_check_decoder(struct fts_settings *set,
 	}
 }
 
-static bool fts_settings_check(void *_set, pool_t pool ATTR_UNUSED,
+static bool fts_settings_check_index_chunk(struct fts_settings *set,
+					   pool_t pool, const char **error_r)
+{
+	const char *const *args;
+
+	if (set->index_chunk[0] == '\0')
+		return TRUE;
+
+	args = t_strsplit(set->index_chunk, ":");
+	if (str_array_length(args) != 3 || args[0][0] == '\0' ||
+	    str_to_uint(args[1], &set->parsed_index_chunk_idx) < 0 ||
+	    str_to_uint(args[2], &set->parsed_index_chunk_count) < 0 ||
+	    set->parsed_index_chunk_idx >= set->parsed_index_chunk_count) {
+		*error_r = t_strdup_printf("Invalid fts_index_chunk: %s",
+					   set->index_chunk);
+		return FALSE;
+	}
+	set->parsed_index_chunk_set = p_strdup(pool, args[0]);
+	return TRUE;
+}
+
+static bool fts_settings_check(void *_set, pool_t pool,
 			       const char **error_r)
 {
 	struct fts_settings *set = _set;
@@ -156,6 +179,8 @@ static bool fts_settings_check(void *_set, pool_t pool ATTR_UNUSED,
 		strcmp(set->search_add_missing,
 		       FTS_SEARCH_ADD_MISSING_BODY_SEARCH_ONLY) == 0;
 	set->parsed_decoder_driver = fts_settings_parse_decoder(set->decoder_driver);
+	if (!fts_settings_check_index_chunk(set, pool, error_r))
+		return FALSE;
 	return fts_settings_check_decoder(set, error_r);
 }
 
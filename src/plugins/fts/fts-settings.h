@@ -29,9 +29,14 @@ struct fts_settings {
 	unsigned int search_timeout;
 	uoff_t message_max_size;
 	bool autoindex;
+	const char *index_chunk;
 
 	enum fts_decoder parsed_decoder_driver;
 	bool parsed_search_add_missing_body_only;
+	/* fts_index_chunk = <set>:<index>:<count> */
+	const char *parsed_index_chunk_set;
+	unsigned int parsed_index_chunk_idx;
+	unsigned int parsed_index_chunk_count;
 };
 
 extern const struct setting_parser_info fts_setting_parser_info;
@@ -1,10 +1,7 @@
 /* Copyright (c) 2006-2018 Dovecot authors, see the included COPYING file */
 
 #include "lib.h"
-#include "net.h"
 #include "str.h"
-#include "strescape.h"
-#include "write-full.h"
 #include "settings.h"
 #include "mail-search-build.h"
 #include "mail-storage.h"
@@ -32,9 +29,6 @@
 #define FTS_LIST_CONTEXT_REQUIRE(obj) \
 	MODULE_CONTEXT_REQUIRE(obj, fts_mailbox_list_module)
 
-#define INDEXER_SOCKET_NAME "indexer"
-#define INDEXER_HANDSHAKE "VERSION\tindexer-client\t1\t0\n"
-
 struct fts_mailbox_list {
 	union mailbox_list_module_context module_ctx;
 	struct fts_backend *backend;
@@ -96,10 +90,16 @@ int fts_mailbox_get_status(struct mailbox *box, enum mailbox_status_items items,
 			status_r) < 0)
 		return -1;
 
-	if ((items & STATUS_FTS_LAST_INDEXED_UID) != 0 &&
-	    fts_mailbox_get_last_indexed_uid(
-			box, &status_r->fts_last_indexed_uid) < 0)
-		return -1;
+	if ((items & STATUS_FTS_LAST_INDEXED_UID) != 0) {
+		struct fts_mailbox_list *flist =
+			FTS_LIST_CONTEXT_REQUIRE(box->list);
+
+		if (fts_mailbox_get_last_indexed_uid(
+				box, &status_r->fts_last_indexed_uid) < 0)
+			return -1;
+		status_r->fts_index_chunks =
+			fts_backend_can_index_chunks(flist->backend);
+	}
 
 	return 0;
 }
@@ -474,26 +474,35 @@ static int fts_mail_get_special(struct mail *_mail, enum mail_fetch_field field,
 	return fmail->module_ctx.super.get_special(_mail, field, value_r);
 }
 
-static int fts_mail_precache_init(struct mail *_mail)
+static int fts_transaction_precache_init(struct mailbox_transaction_context *t)
 {
-	struct fts_transaction_context *ft = FTS_CONTEXT_REQUIRE(_mail->transaction);
-	struct fts_mailbox_list *flist = FTS_LIST_CONTEXT_REQUIRE(_mail->box->list);
+	struct fts_transaction_context *ft = FTS_CONTEXT_REQUIRE(t);
+	struct fts_mailbox_list *flist = FTS_LIST_CONTEXT_REQUIRE(t->box->list);
+	struct fts_mailbox *fbox = FTS_CONTEXT_REQUIRE(t->box);
+	const struct fts_settings *set = fbox->set;
 
 	uint32_t last_uid;
-	if (fts_mailbox_get_last_indexed_uid(_mail->box,&last_uid) < 0) {
+	if (fts_mailbox_get_last_indexed_uid(t->box, &last_uid) < 0) {
 		ft->failure_reason = "Failed to lookup last indexed FTS mail";
 		return -1;
 	}
 
 	uint32_t last_seq = 0, unused ATTR_UNUSED;
 	if (last_uid > 0)
-		mailbox_get_seq_range(_mail->box, 1, last_uid, &unused, &last_seq);
+		mailbox_get_seq_range(t->box, 1, last_uid, &unused, &last_seq);
 
 	ft->precached = TRUE;
-	if (flist->update_ctx == NULL)
+	if (flist->update_ctx == NULL) {
 		flist->update_ctx = fts_backend_update_init(flist->backend);
+		if (set->parsed_index_chunk_set != NULL &&
+		    !fts_backend_update_set_index_chunk(flist->update_ctx,
+				set->parsed_index_chunk_set,
+				set->parsed_index_chunk_idx,
+				set->parsed_index_chunk_count))
+			ft->failure_reason = "FTS backend doesn't support indexing in chunks";
+	}
 	flist->update_ctx_refcount++;
-	return 0;
+	return ft->failure_reason != NULL ? -1 : 0;
 }
 
 static int fts_mail_index(struct mail *_mail)
@@ -507,7 +516,7 @@ static int fts_mail_index(struct mail *_mail)
 		return -1;
 
 	if (!ft->precached) {
-		if (fts_mail_precache_init(_mail) < 0)
+		if (fts_transaction_precache_init(_mail->transaction) < 0)
 			return -1;
 	}
 
@@ -575,6 +584,18 @@ fts_transaction_begin(struct mailbox *box,
 	return t;
 }
 
+static void fts_transaction_index_chunk_abort(struct mailbox_transaction_context *t)
+{
+	struct fts_transaction_context *ft = FTS_CONTEXT_REQUIRE(t);
+	struct fts_mailbox_list *flist = FTS_LIST_CONTEXT_REQUIRE(t->box->list);
+	struct fts_mailbox *fbox = FTS_CONTEXT_REQUIRE(t->box);
+
+	/* a partially indexed chunk must never become visible */
+	if (fbox->set->parsed_index_chunk_set != NULL && ft->precached &&
+	    flist->update_ctx != NULL)
+		flist->update_ctx->failed = TRUE;
+}
+
 static int fts_transaction_end(struct mailbox_transaction_context *t, const char **error_r)
 {
 	struct fts_transaction_context *ft = FTS_CONTEXT_REQUIRE(t);
@@ -585,6 +606,7 @@ static int fts_transaction_end(struct mailbox_transaction_context *t, const char
 	if (ft->failure_reason != NULL) {
 		*error_r = t_strdup(ft->failure_reason);
 		ret = -1;
+		fts_transaction_index_chunk_abort(t);
 	}
 
 	struct event_reason *reason = event_reason_begin("fts:index");
@@ -625,6 +647,7 @@ static void fts_transaction_rollback(struct mailbox_transaction_context *t)
 	struct fts_mailbox *fbox = FTS_CONTEXT_REQUIRE(t->box);
 	const char *error;
 
+	fts_transaction_index_chunk_abort(t);
 	(void)fts_transaction_end(t, &error);
 	fbox->module_ctx.super.transaction_rollback(t);
 }
@@ -633,29 +656,17 @@ static void fts_queue_index(struct mailbox *box)
 {
 	struct mail_user *user = box->storage->user;
 	struct fts_mailbox *fbox = FTS_CONTEXT_REQUIRE(box);
-	string_t *str = t_str_new(256);
-	const char *path;
-	int fd;
-
-	path = t_strconcat(user->set->base_dir, "/"INDEXER_SOCKET_NAME, NULL);
-	fd = net_connect_unix(path);
-	if (fd == -1) {
-		e_error(box->event, "net_connect_unix(%s) failed: %m", path);
-		return;
-	}
+	const char *const args[] = {
+		user->username,
+		box->vname,
+		dec2str(fbox->set->autoindex_max_recent_msgs),
+		user->session_id,
+		NULL
+	};
+	const char *error;
 
-	str_append(str, INDEXER_HANDSHAKE);
-	str_append(str, "APPEND\t0\t");
-	str_append_tabescaped(str, user->username);
-	str_append_c(str, '\t');
-	str_append_tabescaped(str, box->vname);
-	str_printfa(str, "\t%u", fbox->set->autoindex_max_recent_msgs);
-	str_append_c(str, '\t');
-	str_append_tabescaped(str, box->storage->user->session_id);
-	str_append_c(str, '\n');
-	if (write_full(fd, str_data(str), str_len(str)) < 0)
-		e_error(box->event, "write(%s) failed: %m", path);
-	i_close_fd(&fd);
+	if (fts_indexer_queue(user, "APPEND", args, &error) < 0)
+		e_error(box->event, "%s", error);
 }
 
 static int
@@ -672,6 +683,19 @@ fts_transaction_commit(struct mailbox_transaction_context *t,
 	autoindex = ft->mails_saved && fbox->set->autoindex &&
 		fbox->set->search;
 
+	if (fbox->set->parsed_index_chunk_set != NULL && !ft->precached &&
+	    ft->failure_reason == NULL &&
+	    fts_transaction_precache_init(t) == 0) {
+		/* Nothing was indexed, because all the chunk's mails were
+		   expunged. Finish it as an empty chunk, so the rest of the
+		   set can still be published. */
+		struct fts_mailbox_list *flist =
+			FTS_LIST_CONTEXT_REQUIRE(box->list);
+
+		fts_backend_update_set_mailbox(flist->update_ctx, box);
+		fts_backend_update_open_mailbox(flist->update_ctx);
+	}
+
 	if (fts_transaction_end(t, &error) < 0) {
 		mail_storage_set_error(t->box->storage, MAIL_ERROR_TEMP,
 				       t_strdup_printf("FTS transaction commit failed: %s",
@@ -724,18 +748,22 @@ static int fts_sync_deinit(struct mailbox_sync_context *ctx,
 	struct mailbox *box = ctx->box;
 	struct fts_mailbox *fbox = FTS_CONTEXT_REQUIRE(box);
 	struct fts_mailbox_list *flist = FTS_LIST_CONTEXT(box->list);
-	bool optimize;
+	bool optimize, optimize_mailbox;
 	int ret = 0;
 
 	optimize = (ctx->flags & (MAILBOX_SYNC_FLAG_FORCE_RESYNC |
 				  MAILBOX_SYNC_FLAG_OPTIMIZE)) != 0;
+	/* the indexer's OPTIMIZE requests are for a single mailbox */
+	optimize_mailbox = (ctx->flags & MAILBOX_SYNC_FLAG_FORCE_RESYNC) == 0;
 	if (fbox->module_ctx.super.sync_deinit(ctx, status_r) < 0)
 		return -1;
 	ctx = NULL;
 
 	if (optimize) {
 		i_assert(flist != NULL);
-		if (fts_backend_optimize(flist->backend) < 0) {
+		if ((optimize_mailbox ?
+		     fts_backend_optimize_mailbox(flist->backend, box) :
+		     fts_backend_optimize(flist->backend)) < 0) {
 			mailbox_set_critical(box, "FTS optimize failed");
 			ret = -1;
 		}
@@ -0,0 +1,212 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "istream.h"
+#include "sort.h"
+#include "mkdir-parents.h"
+#include "write-full.h"
+#include "settings.h"
+#include "master-service.h"
+#include "mail-search-build.h"
+#include "test-common.h"
+#include "test-mail-storage-common.h"
+#include "virtual-settings.h"
+#include "virtual-storage.h"
+#include "virtual-plugin.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+static struct mail_storage_hooks test_virtual_hooks = {
+	.mailbox_allocated = virtual_backend_mailbox_allocated,
+	.mailbox_opened = virtual_backend_mailbox_opened,
+	.mailbox_list_created = virtual_mailbox_list_created,
+};
+
+static void test_mail_save(struct mailbox *box, const char *subject)
+{
+	struct mailbox_transaction_context *trans;
+	struct mail_save_context *save_ctx;
+	struct istream *input;
+	const char *mail_input;
+	int ret;
+
+	mail_input = t_strdup_printf("Subject: %s\n\nbody\n", subject);
+	input = i_stream_create_from_data(mail_input, strlen(mail_input));
+	trans = mailbox_transaction_begin(box,
+			MAILBOX_TRANSACTION_FLAG_EXTERNAL, __func__);
+	save_ctx = mailbox_save_alloc(trans);
+	if (mailbox_save_begin(&save_ctx, input) < 0)
+		ret = -1;
+	else {
+		do {
+			if (mailbox_save_continue(save_ctx) < 0) {
+				mailbox_save_cancel(&save_ctx);
+				break;
+			}
+		} while ((ret = i_stream_read(input)) > 0);
+		if (save_ctx != NULL)
+			ret = mailbox_save_finish(&save_ctx);
+		else
+			ret = -1;
+	}
+	i_stream_unref(&input);
+	if (ret < 0)
+		mailbox_transaction_rollback(&trans);
+	else
+		ret = mailbox_transaction_commit(&trans);
+	if (ret < 0) {
+		i_fatal("Failed to save mail: %s",
+			mailbox_get_last_internal_error(box, NULL));
+	}
+}
+
+static void
+test_backend_create(struct mail_user *user, const char *name,
+		    const char *const *subjects)
+{
+	struct mailbox *box;
+
+	box = mailbox_alloc(user->namespaces->list, name, 0);
+	test_assert(mailbox_create(box, NULL, FALSE) == 0);
+	for (; *subjects != NULL; subjects++)
+		test_mail_save(box, *subjects);
+	mailbox_free(&box);
+}
+
+static void test_virtual_config_create(struct test_mail_storage_ctx *ctx)
+{
+	const char *dir, *path;
+	const char *config = "box1\nbox2\n  all\n";
+	int fd;
+
+	dir = t_strdup_printf("%s%s/virtual/all", ctx->home_root,
+			      ctx->user->username);
+	test_assert(mkdir_parents(dir, 0700) == 0);
+	path = t_strconcat(dir, "/"VIRTUAL_CONFIG_FNAME, NULL);
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd == -1)
+		i_fatal("open(%s) failed: %m", path);
+	if (write_full(fd, config, strlen(config)) < 0)
+		i_fatal("write(%s) failed: %m", path);
+	i_close_fd(&fd);
+}
+
+static void
+test_virtual_search_init_user(struct test_mail_storage_ctx *ctx,
+			      bool search_backends)
+{
+	const char *const box1_subjects[] = {
+		"foo 1", "bar", "foo 2", NULL
+	};
+	const char *const box2_subjects[] = {
+		"baz", "foo 3", NULL
+	};
+	const char *home = t_strconcat(ctx->home_root, "testuser", NULL);
+	const char *const extra_input[] = {
+		"namespace+=virtual",
+		"namespace/virtual/prefix=virtual/",
+		"namespace/virtual/separator=/",
+		"namespace/virtual/mail_driver=virtual",
+		t_strdup_printf("namespace/virtual/mail_path=%s/virtual", home),
+		"virtual_max_open_mailboxes=1",
+		t_strdup_printf("virtual_search_backends=%s",
+				search_backends ? "yes" : "no"),
+		NULL
+	};
+	struct test_mail_storage_settings set = {
+		.driver = "sdbox",
+		.hierarchy_sep = "/",
+		.extra_input = extra_input,
+	};
+
+	test_mail_storage_init_user(ctx, &set);
+	test_backend_create(ctx->user, "box1", box1_subjects);
+	test_backend_create(ctx->user, "box2", box2_subjects);
+	test_virtual_config_create(ctx);
+}
+
+/* Search for Subject "foo" from the virtual mailbox and return the matching
+   virtual UIDs. */
+static void
+test_virtual_search_run(struct mail_user *user, ARRAY_TYPE(uint32_t) *uids)
+{
+	struct mail_namespace *ns;
+	struct mailbox *box;
+	struct mailbox_transaction_context *trans;
+	struct mail_search_args *args;
+	struct mail_search_arg *arg;
+	struct mail_search_context *search_ctx;
+	struct mail *mail;
+
+	ns = mail_namespace_find(user->namespaces, "virtual/all");
+	box = mailbox_alloc(ns->list, "virtual/all", 0);
+	test_assert(mailbox_sync(box, 0) == 0);
+
+	args = mail_search_build_init();
+	arg = mail_search_build_add(args, SEARCH_HEADER);
+	arg->hdr_field_name = p_strdup(args->pool, "Subject");
+	arg->value.str = p_strdup(args->pool, "foo");
+
+	trans = mailbox_transaction_begin(box, 0, __func__);
+	search_ctx = mailbox_search_init(trans, args, NULL, 0, NULL);
+	while (mailbox_search_next(search_ctx, &mail))
+		array_push_back(uids, &mail->uid);
+	test_assert(mailbox_search_deinit(&search_ctx) == 0);
+	test_assert(mailbox_transaction_commit(&trans) == 0);
+	mail_search_args_unref(&args);
+	mailbox_free(&box);
+}
+
+static void test_virtual_search_backends(void)
+{
+	ARRAY_TYPE(uint32_t) uids_direct, uids_backends;
+	struct test_mail_storage_ctx *ctx;
+
+	test_begin("virtual search backends");
+	t_array_init(&uids_direct, 8);
+	t_array_init(&uids_backends, 8);
+
+	ctx = test_mail_storage_init();
+	settings_info_register(&virtual_setting_parser_info);
+	mail_storage_class_register(&virtual_storage);
+	mail_storage_hooks_add_internal(&test_virtual_hooks);
+
+	test_virtual_search_init_user(ctx, FALSE);
+	test_virtual_search_run(ctx->user, &uids_direct);
+	test_mail_storage_deinit_user(ctx);
+
+	test_virtual_search_init_user(ctx, TRUE);
+	test_virtual_search_run(ctx->user, &uids_backends);
+	test_mail_storage_deinit_user(ctx);
+
+	test_assert(array_count(&uids_direct) == 3);
+	test_assert(array_equal_fn(&uids_direct, &uids_backends,
+				   uint32_cmp) == TRUE);
+
+	mail_storage_hooks_remove_internal(&test_virtual_hooks);
+	mail_storage_class_unregister(&virtual_storage);
+	test_mail_storage_deinit(&ctx);
+	test_end();
+}
+
+int main(int argc, char **argv)
+{
+	void (*const tests[])(void) = {
+		test_virtual_search_backends,
+		NULL
+	};
+	int ret;
+
+	master_service = master_service_init("test-virtual-search",
+					     MASTER_SERVICE_FLAG_STANDALONE |
+					     MASTER_SERVICE_FLAG_DONT_SEND_STATS |
+					     MASTER_SERVICE_FLAG_NO_CONFIG_SETTINGS |
+					     MASTER_SERVICE_FLAG_NO_SSL_INIT |
+					     MASTER_SERVICE_FLAG_NO_INIT_DATASTACK_FRAME,
+					     &argc, &argv, "");
+	ret = test_run(tests);
+	master_service_deinit(&master_service);
+	return ret;
+}
@@ -3,6 +3,7 @@
 #include "lib.h"
 #include "array.h"
 #include "mail-search.h"
+#include "mail-search-build.h"
 #include "index-search-private.h"
 #include "virtual-storage.h"
 
@@ -61,6 +62,128 @@ static int mail_search_get_result(struct mail_search_context *ctx)
 	return ret;
 }
 
+static bool virtual_search_args_want_backend(const struct mail_search_arg *arg)
+{
+	for (; arg != NULL; arg = arg->next) {
+		switch (arg->type) {
+		case SEARCH_OR:
+		case SEARCH_SUB:
+			if (!virtual_search_args_want_backend(arg->value.subargs))
+				return FALSE;
+			break;
+		case SEARCH_FLAGS:
+			/* \Recent is different in the virtual mailbox */
+			if ((arg->value.flags & MAIL_RECENT) != 0)
+				return FALSE;
+			break;
+		case SEARCH_ALL:
+		case SEARCH_KEYWORDS:
+		case SEARCH_BEFORE:
+		case SEARCH_ON:
+		case SEARCH_SINCE:
+		case SEARCH_SMALLER:
+		case SEARCH_LARGER:
+		case SEARCH_HEADER:
+		case SEARCH_HEADER_ADDRESS:
+		case SEARCH_HEADER_COMPRESS_LWSP:
+		case SEARCH_BODY:
+		case SEARCH_TEXT:
+		case SEARCH_GUID:
+		case SEARCH_MIMEPART:
+			break;
+		default:
+			/* sequences, UIDs, modseqs, threads, etc. refer to the
+			   virtual mailbox itself */
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+static int
+virtual_search_backend_box(struct mail_search_context *ctx,
+			   struct virtual_backend_box *bbox,
+			   const struct virtual_search_record *recs,
+			   unsigned int count, ARRAY_TYPE(seq_range) *result)
+{
+	struct virtual_mailbox *mbox =
+		container_of(ctx->transaction->box, struct virtual_mailbox, box);
+	struct mailbox_transaction_context *t;
+	struct mail_search_context *search_ctx;
+	struct mail_search_args *search_args;
+	struct mail_search_arg *arg;
+	struct mail *mail;
+	ARRAY_TYPE(seq_range) matches;
+	unsigned int i;
+	int ret = 0;
+
+	if (!bbox->box->opened && virtual_backend_box_open(mbox, bbox) < 0)
+		return -1;
+	virtual_backend_box_accessed(mbox, bbox);
+
+	/* search only the candidate mails from the backend mailbox */
+	search_args = mail_search_args_dup(ctx->args);
+	arg = mail_search_build_add(search_args, SEARCH_UIDSET);
+	p_array_init(&arg->value.seqset, search_args->pool, count);
+	for (i = 0; i < count; i++)
+		seq_range_array_add(&arg->value.seqset, recs[i].real_uid);
+
+	t_array_init(&matches, 32);
+	t = mailbox_transaction_begin(bbox->box, 0, __func__);
+	search_ctx = mailbox_search_init(t, search_args, NULL, 0, NULL);
+	mail_search_args_unref(&search_args);
+	while (mailbox_search_next(search_ctx, &mail))
+		seq_range_array_add(&matches, mail->uid);
+	if (mailbox_search_deinit(&search_ctx) < 0)
+		ret = -1;
+	(void)mailbox_transaction_commit(&t);
+	if (ret < 0)
+		return -1;
+
+	for (i = 0; i < count; i++) {
+		if (seq_range_exists(&matches, recs[i].real_uid))
+			seq_range_array_add(result, recs[i].virtual_seq);
+	}
+	return 0;
+}
+
+static void
+virtual_search_backends(struct mail_search_context *ctx,
+			struct virtual_search_context *vctx)
+{
+	struct virtual_mailbox *mbox =
+		container_of(ctx->transaction->box, struct virtual_mailbox, box);
+	struct virtual_backend_box *bbox;
+	struct virtual_search_record *recs;
+	unsigned int i, start, count, unsearched_count = 0;
+	int ret;
+
+	recs = array_get_modifiable(&vctx->records, &count);
+	for (start = 0; start < count; start = i) {
+		for (i = start + 1; i < count; i++) {
+			if (recs[i].mailbox_id != recs[start].mailbox_id)
+				break;
+		}
+		if (!virtual_backend_box_lookup(mbox, recs[start].mailbox_id,
+						&bbox))
+			ret = -1;
+		else T_BEGIN {
+			ret = virtual_search_backend_box(ctx, bbox, recs + start,
+							 i - start,
+							 &vctx->result);
+		} T_END;
+		if (ret < 0) {
+			/* check the mails one by one via the virtual
+			   mailbox instead */
+			memmove(recs + unsearched_count, recs + start,
+				(i - start) * sizeof(*recs));
+			unsearched_count += i - start;
+		}
+	}
+	array_delete(&vctx->records, unsearched_count,
+		     count - unsearched_count);
+}
+
 static void virtual_search_get_records(struct mail_search_context *ctx,
 				       struct virtual_search_context *vctx)
 {
@@ -94,6 +217,11 @@ static void virtual_search_get_records(struct mail_search_context *ctx,
 	}
 	array_sort(&vctx->records, virtual_search_record_cmp);
 
+	if (mbox->storage->search_backends &&
+	    array_count(&vctx->records) > 0 &&
+	    virtual_search_args_want_backend(ctx->args->args))
+		virtual_search_backends(ctx, vctx);
+
 	ctx->progress_max = array_count(&vctx->records);
 }
 
@@ -5,6 +5,7 @@ struct virtual_settings {
 	pool_t pool;
 
 	unsigned int virtual_max_open_mailboxes;
+	bool virtual_search_backends;
 };
 
 extern const struct setting_parser_info virtual_setting_parser_info;
@@ -99,6 +99,7 @@ virtual_storage_create(struct mail_storage *_storage,
 		return -1;
 
 	storage->max_open_mailboxes = set->virtual_max_open_mailboxes;
+	storage->search_backends = set->virtual_search_backends;
 	settings_free(set);
 	return 0;
 }
@@ -76,6 +76,7 @@ struct virtual_storage {
 	ARRAY_TYPE(const_string) open_stack;
 
 	unsigned int max_open_mailboxes;
+	bool search_backends;
 };
 
 struct virtual_backend_uidmap {